@@ -0,0 +1,1264 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
+
+#include <gio/gio.h>
+#include "glib-compat.h"
+
+#include "broker.h"
+
+#define BUS_NAME            "org.freedesktop.DBus"
+#define BUS_PATH            "/org/freedesktop/DBus"
+#define BUS_INTERFACE       "org.freedesktop.DBus"
+#define MONITOR_INTERFACE   "org.freedesktop.DBus.Monitoring"
+#define PEER_INTERFACE      "org.freedesktop.DBus.Peer"
+#define INTROSPECT_INTERFACE "org.freedesktop.DBus.Introspectable"
+
+#define ERROR_PREFIX        "org.freedesktop.DBus.Error."
+
+/* RequestName flags and replies from the spec */
+#define NAME_FLAG_ALLOW_REPLACEMENT  0x1
+#define NAME_FLAG_REPLACE_EXISTING   0x2
+#define NAME_FLAG_DO_NOT_QUEUE       0x4
+
+#define REQUEST_PRIMARY_OWNER        1
+#define REQUEST_IN_QUEUE             2
+#define REQUEST_EXISTS               3
+#define REQUEST_ALREADY_OWNER        4
+
+#define RELEASE_RELEASED             1
+#define RELEASE_NON_EXISTENT         2
+#define RELEASE_NOT_OWNER            3
+
+#define START_ALREADY_RUNNING        2
+
+/* Only the first few args are worth matching on */
+#define MATCH_ARGS  10
+
+typedef struct {
+	gchar * rule;
+
+	GDBusMessageType type;
+	gchar * sender;
+	gchar * interface;
+	gchar * member;
+	gchar * path;
+	gchar * path_namespace;
+	gchar * destination;
+	gchar * args[MATCH_ARGS];
+	gchar * arg0namespace;
+	gboolean eavesdrop;
+} match_t;
+
+typedef struct {
+	GDBusConnection * connection;
+	gchar * unique_name;
+	GList * matches;
+	gboolean monitor;
+	guint filter;
+	gulong closed_handler;
+} peer_t;
+
+typedef struct {
+	peer_t * peer;
+	guint32 flags;
+} owner_t;
+
+struct _DbusTestBroker {
+	GThread * thread;
+	GMainContext * context;
+	GMainLoop * loop;
+
+	GDBusServer * server;
+	gchar * guid;
+
+	/* Taken by the filters, which run in the GDBus worker thread,
+	   and by our thread when peers come and go */
+	GMutex lock;
+	guint next_id;
+	GList * peers;
+	GHashTable * unique_names; /* name -> peer_t */
+	GHashTable * names; /* name -> GQueue of owner_t, primary first */
+
+	/* Startup handshake with the thread creating us */
+	GMutex start_lock;
+	GCond started;
+	gboolean running;
+	GError * error;
+
+	/* Set once we're shutting down and the filters should drop
+	   everything */
+	gboolean stopping;
+};
+
+/*
+ * Match rules
+ */
+
+static void
+match_free (gpointer data)
+{
+	match_t * match = (match_t *)data;
+	guint i;
+
+	g_free(match->rule);
+	g_free(match->sender);
+	g_free(match->interface);
+	g_free(match->member);
+	g_free(match->path);
+	g_free(match->path_namespace);
+	g_free(match->destination);
+	g_free(match->arg0namespace);
+	for (i = 0; i < MATCH_ARGS; i++) {
+		g_free(match->args[i]);
+	}
+
+	g_free(match);
+	return;
+}
+
+/* Parses key='value' pairs.  Inside quotes everything is literal,
+   outside them a backslash escapes an apostrophe. */
+static match_t *
+match_new (const gchar * rule)
+{
+	match_t * match = g_new0(match_t, 1);
+	const gchar * pos = rule;
+
+	match->rule = g_strdup(rule);
+
+	while (*pos != '\0') {
+		while (*pos == ',' || g_ascii_isspace(*pos)) {
+			pos++;
+		}
+		if (*pos == '\0') {
+			break;
+		}
+
+		const gchar * equal = strchr(pos, '=');
+		if (equal == NULL) {
+			match_free(match);
+			return NULL;
+		}
+
+		gchar * key = g_strndup(pos, equal - pos);
+		GString * value = g_string_new(NULL);
+		gboolean quoted = FALSE;
+
+		for (pos = equal + 1; *pos != '\0' && (quoted || *pos != ','); pos++) {
+			if (*pos == '\'') {
+				quoted = !quoted;
+			} else if (!quoted && *pos == '\\' && pos[1] == '\'') {
+				g_string_append_c(value, '\'');
+				pos++;
+			} else {
+				g_string_append_c(value, *pos);
+			}
+		}
+
+		gboolean valid = !quoted;
+		gchar * str = g_string_free(value, FALSE);
+
+		if (!valid) {
+			/* Unbalanced quotes */
+		} else if (g_strcmp0(key, "type") == 0) {
+			if (g_strcmp0(str, "signal") == 0) {
+				match->type = G_DBUS_MESSAGE_TYPE_SIGNAL;
+			} else if (g_strcmp0(str, "method_call") == 0) {
+				match->type = G_DBUS_MESSAGE_TYPE_METHOD_CALL;
+			} else if (g_strcmp0(str, "method_return") == 0) {
+				match->type = G_DBUS_MESSAGE_TYPE_METHOD_RETURN;
+			} else if (g_strcmp0(str, "error") == 0) {
+				match->type = G_DBUS_MESSAGE_TYPE_ERROR;
+			} else {
+				valid = FALSE;
+			}
+		} else if (g_strcmp0(key, "sender") == 0) {
+			match->sender = g_strdup(str);
+		} else if (g_strcmp0(key, "interface") == 0) {
+			match->interface = g_strdup(str);
+		} else if (g_strcmp0(key, "member") == 0) {
+			match->member = g_strdup(str);
+		} else if (g_strcmp0(key, "path") == 0) {
+			match->path = g_strdup(str);
+		} else if (g_strcmp0(key, "path_namespace") == 0) {
+			match->path_namespace = g_strdup(str);
+		} else if (g_strcmp0(key, "destination") == 0) {
+			match->destination = g_strdup(str);
+		} else if (g_strcmp0(key, "arg0namespace") == 0) {
+			match->arg0namespace = g_strdup(str);
+		} else if (g_strcmp0(key, "eavesdrop") == 0) {
+			match->eavesdrop = g_strcmp0(str, "true") == 0;
+		} else if (g_str_has_prefix(key, "arg")) {
+			gchar * end = NULL;
+			guint64 arg = g_ascii_strtoull(key + 3, &end, 10);
+
+			if (end == key + 3) {
+				valid = FALSE;
+			} else if (arg < MATCH_ARGS && *end == '\0') {
+				match->args[arg] = g_strdup(str);
+			}
+			/* Anything else, like argNpath, we let everything through
+			   for.  The client will sort out the extra messages. */
+		}
+		/* Unknown keys are ignored so that newer clients work */
+
+		g_free(key);
+		g_free(str);
+
+		if (!valid) {
+			match_free(match);
+			return NULL;
+		}
+	}
+
+	return match;
+}
+
+static const gchar *
+message_string_arg (GDBusMessage * message, guint arg)
+{
+	GVariant * body = g_dbus_message_get_body(message);
+
+	if (body == NULL || arg >= g_variant_n_children(body)) {
+		return NULL;
+	}
+
+	GVariant * child = g_variant_get_child_value(body, arg);
+	const gchar * retval = NULL;
+
+	if (g_variant_is_of_type(child, G_VARIANT_TYPE_STRING) ||
+			g_variant_is_of_type(child, G_VARIANT_TYPE_OBJECT_PATH)) {
+		/* The body holds a reference, so the string stays around */
+		retval = g_variant_get_string(child, NULL);
+	}
+
+	g_variant_unref(child);
+	return retval;
+}
+
+static peer_t * name_owner (DbusTestBroker * broker, const gchar * name);
+
+static gboolean
+match_matches (DbusTestBroker * broker, match_t * match, GDBusMessage * message)
+{
+	if (match->type != G_DBUS_MESSAGE_TYPE_INVALID && match->type != g_dbus_message_get_message_type(message)) {
+		return FALSE;
+	}
+
+	if (match->sender != NULL) {
+		const gchar * sender = g_dbus_message_get_sender(message);
+
+		if (g_strcmp0(match->sender, sender) != 0) {
+			/* Well known names match whoever owns them now */
+			peer_t * owner = name_owner(broker, match->sender);
+
+			if (owner == NULL || g_strcmp0(owner->unique_name, sender) != 0) {
+				return FALSE;
+			}
+		}
+	}
+
+	if (match->interface != NULL && g_strcmp0(match->interface, g_dbus_message_get_interface(message)) != 0) {
+		return FALSE;
+	}
+
+	if (match->member != NULL && g_strcmp0(match->member, g_dbus_message_get_member(message)) != 0) {
+		return FALSE;
+	}
+
+	if (match->path != NULL && g_strcmp0(match->path, g_dbus_message_get_path(message)) != 0) {
+		return FALSE;
+	}
+
+	if (match->path_namespace != NULL) {
+		const gchar * path = g_dbus_message_get_path(message);
+
+		if (path == NULL) {
+			return FALSE;
+		}
+
+		if (g_strcmp0(match->path_namespace, "/") != 0 && g_strcmp0(match->path_namespace, path) != 0) {
+			gsize len = strlen(match->path_namespace);
+
+			if (strncmp(match->path_namespace, path, len) != 0 || path[len] != '/') {
+				return FALSE;
+			}
+		}
+	}
+
+	if (match->destination != NULL && g_strcmp0(match->destination, g_dbus_message_get_destination(message)) != 0) {
+		return FALSE;
+	}
+
+	guint i;
+	for (i = 0; i < MATCH_ARGS; i++) {
+		if (match->args[i] != NULL && g_strcmp0(match->args[i], message_string_arg(message, i)) != 0) {
+			return FALSE;
+		}
+	}
+
+	if (match->arg0namespace != NULL) {
+		const gchar * arg0 = message_string_arg(message, 0);
+
+		if (arg0 == NULL) {
+			return FALSE;
+		}
+
+		if (g_strcmp0(match->arg0namespace, arg0) != 0) {
+			gsize len = strlen(match->arg0namespace);
+
+			if (strncmp(match->arg0namespace, arg0, len) != 0 || arg0[len] != '.') {
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/* Whether any of the rules of the peer wants the message.  Rules that
+   eavesdrop are the only ones that see messages for someone else. */
+static gboolean
+peer_wants (DbusTestBroker * broker, peer_t * peer, GDBusMessage * message, gboolean eavesdropping)
+{
+	if (peer->monitor && peer->matches == NULL) {
+		return TRUE;
+	}
+
+	GList * lmatch;
+	for (lmatch = peer->matches; lmatch != NULL; lmatch = g_list_next(lmatch)) {
+		match_t * match = (match_t *)lmatch->data;
+
+		if (eavesdropping && !match->eavesdrop && !peer->monitor) {
+			continue;
+		}
+
+		if (match_matches(broker, match, message)) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+ * Sending
+ */
+
+static void
+send_to_peer (peer_t * peer, GDBusMessage * message, gboolean preserve_serial)
+{
+	GError * error = NULL;
+	GDBusMessage * copy = g_dbus_message_copy(message, &error);
+
+	if (copy == NULL) {
+		g_warning("Unable to copy message: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	if (!g_dbus_connection_send_message(peer->connection,
+	                                    copy,
+	                                    preserve_serial ? G_DBUS_SEND_MESSAGE_FLAGS_PRESERVE_SERIAL : G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+	                                    NULL, /* serial */
+	                                    &error)) {
+		/* Peer went away, its closed handler will clean up */
+		g_debug("Unable to send message to '%s': %s", peer->unique_name, error->message);
+		g_error_free(error);
+	}
+
+	g_object_unref(copy);
+	return;
+}
+
+/* Delivers a message that already has its sender set to wherever it
+   goes, including monitors and eavesdroppers */
+static void
+route (DbusTestBroker * broker, GDBusMessage * message, peer_t * from, gboolean preserve_serial)
+{
+	const gchar * destination = g_dbus_message_get_destination(message);
+	peer_t * target = NULL;
+
+	if (destination != NULL) {
+		target = name_owner(broker, destination);
+
+		if (target != NULL) {
+			send_to_peer(target, message, preserve_serial);
+		} else if (from != NULL &&
+				g_dbus_message_get_message_type(message) == G_DBUS_MESSAGE_TYPE_METHOD_CALL &&
+				!(g_dbus_message_get_flags(message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)) {
+			GDBusMessage * reply = g_dbus_message_new_method_error(message,
+			                                                       ERROR_PREFIX "ServiceUnknown",
+			                                                       "The name %s was not provided by any .service files",
+			                                                       destination);
+			g_dbus_message_set_sender(reply, BUS_NAME);
+			g_dbus_message_set_destination(reply, from->unique_name);
+			send_to_peer(from, reply, FALSE);
+			g_object_unref(reply);
+		}
+	}
+
+	GList * lpeer;
+	for (lpeer = broker->peers; lpeer != NULL; lpeer = g_list_next(lpeer)) {
+		peer_t * peer = (peer_t *)lpeer->data;
+
+		if (peer == target || peer->unique_name == NULL) {
+			continue;
+		}
+
+		/* Broadcasts go to anyone that asked, directed messages only
+		   to those listening in */
+		if (peer_wants(broker, peer, message, destination != NULL || peer->monitor)) {
+			send_to_peer(peer, message, preserve_serial);
+		}
+	}
+
+	return;
+}
+
+static void
+emit_bus_signal (DbusTestBroker * broker, const gchar * destination, const gchar * member, GVariant * body)
+{
+	GDBusMessage * signal = g_dbus_message_new_signal(BUS_PATH, BUS_INTERFACE, member);
+
+	g_dbus_message_set_sender(signal, BUS_NAME);
+	if (destination != NULL) {
+		g_dbus_message_set_destination(signal, destination);
+	}
+	g_dbus_message_set_body(signal, body);
+
+	route(broker, signal, NULL, FALSE);
+
+	g_object_unref(signal);
+	return;
+}
+
+static void
+name_owner_changed (DbusTestBroker * broker, const gchar * name, peer_t * old_owner, peer_t * new_owner)
+{
+	emit_bus_signal(broker, NULL, "NameOwnerChanged",
+	                g_variant_new("(sss)",
+	                              name,
+	                              old_owner != NULL ? old_owner->unique_name : "",
+	                              new_owner != NULL ? new_owner->unique_name : ""));
+	return;
+}
+
+/*
+ * Names
+ */
+
+static peer_t *
+name_owner (DbusTestBroker * broker, const gchar * name)
+{
+	if (name[0] == ':') {
+		return g_hash_table_lookup(broker->unique_names, name);
+	}
+
+	GQueue * owners = g_hash_table_lookup(broker->names, name);
+	if (owners == NULL || g_queue_is_empty(owners)) {
+		return NULL;
+	}
+
+	return ((owner_t *)g_queue_peek_head(owners))->peer;
+}
+
+static GList *
+name_find_owner (GQueue * owners, peer_t * peer)
+{
+	GList * lowner;
+
+	for (lowner = owners->head; lowner != NULL; lowner = g_list_next(lowner)) {
+		if (((owner_t *)lowner->data)->peer == peer) {
+			return lowner;
+		}
+	}
+
+	return NULL;
+}
+
+/* Takes the peer out of the owners of the name, telling everyone if
+   that changes who owns it */
+static void
+name_drop_owner (DbusTestBroker * broker, const gchar * name, GQueue * owners, GList * lowner)
+{
+	owner_t * owner = (owner_t *)lowner->data;
+	gboolean primary = lowner == owners->head;
+
+	g_queue_delete_link(owners, lowner);
+
+	if (primary) {
+		peer_t * next = g_queue_is_empty(owners) ? NULL : ((owner_t *)g_queue_peek_head(owners))->peer;
+
+		emit_bus_signal(broker, owner->peer->unique_name, "NameLost", g_variant_new("(s)", name));
+		name_owner_changed(broker, name, owner->peer, next);
+
+		if (next != NULL) {
+			emit_bus_signal(broker, next->unique_name, "NameAcquired", g_variant_new("(s)", name));
+		}
+	}
+
+	g_free(owner);
+
+	if (g_queue_is_empty(owners)) {
+		g_hash_table_remove(broker->names, name);
+	}
+
+	return;
+}
+
+static guint32
+name_request (DbusTestBroker * broker, peer_t * peer, const gchar * name, guint32 flags)
+{
+	GQueue * owners = g_hash_table_lookup(broker->names, name);
+
+	if (owners == NULL) {
+		owners = g_queue_new();
+		g_hash_table_insert(broker->names, g_strdup(name), owners);
+	}
+
+	GList * lexisting = name_find_owner(owners, peer);
+
+	if (g_queue_is_empty(owners)) {
+		owner_t * owner = g_new0(owner_t, 1);
+		owner->peer = peer;
+		owner->flags = flags;
+		g_queue_push_head(owners, owner);
+
+		name_owner_changed(broker, name, NULL, peer);
+		emit_bus_signal(broker, peer->unique_name, "NameAcquired", g_variant_new("(s)", name));
+
+		return REQUEST_PRIMARY_OWNER;
+	}
+
+	owner_t * primary = (owner_t *)g_queue_peek_head(owners);
+
+	if (primary->peer == peer) {
+		primary->flags = flags;
+		return REQUEST_ALREADY_OWNER;
+	}
+
+	if ((flags & NAME_FLAG_REPLACE_EXISTING) && (primary->flags & NAME_FLAG_ALLOW_REPLACEMENT)) {
+		if (lexisting != NULL) {
+			g_free(lexisting->data);
+			g_queue_delete_link(owners, lexisting);
+		}
+
+		owner_t * owner = g_new0(owner_t, 1);
+		owner->peer = peer;
+		owner->flags = flags;
+
+		g_queue_pop_head(owners);
+		g_queue_push_head(owners, owner);
+
+		emit_bus_signal(broker, primary->peer->unique_name, "NameLost", g_variant_new("(s)", name));
+		name_owner_changed(broker, name, primary->peer, peer);
+		emit_bus_signal(broker, peer->unique_name, "NameAcquired", g_variant_new("(s)", name));
+
+		/* The old owner waits its turn again unless it didn't want to */
+		if (primary->flags & NAME_FLAG_DO_NOT_QUEUE) {
+			g_free(primary);
+		} else {
+			g_queue_push_nth(owners, primary, 1);
+		}
+
+		return REQUEST_PRIMARY_OWNER;
+	}
+
+	if (flags & NAME_FLAG_DO_NOT_QUEUE) {
+		if (lexisting != NULL) {
+			g_free(lexisting->data);
+			g_queue_delete_link(owners, lexisting);
+		}
+
+		return REQUEST_EXISTS;
+	}
+
+	if (lexisting != NULL) {
+		((owner_t *)lexisting->data)->flags = flags;
+	} else {
+		owner_t * owner = g_new0(owner_t, 1);
+		owner->peer = peer;
+		owner->flags = flags;
+		g_queue_push_tail(owners, owner);
+	}
+
+	return REQUEST_IN_QUEUE;
+}
+
+static guint32
+name_release (DbusTestBroker * broker, peer_t * peer, const gchar * name)
+{
+	GQueue * owners = g_hash_table_lookup(broker->names, name);
+
+	if (owners == NULL) {
+		return RELEASE_NON_EXISTENT;
+	}
+
+	GList * lowner = name_find_owner(owners, peer);
+	if (lowner == NULL) {
+		return RELEASE_NOT_OWNER;
+	}
+
+	name_drop_owner(broker, name, owners, lowner);
+
+	return RELEASE_RELEASED;
+}
+
+/* Lets go of all the names the peer owns or is waiting on */
+static void
+peer_release_names (DbusTestBroker * broker, peer_t * peer)
+{
+	GList * names = g_hash_table_get_keys(broker->names);
+	GList * lname;
+
+	for (lname = names; lname != NULL; lname = g_list_next(lname)) {
+		gchar * name = g_strdup((const gchar *)lname->data);
+		GQueue * owners = g_hash_table_lookup(broker->names, name);
+		GList * lowner = name_find_owner(owners, peer);
+
+		if (lowner != NULL) {
+			name_drop_owner(broker, name, owners, lowner);
+		}
+
+		g_free(name);
+	}
+
+	g_list_free(names);
+	return;
+}
+
+/*
+ * The bus interface
+ */
+
+static const gchar * introspection_xml =
+	"<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\"\n"
+	"\"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n"
+	"<node>\n"
+	"  <interface name=\"org.freedesktop.DBus\">\n"
+	"    <method name=\"Hello\"><arg direction=\"out\" type=\"s\"/></method>\n"
+	"    <method name=\"RequestName\"><arg direction=\"in\" type=\"s\"/><arg direction=\"in\" type=\"u\"/><arg direction=\"out\" type=\"u\"/></method>\n"
+	"    <method name=\"ReleaseName\"><arg direction=\"in\" type=\"s\"/><arg direction=\"out\" type=\"u\"/></method>\n"
+	"    <method name=\"StartServiceByName\"><arg direction=\"in\" type=\"s\"/><arg direction=\"in\" type=\"u\"/><arg direction=\"out\" type=\"u\"/></method>\n"
+	"    <method name=\"UpdateActivationEnvironment\"><arg direction=\"in\" type=\"a{ss}\"/></method>\n"
+	"    <method name=\"NameHasOwner\"><arg direction=\"in\" type=\"s\"/><arg direction=\"out\" type=\"b\"/></method>\n"
+	"    <method name=\"ListNames\"><arg direction=\"out\" type=\"as\"/></method>\n"
+	"    <method name=\"ListActivatableNames\"><arg direction=\"out\" type=\"as\"/></method>\n"
+	"    <method name=\"AddMatch\"><arg direction=\"in\" type=\"s\"/></method>\n"
+	"    <method name=\"RemoveMatch\"><arg direction=\"in\" type=\"s\"/></method>\n"
+	"    <method name=\"GetNameOwner\"><arg direction=\"in\" type=\"s\"/><arg direction=\"out\" type=\"s\"/></method>\n"
+	"    <method name=\"ListQueuedOwners\"><arg direction=\"in\" type=\"s\"/><arg direction=\"out\" type=\"as\"/></method>\n"
+	"    <method name=\"GetConnectionUnixUser\"><arg direction=\"in\" type=\"s\"/><arg direction=\"out\" type=\"u\"/></method>\n"
+	"    <method name=\"GetConnectionUnixProcessID\"><arg direction=\"in\" type=\"s\"/><arg direction=\"out\" type=\"u\"/></method>\n"
+	"    <method name=\"GetId\"><arg direction=\"out\" type=\"s\"/></method>\n"
+	"    <signal name=\"NameOwnerChanged\"><arg type=\"s\"/><arg type=\"s\"/><arg type=\"s\"/></signal>\n"
+	"    <signal name=\"NameLost\"><arg type=\"s\"/></signal>\n"
+	"    <signal name=\"NameAcquired\"><arg type=\"s\"/></signal>\n"
+	"  </interface>\n"
+	"  <interface name=\"org.freedesktop.DBus.Monitoring\">\n"
+	"    <method name=\"BecomeMonitor\"><arg direction=\"in\" type=\"as\"/><arg direction=\"in\" type=\"u\"/></method>\n"
+	"  </interface>\n"
+	"  <interface name=\"org.freedesktop.DBus.Introspectable\">\n"
+	"    <method name=\"Introspect\"><arg direction=\"out\" type=\"s\"/></method>\n"
+	"  </interface>\n"
+	"  <interface name=\"org.freedesktop.DBus.Peer\">\n"
+	"    <method name=\"Ping\"/>\n"
+	"    <method name=\"GetMachineId\"><arg direction=\"out\" type=\"s\"/></method>\n"
+	"  </interface>\n"
+	"</node>\n";
+
+/* Looks up the peer for a name given to one of the GetConnection*
+   methods, setting up the error reply if there isn't one */
+static peer_t *
+bus_lookup_peer (DbusTestBroker * broker, GDBusMessage * message, const gchar * name, GDBusMessage ** reply)
+{
+	peer_t * peer = name_owner(broker, name);
+
+	if (peer == NULL) {
+		*reply = g_dbus_message_new_method_error(message,
+		                                         ERROR_PREFIX "NameHasNoOwner",
+		                                         "Could not get owner of name '%s': no such name",
+		                                         name);
+	}
+
+	return peer;
+}
+
+static gboolean
+bus_peer_credentials (peer_t * peer, guint32 * uid, guint32 * pid)
+{
+	GCredentials * credentials = g_dbus_connection_get_peer_credentials(peer->connection);
+
+	if (credentials == NULL) {
+		return FALSE;
+	}
+
+#ifdef __linux__
+	struct ucred * ucred = g_credentials_get_native(credentials, G_CREDENTIALS_TYPE_LINUX_UCRED);
+	if (ucred == NULL) {
+		return FALSE;
+	}
+
+	*uid = ucred->uid;
+	*pid = ucred->pid;
+	return TRUE;
+#else
+	*uid = g_credentials_get_unix_user(credentials, NULL);
+	*pid = 0;
+	return TRUE;
+#endif
+}
+
+/* Handles a message for the bus itself and returns the reply, or NULL
+   if it has been sent already */
+static GDBusMessage *
+bus_method (DbusTestBroker * broker, peer_t * peer, GDBusMessage * message)
+{
+	const gchar * interface = g_dbus_message_get_interface(message);
+	const gchar * member = g_dbus_message_get_member(message);
+	GVariant * body = g_dbus_message_get_body(message);
+	const gchar * signature = body != NULL ? g_variant_get_type_string(body) : "()";
+	GDBusMessage * reply = NULL;
+
+	if (g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL) {
+		return NULL;
+	}
+
+	if (peer->unique_name == NULL && g_strcmp0(member, "Hello") != 0) {
+		return g_dbus_message_new_method_error(message,
+		                                       ERROR_PREFIX "AccessDenied",
+		                                       "Client tried to send a message other than Hello without being registered");
+	}
+
+	if (member == NULL) {
+		/* Fall through to unknown method */
+	} else if (g_strcmp0(interface, INTROSPECT_INTERFACE) == 0 && g_strcmp0(member, "Introspect") == 0) {
+		reply = g_dbus_message_new_method_reply(message);
+		g_dbus_message_set_body(reply, g_variant_new("(s)", introspection_xml));
+	} else if (g_strcmp0(interface, PEER_INTERFACE) == 0 && g_strcmp0(member, "Ping") == 0) {
+		reply = g_dbus_message_new_method_reply(message);
+	} else if (g_strcmp0(interface, PEER_INTERFACE) == 0 && g_strcmp0(member, "GetMachineId") == 0) {
+		reply = g_dbus_message_new_method_reply(message);
+		g_dbus_message_set_body(reply, g_variant_new("(s)", broker->guid));
+	} else if (g_strcmp0(interface, MONITOR_INTERFACE) == 0 && g_strcmp0(member, "BecomeMonitor") == 0 && g_strcmp0(signature, "(asu)") == 0) {
+		GVariantIter * iter;
+		const gchar * rule;
+		GList * matches = NULL;
+		gboolean valid = TRUE;
+
+		g_variant_get(body, "(asu)", &iter, NULL);
+		while (g_variant_iter_loop(iter, "&s", &rule)) {
+			match_t * match = match_new(rule);
+
+			if (match == NULL) {
+				valid = FALSE;
+			} else {
+				matches = g_list_append(matches, match);
+			}
+		}
+		g_variant_iter_free(iter);
+
+		if (!valid) {
+			g_list_free_full(matches, match_free);
+			reply = g_dbus_message_new_method_error(message, ERROR_PREFIX "MatchRuleInvalid", "Invalid match rule");
+		} else {
+			/* Monitors don't get to own anything, and only listen */
+			reply = g_dbus_message_new_method_reply(message);
+			g_dbus_message_set_destination(reply, peer->unique_name);
+			send_to_peer(peer, reply, FALSE);
+			g_clear_object(&reply);
+
+			peer_release_names(broker, peer);
+			emit_bus_signal(broker, peer->unique_name, "NameLost", g_variant_new("(s)", peer->unique_name));
+			g_hash_table_remove(broker->unique_names, peer->unique_name);
+			name_owner_changed(broker, peer->unique_name, peer, NULL);
+
+			g_list_free_full(peer->matches, match_free);
+			peer->matches = matches;
+			peer->monitor = TRUE;
+
+			return NULL;
+		}
+	} else if (g_strcmp0(interface, BUS_INTERFACE) != 0 && interface != NULL) {
+		/* Fall through to unknown method */
+	} else if (g_strcmp0(member, "Hello") == 0) {
+		if (peer->unique_name != NULL) {
+			return g_dbus_message_new_method_error(message, ERROR_PREFIX "Failed", "Already handled an Hello message");
+		}
+
+		peer->unique_name = g_strdup_printf(":1.%u", broker->next_id++);
+		g_hash_table_insert(broker->unique_names, peer->unique_name, peer);
+
+		reply = g_dbus_message_new_method_reply(message);
+		g_dbus_message_set_body(reply, g_variant_new("(s)", peer->unique_name));
+		g_dbus_message_set_sender(reply, BUS_NAME);
+		g_dbus_message_set_destination(reply, peer->unique_name);
+		send_to_peer(peer, reply, FALSE);
+		g_clear_object(&reply);
+
+		name_owner_changed(broker, peer->unique_name, NULL, peer);
+		emit_bus_signal(broker, peer->unique_name, "NameAcquired", g_variant_new("(s)", peer->unique_name));
+
+		return NULL;
+	} else if (g_strcmp0(member, "RequestName") == 0 && g_strcmp0(signature, "(su)") == 0) {
+		const gchar * name;
+		guint32 flags;
+		g_variant_get(body, "(&su)", &name, &flags);
+
+		if (!g_dbus_is_name(name) || g_dbus_is_unique_name(name)) {
+			reply = g_dbus_message_new_method_error(message, ERROR_PREFIX "InvalidArgs", "Cannot acquire a service named '%s'", name);
+		} else if (g_strcmp0(name, BUS_NAME) == 0) {
+			reply = g_dbus_message_new_method_error(message, ERROR_PREFIX "InvalidArgs", "Cannot acquire a service named '%s', it is reserved", name);
+		} else {
+			reply = g_dbus_message_new_method_reply(message);
+			g_dbus_message_set_body(reply, g_variant_new("(u)", name_request(broker, peer, name, flags)));
+		}
+	} else if (g_strcmp0(member, "ReleaseName") == 0 && g_strcmp0(signature, "(s)") == 0) {
+		const gchar * name;
+		g_variant_get(body, "(&s)", &name);
+
+		if (!g_dbus_is_name(name) || g_dbus_is_unique_name(name) || g_strcmp0(name, BUS_NAME) == 0) {
+			reply = g_dbus_message_new_method_error(message, ERROR_PREFIX "InvalidArgs", "Cannot release a service named '%s'", name);
+		} else {
+			reply = g_dbus_message_new_method_reply(message);
+			g_dbus_message_set_body(reply, g_variant_new("(u)", name_release(broker, peer, name)));
+		}
+	} else if (g_strcmp0(member, "GetNameOwner") == 0 && g_strcmp0(signature, "(s)") == 0) {
+		const gchar * name;
+		g_variant_get(body, "(&s)", &name);
+
+		if (g_strcmp0(name, BUS_NAME) == 0) {
+			reply = g_dbus_message_new_method_reply(message);
+			g_dbus_message_set_body(reply, g_variant_new("(s)", BUS_NAME));
+		} else {
+			peer_t * owner = bus_lookup_peer(broker, message, name, &reply);
+
+			if (owner != NULL) {
+				reply = g_dbus_message_new_method_reply(message);
+				g_dbus_message_set_body(reply, g_variant_new("(s)", owner->unique_name));
+			}
+		}
+	} else if (g_strcmp0(member, "NameHasOwner") == 0 && g_strcmp0(signature, "(s)") == 0) {
+		const gchar * name;
+		g_variant_get(body, "(&s)", &name);
+
+		reply = g_dbus_message_new_method_reply(message);
+		g_dbus_message_set_body(reply, g_variant_new("(b)", g_strcmp0(name, BUS_NAME) == 0 || name_owner(broker, name) != NULL));
+	} else if (g_strcmp0(member, "StartServiceByName") == 0 && g_strcmp0(signature, "(su)") == 0) {
+		const gchar * name;
+		g_variant_get(body, "(&su)", &name, NULL);
+
+		/* There's no activation, but things that are there already
+		   are fine */
+		if (g_strcmp0(name, BUS_NAME) == 0 || name_owner(broker, name) != NULL) {
+			reply = g_dbus_message_new_method_reply(message);
+			g_dbus_message_set_body(reply, g_variant_new("(u)", START_ALREADY_RUNNING));
+		} else {
+			reply = g_dbus_message_new_method_error(message,
+			                                        ERROR_PREFIX "ServiceUnknown",
+			                                        "The name %s was not provided by any .service files",
+			                                        name);
+		}
+	} else if (g_strcmp0(member, "UpdateActivationEnvironment") == 0) {
+		reply = g_dbus_message_new_method_reply(message);
+	} else if (g_strcmp0(member, "ListNames") == 0 || g_strcmp0(member, "ListActivatableNames") == 0) {
+		GVariantBuilder builder;
+		g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+		g_variant_builder_add(&builder, "s", BUS_NAME);
+
+		if (g_strcmp0(member, "ListNames") == 0) {
+			GHashTableIter iter;
+			gpointer name;
+
+			g_hash_table_iter_init(&iter, broker->unique_names);
+			while (g_hash_table_iter_next(&iter, &name, NULL)) {
+				g_variant_builder_add(&builder, "s", name);
+			}
+
+			g_hash_table_iter_init(&iter, broker->names);
+			while (g_hash_table_iter_next(&iter, &name, NULL)) {
+				g_variant_builder_add(&builder, "s", name);
+			}
+		}
+
+		reply = g_dbus_message_new_method_reply(message);
+		g_dbus_message_set_body(reply, g_variant_new("(as)", &builder));
+	} else if (g_strcmp0(member, "ListQueuedOwners") == 0 && g_strcmp0(signature, "(s)") == 0) {
+		const gchar * name;
+		g_variant_get(body, "(&s)", &name);
+
+		GQueue * owners = g_hash_table_lookup(broker->names, name);
+		if (owners == NULL) {
+			reply = g_dbus_message_new_method_error(message,
+			                                        ERROR_PREFIX "NameHasNoOwner",
+			                                        "Could not get owners of name '%s': no such name",
+			                                        name);
+		} else {
+			GVariantBuilder builder;
+			GList * lowner;
+
+			g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+			for (lowner = owners->head; lowner != NULL; lowner = g_list_next(lowner)) {
+				g_variant_builder_add(&builder, "s", ((owner_t *)lowner->data)->peer->unique_name);
+			}
+
+			reply = g_dbus_message_new_method_reply(message);
+			g_dbus_message_set_body(reply, g_variant_new("(as)", &builder));
+		}
+	} else if (g_strcmp0(member, "AddMatch") == 0 && g_strcmp0(signature, "(s)") == 0) {
+		const gchar * rule;
+		g_variant_get(body, "(&s)", &rule);
+
+		match_t * match = match_new(rule);
+		if (match == NULL) {
+			reply = g_dbus_message_new_method_error(message, ERROR_PREFIX "MatchRuleInvalid", "Invalid match rule '%s'", rule);
+		} else {
+			peer->matches = g_list_append(peer->matches, match);
+			reply = g_dbus_message_new_method_reply(message);
+		}
+	} else if (g_strcmp0(member, "RemoveMatch") == 0 && g_strcmp0(signature, "(s)") == 0) {
+		const gchar * rule;
+		g_variant_get(body, "(&s)", &rule);
+
+		GList * lmatch;
+		for (lmatch = peer->matches; lmatch != NULL; lmatch = g_list_next(lmatch)) {
+			if (g_strcmp0(((match_t *)lmatch->data)->rule, rule) == 0) {
+				break;
+			}
+		}
+
+		if (lmatch == NULL) {
+			reply = g_dbus_message_new_method_error(message, ERROR_PREFIX "MatchRuleNotFound", "The given match rule wasn't found and can't be removed");
+		} else {
+			match_free(lmatch->data);
+			peer->matches = g_list_delete_link(peer->matches, lmatch);
+			reply = g_dbus_message_new_method_reply(message);
+		}
+	} else if (g_strcmp0(member, "GetId") == 0) {
+		reply = g_dbus_message_new_method_reply(message);
+		g_dbus_message_set_body(reply, g_variant_new("(s)", broker->guid));
+	} else if ((g_strcmp0(member, "GetConnectionUnixUser") == 0 || g_strcmp0(member, "GetConnectionUnixProcessID") == 0) && g_strcmp0(signature, "(s)") == 0) {
+		const gchar * name;
+		g_variant_get(body, "(&s)", &name);
+
+		peer_t * owner = bus_lookup_peer(broker, message, name, &reply);
+		guint32 uid, pid;
+
+		if (owner == NULL) {
+			/* Error already set */
+		} else if (!bus_peer_credentials(owner, &uid, &pid)) {
+			reply = g_dbus_message_new_method_error(message,
+			                                        ERROR_PREFIX "Failed",
+			                                        "Could not determine credentials for '%s'",
+			                                        name);
+		} else {
+			reply = g_dbus_message_new_method_reply(message);
+			g_dbus_message_set_body(reply, g_variant_new("(u)", g_strcmp0(member, "GetConnectionUnixUser") == 0 ? uid : pid));
+		}
+	}
+
+	if (reply == NULL) {
+		reply = g_dbus_message_new_method_error(message,
+		                                        ERROR_PREFIX "UnknownMethod",
+		                                        "Method \"%s\" with signature \"%s\" on interface \"%s\" doesn't exist",
+		                                        member != NULL ? member : "",
+		                                        signature,
+		                                        interface != NULL ? interface : "");
+	}
+
+	return reply;
+}
+
+/* Every message from the peers comes through here, in the GDBus worker
+   thread.  None of them are for the connection itself, so we handle or
+   route all of them and drop them. */
+static GDBusMessage *
+peer_filter (GDBusConnection * connection, GDBusMessage * message, gboolean incoming, gpointer user_data)
+{
+	if (!incoming) {
+		return message;
+	}
+
+	peer_t * peer = (peer_t *)g_object_get_data(G_OBJECT(connection), "dbus-test-broker-peer");
+	DbusTestBroker * broker = (DbusTestBroker *)user_data;
+
+	g_mutex_lock(&broker->lock);
+
+	if (broker->stopping || peer == NULL || peer->monitor) {
+		/* Monitors don't get to say anything */
+	} else if (g_strcmp0(g_dbus_message_get_destination(message), BUS_NAME) == 0) {
+		GDBusMessage * reply = bus_method(broker, peer, message);
+
+		if (reply != NULL) {
+			g_dbus_message_set_sender(reply, BUS_NAME);
+			if (peer->unique_name != NULL) {
+				g_dbus_message_set_destination(reply, peer->unique_name);
+			}
+
+			if (!(g_dbus_message_get_flags(message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)) {
+				send_to_peer(peer, reply, FALSE);
+			}
+
+			g_object_unref(reply);
+		}
+	} else if (peer->unique_name == NULL) {
+		g_debug("Dropping message from a peer that didn't say Hello");
+	} else {
+		GError * error = NULL;
+		GDBusMessage * copy = g_dbus_message_copy(message, &error);
+
+		if (copy != NULL) {
+			g_dbus_message_set_sender(copy, peer->unique_name);
+			route(broker, copy, peer, TRUE);
+			g_object_unref(copy);
+		} else {
+			g_warning("Unable to copy message: %s", error->message);
+			g_error_free(error);
+		}
+	}
+
+	g_mutex_unlock(&broker->lock);
+
+	g_object_unref(message);
+	return NULL;
+}
+
+/*
+ * Peers
+ */
+
+static void
+peer_free (peer_t * peer)
+{
+	g_signal_handler_disconnect(peer->connection, peer->closed_handler);
+	g_dbus_connection_remove_filter(peer->connection, peer->filter);
+	g_object_set_data(G_OBJECT(peer->connection), "dbus-test-broker-peer", NULL);
+
+	g_list_free_full(peer->matches, match_free);
+	g_free(peer->unique_name);
+	g_object_unref(peer->connection);
+	g_free(peer);
+
+	return;
+}
+
+/* Called once the worker thread is done with the connection, so no
+   more messages are going to show up for it */
+static void
+peer_closed (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED gboolean remote_peer_vanished, G_GNUC_UNUSED GError * error, gpointer user_data)
+{
+	peer_t * peer = (peer_t *)user_data;
+	DbusTestBroker * broker = g_object_get_data(G_OBJECT(peer->connection), "dbus-test-broker");
+
+	g_mutex_lock(&broker->lock);
+
+	if (g_list_find(broker->peers, peer) == NULL) {
+		/* Shutting down, the thread frees it */
+		g_mutex_unlock(&broker->lock);
+		return;
+	}
+
+	broker->peers = g_list_remove(broker->peers, peer);
+
+	if (peer->unique_name != NULL && !peer->monitor) {
+		peer_release_names(broker, peer);
+		g_hash_table_remove(broker->unique_names, peer->unique_name);
+		name_owner_changed(broker, peer->unique_name, peer, NULL);
+	}
+
+	g_mutex_unlock(&broker->lock);
+
+	peer_free(peer);
+	return;
+}
+
+static gboolean
+new_connection (G_GNUC_UNUSED GDBusServer * server, GDBusConnection * connection, gpointer user_data)
+{
+	DbusTestBroker * broker = (DbusTestBroker *)user_data;
+	peer_t * peer = g_new0(peer_t, 1);
+
+	peer->connection = g_object_ref(connection);
+
+	/* Message processing starts once we return, so the filter sees
+	   everything */
+	g_object_set_data(G_OBJECT(connection), "dbus-test-broker", broker);
+	g_object_set_data(G_OBJECT(connection), "dbus-test-broker-peer", peer);
+	peer->filter = g_dbus_connection_add_filter(connection, peer_filter, broker, NULL);
+	peer->closed_handler = g_signal_connect(connection, "closed", G_CALLBACK(peer_closed), peer);
+
+	g_mutex_lock(&broker->lock);
+	broker->peers = g_list_prepend(broker->peers, peer);
+	g_mutex_unlock(&broker->lock);
+
+	return TRUE;
+}
+
+/*
+ * The thread
+ */
+
+static gpointer
+broker_thread (gpointer user_data)
+{
+	DbusTestBroker * broker = (DbusTestBroker *)user_data;
+	GError * error = NULL;
+
+	g_main_context_push_thread_default(broker->context);
+
+	gchar * tmpdir = g_strdup_printf("unix:tmpdir=%s", g_get_tmp_dir());
+	broker->server = g_dbus_server_new_sync(tmpdir,
+	                                        G_DBUS_SERVER_FLAGS_NONE,
+	                                        broker->guid,
+	                                        NULL, /* observer */
+	                                        NULL, /* cancel */
+	                                        &error);
+	g_free(tmpdir);
+
+	if (broker->server != NULL) {
+		g_signal_connect(broker->server, "new-connection", G_CALLBACK(new_connection), broker);
+		g_dbus_server_start(broker->server);
+	}
+
+	g_mutex_lock(&broker->start_lock);
+	broker->error = error;
+	broker->running = TRUE;
+	g_cond_signal(&broker->started);
+	g_mutex_unlock(&broker->start_lock);
+
+	if (broker->server != NULL) {
+		g_main_loop_run(broker->loop);
+
+		g_dbus_server_stop(broker->server);
+
+		/* Nobody gets to route to the peers once we take them */
+		g_mutex_lock(&broker->lock);
+		broker->stopping = TRUE;
+		GList * peers = broker->peers;
+		broker->peers = NULL;
+		g_hash_table_remove_all(broker->unique_names);
+		g_hash_table_remove_all(broker->names);
+		g_mutex_unlock(&broker->lock);
+
+		/* Closing makes the worker let go of them, then they're ours */
+		GList * lpeer;
+		for (lpeer = peers; lpeer != NULL; lpeer = g_list_next(lpeer)) {
+			peer_t * peer = (peer_t *)lpeer->data;
+
+			g_dbus_connection_close_sync(peer->connection, NULL, NULL);
+			peer_free(peer);
+		}
+		g_list_free(peers);
+
+		g_clear_object(&broker->server);
+	}
+
+	g_main_context_pop_thread_default(broker->context);
+
+	return NULL;
+}
+
+/* Starts the bus in a thread of its own, so that connecting to it
+   from this thread doesn't need our main loop to be running */
+DbusTestBroker *
+_dbus_test_broker_new (GError ** error)
+{
+	DbusTestBroker * broker = g_new0(DbusTestBroker, 1);
+
+	broker->guid = g_dbus_generate_guid();
+	broker->context = g_main_context_new();
+	broker->loop = g_main_loop_new(broker->context, FALSE);
+	broker->next_id = 1;
+	broker->unique_names = g_hash_table_new(g_str_hash, g_str_equal);
+	broker->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_queue_free);
+
+	g_mutex_init(&broker->lock);
+	g_mutex_init(&broker->start_lock);
+	g_cond_init(&broker->started);
+
+	broker->thread = g_thread_new("dbus-test-broker", broker_thread, broker);
+
+	g_mutex_lock(&broker->start_lock);
+	while (!broker->running) {
+		g_cond_wait(&broker->started, &broker->start_lock);
+	}
+	g_mutex_unlock(&broker->start_lock);
+
+	if (broker->error != NULL) {
+		g_propagate_error(error, broker->error);
+		broker->error = NULL;
+		_dbus_test_broker_free(broker);
+		return NULL;
+	}
+
+	return broker;
+}
+
+static gboolean
+broker_quit (gpointer user_data)
+{
+	g_main_loop_quit((GMainLoop *)user_data);
+	return G_SOURCE_REMOVE;
+}
+
+/* Disconnects everyone and stops the thread */
+void
+_dbus_test_broker_free (DbusTestBroker * broker)
+{
+	g_return_if_fail(broker != NULL);
+
+	/* A source rather than an invoke so that it can't run before the
+	   loop does */
+	GSource * quit = g_idle_source_new();
+	g_source_set_callback(quit, broker_quit, broker->loop, NULL);
+	g_source_attach(quit, broker->context);
+	g_source_unref(quit);
+
+	g_thread_join(broker->thread);
+
+	g_hash_table_destroy(broker->unique_names);
+	g_hash_table_destroy(broker->names);
+
+	g_mutex_clear(&broker->lock);
+	g_mutex_clear(&broker->start_lock);
+	g_cond_clear(&broker->started);
+
+	g_main_loop_unref(broker->loop);
+	g_main_context_unref(broker->context);
+	g_free(broker->guid);
+	g_free(broker);
+
+	return;
+}
+
+/* The address for clients to connect to */
+const gchar *
+_dbus_test_broker_get_address (DbusTestBroker * broker)
+{
+	g_return_val_if_fail(broker != NULL, NULL);
+	return g_dbus_server_get_client_address(broker->server);
+}
@@ -0,0 +1,40 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_BROKER_H__
+#define __DBUS_TEST_BROKER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A minimal message bus that runs in a thread of our own process
+   instead of a dbus-daemon.  It does Hello, name ownership, match
+   rules, routing and monitors, but no activation or policy.  This
+   is internal to the library, the service uses it for the embedded
+   bus backend. */
+typedef struct _DbusTestBroker DbusTestBroker;
+
+G_GNUC_INTERNAL
+DbusTestBroker * _dbus_test_broker_new         (GError **         error);
+G_GNUC_INTERNAL
+void             _dbus_test_broker_free        (DbusTestBroker *  broker);
+G_GNUC_INTERNAL
+const gchar *    _dbus_test_broker_get_address (DbusTestBroker *  broker);
+
+G_END_DECLS
+
+#endif
@@ -21,19 +21,30 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "config.h"
 #endif
 
+#include <signal.h>
+
 #include <glib.h>
+#include <gio/gio.h>
 #include "glib-compat.h"
 #include "dbus-test.h"
+#include "guard.h"
+#include "kill.h"
 
 struct _DbusTestBustlePrivate {
 	gchar * filename;
 	gchar * executable;
 
-	guint watch;
+	GSource * watch;
 	GIOChannel * stderr;
+	GSource * stderr_watch;
 	GIOChannel * file;
 	GPid pid;
 
+	GDBusConnection * bus;
+	guint owner_changed;
+	GCancellable * cancel;
+	gboolean attached;
+
 	gboolean crashed;
 };
 
@@ -82,11 +93,17 @@ dbus_test_bustle_init (DbusTestBustle *self)
 	self->priv->filename = g_strconcat(current_dir, G_DIR_SEPARATOR_S, "bustle.log", NULL);
 	self->priv->executable = g_strdup(BUSTLE_DUAL_MONITOR);
 
-	self->priv->watch = 0;
+	self->priv->watch = NULL;
 	self->priv->stderr = NULL;
+	self->priv->stderr_watch = NULL;
 	self->priv->file = NULL;
 	self->priv->pid = 0;
 
+	self->priv->bus = NULL;
+	self->priv->owner_changed = 0;
+	self->priv->cancel = g_cancellable_new();
+	self->priv->attached = FALSE;
+
 	self->priv->crashed = FALSE;
 
 	g_free (current_dir);
@@ -99,15 +116,32 @@ dbus_test_bustle_dispose (GObject *object)
 	g_return_if_fail(DBUS_TEST_IS_BUSTLE(object));
 	DbusTestBustle * bustler = DBUS_TEST_BUSTLE(object);
 
-	if (bustler->priv->watch != 0) {
-		g_source_remove(bustler->priv->watch);
-		bustler->priv->watch = 0;
+	if (bustler->priv->watch != NULL) {
+		g_source_destroy(bustler->priv->watch);
+		g_clear_pointer(&bustler->priv->watch, g_source_unref);
+	}
+
+	if (bustler->priv->stderr_watch != NULL) {
+		g_source_destroy(bustler->priv->stderr_watch);
+		g_clear_pointer(&bustler->priv->stderr_watch, g_source_unref);
 	}
 
+	if (bustler->priv->cancel != NULL) {
+		g_cancellable_cancel(bustler->priv->cancel);
+		g_clear_object(&bustler->priv->cancel);
+	}
+
+	if (bustler->priv->owner_changed != 0) {
+		g_dbus_connection_signal_unsubscribe(bustler->priv->bus, bustler->priv->owner_changed);
+		bustler->priv->owner_changed = 0;
+	}
+
+	g_clear_object(&bustler->priv->bus);
+
 	if (bustler->priv->pid != 0) {
-		gchar * command = g_strdup_printf("kill -INT %d", bustler->priv->pid);
-		g_spawn_command_line_sync(command, NULL, NULL, NULL, NULL);
-		g_free(command);
+		/* The monitor writes out the rest of the file on SIGINT */
+		_dbus_test_kill(bustler->priv->pid, SIGINT, DBUS_TEST_KILL_DEFAULT_TIMEOUT);
+		_dbus_test_guard_remove(-bustler->priv->pid);
 
 		g_spawn_close_pid(bustler->priv->pid);
 	}
@@ -170,17 +204,158 @@ dbus_test_bustle_set_executable (DbusTestBustle * bustle, const gchar * executab
 	return;
 }
 
+/* The monitor is on the bus, or we've given up on seeing it, either way
+   stop watching and let the other tasks go */
+static void
+bustle_attached (DbusTestBustle * bustler)
+{
+	if (bustler->priv->attached) {
+		return;
+	}
+	bustler->priv->attached = TRUE;
+
+	g_cancellable_cancel(bustler->priv->cancel);
+
+	if (bustler->priv->owner_changed != 0) {
+		g_dbus_connection_signal_unsubscribe(bustler->priv->bus, bustler->priv->owner_changed);
+		bustler->priv->owner_changed = 0;
+	}
+
+	g_clear_object(&bustler->priv->bus);
+
+	dbus_test_task_release_ready(DBUS_TEST_TASK(bustler));
+
+	return;
+}
+
+static void
+got_connection_pid (GObject * obj, GAsyncResult * res, gpointer user_data)
+{
+	GError * error = NULL;
+	GVariant * ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, &error);
+
+	if (error != NULL) {
+		/* Bustler may be gone if it was cancelled, don't touch it.  A
+		   connection that went away before we could ask could be any
+		   short lived one, only our monitor's PID counts.  If that was
+		   the monitor the service's ready timeout lets the others go. */
+		g_error_free(error);
+		return;
+	}
+
+	DbusTestBustle * bustler = DBUS_TEST_BUSTLE(user_data);
+	guint32 pid = 0;
+	g_variant_get(ret, "(u)", &pid);
+	g_variant_unref(ret);
+
+	if (bustler->priv->pid != 0 && (GPid)pid == bustler->priv->pid) {
+		bustle_attached(bustler);
+	}
+
+	return;
+}
+
+/* Look at each new connection to see if it is our monitor */
+static void
+name_owner_changed (GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, G_GNUC_UNUSED const gchar * path, G_GNUC_UNUSED const gchar * interface, G_GNUC_UNUSED const gchar * signal, GVariant * params, gpointer user_data)
+{
+	DbusTestBustle * bustler = DBUS_TEST_BUSTLE(user_data);
+	const gchar * name = NULL;
+	const gchar * old_owner = NULL;
+	const gchar * new_owner = NULL;
+
+	g_variant_get(params, "(&s&s&s)", &name, &old_owner, &new_owner);
+
+	if (name[0] != ':' || new_owner[0] == '\0' || bustler->priv->attached) {
+		return;
+	}
+
+	g_dbus_connection_call(connection,
+	                       "org.freedesktop.DBus",
+	                       "/org/freedesktop/DBus",
+	                       "org.freedesktop.DBus",
+	                       "GetConnectionUnixProcessID",
+	                       g_variant_new("(s)", name),
+	                       G_VARIANT_TYPE("(u)"),
+	                       G_DBUS_CALL_FLAGS_NONE,
+	                       -1, /* timeout */
+	                       bustler->priv->cancel,
+	                       got_connection_pid,
+	                       bustler);
+
+	return;
+}
+
+/* Get a connection of our own to watch for the monitor showing up,
+   we don't want to share one that could close on us.  The bus is the
+   one in the environment the service gave us, which isn't always
+   ours. */
+static void
+watch_for_monitor (DbusTestBustle * bustler)
+{
+	GError * error = NULL;
+	GBusType bustype = G_BUS_TYPE_SESSION;
+	const gchar * variable = "DBUS_SESSION_BUS_ADDRESS";
+
+	if (dbus_test_task_get_bus(DBUS_TEST_TASK(bustler)) == DBUS_TEST_SERVICE_BUS_SYSTEM) {
+		bustype = G_BUS_TYPE_SYSTEM;
+		variable = "DBUS_SYSTEM_BUS_ADDRESS";
+	}
+
+	gchar * address = NULL;
+	gchar ** envp = dbus_test_task_get_environment(DBUS_TEST_TASK(bustler));
+
+	if (envp != NULL && g_environ_getenv(envp, variable) != NULL) {
+		address = g_strdup(g_environ_getenv(envp, variable));
+	} else {
+		address = g_dbus_address_get_for_bus_sync(bustype, NULL, &error);
+	}
+
+	if (address != NULL) {
+		bustler->priv->bus = g_dbus_connection_new_for_address_sync(address,
+			G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+			NULL, /* observer */
+			NULL, /* cancel */
+			&error);
+		g_free(address);
+	}
+
+	if (error != NULL) {
+		g_warning("Unable to watch for the bustle monitor: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	bustler->priv->owner_changed = g_dbus_connection_signal_subscribe(bustler->priv->bus,
+		"org.freedesktop.DBus", /* sender */
+		"org.freedesktop.DBus", /* interface */
+		"NameOwnerChanged", /* member */
+		"/org/freedesktop/DBus", /* path */
+		NULL, /* arg0 */
+		G_DBUS_SIGNAL_FLAGS_NONE,
+		name_owner_changed,
+		bustler,
+		NULL); /* user data free */
+
+	return;
+}
+
 static void
 bustle_watcher (GPid pid, G_GNUC_UNUSED gint status, gpointer data)
 {
 	g_critical("Bustle Monitor exited abruptly!");
 	DbusTestBustle * bustler = DBUS_TEST_BUSTLE(data);
 
+	g_clear_pointer(&bustler->priv->watch, g_source_unref);
+
 	if (bustler->priv->pid != 0) {
+		_dbus_test_guard_remove(-bustler->priv->pid);
 		g_spawn_close_pid(pid);
 		bustler->priv->pid = 0;
 	}
 
+	bustle_attached(bustler);
+
 	bustler->priv->crashed = TRUE;
 	g_signal_emit_by_name(G_OBJECT(bustler), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, DBUS_TEST_TASK_STATE_FINISHED, NULL);
 
@@ -225,12 +400,16 @@ process_run (DbusTestTask * task)
 	
 	GError * error = NULL;
 
+	/* Don't let the other tasks start until we can record them */
+	dbus_test_task_hold_ready(task);
+
 	bustler->priv->file = g_io_channel_new_file(bustler->priv->filename, "w", &error);
 
 	if (error != NULL) {
 		g_critical("Unable to open bustle file '%s': %s", bustler->priv->filename, error->message);
 		g_error_free(error);
 
+		bustle_attached(bustler);
 		bustler->priv->crashed = TRUE;
 		g_signal_emit_by_name(G_OBJECT(bustler), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, DBUS_TEST_TASK_STATE_FINISHED, NULL);
 		return;
@@ -244,12 +423,15 @@ process_run (DbusTestTask * task)
 	bustle_monitor[0] = (gchar *)bustler->priv->executable;
 	bustle_monitor[1] = (gchar *)bustler->priv->filename;
 
+	/* Needs to be on the bus before the monitor is */
+	watch_for_monitor(bustler);
+
 	g_spawn_async_with_pipes(current_dir,
 	                         bustle_monitor, /* argv */
-	                         NULL, /* envp */
+	                         dbus_test_task_get_environment(task), /* envp */
 	                         /* G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL, */ /* flags */
 	                         G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, /* flags */
-	                         NULL, /* child setup func */
+	                         _dbus_test_kill_child_setup, /* child setup func */
 	                         NULL, /* child setup data */
 	                         &bustler->priv->pid, /* PID */
 	                         NULL, /* stdin */
@@ -265,23 +447,37 @@ process_run (DbusTestTask * task)
 		g_error_free(error);
 
 		bustler->priv->pid = 0; /* ensure this */
+		bustle_attached(bustler);
 		bustler->priv->crashed = TRUE;
 		g_signal_emit_by_name(G_OBJECT(bustler), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, DBUS_TEST_TASK_STATE_FINISHED, NULL);
 		return;
 	}
 
+	_dbus_test_guard_add(-bustler->priv->pid);
+
 	if (TRUE) {
 		gchar * start = g_strdup_printf("Starting bustle monitor.  PID: %d", bustler->priv->pid);
 		dbus_test_task_print(DBUS_TEST_TASK(bustler), start);
 		g_free(start);
 	}
-	bustler->priv->watch = g_child_watch_add(bustler->priv->pid, bustle_watcher, bustler);
+
+	/* Watched from the service's context, which isn't always the
+	   global default one */
+	GMainContext * context = g_main_context_get_thread_default();
+
+	bustler->priv->watch = g_child_watch_source_new(bustler->priv->pid);
+	g_source_set_callback(bustler->priv->watch, G_SOURCE_FUNC(bustle_watcher), bustler, NULL);
+	g_source_attach(bustler->priv->watch, context);
+
+	if (bustler->priv->bus == NULL) {
+		/* No way to know when it's there */
+		bustle_attached(bustler);
+	}
 
 	bustler->priv->stderr = g_io_channel_unix_new(bustle_stderr_num);
-	g_io_add_watch(bustler->priv->stderr,
-	               G_IO_IN | G_IO_HUP | G_IO_ERR, /* conditions */
-	               bustle_write_error, /* func */
-	               bustler); /* func data */
+	bustler->priv->stderr_watch = g_io_create_watch(bustler->priv->stderr, G_IO_IN | G_IO_HUP | G_IO_ERR);
+	g_source_set_callback(bustler->priv->stderr_watch, G_SOURCE_FUNC(bustle_write_error), bustler, NULL);
+	g_source_attach(bustler->priv->stderr_watch, context);
 
 	return;
 }
@@ -0,0 +1,402 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "cgroup.h"
+#include "guard.h"
+
+#define CGROUP_MOUNT  "/sys/fs/cgroup"
+/* Where we move ourselves so our group can have children with
+   controllers, only leaves can have processes in them */
+#define CGROUP_LEAF   "dbus-test-runner"
+
+/* How long we wait for what was killed to leave before giving up on
+   removing the group */
+#define CGROUP_REMOVE_TIMEOUT  (G_USEC_PER_SEC)
+
+struct _DbusTestCgroup {
+	gchar * path;
+	gint procs_fd;
+	gboolean guarded;
+};
+
+/* Our own group, set up once for the whole process */
+G_LOCK_DEFINE_STATIC(cgroup_base);
+static gchar * cgroup_base = NULL;
+
+/* The files in a group aren't regular files, they get written in one
+   go and not replaced like g_file_set_contents() would */
+static gboolean
+cgroup_write (const gchar * path, const gchar * file, const gchar * value, GError ** error)
+{
+	gchar * filename = g_build_filename(path, file, NULL);
+	gssize len = strlen(value);
+	gint fd = open(filename, O_WRONLY | O_CLOEXEC);
+	gboolean written = fd >= 0 && write(fd, value, len) == len;
+	gint errsv = errno;
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	if (!written) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv), "Unable to write '%s' to '%s': %s", value, filename, g_strerror(errsv));
+	}
+
+	g_free(filename);
+	return written;
+}
+
+static gchar *
+cgroup_read (const gchar * path, const gchar * file)
+{
+	gchar * filename = g_build_filename(path, file, NULL);
+	gchar * contents = NULL;
+
+	if (!g_file_get_contents(filename, &contents, NULL, NULL)) {
+		contents = NULL;
+	}
+
+	g_free(filename);
+	return contents;
+}
+
+/* Turns on what we measure and limit for the groups under @path, as
+   far as the kernel and whoever delegated to us allow */
+static void
+cgroup_enable_controllers (const gchar * path)
+{
+	static const gchar * wanted[] = { "cpu", "memory", "io", "pids" };
+	gchar * available = cgroup_read(path, "cgroup.controllers");
+
+	if (available == NULL) {
+		return;
+	}
+
+	gchar ** names = g_strsplit_set(g_strstrip(available), " ", -1);
+	guint i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(wanted); i++) {
+		for (j = 0; names[j] != NULL; j++) {
+			if (g_strcmp0(names[j], wanted[i]) == 0) {
+				gchar * enable = g_strconcat("+", wanted[i], NULL);
+				cgroup_write(path, "cgroup.subtree_control", enable, NULL);
+				g_free(enable);
+				break;
+			}
+		}
+	}
+
+	g_strfreev(names);
+	g_free(available);
+
+	return;
+}
+
+/* The group we were started in, from the unified hierarchy line */
+static gchar *
+cgroup_self (void)
+{
+	gchar * contents = NULL;
+	gchar * self = NULL;
+
+	if (!g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL)) {
+		return NULL;
+	}
+
+	gchar ** lines = g_strsplit(contents, "\n", -1);
+	gchar ** line;
+
+	for (line = lines; *line != NULL && self == NULL; line++) {
+		if (g_str_has_prefix(*line, "0::")) {
+			self = g_build_filename(CGROUP_MOUNT, *line + strlen("0::"), NULL);
+		}
+	}
+
+	g_strfreev(lines);
+	g_free(contents);
+
+	return self;
+}
+
+/* Where the groups go, the first time through we move into our leaf
+   and turn the controllers on */
+static const gchar *
+cgroup_base_get (GError ** error)
+{
+	const gchar * base;
+
+	G_LOCK(cgroup_base);
+
+	if (cgroup_base == NULL) {
+		gchar * self = cgroup_self();
+
+		if (self == NULL) {
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT, "Not in a cgroup v2 hierarchy");
+		} else {
+			gchar * leaf = g_build_filename(self, CGROUP_LEAF, NULL);
+			gchar * pid = g_strdup_printf("%d", (gint)getpid());
+
+			if (g_mkdir(leaf, 0755) != 0 && errno != EEXIST) {
+				gint errsv = errno;
+				g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv), "Unable to create cgroup '%s': %s", leaf, g_strerror(errsv));
+			} else if (cgroup_write(leaf, "cgroup.procs", pid, error)) {
+				cgroup_enable_controllers(self);
+				cgroup_base = self;
+				self = NULL;
+			}
+
+			g_free(pid);
+			g_free(leaf);
+			g_free(self);
+		}
+	}
+
+	base = cgroup_base;
+
+	G_UNLOCK(cgroup_base);
+
+	return base;
+}
+
+/* Makes a group called @name under @parent, or under our own group
+   without one.  Groups without a parent get the controllers turned
+   on for their children.  One that is already there belongs to
+   someone else, sharing it would mix up the limits and usage, so that
+   is an error. */
+DbusTestCgroup *
+_dbus_test_cgroup_new (DbusTestCgroup * parent, const gchar * name, GError ** error)
+{
+	g_return_val_if_fail(name != NULL, NULL);
+
+	const gchar * base = parent != NULL ? parent->path : cgroup_base_get(error);
+	if (base == NULL) {
+		return NULL;
+	}
+
+	/* A slash would be a path, a dot at the start would look like
+	   one of the files in the group */
+	gchar * dirname = g_strdup(name);
+	g_strdelimit(dirname, "/", '_');
+	if (dirname[0] == '.') {
+		dirname[0] = '_';
+	}
+
+	gchar * path = g_build_filename(base, dirname, NULL);
+	g_free(dirname);
+
+	if (g_mkdir(path, 0755) != 0) {
+		gint errsv = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv), "Unable to create cgroup '%s': %s", path, g_strerror(errsv));
+		g_free(path);
+		return NULL;
+	}
+
+	gchar * procs = g_build_filename(path, "cgroup.procs", NULL);
+	gint procs_fd = open(procs, O_WRONLY | O_CLOEXEC);
+	gint errsv = errno;
+	g_free(procs);
+
+	if (procs_fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv), "Unable to open cgroup '%s': %s", path, g_strerror(errsv));
+		g_rmdir(path);
+		g_free(path);
+		return NULL;
+	}
+
+	if (parent == NULL) {
+		cgroup_enable_controllers(path);
+	}
+
+	DbusTestCgroup * cgroup = g_new0(DbusTestCgroup, 1);
+	cgroup->path = path;
+	cgroup->procs_fd = procs_fd;
+
+	/* The ones under it go with it */
+	cgroup->guarded = parent == NULL;
+	if (cgroup->guarded) {
+		_dbus_test_guard_add_cgroup(path);
+	}
+
+	return cgroup;
+}
+
+/* Kills everything left in the group and removes it */
+void
+_dbus_test_cgroup_free (DbusTestCgroup * cgroup)
+{
+	g_return_if_fail(cgroup != NULL);
+
+	_dbus_test_cgroup_kill(cgroup);
+	close(cgroup->procs_fd);
+
+	/* It can't go until the kernel is done with what was in it */
+	gint64 end = g_get_monotonic_time() + CGROUP_REMOVE_TIMEOUT;
+	while (g_rmdir(cgroup->path) != 0 && errno == EBUSY && g_get_monotonic_time() < end) {
+		g_usleep(1000);
+	}
+
+	if (cgroup->guarded) {
+		_dbus_test_guard_remove_cgroup(cgroup->path);
+	}
+
+	g_free(cgroup->path);
+	g_free(cgroup);
+
+	return;
+}
+
+/* Sets one of the interface files, like memory.max */
+gboolean
+_dbus_test_cgroup_set (DbusTestCgroup * cgroup, const gchar * file, const gchar * value, GError ** error)
+{
+	g_return_val_if_fail(cgroup != NULL, FALSE);
+
+	return cgroup_write(cgroup->path, file, value, error);
+}
+
+/* Everything in the group and under it, whatever process group or
+   session it went off into */
+void
+_dbus_test_cgroup_kill (DbusTestCgroup * cgroup)
+{
+	g_return_if_fail(cgroup != NULL);
+
+	if (cgroup_write(cgroup->path, "cgroup.kill", "1", NULL)) {
+		return;
+	}
+
+	/* Before cgroup.kill, go around a few times for anything that
+	   was forking while we were at it */
+	gint round;
+	for (round = 0; round < 10; round++) {
+		gchar * procs = cgroup_read(cgroup->path, "cgroup.procs");
+		gboolean found = FALSE;
+
+		if (procs != NULL) {
+			gchar ** pids = g_strsplit(procs, "\n", -1);
+			gchar ** pid;
+
+			for (pid = pids; *pid != NULL; pid++) {
+				if (**pid != '\0') {
+					kill((GPid)g_ascii_strtoll(*pid, NULL, 10), SIGKILL);
+					found = TRUE;
+				}
+			}
+
+			g_strfreev(pids);
+			g_free(procs);
+		}
+
+		if (!found) {
+			break;
+		}
+	}
+
+	return;
+}
+
+/* For children to write their PID to before they exec */
+gint
+_dbus_test_cgroup_get_procs_fd (DbusTestCgroup * cgroup)
+{
+	g_return_val_if_fail(cgroup != NULL, -1);
+
+	return cgroup->procs_fd;
+}
+
+/* The value after @key in a "key value" file like cpu.stat */
+static gint64
+cgroup_stat_value (gchar ** lines, const gchar * key)
+{
+	gchar ** line;
+	gsize len = strlen(key);
+
+	for (line = lines; *line != NULL; line++) {
+		if (strncmp(*line, key, len) == 0 && (*line)[len] == ' ') {
+			return g_ascii_strtoll(*line + len + 1, NULL, 10);
+		}
+	}
+
+	return -1;
+}
+
+void
+_dbus_test_cgroup_get_usage (DbusTestCgroup * cgroup, DbusTestCgroupUsage * usage)
+{
+	g_return_if_fail(cgroup != NULL);
+	g_return_if_fail(usage != NULL);
+
+	usage->cpu_time = -1;
+	usage->user_time = -1;
+	usage->system_time = -1;
+	usage->memory_peak = -1;
+	usage->io_read = -1;
+	usage->io_written = -1;
+
+	gchar * contents = cgroup_read(cgroup->path, "cpu.stat");
+	if (contents != NULL) {
+		gchar ** lines = g_strsplit(contents, "\n", -1);
+
+		usage->cpu_time = cgroup_stat_value(lines, "usage_usec");
+		usage->user_time = cgroup_stat_value(lines, "user_usec");
+		usage->system_time = cgroup_stat_value(lines, "system_usec");
+
+		g_strfreev(lines);
+		g_free(contents);
+	}
+
+	contents = cgroup_read(cgroup->path, "memory.peak");
+	if (contents != NULL) {
+		usage->memory_peak = g_ascii_strtoll(contents, NULL, 10);
+		g_free(contents);
+	}
+
+	/* A line for each device, "8:0 rbytes=1 wbytes=2 ..." */
+	contents = cgroup_read(cgroup->path, "io.stat");
+	if (contents != NULL) {
+		gchar ** fields = g_strsplit_set(contents, " \n", -1);
+		gchar ** field;
+
+		usage->io_read = 0;
+		usage->io_written = 0;
+
+		for (field = fields; *field != NULL; field++) {
+			if (g_str_has_prefix(*field, "rbytes=")) {
+				usage->io_read += g_ascii_strtoll(*field + strlen("rbytes="), NULL, 10);
+			} else if (g_str_has_prefix(*field, "wbytes=")) {
+				usage->io_written += g_ascii_strtoll(*field + strlen("wbytes="), NULL, 10);
+			}
+		}
+
+		g_strfreev(fields);
+		g_free(contents);
+	}
+
+	return;
+}
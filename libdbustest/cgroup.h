@@ -0,0 +1,62 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_CGROUP_H__
+#define __DBUS_TEST_CGROUP_H__
+
+#include <glib.h>
+#include "dbus-test.h"
+
+G_BEGIN_DECLS
+
+/* Cgroup v2 groups for a service and its tasks.  The runner needs to
+   be in a cgroup delegated to it, like a scope from systemd-run with
+   Delegate=yes.  The first group made moves us into a leaf of our own
+   so the controllers can be turned on for the rest, then each service
+   gets a group and each of its tasks one under that.  Children join
+   their task's group before they exec, so everything they start is
+   counted and killed with them.  This is internal to the library. */
+typedef struct _DbusTestCgroup DbusTestCgroup;
+
+G_GNUC_INTERNAL
+DbusTestCgroup * _dbus_test_cgroup_new          (DbusTestCgroup *        parent,
+                                                 const gchar *           name,
+                                                 GError **               error);
+G_GNUC_INTERNAL
+void             _dbus_test_cgroup_free         (DbusTestCgroup *        cgroup);
+G_GNUC_INTERNAL
+gboolean         _dbus_test_cgroup_set          (DbusTestCgroup *        cgroup,
+                                                 const gchar *           file,
+                                                 const gchar *           value,
+                                                 GError **               error);
+G_GNUC_INTERNAL
+void             _dbus_test_cgroup_kill         (DbusTestCgroup *        cgroup);
+G_GNUC_INTERNAL
+gint             _dbus_test_cgroup_get_procs_fd (DbusTestCgroup *        cgroup);
+G_GNUC_INTERNAL
+void             _dbus_test_cgroup_get_usage    (DbusTestCgroup *        cgroup,
+                                                 DbusTestCgroupUsage *   usage);
+
+/* The task's end of it */
+G_GNUC_INTERNAL
+void             _dbus_test_task_set_cgroup     (DbusTestTask *          task,
+                                                 DbusTestCgroup *        cgroup);
+G_GNUC_INTERNAL
+DbusTestCgroup * _dbus_test_task_get_cgroup     (DbusTestTask *          task);
+
+G_END_DECLS
+
+#endif
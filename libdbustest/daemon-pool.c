@@ -0,0 +1,451 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+#include "glib-compat.h"
+
+#include "dbus-test.h"
+#include "daemon.h"
+
+struct _DbusTestDaemonPoolPrivate {
+	gchar * daemon;
+	gchar * conffile;
+	gboolean keep_env;
+	guint size;
+
+	/* Protects everything below, services in other threads
+	   take daemons out of the pool */
+	GMutex lock;
+	GCond handed_over;
+	GMainContext * context;
+
+	/* Daemons that have given us their address */
+	GQueue idle;
+	/* Daemons that are still starting up */
+	GQueue starting;
+
+	GSource * refill_source;
+	gboolean broken;
+};
+
+typedef struct {
+	GMainContext * context;
+	DbusTestDaemonFunc address_func;
+	DbusTestDaemonFunc exit_func;
+	gpointer user_data;
+
+	DbusTestDaemon * daemon;
+	gboolean done;
+} handover_t;
+
+/* How long to wait for whoever owns the pool's context to hand over
+   a daemon before starting one ourselves */
+#define POOL_HANDOVER_TIMEOUT  G_TIME_SPAN_SECOND
+
+#define DBUS_TEST_DAEMON_POOL_GET_PRIVATE(o) \
+(G_TYPE_INSTANCE_GET_PRIVATE ((o), DBUS_TEST_TYPE_DAEMON_POOL, DbusTestDaemonPoolPrivate))
+
+static void dbus_test_daemon_pool_class_init (DbusTestDaemonPoolClass *klass);
+static void dbus_test_daemon_pool_init       (DbusTestDaemonPool *self);
+static void dbus_test_daemon_pool_dispose    (GObject *object);
+static void dbus_test_daemon_pool_finalize   (GObject *object);
+static void pool_fill                        (DbusTestDaemonPool * pool);
+static void pool_queue_refill                (DbusTestDaemonPool * pool);
+
+G_DEFINE_TYPE (DbusTestDaemonPool, dbus_test_daemon_pool, G_TYPE_OBJECT);
+
+static void
+dbus_test_daemon_pool_class_init (DbusTestDaemonPoolClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (DbusTestDaemonPoolPrivate));
+
+	object_class->dispose = dbus_test_daemon_pool_dispose;
+	object_class->finalize = dbus_test_daemon_pool_finalize;
+
+	return;
+}
+
+static void
+dbus_test_daemon_pool_init (DbusTestDaemonPool *self)
+{
+	self->priv = DBUS_TEST_DAEMON_POOL_GET_PRIVATE(self);
+
+	self->priv->daemon = NULL;
+	self->priv->conffile = NULL;
+	self->priv->keep_env = FALSE;
+	self->priv->size = 0;
+
+	g_mutex_init(&self->priv->lock);
+	g_cond_init(&self->priv->handed_over);
+	self->priv->context = g_main_context_ref_thread_default();
+
+	g_queue_init(&self->priv->idle);
+	g_queue_init(&self->priv->starting);
+
+	self->priv->refill_source = NULL;
+	self->priv->broken = FALSE;
+
+	return;
+}
+
+static void
+daemon_free (gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+	_dbus_test_daemon_free((DbusTestDaemon *)data);
+	return;
+}
+
+static void
+dbus_test_daemon_pool_dispose (GObject *object)
+{
+	g_return_if_fail(DBUS_TEST_IS_DAEMON_POOL(object));
+	DbusTestDaemonPool * self = DBUS_TEST_DAEMON_POOL(object);
+
+	g_mutex_lock(&self->priv->lock);
+
+	if (self->priv->refill_source != NULL) {
+		g_source_destroy(self->priv->refill_source);
+		g_clear_pointer(&self->priv->refill_source, g_source_unref);
+	}
+
+	g_queue_foreach(&self->priv->idle, daemon_free, NULL);
+	g_queue_clear(&self->priv->idle);
+
+	g_queue_foreach(&self->priv->starting, daemon_free, NULL);
+	g_queue_clear(&self->priv->starting);
+
+	g_mutex_unlock(&self->priv->lock);
+
+	G_OBJECT_CLASS (dbus_test_daemon_pool_parent_class)->dispose (object);
+	return;
+}
+
+static void
+dbus_test_daemon_pool_finalize (GObject *object)
+{
+	g_return_if_fail(DBUS_TEST_IS_DAEMON_POOL(object));
+	DbusTestDaemonPool * self = DBUS_TEST_DAEMON_POOL(object);
+
+	g_free(self->priv->daemon);
+	self->priv->daemon = NULL;
+	g_free(self->priv->conffile);
+	self->priv->conffile = NULL;
+
+	g_clear_pointer(&self->priv->context, g_main_context_unref);
+	g_cond_clear(&self->priv->handed_over);
+	g_mutex_clear(&self->priv->lock);
+
+	G_OBJECT_CLASS (dbus_test_daemon_pool_parent_class)->finalize (object);
+	return;
+}
+
+/**
+ * dbus_test_daemon_pool_new:
+ * @daemon: (allow-none): dbus-daemon executable, NULL for the default
+ * @conffile: (allow-none): Config file for the daemons, NULL for the
+ *   default session config
+ * @keep_env: Whether the daemons should get our environment
+ * @size: Number of idle daemons to keep around
+ *
+ * Starts @size bus daemons right away so that a #DbusTestService
+ * using the pool doesn't have to wait for one to start.  Daemons
+ * handed out are replaced in the background.
+ *
+ * The daemons are watched from the thread-default main context of
+ * the caller, which needs to keep running for the pool to refill.
+ * Services running in other threads can take daemons from the pool.
+ *
+ * Return value: (transfer full): A new #DbusTestDaemonPool
+ */
+DbusTestDaemonPool *
+dbus_test_daemon_pool_new (const gchar * daemon, const gchar * conffile, gboolean keep_env, guint size)
+{
+	DbusTestDaemonPool * pool = g_object_new(DBUS_TEST_TYPE_DAEMON_POOL,
+	                                         NULL);
+
+	pool->priv->daemon = g_strdup(daemon != NULL ? daemon : "dbus-daemon");
+	pool->priv->conffile = g_strdup(conffile != NULL ? conffile : DEFAULT_SESSION_CONF);
+	pool->priv->keep_env = keep_env;
+	pool->priv->size = size;
+
+	g_mutex_lock(&pool->priv->lock);
+	pool_fill(pool);
+	g_mutex_unlock(&pool->priv->lock);
+
+	return pool;
+}
+
+/**
+ * dbus_test_daemon_pool_set_size:
+ * @pool: A #DbusTestDaemonPool
+ * @size: Number of idle daemons to keep around
+ *
+ * Changes how many daemons the pool keeps ready.  Daemons that are
+ * already started stay and are still handed out, lowering it only
+ * means fewer get started to replace them.  Set it to zero once no
+ * more services are going to take daemons, so that those handed back
+ * aren't replaced by daemons that are never used.
+ */
+void
+dbus_test_daemon_pool_set_size (DbusTestDaemonPool * pool, guint size)
+{
+	g_return_if_fail(DBUS_TEST_IS_DAEMON_POOL(pool));
+
+	g_mutex_lock(&pool->priv->lock);
+	pool->priv->size = size;
+	pool_queue_refill(pool);
+	g_mutex_unlock(&pool->priv->lock);
+
+	return;
+}
+
+/**
+ * dbus_test_daemon_pool_get_idle:
+ * @pool: A #DbusTestDaemonPool
+ *
+ * Return value: Number of daemons that are started and have
+ *   an address, ready to be handed out.
+ */
+guint
+dbus_test_daemon_pool_get_idle (DbusTestDaemonPool * pool)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_DAEMON_POOL(pool), 0);
+
+	g_mutex_lock(&pool->priv->lock);
+	guint idle = g_queue_get_length(&pool->priv->idle);
+	g_mutex_unlock(&pool->priv->lock);
+
+	return idle;
+}
+
+static void
+pool_daemon_address (DbusTestDaemon * daemon, gpointer user_data)
+{
+	DbusTestDaemonPool * pool = DBUS_TEST_DAEMON_POOL(user_data);
+
+	g_mutex_lock(&pool->priv->lock);
+	g_queue_remove(&pool->priv->starting, daemon);
+	g_queue_push_tail(&pool->priv->idle, daemon);
+	g_mutex_unlock(&pool->priv->lock);
+
+	return;
+}
+
+static gboolean
+pool_refill (gpointer user_data)
+{
+	DbusTestDaemonPool * pool = DBUS_TEST_DAEMON_POOL(user_data);
+
+	g_mutex_lock(&pool->priv->lock);
+	g_clear_pointer(&pool->priv->refill_source, g_source_unref);
+	pool_fill(pool);
+	g_mutex_unlock(&pool->priv->lock);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Called with the lock held, from any thread */
+static void
+pool_queue_refill (DbusTestDaemonPool * pool)
+{
+	if (pool->priv->broken || pool->priv->refill_source != NULL) {
+		return;
+	}
+
+	pool->priv->refill_source = g_idle_source_new();
+	g_source_set_callback(pool->priv->refill_source, pool_refill, pool, NULL);
+	g_source_attach(pool->priv->refill_source, pool->priv->context);
+
+	return;
+}
+
+static void
+pool_daemon_exited (DbusTestDaemon * daemon, gpointer user_data)
+{
+	DbusTestDaemonPool * pool = DBUS_TEST_DAEMON_POOL(user_data);
+
+	g_mutex_lock(&pool->priv->lock);
+
+	if (g_queue_remove(&pool->priv->starting, daemon)) {
+		/* Died before telling us where it is, starting more
+		   of them isn't going to help */
+		g_warning("Pooled DBus daemon exited while starting, not starting more");
+		pool->priv->broken = TRUE;
+	} else {
+		g_queue_remove(&pool->priv->idle, daemon);
+		pool_queue_refill(pool);
+	}
+
+	g_mutex_unlock(&pool->priv->lock);
+
+	_dbus_test_daemon_free(daemon);
+	return;
+}
+
+/* Start daemons until we've got enough of them on the way, called
+   with the lock held from the pool's context */
+static void
+pool_fill (DbusTestDaemonPool * pool)
+{
+	while (!pool->priv->broken &&
+			g_queue_get_length(&pool->priv->idle) + g_queue_get_length(&pool->priv->starting) < pool->priv->size) {
+		GError * error = NULL;
+		DbusTestDaemon * daemon = _dbus_test_daemon_new(pool->priv->daemon, pool->priv->conffile, pool->priv->keep_env, &error);
+
+		if (daemon == NULL) {
+			g_warning("Unable to start pooled dbus daemon: %s", error != NULL ? error->message : "unknown error");
+			g_clear_error(&error);
+			pool->priv->broken = TRUE;
+			break;
+		}
+
+		_dbus_test_daemon_set_callbacks(daemon, pool_daemon_address, pool_daemon_exited, pool);
+		g_queue_push_tail(&pool->priv->starting, daemon);
+	}
+
+	return;
+}
+
+/* Runs where the pool's daemons are watched so that nothing is
+   dispatching on the daemon while it moves to the new context.  Called
+   with the lock held. */
+static void
+pool_handover (DbusTestDaemonPool * pool, handover_t * handover)
+{
+	handover->daemon = g_queue_pop_head(&pool->priv->idle);
+	if (handover->daemon == NULL) {
+		handover->daemon = g_queue_pop_head(&pool->priv->starting);
+	}
+
+	if (handover->daemon != NULL) {
+		_dbus_test_daemon_set_callbacks(handover->daemon, handover->address_func, handover->exit_func, handover->user_data);
+		_dbus_test_daemon_attach(handover->daemon, handover->context);
+		pool_queue_refill(pool);
+	}
+
+	handover->done = TRUE;
+	g_cond_broadcast(&pool->priv->handed_over);
+
+	return;
+}
+
+/* Belongs to the idle source, @handover is cleared under the lock by
+   a taker that has given up waiting */
+typedef struct {
+	DbusTestDaemonPool * pool;
+	handover_t * handover;
+} handover_idle_t;
+
+static gboolean
+pool_handover_idle (gpointer user_data)
+{
+	handover_idle_t * data = (handover_idle_t *)user_data;
+
+	g_mutex_lock(&data->pool->priv->lock);
+	if (data->handover != NULL) {
+		pool_handover(data->pool, data->handover);
+	}
+	g_mutex_unlock(&data->pool->priv->lock);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Hands out a daemon matching the request, preferring one that already
+   has its address.  The daemon gets the callbacks and is watched from
+   the thread-default context of the caller, which owns it afterwards.
+   Returns NULL if the pool can't help, including when its context is
+   owned by someone that isn't running it. */
+DbusTestDaemon *
+_dbus_test_daemon_pool_take (DbusTestDaemonPool * pool, const gchar * executable, const gchar * conffile, gboolean keep_env, DbusTestDaemonFunc address_func, DbusTestDaemonFunc exit_func, gpointer user_data)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_DAEMON_POOL(pool), NULL);
+
+	if (g_strcmp0(pool->priv->daemon, executable) != 0 ||
+			g_strcmp0(pool->priv->conffile, conffile) != 0 ||
+			!pool->priv->keep_env != !keep_env) {
+		return NULL;
+	}
+
+	handover_t handover = {
+		.context = g_main_context_get_thread_default(),
+		.address_func = address_func,
+		.exit_func = exit_func,
+		.user_data = user_data,
+		.daemon = NULL,
+		.done = FALSE
+	};
+
+	if (g_main_context_acquire(pool->priv->context)) {
+		g_mutex_lock(&pool->priv->lock);
+		pool_handover(pool, &handover);
+		g_mutex_unlock(&pool->priv->lock);
+		g_main_context_release(pool->priv->context);
+	} else {
+		/* Someone owns the pool's context, get them to do it */
+		handover_idle_t * data = g_new0(handover_idle_t, 1);
+		data->pool = pool;
+		data->handover = &handover;
+
+		GSource * source = g_idle_source_new();
+		g_source_set_priority(source, G_PRIORITY_HIGH);
+		g_source_set_callback(source, pool_handover_idle, data, g_free);
+		g_source_attach(source, pool->priv->context);
+
+		gint64 end = g_get_monotonic_time() + POOL_HANDOVER_TIMEOUT;
+
+		g_mutex_lock(&pool->priv->lock);
+		while (!handover.done) {
+			if (!g_cond_wait_until(&pool->priv->handed_over, &pool->priv->lock, end)) {
+				break;
+			}
+		}
+		if (!handover.done) {
+			/* Not being run, the caller starts a daemon of its own */
+			data->handover = NULL;
+		}
+		g_mutex_unlock(&pool->priv->lock);
+
+		g_source_destroy(source);
+		g_source_unref(source);
+	}
+
+	return handover.daemon;
+}
+
+/* Takes back a daemon that a service is done with.  A bus that has
+   been used has names, match rules and activated services left over,
+   so it isn't handed out again; it gets killed and a fresh one is
+   started in the background to take its place. */
+void
+_dbus_test_daemon_pool_recycle (DbusTestDaemonPool * pool, DbusTestDaemon * daemon)
+{
+	g_return_if_fail(DBUS_TEST_IS_DAEMON_POOL(pool));
+	g_return_if_fail(daemon != NULL);
+
+	_dbus_test_daemon_free(daemon);
+
+	g_mutex_lock(&pool->priv->lock);
+	pool_queue_refill(pool);
+	g_mutex_unlock(&pool->priv->lock);
+
+	return;
+}
@@ -0,0 +1,55 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_DAEMON_POOL_H__
+#define __DBUS_TEST_DAEMON_POOL_H__
+
+#ifndef __DBUS_TEST_TOP_LEVEL__
+#error "Please include #include <libdbustest/dbus-test.h> only"
+#endif
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define DBUS_TEST_TYPE_DAEMON_POOL            (dbus_test_daemon_pool_get_type ())
+#define DBUS_TEST_DAEMON_POOL(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), DBUS_TEST_TYPE_DAEMON_POOL, DbusTestDaemonPool))
+#define DBUS_TEST_DAEMON_POOL_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), DBUS_TEST_TYPE_DAEMON_POOL, DbusTestDaemonPoolClass))
+#define DBUS_TEST_IS_DAEMON_POOL(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), DBUS_TEST_TYPE_DAEMON_POOL))
+#define DBUS_TEST_IS_DAEMON_POOL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), DBUS_TEST_TYPE_DAEMON_POOL))
+#define DBUS_TEST_DAEMON_POOL_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), DBUS_TEST_TYPE_DAEMON_POOL, DbusTestDaemonPoolClass))
+
+typedef struct _DbusTestDaemonPool         DbusTestDaemonPool;
+typedef struct _DbusTestDaemonPoolClass    DbusTestDaemonPoolClass;
+typedef struct _DbusTestDaemonPoolPrivate  DbusTestDaemonPoolPrivate;
+
+struct _DbusTestDaemonPoolClass {
+	GObjectClass parent_class;
+};
+
+struct _DbusTestDaemonPool {
+	GObject parent;
+	DbusTestDaemonPoolPrivate * priv;
+};
+
+GType dbus_test_daemon_pool_get_type (void);
+DbusTestDaemonPool * dbus_test_daemon_pool_new (const gchar * daemon, const gchar * conffile, gboolean keep_env, guint size);
+void dbus_test_daemon_pool_set_size (DbusTestDaemonPool * pool, guint size);
+guint dbus_test_daemon_pool_get_idle (DbusTestDaemonPool * pool);
+
+G_END_DECLS
+
+#endif
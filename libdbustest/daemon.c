@@ -0,0 +1,348 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include "glib-compat.h"
+
+#include "daemon.h"
+#include "guard.h"
+#include "kill.h"
+
+struct _DbusTestDaemon {
+	GPid pid;
+	GSource * watch;
+	GIOChannel * io;
+	GSource * io_watch;
+	GIOChannel * address_io;
+	GSource * address_watch;
+	GString * address_buffer;
+	gchar * address;
+
+	gchar * executable;
+	gchar * conffile;
+
+	DbusTestDaemonFunc address_func;
+	DbusTestDaemonFunc exit_func;
+	gpointer user_data;
+};
+
+/* The daemon writes its address to a pipe of its own and closes it,
+   so we know it's listening as soon as that arrives.  We read whatever
+   is there without waiting on lines. */
+static gboolean
+daemon_address_writes (GIOChannel * channel, G_GNUC_UNUSED GIOCondition condition, gpointer data)
+{
+	DbusTestDaemon * daemon = (DbusTestDaemon *)data;
+	GIOStatus status;
+	gchar buffer[256];
+	gsize got;
+
+	do {
+		got = 0;
+		status = g_io_channel_read_chars(channel, buffer, sizeof(buffer), &got, NULL);
+		g_string_append_len(daemon->address_buffer, buffer, got);
+	} while (status == G_IO_STATUS_NORMAL && got > 0);
+
+	gchar * newline = strchr(daemon->address_buffer->str, '\n');
+	if (newline == NULL && status == G_IO_STATUS_AGAIN) {
+		return TRUE;
+	}
+
+	if (newline != NULL) {
+		g_string_truncate(daemon->address_buffer, newline - daemon->address_buffer->str);
+	}
+
+	g_clear_pointer(&daemon->address_watch, g_source_unref);
+	g_io_channel_shutdown(daemon->address_io, FALSE, NULL);
+	g_clear_pointer(&daemon->address_io, g_io_channel_unref);
+
+	if (daemon->address_buffer->len == 0) {
+		/* Closed without an address, the child watch will tell
+		   everyone when it goes */
+		g_string_free(daemon->address_buffer, TRUE);
+		daemon->address_buffer = NULL;
+		return FALSE;
+	}
+
+	daemon->address = g_string_free(daemon->address_buffer, FALSE);
+	daemon->address_buffer = NULL;
+
+	if (daemon->address_func != NULL) {
+		daemon->address_func(daemon, daemon->user_data);
+	}
+
+	return FALSE;
+}
+
+/* Anything the daemon prints we pass along */
+static gboolean
+daemon_writes (GIOChannel * channel, GIOCondition condition, gpointer data)
+{
+	DbusTestDaemon * daemon = (DbusTestDaemon *)data;
+
+	if (condition & G_IO_ERR) {
+		g_critical("DBus writing failure!");
+		g_clear_pointer(&daemon->io_watch, g_source_unref);
+		return FALSE;
+	}
+
+	gchar * line;
+	gsize termloc;
+	GIOStatus status = g_io_channel_read_line (channel, &line, NULL, &termloc, NULL);
+	if (status != G_IO_STATUS_NORMAL) {
+		/* Closed on us, the child watch will tell everyone */
+		g_clear_pointer(&daemon->io_watch, g_source_unref);
+		return FALSE;
+	}
+	line[termloc] = '\0';
+
+	g_print("DBus daemon: %s\n", line);
+	g_free(line);
+
+	return TRUE;
+}
+
+static void
+daemon_exited (GPid pid, G_GNUC_UNUSED gint status, gpointer data)
+{
+	DbusTestDaemon * daemon = (DbusTestDaemon *)data;
+
+	g_clear_pointer(&daemon->watch, g_source_unref);
+
+	if (daemon->pid != 0) {
+		_dbus_test_guard_remove(-daemon->pid);
+	}
+	if (pid != 0) {
+		g_spawn_close_pid(pid);
+	}
+	daemon->pid = 0;
+
+	if (daemon->exit_func != NULL) {
+		daemon->exit_func(daemon, daemon->user_data);
+	}
+
+	return;
+}
+
+/* The spawn marks everything but stdio close-on-exec before calling
+   us, the address pipe has to make it through */
+static void
+daemon_child_setup (gpointer user_data)
+{
+	gint fd = GPOINTER_TO_INT(user_data);
+
+	_dbus_test_kill_child_init();
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) & ~FD_CLOEXEC);
+}
+
+/* Starts a daemon, the address comes in later through the address
+   callback. */
+DbusTestDaemon *
+_dbus_test_daemon_new (const gchar * executable, const gchar * conffile, gboolean keep_env, GError ** error)
+{
+	g_return_val_if_fail(executable != NULL, NULL);
+	g_return_val_if_fail(conffile != NULL, NULL);
+
+	DbusTestDaemon * daemon = g_new0(DbusTestDaemon, 1);
+
+	daemon->executable = g_strdup(executable);
+	daemon->conffile = g_strdup(conffile);
+
+	gint address_pipe[2];
+	if (!g_unix_open_pipe(address_pipe, FD_CLOEXEC, error)) {
+		_dbus_test_daemon_free(daemon);
+		return NULL;
+	}
+
+	gint dbus_stdout = 0;
+	gchar * blank[1] = {NULL};
+	gchar * current_dir = g_get_current_dir();
+	gchar * print_address = g_strdup_printf("--print-address=%d", address_pipe[1]);
+	gchar * dbus_startup[] = {daemon->executable, "--config-file", daemon->conffile, print_address, NULL};
+	g_spawn_async_with_pipes(current_dir,
+	                         dbus_startup, /* argv */
+	                         keep_env ? NULL : blank, /* envp */
+	                         G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, /* flags */
+	                         daemon_child_setup, /* child setup func */
+	                         GINT_TO_POINTER(address_pipe[1]), /* child setup data */
+	                         &daemon->pid, /* PID */
+	                         NULL, /* stdin */
+	                         &dbus_stdout, /* stdout */
+	                         NULL, /* stderr */
+	                         error); /* error */
+
+	g_free(print_address);
+	g_free (current_dir);
+
+	/* Only the daemon writes to it, so we see the end when it's done */
+	close(address_pipe[1]);
+
+	if (daemon->pid == 0) {
+		close(address_pipe[0]);
+		_dbus_test_daemon_free(daemon);
+		return NULL;
+	}
+
+	_dbus_test_guard_add(-daemon->pid);
+
+	daemon->io = g_io_channel_unix_new(dbus_stdout);
+	g_io_channel_set_close_on_unref(daemon->io, TRUE);
+
+	daemon->address_io = g_io_channel_unix_new(address_pipe[0]);
+	g_io_channel_set_close_on_unref(daemon->address_io, TRUE);
+	g_io_channel_set_encoding(daemon->address_io, NULL, NULL);
+	g_io_channel_set_buffered(daemon->address_io, FALSE);
+	g_io_channel_set_flags(daemon->address_io, G_IO_FLAG_NONBLOCK, NULL);
+	daemon->address_buffer = g_string_new(NULL);
+
+	_dbus_test_daemon_attach(daemon, g_main_context_get_thread_default());
+
+	return daemon;
+}
+
+static void
+daemon_detach (DbusTestDaemon * daemon)
+{
+	if (daemon->watch != NULL) {
+		g_source_destroy(daemon->watch);
+		g_clear_pointer(&daemon->watch, g_source_unref);
+	}
+
+	if (daemon->io_watch != NULL) {
+		g_source_destroy(daemon->io_watch);
+		g_clear_pointer(&daemon->io_watch, g_source_unref);
+	}
+
+	if (daemon->address_watch != NULL) {
+		g_source_destroy(daemon->address_watch);
+		g_clear_pointer(&daemon->address_watch, g_source_unref);
+	}
+
+	return;
+}
+
+/* Moves the watches on the daemon over to @context, NULL being the
+   global default one.  Must be called from the thread that is running
+   the context they're on now, or when nothing is running it. */
+void
+_dbus_test_daemon_attach (DbusTestDaemon * daemon, GMainContext * context)
+{
+	g_return_if_fail(daemon != NULL);
+
+	gboolean watch_io = daemon->io_watch != NULL || daemon->watch == NULL;
+
+	daemon_detach(daemon);
+
+	if (daemon->pid == 0) {
+		return;
+	}
+
+	daemon->watch = g_child_watch_source_new(daemon->pid);
+	g_source_set_callback(daemon->watch, G_SOURCE_FUNC(daemon_exited), daemon, NULL);
+	g_source_attach(daemon->watch, context);
+
+	if (watch_io) {
+		daemon->io_watch = g_io_create_watch(daemon->io, G_IO_IN | G_IO_HUP | G_IO_ERR);
+		g_source_set_callback(daemon->io_watch, G_SOURCE_FUNC(daemon_writes), daemon, NULL);
+		g_source_attach(daemon->io_watch, context);
+	}
+
+	if (daemon->address_io != NULL) {
+		daemon->address_watch = g_io_create_watch(daemon->address_io, G_IO_IN | G_IO_HUP | G_IO_ERR);
+		g_source_set_callback(daemon->address_watch, G_SOURCE_FUNC(daemon_address_writes), daemon, NULL);
+		g_source_attach(daemon->address_watch, context);
+	}
+
+	return;
+}
+
+/* Kill the daemon and free everything.  Callbacks won't be called. */
+void
+_dbus_test_daemon_free (DbusTestDaemon * daemon)
+{
+	g_return_if_fail(daemon != NULL);
+
+	daemon_detach(daemon);
+
+	if (daemon->io != NULL) {
+		g_io_channel_shutdown(daemon->io, TRUE, NULL);
+		g_clear_pointer(&daemon->io, g_io_channel_unref);
+	}
+
+	if (daemon->address_io != NULL) {
+		g_io_channel_shutdown(daemon->address_io, FALSE, NULL);
+		g_clear_pointer(&daemon->address_io, g_io_channel_unref);
+	}
+
+	if (daemon->address_buffer != NULL) {
+		g_string_free(daemon->address_buffer, TRUE);
+	}
+
+	if (daemon->pid != 0) {
+		_dbus_test_kill(daemon->pid, SIGTERM, DBUS_TEST_KILL_DEFAULT_TIMEOUT);
+		_dbus_test_guard_remove(-daemon->pid);
+
+		g_spawn_close_pid(daemon->pid);
+		daemon->pid = 0;
+	}
+
+	g_free(daemon->address);
+	g_free(daemon->executable);
+	g_free(daemon->conffile);
+
+	g_free(daemon);
+	return;
+}
+
+/* Changes who gets told about the daemon, used when a pooled daemon
+   gets handed to a service */
+void
+_dbus_test_daemon_set_callbacks (DbusTestDaemon * daemon, DbusTestDaemonFunc address_func, DbusTestDaemonFunc exit_func, gpointer user_data)
+{
+	g_return_if_fail(daemon != NULL);
+
+	daemon->address_func = address_func;
+	daemon->exit_func = exit_func;
+	daemon->user_data = user_data;
+
+	return;
+}
+
+/* The bus address, NULL until the daemon has sent it */
+const gchar *
+_dbus_test_daemon_get_address (DbusTestDaemon * daemon)
+{
+	g_return_val_if_fail(daemon != NULL, NULL);
+	return daemon->address;
+}
+
+/* PID of the daemon or zero if it has exited */
+GPid
+_dbus_test_daemon_get_pid (DbusTestDaemon * daemon)
+{
+	g_return_val_if_fail(daemon != NULL, 0);
+	return daemon->pid;
+}
@@ -0,0 +1,66 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_DAEMON_H__
+#define __DBUS_TEST_DAEMON_H__
+
+#include <glib.h>
+
+#include "dbus-test.h"
+
+G_BEGIN_DECLS
+
+/* A dbus-daemon process that we've started.  This is internal to the
+   library, it is shared by the service and the daemon pool. */
+typedef struct _DbusTestDaemon DbusTestDaemon;
+
+typedef void (*DbusTestDaemonFunc) (DbusTestDaemon * daemon, gpointer user_data);
+
+G_GNUC_INTERNAL
+DbusTestDaemon * _dbus_test_daemon_new           (const gchar *        executable,
+                                                  const gchar *        conffile,
+                                                  gboolean             keep_env,
+                                                  GError **            error);
+G_GNUC_INTERNAL
+void             _dbus_test_daemon_free          (DbusTestDaemon *     daemon);
+G_GNUC_INTERNAL
+void             _dbus_test_daemon_attach        (DbusTestDaemon *     daemon,
+                                                  GMainContext *       context);
+G_GNUC_INTERNAL
+void             _dbus_test_daemon_set_callbacks (DbusTestDaemon *     daemon,
+                                                  DbusTestDaemonFunc   address_func,
+                                                  DbusTestDaemonFunc   exit_func,
+                                                  gpointer             user_data);
+G_GNUC_INTERNAL
+const gchar *    _dbus_test_daemon_get_address   (DbusTestDaemon *     daemon);
+G_GNUC_INTERNAL
+GPid             _dbus_test_daemon_get_pid       (DbusTestDaemon *     daemon);
+
+G_GNUC_INTERNAL
+DbusTestDaemon * _dbus_test_daemon_pool_take     (DbusTestDaemonPool * pool,
+                                                  const gchar *        executable,
+                                                  const gchar *        conffile,
+                                                  gboolean             keep_env,
+                                                  DbusTestDaemonFunc   address_func,
+                                                  DbusTestDaemonFunc   exit_func,
+                                                  gpointer             user_data);
+G_GNUC_INTERNAL
+void             _dbus_test_daemon_pool_recycle  (DbusTestDaemonPool * pool,
+                                                  DbusTestDaemon *     daemon);
+
+G_END_DECLS
+
+#endif
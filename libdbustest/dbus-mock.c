@@ -23,7 +23,11 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "dbus-test.h"
 #include "dbus-mock-iface.h"
+#include "mock-engine.h"
+#include "trace-internal.h"
+#include "kill.h"
 #include "string.h" /* strlen */
+#include <signal.h>
 
 typedef struct _MockObjectProperty MockObjectProperty;
 typedef struct _MockObjectMethod MockObjectMethod;
@@ -33,9 +37,26 @@ struct _DbusTestDbusMockPrivate {
 	_DbusMockIfaceOrgFreedesktopDBusMock * proxy;
 	/* Entries of DbusTestDbusMockObject */
 	GList * objects;
-	GHashTable * object_proxies;
+	/* Object path to a GList of the DbusTestDbusMockObject on it */
+	GHashTable * object_paths;
+	/* Object paths DBusMock has an object for */
+	GHashTable * installed_paths;
 	GDBusConnection * bus;
 	GCancellable * cancel;
+	/* Entries of call_watch_t */
+	GList * watches;
+	/* The MethodCalled signals from python-dbusmock go on a context
+	   of their own, to be taken into the call logs when they're asked
+	   for */
+	GMainContext * call_context;
+	guint call_subscription;
+
+	DbusTestDbusMockBackend backend;
+	/* The native backend stands in for the process */
+	DbusTestMockEngine * engine;
+	DbusTestTaskState native_state;
+	/* Started, but never got to where it could be used */
+	gboolean failed;
 };
 
 /* Represents every object on the bus that we're mocking */
@@ -44,6 +65,10 @@ struct _DbusTestDbusMockObject {
 	gchar * interface;
 	GArray * properties;
 	GArray * methods;
+	/* Names to the index in the arrays plus one, the names are the
+	   ones in the arrays */
+	GHashTable * property_index;
+	GHashTable * method_index;
 };
 
 /* A property on an object */
@@ -59,6 +84,8 @@ struct _MockObjectMethod {
 	GVariantType * in;
 	GVariantType * out;
 	gchar * code;
+	/* What the native backend replies with, NULL for zeros */
+	GVariant * ret;
 	GArray * calls;
 };
 
@@ -70,6 +97,7 @@ enum {
 
 enum {
 	ERROR_METHOD_NOT_FOUND,
+	ERROR_NOT_SUPPORTED,
 	NUM_ERRORS
 };
 
@@ -84,6 +112,8 @@ static void constructed                    (GObject * object);
 static void dbus_test_dbus_mock_dispose    (GObject *object);
 static void dbus_test_dbus_mock_finalize   (GObject *object);
 static void run                            (DbusTestTask * task);
+static DbusTestTaskState mock_get_state    (DbusTestTask * task);
+static gboolean mock_get_passed            (DbusTestTask * task);
 static void get_property                   (GObject * object,
                                             guint property_id,
                                             GValue * value,
@@ -93,6 +123,15 @@ static void set_property                   (GObject * object,
                                             const GValue * value,
                                             GParamSpec * pspec);
 static void object_free                    (gpointer data);
+static void call_watch_done                (gpointer data,
+                                            gpointer called);
+static void call_log_signal                (GDBusConnection * connection,
+                                            const gchar * sender,
+                                            const gchar * path,
+                                            const gchar * interface,
+                                            const gchar * signal,
+                                            GVariant * params,
+                                            gpointer data);
 static void method_free                    (gpointer data);
 static void property_free                  (gpointer data);
 
@@ -123,6 +162,8 @@ dbus_test_dbus_mock_class_init (DbusTestDbusMockClass *klass)
 	DbusTestTaskClass * tclass = DBUS_TEST_TASK_CLASS(klass);
 
 	tclass->run = run;
+	tclass->get_state = mock_get_state;
+	tclass->get_passed = mock_get_passed;
 
 	return;
 }
@@ -134,10 +175,19 @@ dbus_test_dbus_mock_init (DbusTestDbusMock *self)
 	self->priv = DBUS_TEST_DBUS_MOCK_GET_PRIVATE(self);
 
 	self->priv->objects = NULL;
-	self->priv->object_proxies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+	self->priv->object_paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_list_free);
+	self->priv->installed_paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
 	self->priv->cancel = g_cancellable_new();
 
+	self->priv->call_context = NULL;
+	self->priv->call_subscription = 0;
+
+	self->priv->backend = DBUS_TEST_DBUS_MOCK_BACKEND_PYTHON;
+	self->priv->engine = NULL;
+	self->priv->native_state = DBUS_TEST_TASK_STATE_INIT;
+	self->priv->failed = FALSE;
+
 	return;
 }
 
@@ -167,7 +217,26 @@ dbus_test_dbus_mock_dispose (GObject *object)
 		g_cancellable_cancel(self->priv->cancel);
 	g_clear_object(&self->priv->cancel);
 
-	g_hash_table_remove_all(self->priv->object_proxies);
+	/* Nobody is going to call them now */
+	GList * watches = self->priv->watches;
+	self->priv->watches = NULL;
+	g_list_foreach(watches, call_watch_done, GINT_TO_POINTER(FALSE));
+	g_list_free(watches);
+
+	if (self->priv->call_subscription != 0) {
+		g_dbus_connection_signal_unsubscribe(self->priv->bus, self->priv->call_subscription);
+		self->priv->call_subscription = 0;
+	}
+	g_clear_pointer(&self->priv->call_context, g_main_context_unref);
+
+	g_hash_table_remove_all(self->priv->installed_paths);
+	g_hash_table_remove_all(self->priv->object_paths);
+
+	if (self->priv->engine != NULL) {
+		_dbus_test_mock_engine_free(self->priv->engine);
+		self->priv->engine = NULL;
+		self->priv->native_state = DBUS_TEST_TASK_STATE_FINISHED;
+	}
 
 	g_list_free_full(self->priv->objects, object_free);
 	self->priv->objects = NULL;
@@ -186,7 +255,8 @@ dbus_test_dbus_mock_finalize (GObject *object)
 	DbusTestDbusMock * self = DBUS_TEST_DBUS_MOCK(object);
 
 	g_free(self->priv->name);
-	g_hash_table_destroy(self->priv->object_proxies);
+	g_hash_table_destroy(self->priv->object_paths);
+	g_hash_table_destroy(self->priv->installed_paths);
 
 	G_OBJECT_CLASS (dbus_test_dbus_mock_parent_class)->finalize (object);
 	return;
@@ -234,6 +304,35 @@ is_running (DbusTestDbusMock * mock)
 	return dbus_test_task_get_state(DBUS_TEST_TASK(mock)) == DBUS_TEST_TASK_STATE_RUNNING;
 }
 
+/* Without a process the native backend keeps its own state */
+static DbusTestTaskState
+mock_get_state (DbusTestTask * task)
+{
+	DbusTestDbusMock * self = DBUS_TEST_DBUS_MOCK(task);
+
+	if (self->priv->backend == DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE) {
+		return self->priv->native_state;
+	}
+
+	return DBUS_TEST_TASK_CLASS (dbus_test_dbus_mock_parent_class)->get_state (task);
+}
+
+static gboolean
+mock_get_passed (DbusTestTask * task)
+{
+	DbusTestDbusMock * self = DBUS_TEST_DBUS_MOCK(task);
+
+	if (self->priv->backend == DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE) {
+		return self->priv->engine != NULL;
+	}
+
+	if (self->priv->failed) {
+		return FALSE;
+	}
+
+	return DBUS_TEST_TASK_CLASS (dbus_test_dbus_mock_parent_class)->get_passed (task);
+}
+
 /* Turns a property object into the variant to represent it */
 static GVariant *
 property_to_variant (MockObjectProperty * prop)
@@ -293,111 +392,315 @@ method_to_variant (MockObjectMethod * method)
 	return g_variant_builder_end(&builder);
 }
 
-/* Add an object to the DBus Mock */
+/* Add an object to the native backend, methods and properties
+   and all.  They go over to its thread together, anything that
+   didn't work comes from the end of the batch. */
 static gboolean
-install_object (DbusTestDbusMock * mock, DbusTestDbusMockObject * object, GError ** error)
+install_object_native (DbusTestDbusMock * mock, DbusTestDbusMockObject * object, GError ** error)
 {
-	GVariant * properties = NULL;
-	GVariant * methods = NULL;
+	guint i;
 
-	g_return_val_if_fail(mock->priv->proxy != NULL, FALSE);
+	_dbus_test_mock_engine_batch_begin(mock->priv->engine);
 
-	if (object->properties->len > 0) {
-		GVariantBuilder property_builder;
-		guint i;
+	_dbus_test_mock_engine_add_object(mock->priv->engine, object->object_path, object->interface, NULL);
 
-		g_variant_builder_init(&property_builder, G_VARIANT_TYPE_ARRAY);
+	for (i = 0; i < object->methods->len; i++) {
+		MockObjectMethod * method = &g_array_index(object->methods, MockObjectMethod, i);
+		_dbus_test_mock_engine_add_method(mock->priv->engine, object->object_path, object->interface, method->name, method->in, method->out, method->ret, NULL);
+	}
 
-		for (i = 0; i < object->properties->len; i++) {
-			MockObjectProperty * prop = &g_array_index(object->properties, MockObjectProperty, i);
-			g_variant_builder_add_value(&property_builder, property_to_variant(prop));
-		}
+	for (i = 0; i < object->properties->len; i++) {
+		MockObjectProperty * prop = &g_array_index(object->properties, MockObjectProperty, i);
+		_dbus_test_mock_engine_add_property(mock->priv->engine, object->object_path, object->interface, prop->name, prop->value, NULL);
+	}
 
-		properties = g_variant_builder_end(&property_builder);
-	} else {
-		properties = g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0);
+	return _dbus_test_mock_engine_batch_end(mock->priv->engine, error);
+}
+
+/* The properties of an object as DBusMock takes them */
+static GVariant *
+object_properties (DbusTestDbusMockObject * object)
+{
+	GVariantBuilder property_builder;
+	guint i;
+
+	g_variant_builder_init(&property_builder, G_VARIANT_TYPE("a{sv}"));
+
+	for (i = 0; i < object->properties->len; i++) {
+		MockObjectProperty * prop = &g_array_index(object->properties, MockObjectProperty, i);
+		g_variant_builder_add_value(&property_builder, property_to_variant(prop));
 	}
 
-	if (object->methods->len > 0) {
-		GVariantBuilder method_builder;
-		guint i;
+	return g_variant_builder_end(&property_builder);
+}
 
-		g_variant_builder_init(&method_builder, G_VARIANT_TYPE_ARRAY);
+/* The methods of an object as DBusMock takes them */
+static GVariant *
+object_methods (DbusTestDbusMockObject * object)
+{
+	GVariantBuilder method_builder;
+	guint i;
 
-		for (i = 0; i < object->methods->len; i++) {
-			MockObjectMethod * method = &g_array_index(object->methods, MockObjectMethod, i);
-			g_variant_builder_add_value(&method_builder, method_to_variant(method));
-		}
+	g_variant_builder_init(&method_builder, G_VARIANT_TYPE("a(ssss)"));
 
-		methods = g_variant_builder_end(&method_builder);
-	} else {
-		methods = g_variant_new_array(G_VARIANT_TYPE("(ssss)"), NULL, 0);
+	for (i = 0; i < object->methods->len; i++) {
+		MockObjectMethod * method = &g_array_index(object->methods, MockObjectMethod, i);
+		g_variant_builder_add_value(&method_builder, method_to_variant(method));
 	}
 
+	return g_variant_builder_end(&method_builder);
+}
+
+/* Talks to DBusMock about the object at @path.  Everything goes over
+   the one connection, a proxy for each object costs too much when
+   there are thousands of them. */
+static GVariant *
+mock_call (DbusTestDbusMock * mock, const gchar * path, const gchar * method, GVariant * params, const GVariantType * reply_type, GError ** error)
+{
+	return g_dbus_connection_call_sync(mock->priv->bus,
+		mock->priv->name,
+		path,
+		"org.freedesktop.DBus.Mock",
+		method,
+		params,
+		reply_type,
+		G_DBUS_CALL_FLAGS_NO_AUTO_START,
+		-1, /* timeout */
+		mock->priv->cancel,
+		error);
+}
+
+/* For the calls that don't return anything */
+static gboolean
+mock_call_void (DbusTestDbusMock * mock, const gchar * path, const gchar * method, GVariant * params, GError ** error)
+{
+	GVariant * reply = mock_call(mock, path, method, params, NULL, error);
+
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	g_variant_unref(reply);
+	return TRUE;
+}
+
+/* Add an object to the DBus Mock */
+static gboolean
+install_object (DbusTestDbusMock * mock, DbusTestDbusMockObject * object, GError ** error)
+{
+	if (mock->priv->engine != NULL) {
+		return install_object_native(mock, object, error);
+	}
 
-	_DbusMockIfaceOrgFreedesktopDBusMock * proxy = g_hash_table_lookup(mock->priv->object_proxies, object->object_path);
+	g_return_val_if_fail(mock->priv->bus != NULL, FALSE);
 
-	if (proxy == NULL) {
+	if (!g_hash_table_contains(mock->priv->installed_paths, object->object_path)) {
 		g_debug("Add object (%s) on '%s'", object->interface, object->object_path);
-		gboolean add_object = _dbus_mock_iface_org_freedesktop_dbus_mock_call_add_object_sync(
-			mock->priv->proxy,
-			object->object_path,
-			object->interface,
-			properties,
-			methods,
-			mock->priv->cancel,
+		gboolean add_object = mock_call_void(mock, "/", "AddObject",
+			g_variant_new("(ss@a{sv}@a(ssss))", object->object_path, object->interface, object_properties(object), object_methods(object)),
 			error);
 
 		if (add_object) {
-			proxy = _dbus_mock_iface_org_freedesktop_dbus_mock_proxy_new_sync(mock->priv->bus,
-				G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES | G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
-				mock->priv->name,
-				object->object_path, /* path */
-				mock->priv->cancel,
-				error
-			);
-
-			g_hash_table_insert(mock->priv->object_proxies, g_strdup(object->object_path), proxy);
+			g_hash_table_add(mock->priv->installed_paths, g_strdup(object->object_path));
 		}
-	} else {
-		gboolean methods_sent = FALSE;
-		gboolean props_sent = FALSE;
-
-		if (object->properties->len > 0) {
-			g_debug("Add props");
-			props_sent = _dbus_mock_iface_org_freedesktop_dbus_mock_call_add_properties_sync(
-				proxy,
-				object->interface,
-				properties,
-				NULL, /* cancel */
-				error);
+
+		return add_object;
+	}
+
+	gboolean methods_sent = TRUE;
+	gboolean props_sent = TRUE;
+
+	if (object->properties->len > 0) {
+		g_debug("Add props");
+		props_sent = mock_call_void(mock, object->object_path, "AddProperties",
+			g_variant_new("(s@a{sv})", object->interface, object_properties(object)),
+			error);
+	}
+
+	if (props_sent && object->methods->len > 0) {
+		g_debug("Add methods");
+		methods_sent = mock_call_void(mock, object->object_path, "AddMethods",
+			g_variant_new("(s@a(ssss))", object->interface, object_methods(object)),
+			error);
+	}
+
+	if (!methods_sent || !props_sent) {
+		g_warning("Unable to send methods and properties");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The process started but the mock never got set up, so nothing can
+   count on it.  Stop it so that it finishes, and fails, like any other
+   task that didn't work. */
+static void
+mock_failed (DbusTestDbusMock * self)
+{
+	GPid pid = dbus_test_process_get_pid(DBUS_TEST_PROCESS(self));
+
+	self->priv->failed = TRUE;
+
+	if (pid != 0) {
+		_dbus_test_kill_signal(pid, SIGTERM);
+	}
+
+	return;
+}
+
+/* All the calls installing objects when the mock starts */
+typedef struct {
+	DbusTestDbusMock * mock;
+	GMainLoop * loop;
+	guint pending;
+	/* The first call that didn't work */
+	GError * error;
+} install_batch_t;
+
+typedef struct {
+	install_batch_t * batch;
+	DbusTestDbusMock * mock;
+	gchar * path;
+	/* Whether this made the object, it isn't there if it didn't work */
+	gboolean add_object;
+} install_call_t;
+
+/* The last reply is in, the mock is ready if they all worked */
+static void
+install_batch_done (install_batch_t * batch)
+{
+	DbusTestTask * task = DBUS_TEST_TASK(batch->mock);
+
+	if (batch->error != NULL) {
+		gchar * message = g_strdup_printf("Unable to install objects: %s", batch->error->message);
+		dbus_test_task_print(task, message);
+		g_free(message);
+
+		mock_failed(batch->mock);
+	}
+
+	dbus_test_task_release_ready(task);
+	g_main_loop_quit(batch->loop);
+
+	return;
+}
+
+static void
+install_call_done (GObject * source, GAsyncResult * res, gpointer pcall)
+{
+	install_call_t * call = (install_call_t *)pcall;
+	GError * error = NULL;
+
+	GVariant * ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+	if (ret != NULL) {
+		g_variant_unref(ret);
+	}
+
+	if (error != NULL) {
+		if (call->batch->error == NULL) {
+			g_prefix_error(&error, "'%s': ", call->path);
+			g_propagate_error(&call->batch->error, error);
 		} else {
-			props_sent = TRUE;
-			g_variant_ref_sink(properties);
-			g_variant_unref(properties);
+			g_error_free(error);
 		}
 
-		if (object->methods->len > 0) {
-			g_debug("Add methods");
-			methods_sent = _dbus_mock_iface_org_freedesktop_dbus_mock_call_add_methods_sync(
-				proxy,
-				object->interface,
-				methods,
-				NULL, /* cancel */
-				error);
-		} else {
-			methods_sent = TRUE;
-			g_variant_ref_sink(methods);
-			g_variant_unref(methods);
+		if (call->add_object) {
+			g_hash_table_remove(call->mock->priv->installed_paths, call->path);
+		}
+	}
+
+	call->batch->pending--;
+	if (call->batch->pending == 0) {
+		install_batch_done(call->batch);
+	}
+
+	g_free(call->path);
+	g_free(call);
+
+	return;
+}
+
+static void
+install_call (install_batch_t * batch, DbusTestDbusMock * mock, const gchar * call_path, const gchar * path, const gchar * method, GVariant * params, gboolean add_object)
+{
+	install_call_t * call = g_new0(install_call_t, 1);
+	call->batch = batch;
+	call->mock = mock;
+	call->path = g_strdup(path);
+	call->add_object = add_object;
+
+	batch->pending++;
+
+	g_dbus_connection_call(mock->priv->bus,
+		mock->priv->name,
+		call_path,
+		"org.freedesktop.DBus.Mock",
+		method,
+		params,
+		NULL, /* reply type */
+		G_DBUS_CALL_FLAGS_NO_AUTO_START,
+		-1, /* timeout */
+		mock->priv->cancel,
+		install_call_done,
+		call);
+
+	return;
+}
+
+/* Sends everything for the objects at once and then waits on the
+   replies, rather than waiting on each one in turn.  The calls all go
+   out on one connection so DBusMock gets them in order, an object is
+   there before anything is added to it.  The hold on the mock being
+   ready goes with the last reply, and if any of them failed so does
+   the mock. */
+static void
+install_objects_pipelined (DbusTestDbusMock * self)
+{
+	/* The replies come on the context the calls were made on */
+	install_batch_t batch = {
+		.mock = self,
+		.loop = g_main_loop_new(g_main_context_get_thread_default(), FALSE),
+		.pending = 0,
+		.error = NULL
+	};
+	GList * lobj;
+
+	for (lobj = self->priv->objects; lobj != NULL; lobj = g_list_next(lobj)) {
+		DbusTestDbusMockObject * obj = (DbusTestDbusMockObject *)lobj->data;
+
+		if (!g_hash_table_contains(self->priv->installed_paths, obj->object_path)) {
+			g_hash_table_add(self->priv->installed_paths, g_strdup(obj->object_path));
+
+			install_call(&batch, self, "/", obj->object_path, "AddObject",
+				g_variant_new("(ss@a{sv}@a(ssss))", obj->object_path, obj->interface, object_properties(obj), object_methods(obj)),
+				TRUE);
+			continue;
+		}
+
+		if (obj->properties->len > 0) {
+			install_call(&batch, self, obj->object_path, obj->object_path, "AddProperties",
+				g_variant_new("(s@a{sv})", obj->interface, object_properties(obj)),
+				FALSE);
 		}
 
-		if (!methods_sent || !props_sent) {
-			g_warning("Unable to send methods and properties");
-			proxy = NULL;
+		if (obj->methods->len > 0) {
+			install_call(&batch, self, obj->object_path, obj->object_path, "AddMethods",
+				g_variant_new("(s@a(ssss))", obj->interface, object_methods(obj)),
+				FALSE);
 		}
 	}
 
-	return proxy != NULL;
+	if (batch.pending > 0) {
+		g_main_loop_run(batch.loop);
+	} else {
+		install_batch_done(&batch);
+	}
+
+	g_main_loop_unref(batch.loop);
+	g_clear_error(&batch.error);
+
+	return;
 }
 
 /* Catch the mock taking too long to start */
@@ -450,6 +753,116 @@ configure_process (DbusTestDbusMock * self)
 	g_array_unref(params);
 }
 
+/* Puts the objects we have so far on the bus */
+static void
+install_objects (DbusTestDbusMock * self)
+{
+	GList * lobj;
+
+	for (lobj = self->priv->objects; lobj != NULL; lobj = g_list_next(lobj)) {
+		GError * error = NULL;
+
+		DbusTestDbusMockObject * obj = (DbusTestDbusMockObject *)lobj->data;
+		install_object(self, obj, &error);
+
+		if (error != NULL) {
+			g_warning("Unable to install object '%s': %s", obj->object_path, error->message);
+			g_error_free(error);
+		}
+	}
+
+	return;
+}
+
+/* Our connection to the bus the mock is on, the service's own when
+   we have one as the shared ones only know the bus in our environment */
+static GDBusConnection *
+mock_bus (DbusTestDbusMock * self, GError ** error)
+{
+	DbusTestTask * task = DBUS_TEST_TASK(self);
+
+	if (dbus_test_task_get_connection(task) != NULL) {
+		return g_object_ref(dbus_test_task_get_connection(task));
+	}
+
+	if (dbus_test_task_get_bus(task) == DBUS_TEST_SERVICE_BUS_SYSTEM) {
+		return g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, error);
+	}
+
+	return g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
+}
+
+/* The address of the bus the mock is on, from the environment the
+   service gives its tasks when there is one */
+static gchar *
+native_address (DbusTestDbusMock * self, GError ** error)
+{
+	DbusTestTask * task = DBUS_TEST_TASK(self);
+	gboolean system = dbus_test_task_get_bus(task) == DBUS_TEST_SERVICE_BUS_SYSTEM;
+	const gchar * variable = system ? "DBUS_SYSTEM_BUS_ADDRESS" : "DBUS_SESSION_BUS_ADDRESS";
+	gchar ** environment = dbus_test_task_get_environment(task);
+	const gchar * address = environment != NULL ? g_environ_getenv(environment, variable) : g_getenv(variable);
+
+	if (address != NULL) {
+		return g_strdup(address);
+	}
+
+	return g_dbus_address_get_for_bus_sync(system ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION, NULL, error);
+}
+
+/* Start the native backend, the objects go on before the name so
+   they're there for anyone waiting on it */
+static void
+run_native (DbusTestDbusMock * self)
+{
+	DbusTestTask * task = DBUS_TEST_TASK(self);
+	GError * error = NULL;
+	gint64 start = g_get_monotonic_time();
+
+	/* Only to hear about calls, the engine has its own */
+	self->priv->bus = mock_bus(self, &error);
+
+	gchar * address = self->priv->bus != NULL ? native_address(self, &error) : NULL;
+	if (address != NULL) {
+		self->priv->engine = _dbus_test_mock_engine_new(address, &error);
+		g_free(address);
+	}
+
+	if (self->priv->engine != NULL) {
+		_dbus_test_trace_span(dbus_test_task_get_name(task), "mock", "mock start", start, g_get_monotonic_time());
+		start = g_get_monotonic_time();
+
+		/* Every object in one trip to the engine's thread */
+		GError * install_error = NULL;
+		_dbus_test_mock_engine_batch_begin(self->priv->engine);
+		install_objects(self);
+		if (!_dbus_test_mock_engine_batch_end(self->priv->engine, &install_error)) {
+			g_warning("Unable to install objects: %s", install_error->message);
+			g_error_free(install_error);
+		}
+
+		if (!_dbus_test_mock_engine_own_name(self->priv->engine, self->priv->name, &error)) {
+			_dbus_test_mock_engine_free(self->priv->engine);
+			self->priv->engine = NULL;
+		}
+
+		_dbus_test_trace_span(dbus_test_task_get_name(task), "mock", "installing objects", start, g_get_monotonic_time());
+	}
+
+	if (self->priv->engine == NULL) {
+		g_warning("Unable to start DBus Mock: %s", error->message);
+		g_error_free(error);
+		self->priv->native_state = DBUS_TEST_TASK_STATE_FINISHED;
+		g_signal_emit_by_name(G_OBJECT(self), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, DBUS_TEST_TASK_STATE_FINISHED, NULL);
+		return;
+	}
+
+	self->priv->native_state = DBUS_TEST_TASK_STATE_RUNNING;
+	g_signal_emit_by_name(G_OBJECT(self), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, DBUS_TEST_TASK_STATE_RUNNING, NULL);
+
+	return;
+}
+
 /* Run the mock */
 static void
 run (DbusTestTask * task)
@@ -457,23 +870,49 @@ run (DbusTestTask * task)
 	GError * error = NULL;
 	DbusTestDbusMock * self = DBUS_TEST_DBUS_MOCK(task);
 
-	/* Grab the new bus */
-	if (dbus_test_task_get_bus(DBUS_TEST_TASK(self)) == DBUS_TEST_SERVICE_BUS_SYSTEM) {
-		self->priv->bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
-	} else {
-		self->priv->bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+	if (self->priv->backend == DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE) {
+		run_native(self);
+		return;
 	}
 
+	/* Grab the new bus */
+	self->priv->bus = mock_bus(self, &error);
+
 	if (error != NULL) {
 		g_warning("Unable to get bus to start DBus Mock: %s", error->message);
 		g_error_free(error);
 		return;
 	}
 
+	/* Listening before it starts so no call is missed */
+	self->priv->call_context = g_main_context_new();
+	g_main_context_push_thread_default(self->priv->call_context);
+	self->priv->call_subscription = g_dbus_connection_signal_subscribe(self->priv->bus,
+		self->priv->name,
+		"org.freedesktop.DBus.Mock",
+		"MethodCalled",
+		NULL, /* path */
+		NULL, /* arg0 */
+		G_DBUS_SIGNAL_FLAGS_NONE,
+		call_log_signal,
+		self,
+		NULL); /* free func */
+	g_main_context_pop_thread_default(self->priv->call_context);
+
+	/* The process is running as soon as it is spawned, but nothing
+	   can use the mock until it has its name and objects */
+	dbus_test_task_hold_ready(task);
+
 	/* Use the process code to get the process running */
+	gint64 start = g_get_monotonic_time();
 	configure_process(self);
 	DBUS_TEST_TASK_CLASS (dbus_test_dbus_mock_parent_class)->run (task);
 
+	if (!is_running(self)) {
+		dbus_test_task_release_ready(task);
+		return;
+	}
+
 	/**** Initialize the DBus Mock instance ****/
 
 	/* Zero, Setup the proxy */
@@ -488,6 +927,8 @@ run (DbusTestTask * task)
 	if (error != NULL) {
 		g_critical("Unable to build proxy to DBusMock: %s", error->message);
 		g_error_free(error);
+		mock_failed(self);
+		dbus_test_task_release_ready(task);
 		return;
 	}
 
@@ -495,38 +936,39 @@ run (DbusTestTask * task)
 	gchar * owner = g_dbus_proxy_get_name_owner(G_DBUS_PROXY(self->priv->proxy));
 	if (owner == NULL) {
 		g_debug("Waiting on name from DBusMock");
-		GMainLoop * mainloop = g_main_loop_new(NULL, FALSE);
+		/* The proxy signals on the context it was made on */
+		GMainContext * context = g_main_context_get_thread_default();
+		GMainLoop * mainloop = g_main_loop_new(context, FALSE);
 
-		guint timeout_sig = g_timeout_add_seconds(3, mock_start_check, mainloop);
+		GSource * timeout_source = g_timeout_source_new_seconds(3);
+		g_source_set_callback(timeout_source, mock_start_check, mainloop, NULL);
+		g_source_attach(timeout_source, context);
 		gulong owner_sig = g_signal_connect(G_OBJECT(self->priv->proxy), "notify::g-name-owner", G_CALLBACK(got_name_owner), mainloop);
 
 		g_main_loop_run(mainloop);
 		g_main_loop_unref(mainloop);
 
 		g_signal_handler_disconnect(self->priv->proxy, owner_sig);
-		g_source_remove(timeout_sig);
+		g_source_destroy(timeout_source);
+		g_source_unref(timeout_source);
 
 		owner = g_dbus_proxy_get_name_owner(G_DBUS_PROXY(self->priv->proxy));
 		if (owner == NULL) {
 			g_critical("Unable to get DBusMock started within 3 seconds");
+			mock_failed(self);
+			dbus_test_task_release_ready(task);
 			return;
 		}
 	}
 	g_free(owner);
 
-	/* Second, Install Objects */
-	GList * lobj = self->priv->objects;
-	for (lobj = self->priv->objects; lobj != NULL; lobj = g_list_next(lobj)) {
-		GError * error = NULL;
+	_dbus_test_trace_span(dbus_test_task_get_name(task), "mock", "mock start", start, g_get_monotonic_time());
+	start = g_get_monotonic_time();
 
-		DbusTestDbusMockObject * obj = (DbusTestDbusMockObject *)lobj->data;
-		install_object(self, obj, &error);
+	/* Second, Install Objects */
+	install_objects_pipelined(self);
 
-		if (error != NULL) {
-			g_warning("Unable to install object '%s': %s", obj->object_path, error->message);
-			g_error_free(error);
-		}
-	}
+	_dbus_test_trace_span(dbus_test_task_get_name(task), "mock", "installing objects", start, g_get_monotonic_time());
 
 	return;
 }
@@ -553,6 +995,48 @@ dbus_test_dbus_mock_new (const gchar * bus_name)
 	return mock;
 }
 
+/**
+ * dbus_test_dbus_mock_set_backend:
+ * @mock: A #DbusTestDbusMock instance
+ * @backend: What serves the mocked objects
+ *
+ * Chooses between running python-dbusmock and serving the objects from
+ * a thread in this process.  The native backend starts without spawning
+ * anything, but it doesn't run Python code, see
+ * dbus_test_dbus_mock_object_set_method_return().  This can only be
+ * changed before the mock runs.
+ */
+void
+dbus_test_dbus_mock_set_backend (DbusTestDbusMock * mock, DbusTestDbusMockBackend backend)
+{
+	g_return_if_fail(DBUS_TEST_IS_DBUS_MOCK(mock));
+
+	if (dbus_test_task_get_state(DBUS_TEST_TASK(mock)) != DBUS_TEST_TASK_STATE_INIT) {
+		g_warning("Can not set the backend of a mock that has already run");
+		return;
+	}
+
+	mock->priv->backend = backend;
+
+	return;
+}
+
+/**
+ * dbus_test_dbus_mock_get_backend:
+ * @mock: A #DbusTestDbusMock instance
+ *
+ * Gets the backend set with dbus_test_dbus_mock_set_backend().
+ *
+ * Return value: What serves the mocked objects
+ */
+DbusTestDbusMockBackend
+dbus_test_dbus_mock_get_backend (DbusTestDbusMock * mock)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_DBUS_MOCK(mock), DBUS_TEST_DBUS_MOCK_BACKEND_PYTHON);
+
+	return mock->priv->backend;
+}
+
 /**
  * dbus_test_dbus_mock_get_object:
  * @mock: A #DbusTestDbusMock instance
@@ -574,13 +1058,14 @@ dbus_test_dbus_mock_get_object (DbusTestDbusMock * mock, const gchar * path, con
 	g_return_val_if_fail(path != NULL, NULL);
 	g_return_val_if_fail(interface != NULL, NULL);
 
-	/* Check to see if we have that one */
-	GList * lobj = mock->priv->objects;
-	for (lobj = mock->priv->objects; lobj != NULL; lobj = g_list_next(lobj)) {
+	/* Check to see if we have that one, there's only an object
+	   for each interface on the path to look through */
+	GList * path_objects = g_hash_table_lookup(mock->priv->object_paths, path);
+	GList * lobj;
+	for (lobj = path_objects; lobj != NULL; lobj = g_list_next(lobj)) {
 		DbusTestDbusMockObject * obj = (DbusTestDbusMockObject *)lobj->data;
 
-		if (g_strcmp0(path, obj->object_path) == 0 &&
-			g_strcmp0(interface, obj->interface) == 0) {
+		if (g_strcmp0(interface, obj->interface) == 0) {
 			return obj;
 		}
 	}
@@ -594,8 +1079,16 @@ dbus_test_dbus_mock_get_object (DbusTestDbusMock * mock, const gchar * path, con
 	g_array_set_clear_func(newobj->properties, property_free);
 	newobj->methods = g_array_new(FALSE, TRUE, sizeof(MockObjectMethod));
 	g_array_set_clear_func(newobj->methods, method_free);
+	newobj->property_index = g_hash_table_new(g_str_hash, g_str_equal);
+	newobj->method_index = g_hash_table_new(g_str_hash, g_str_equal);
 
 	mock->priv->objects = g_list_prepend(mock->priv->objects, newobj);
+	if (path_objects == NULL) {
+		g_hash_table_insert(mock->priv->object_paths, g_strdup(path), g_list_prepend(NULL, newobj));
+	} else {
+		/* After the first, so the list in the table starts the same */
+		g_list_insert(path_objects, newobj, 1);
+	}
 
 	g_debug("Creating object: %s (%s)", newobj->object_path, newobj->interface);
 
@@ -617,6 +1110,8 @@ object_free (gpointer data)
 
 	g_free(obj->interface);
 	g_free(obj->object_path);
+	g_hash_table_destroy(obj->property_index);
+	g_hash_table_destroy(obj->method_index);
 	g_array_free(obj->properties, TRUE);
 	g_array_free(obj->methods, TRUE);
 
@@ -628,15 +1123,13 @@ object_free (gpointer data)
 static inline MockObjectMethod *
 get_obj_method (DbusTestDbusMockObject * obj, const gchar * name)
 {
-	guint i;
-	for (i = 0; i < obj->methods->len; i++) {
-		MockObjectMethod * method = &g_array_index(obj->methods, MockObjectMethod, i);
-		if (g_strcmp0(method->name, name) == 0) {
-			return method;
-		}
+	guint index = GPOINTER_TO_UINT(g_hash_table_lookup(obj->method_index, name));
+
+	if (index == 0) {
+		return NULL;
 	}
 
-	return NULL;
+	return &g_array_index(obj->methods, MockObjectMethod, index - 1);
 }
 
 /* Free the resources for the call */
@@ -656,22 +1149,26 @@ call_free (gpointer pcall)
  * @method: Name of the method
  * @inparams: (allow-none): Parameters going into the method as a tuple
  * @outparams: (allow-none): Parameters gonig out of the method as a tuple
- * @python_code: Python code to execute when the method is called
+ * @python_code: (allow-none): Python code to execute when the method is called
  * @error: Possible error to return
  *
  * Sets up a method on the object specified.  When the method is activated this is
  * both tracked by DBusMock and the code in @python_code is executed.  This then
  * can return a value that is the same type as @outparams.
  *
+ * The native backend doesn't run @python_code, and it can be %NULL there.  It
+ * replies with what was set with dbus_test_dbus_mock_object_set_method_return(),
+ * or zeros and empty values of @outparams until something is.
+ *
  * Return value: Whether it was registered successfully
  */
 gboolean
-dbus_test_dbus_mock_object_add_method (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * method, const GVariantType * inparams, const GVariantType * outparams, const gchar * python_code, G_GNUC_UNUSED GError ** error)
+dbus_test_dbus_mock_object_add_method (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * method, const GVariantType * inparams, const GVariantType * outparams, const gchar * python_code, GError ** error)
 {
 	g_return_val_if_fail(DBUS_TEST_IS_DBUS_MOCK(mock), FALSE);
 	g_return_val_if_fail(obj != NULL, FALSE);
 	g_return_val_if_fail(method != NULL, FALSE);
-	g_return_val_if_fail(python_code != NULL, FALSE);
+	g_return_val_if_fail(python_code != NULL || mock->priv->backend == DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE, FALSE);
 
 	/* Check to make sure it doesn't already exist */
 	MockObjectMethod * meth = get_obj_method(obj, method);
@@ -683,35 +1180,38 @@ dbus_test_dbus_mock_object_add_method (DbusTestDbusMock * mock, DbusTestDbusMock
 	newmethod.in = inparams ? g_variant_type_copy(inparams) : NULL;
 	newmethod.out = outparams ? g_variant_type_copy(outparams) : NULL;
 	newmethod.code = g_strdup(python_code);
+	newmethod.ret = NULL;
 	newmethod.calls = g_array_new(TRUE, TRUE, sizeof(DbusTestDbusMockCall));
 	g_array_set_clear_func(newmethod.calls, call_free);
 
 	g_array_append_val(obj->methods, newmethod);
+	g_hash_table_insert(obj->method_index, newmethod.name, GUINT_TO_POINTER(obj->methods->len));
 
 	/* If we're not running we can just leave it here */
 	if (!is_running(mock)) {
 		return TRUE;
 	}
 
+	if (mock->priv->engine != NULL) {
+		return _dbus_test_mock_engine_add_method(mock->priv->engine, obj->object_path, obj->interface, method, inparams, outparams, NULL, error);
+	}
+
 	GVariant * in = method_params_to_variant(inparams);
 	GVariant * out = method_params_to_variant(outparams);
 
 	g_variant_ref_sink(in);
 	g_variant_ref_sink(out);
 
-	_DbusMockIfaceOrgFreedesktopDBusMock * proxy = g_hash_table_lookup(mock->priv->object_proxies, obj->object_path);
-	g_return_val_if_fail(proxy != NULL, FALSE); /* Should never happen */
+	g_return_val_if_fail(g_hash_table_contains(mock->priv->installed_paths, obj->object_path), FALSE); /* Should never happen */
 
-	gboolean ret = _dbus_mock_iface_org_freedesktop_dbus_mock_call_add_method_sync(
-		proxy,
-		obj->interface,
-		method,
-		g_variant_get_string(in, NULL),
-		g_variant_get_string(out, NULL),
-		python_code,
-		mock->priv->cancel,
-		error
-	);
+	gboolean ret = mock_call_void(mock, obj->object_path, "AddMethod",
+		g_variant_new("(sssss)",
+			obj->interface,
+			method,
+			g_variant_get_string(in, NULL),
+			g_variant_get_string(out, NULL),
+			python_code),
+		error);
 
 	g_variant_unref(in);
 	g_variant_unref(out);
@@ -729,12 +1229,74 @@ method_free (gpointer data)
 	g_variant_type_free(method->in);
 	g_variant_type_free(method->out);
 	g_free(method->code);
+	if (method->ret != NULL) {
+		g_variant_unref(method->ret);
+	}
 	g_array_free(method->calls, TRUE);
 
 	/* NOTE: No free of 'data' */
 	return;
 }
 
+/**
+ * dbus_test_dbus_mock_object_set_method_return:
+ * @mock: A #DbusTestDbusMock instance
+ * @obj: A handle to an object on the mock interface
+ * @method: Name of the method
+ * @value: (allow-none): What the method returns, of its @outparams type
+ * @error: A possible error
+ *
+ * Sets what a method added with dbus_test_dbus_mock_object_add_method()
+ * replies with, straight from C instead of from Python code.  A floating
+ * @value is consumed.  %NULL goes back to zeros and empty values.  Only
+ * the native backend supports this, see dbus_test_dbus_mock_set_backend().
+ *
+ * Return value: Whether the method will reply with it
+ */
+gboolean
+dbus_test_dbus_mock_object_set_method_return (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * method, GVariant * value, GError ** error)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_DBUS_MOCK(mock), FALSE);
+	g_return_val_if_fail(obj != NULL, FALSE);
+	g_return_val_if_fail(method != NULL, FALSE);
+
+	if (value != NULL) {
+		g_variant_ref_sink(value);
+	}
+
+	if (mock->priv->backend != DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE) {
+		g_set_error(error, _dbus_mock_quark(), ERROR_NOT_SUPPORTED, "Return values can only be set with the native backend");
+		if (value != NULL) {
+			g_variant_unref(value);
+		}
+		return FALSE;
+	}
+
+	MockObjectMethod * meth = get_obj_method(obj, method);
+	if (meth == NULL) {
+		g_set_error(error, _dbus_mock_quark(), ERROR_METHOD_NOT_FOUND, "Method '%s' not found on object '%s'", method, obj->object_path);
+		if (value != NULL) {
+			g_variant_unref(value);
+		}
+		return FALSE;
+	}
+
+	/* Checked by the engine, which only has it once it's running */
+	if (is_running(mock) && !_dbus_test_mock_engine_set_return(mock->priv->engine, obj->object_path, obj->interface, method, value, error)) {
+		if (value != NULL) {
+			g_variant_unref(value);
+		}
+		return FALSE;
+	}
+
+	if (meth->ret != NULL) {
+		g_variant_unref(meth->ret);
+	}
+	meth->ret = value;
+
+	return TRUE;
+}
+
 /**
  * dbus_test_dbus_mock_object_check_method_call:
  * @mock: A #DbusTestDbusMock instance
@@ -776,6 +1338,62 @@ dbus_test_dbus_mock_object_check_method_call (DbusTestDbusMock * mock, DbusTestD
 	return FALSE;
 }
 
+/* Takes in the signals for the calls that have come so far */
+static void
+call_log_dispatch (DbusTestDbusMock * mock)
+{
+	while (g_main_context_iteration(mock->priv->call_context, FALSE));
+
+	return;
+}
+
+/* python-dbusmock signals each call before it replies to it, so once
+   it has answered us the signal for every call made before is here */
+static gboolean
+call_log_sync (DbusTestDbusMock * mock, GError ** error)
+{
+	GVariant * reply = g_dbus_connection_call_sync(mock->priv->bus,
+		mock->priv->name,
+		"/",
+		"org.freedesktop.DBus.Peer",
+		"Ping",
+		NULL, /* params */
+		NULL, /* reply type */
+		G_DBUS_CALL_FLAGS_NO_AUTO_START,
+		-1, /* timeout */
+		mock->priv->cancel,
+		error);
+
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	g_variant_unref(reply);
+	call_log_dispatch(mock);
+
+	return TRUE;
+}
+
+/* The calls we have for every object on @path, DBusMock keeps them
+   for the path and not for the interface */
+static void
+forget_method_calls (DbusTestDbusMock * mock, const gchar * path)
+{
+	GList * lobj;
+
+	for (lobj = g_hash_table_lookup(mock->priv->object_paths, path); lobj != NULL; lobj = g_list_next(lobj)) {
+		DbusTestDbusMockObject * obj = (DbusTestDbusMockObject *)lobj->data;
+		guint i;
+
+		for (i = 0; i < obj->methods->len; i++) {
+			MockObjectMethod * method = &g_array_index(obj->methods, MockObjectMethod, i);
+			g_array_set_size(method->calls, 0);
+		}
+	}
+
+	return;
+}
+
 /**
  * dbus_test_dbus_mock_object_clear_method_calls:
  * @mock: A #DbusTestDbusMock instance
@@ -796,14 +1414,24 @@ dbus_test_dbus_mock_object_clear_method_calls (DbusTestDbusMock * mock, DbusTest
 		return FALSE;
 	}
 
-	_DbusMockIfaceOrgFreedesktopDBusMock * proxy = g_hash_table_lookup(mock->priv->object_proxies, obj->object_path);
-	g_return_val_if_fail(proxy != NULL, FALSE); /* Should never happen */
+	if (mock->priv->engine != NULL) {
+		forget_method_calls(mock, obj->object_path);
+		_dbus_test_mock_engine_clear_calls(mock->priv->engine, obj->object_path);
+		return TRUE;
+	}
 
-	return _dbus_mock_iface_org_freedesktop_dbus_mock_call_clear_calls_sync(
-		proxy,
-		mock->priv->cancel,
-		error
-	);
+	g_return_val_if_fail(g_hash_table_contains(mock->priv->installed_paths, obj->object_path), FALSE); /* Should never happen */
+
+	if (!mock_call_void(mock, obj->object_path, "ClearCalls", NULL, error)) {
+		return FALSE;
+	}
+
+	/* The signals for calls before the clear are all here now, they
+	   go with the rest */
+	call_log_dispatch(mock);
+	forget_method_calls(mock, obj->object_path);
+
+	return TRUE;
 }
 
 /* We get back an av from DBusMock but everyone else uses
@@ -829,6 +1457,47 @@ variant_array_to_tuple (GVariant * array_in)
 	return g_variant_builder_end(&builder);
 }
 
+/* A call to the python mock, added to the log of every object on the
+   path with the method.  Like DBusMock we keep them for the path. */
+static void
+call_log_signal (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, const gchar * path, G_GNUC_UNUSED const gchar * interface, G_GNUC_UNUSED const gchar * signal, GVariant * params, gpointer data)
+{
+	DbusTestDbusMock * mock = DBUS_TEST_DBUS_MOCK(data);
+	const gchar * method = NULL;
+	GVariant * args = NULL;
+	GList * lobj;
+
+	if (!g_variant_is_of_type(params, G_VARIANT_TYPE("(sav)"))) {
+		return;
+	}
+
+	g_variant_get(params, "(&s@av)", &method, &args);
+	GVariant * tuple = g_variant_ref_sink(variant_array_to_tuple(args));
+	guint64 timestamp = g_get_real_time() / G_USEC_PER_SEC;
+
+	for (lobj = g_hash_table_lookup(mock->priv->object_paths, path); lobj != NULL; lobj = g_list_next(lobj)) {
+		DbusTestDbusMockObject * obj = (DbusTestDbusMockObject *)lobj->data;
+		MockObjectMethod * meth = get_obj_method(obj, method);
+
+		if (meth == NULL) {
+			continue;
+		}
+
+		DbusTestDbusMockCall callsig = {
+			.timestamp = timestamp,
+			.name = g_strdup(method),
+			.params = g_variant_ref(tuple)
+		};
+
+		g_array_append_val(meth->calls, callsig);
+	}
+
+	g_variant_unref(tuple);
+	g_variant_unref(args);
+
+	return;
+}
+
 /**
  * dbus_test_dbus_mock_object_get_method_calls:
  * @mock: A #DbusTestDbusMock instance
@@ -838,6 +1507,10 @@ variant_array_to_tuple (GVariant * array_in)
  * @error: A possible error 
  *
  * Gets a list of all method calls for a function including the parmeters.
+ * The calls from earlier times this was called are kept, only the ones
+ * made since are fetched and converted, so polling stays cheap as the
+ * list grows.  The array can move when that happens, don't hold on to it
+ * past the next call.
  *
  * Return value: (transfer none): An array of calls with the last item
  *   having a timestamp of 0.  Also length in the optional @len param.
@@ -859,9 +1532,6 @@ dbus_test_dbus_mock_object_get_method_calls (DbusTestDbusMock * mock, DbusTestDb
 		return NULL;
 	}
 
-	_DbusMockIfaceOrgFreedesktopDBusMock * proxy = g_hash_table_lookup(mock->priv->object_proxies, obj->object_path);
-	g_return_val_if_fail(proxy != NULL, FALSE); /* Should never happen */
-
 	/* Find our method */
 	MockObjectMethod * meth = get_obj_method(obj, method);
 	if (meth == NULL) {
@@ -869,63 +1539,309 @@ dbus_test_dbus_mock_object_get_method_calls (DbusTestDbusMock * mock, DbusTestDb
 		return NULL;
 	}
 
-	/* Clear the current list of calls */
-	g_array_set_size(meth->calls, 0);
+	/* The list only grows until it's cleared, what we have is the
+	   start of it */
+	if (mock->priv->engine != NULL) {
+		_dbus_test_mock_engine_get_calls(mock->priv->engine, obj->object_path, method, meth->calls->len, meth->calls);
 
-	GVariant * call_list = NULL;
-	_dbus_mock_iface_org_freedesktop_dbus_mock_call_get_calls_sync(
-		proxy,
-		&call_list,
-		mock->priv->cancel,
-		error);
+		if (length != NULL) {
+			*length = meth->calls->len;
+		}
+
+		return (const DbusTestDbusMockCall *)meth->calls->data;
+	}
 
-	if (call_list == NULL) {
+	g_return_val_if_fail(g_hash_table_contains(mock->priv->installed_paths, obj->object_path), NULL); /* Should never happen */
+
+	/* The signals have added the calls to the log as they came */
+	if (!call_log_sync(mock, error)) {
 		return NULL;
 	}
 
-	GVariantIter call_list_itr;
-	g_variant_iter_init(&call_list_itr, call_list);
+	if (length != NULL) {
+		*length = meth->calls->len;
+	}
+
+	return (const DbusTestDbusMockCall *)meth->calls->data;
+}
 
-	guint64 timestamp = 0;
-	const gchar * name = NULL;
-	GVariant * params = NULL;
+/* Someone waiting on calls to a method */
+typedef struct {
+	DbusTestDbusMock * mock;
+	DbusTestDbusMockObject * obj;
+	gchar * method;
+	GVariant * params;
+	guint count;
 
-	while (g_variant_iter_loop(&call_list_itr, "(t&s@av)", &timestamp, &name, &params)) {
-		if (g_strcmp0(method, name) != 0) {
-			continue;
+	guint subscription;
+	GSource * check;
+	GSource * timeout;
+
+	DbusTestDbusMockCallFunc func;
+	gpointer user_data;
+} call_watch_t;
+
+/* Tells the waiter and frees the watch, @called is a boolean in a
+   pointer so that it fits g_list_foreach() */
+static void
+call_watch_done (gpointer data, gpointer called)
+{
+	call_watch_t * watch = (call_watch_t *)data;
+	DbusTestDbusMock * mock = watch->mock;
+
+	mock->priv->watches = g_list_remove(mock->priv->watches, watch);
+
+	g_dbus_connection_signal_unsubscribe(mock->priv->bus, watch->subscription);
+
+	if (watch->check != NULL) {
+		g_source_destroy(watch->check);
+		g_source_unref(watch->check);
+	}
+
+	if (watch->timeout != NULL) {
+		g_source_destroy(watch->timeout);
+		g_source_unref(watch->timeout);
+	}
+
+	if (watch->func != NULL) {
+		watch->func(mock, watch->obj, watch->method, GPOINTER_TO_INT(called), watch->user_data);
+	}
+
+	if (watch->params != NULL) {
+		g_variant_unref(watch->params);
+	}
+	g_free(watch->method);
+	g_free(watch);
+
+	return;
+}
+
+/* Counts the calls in the log, which has them all, rather than the
+   signals, which would miss the ones from before we were watching */
+static void
+call_watch_check (call_watch_t * watch)
+{
+	guint length = 0;
+	guint matched = 0;
+	guint i;
+
+	const DbusTestDbusMockCall * calls = dbus_test_dbus_mock_object_get_method_calls(watch->mock, watch->obj, watch->method, &length, NULL);
+
+	for (i = 0; i < length; i++) {
+		if (watch->params == NULL || g_variant_equal(watch->params, calls[i].params)) {
+			matched++;
 		}
+	}
 
-		DbusTestDbusMockCall callsig = {
-			.timestamp = timestamp,
-			.name = g_strdup(name),
-			.params = g_variant_ref_sink(variant_array_to_tuple(params))
-		};
+	if (matched >= watch->count) {
+		call_watch_done(watch, GINT_TO_POINTER(TRUE));
+	}
 
-		g_array_append_val(meth->calls, callsig);
+	return;
+}
+
+static void
+call_watch_signal (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, G_GNUC_UNUSED const gchar * path, G_GNUC_UNUSED const gchar * interface, G_GNUC_UNUSED const gchar * signal, GVariant * params, gpointer data)
+{
+	call_watch_t * watch = (call_watch_t *)data;
+	const gchar * method = NULL;
+
+	/* Only a call to our method can change anything */
+	g_variant_get_child(params, 0, "&s", &method);
+	if (g_strcmp0(method, watch->method) != 0) {
+		return;
 	}
 
-	g_variant_unref(call_list);
+	call_watch_check(watch);
 
-	if (length != NULL) {
-		*length = meth->calls->len;
+	return;
+}
+
+static gboolean
+call_watch_first_check (gpointer data)
+{
+	call_watch_t * watch = (call_watch_t *)data;
+
+	g_source_unref(watch->check);
+	watch->check = NULL;
+
+	call_watch_check(watch);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+call_watch_timeout (gpointer data)
+{
+	call_watch_t * watch = (call_watch_t *)data;
+
+	/* Going now, not for call_watch_done() to destroy */
+	g_source_unref(watch->timeout);
+	watch->timeout = NULL;
+
+	call_watch_done(watch, GINT_TO_POINTER(FALSE));
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * dbus_test_dbus_mock_object_wait_for_call_async:
+ * @mock: A #DbusTestDbusMock instance
+ * @obj: A handle to an object on the mock interface
+ * @method: Name of the method
+ * @params: (allow-none): Parameters the calls need to have
+ * @count: How many calls to wait for
+ * @timeout: Milliseconds to wait, or 0 to wait until the mock goes
+ * @func: Called once when there are @count calls or it stops waiting
+ * @user_data: Data for @func
+ * @error: A possible error
+ *
+ * Waits without blocking for @method to have been called @count times,
+ * counting the calls before this too.  If @params is set only calls
+ * with those parameters count.  Rather than polling the mock this
+ * listens for its MethodCalled signal, so @func is called as soon as
+ * the call that makes up the count is made.  @func is called from the
+ * thread-default main context of the caller, and never before this
+ * returns.
+ *
+ * Return value: Whether it is waiting, @func isn't called if not
+ */
+gboolean
+dbus_test_dbus_mock_object_wait_for_call_async (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * method, GVariant * params, guint count, guint timeout, DbusTestDbusMockCallFunc func, gpointer user_data, GError ** error)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_DBUS_MOCK(mock), FALSE);
+	g_return_val_if_fail(obj != NULL, FALSE);
+	g_return_val_if_fail(method != NULL, FALSE);
+
+	if (params != NULL) {
+		g_variant_ref_sink(params);
 	}
 
-	return (const DbusTestDbusMockCall *)meth->calls->data;
+	if (!is_running(mock) || mock->priv->bus == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED, "DBus Mock is not running");
+		if (params != NULL) {
+			g_variant_unref(params);
+		}
+		return FALSE;
+	}
+
+	if (get_obj_method(obj, method) == NULL) {
+		g_set_error(error, _dbus_mock_quark(), ERROR_METHOD_NOT_FOUND, "Method '%s' not found on object '%s'", method, obj->object_path);
+		if (params != NULL) {
+			g_variant_unref(params);
+		}
+		return FALSE;
+	}
+
+	GMainContext * context = g_main_context_get_thread_default();
+	call_watch_t * watch = g_new0(call_watch_t, 1);
+	watch->mock = mock;
+	watch->obj = obj;
+	watch->method = g_strdup(method);
+	watch->params = params;
+	watch->count = count;
+	watch->func = func;
+	watch->user_data = user_data;
+
+	/* Before looking at the log, so no call falls in between */
+	watch->subscription = g_dbus_connection_signal_subscribe(mock->priv->bus,
+		mock->priv->name,
+		"org.freedesktop.DBus.Mock",
+		"MethodCalled",
+		obj->object_path,
+		NULL, /* arg0 */
+		G_DBUS_SIGNAL_FLAGS_NONE,
+		call_watch_signal,
+		watch,
+		NULL); /* free func */
+
+	watch->check = g_idle_source_new();
+	g_source_set_callback(watch->check, call_watch_first_check, watch, NULL);
+	g_source_attach(watch->check, context);
+
+	if (timeout > 0) {
+		watch->timeout = g_timeout_source_new(timeout);
+		g_source_set_callback(watch->timeout, call_watch_timeout, watch, NULL);
+		g_source_attach(watch->timeout, context);
+	}
+
+	mock->priv->watches = g_list_prepend(mock->priv->watches, watch);
+
+	return TRUE;
+}
+
+typedef struct {
+	gboolean done;
+	gboolean called;
+} call_wait_t;
+
+static void
+call_wait_done (G_GNUC_UNUSED DbusTestDbusMock * mock, G_GNUC_UNUSED DbusTestDbusMockObject * obj, G_GNUC_UNUSED const gchar * method, gboolean called, gpointer data)
+{
+	call_wait_t * wait = (call_wait_t *)data;
+
+	wait->done = TRUE;
+	wait->called = called;
+
+	return;
+}
+
+/**
+ * dbus_test_dbus_mock_object_wait_for_call:
+ * @mock: A #DbusTestDbusMock instance
+ * @obj: A handle to an object on the mock interface
+ * @method: Name of the method
+ * @params: (allow-none): Parameters the calls need to have
+ * @count: How many calls to wait for
+ * @timeout: Milliseconds to wait, or 0 to wait as long as it takes
+ * @error: A possible error
+ *
+ * Blocks until @method has been called @count times, see
+ * dbus_test_dbus_mock_object_wait_for_call_async().  Only the mock's
+ * signals are dispatched while waiting, not the caller's other sources.
+ *
+ * Return value: Whether there were @count calls in time
+ */
+gboolean
+dbus_test_dbus_mock_object_wait_for_call (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * method, GVariant * params, guint count, guint timeout, GError ** error)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_DBUS_MOCK(mock), FALSE);
+
+	call_wait_t wait = {
+		.done = FALSE,
+		.called = FALSE
+	};
+
+	GMainContext * context = g_main_context_new();
+	g_main_context_push_thread_default(context);
+
+	if (dbus_test_dbus_mock_object_wait_for_call_async(mock, obj, method, params, count, timeout, call_wait_done, &wait, error)) {
+		while (!wait.done) {
+			g_main_context_iteration(context, TRUE);
+		}
+
+		if (!wait.called) {
+			g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "Method '%s' wasn't called %u times in %u ms", method, count, timeout);
+		}
+	}
+
+	g_main_context_pop_thread_default(context);
+	g_main_context_unref(context);
+
+	return wait.called;
 }
 
 /* Quick helper to get an object property */
 static inline MockObjectProperty *
 get_obj_property (DbusTestDbusMockObject * obj, const gchar * name)
 {
-	guint i;
-	for (i = 0; i < obj->properties->len; i++) {
-		MockObjectProperty * prop = &g_array_index(obj->properties, MockObjectProperty, i);
-		if (g_strcmp0(prop->name, name) == 0) {
-			return prop;
-		}
+	guint index = GPOINTER_TO_UINT(g_hash_table_lookup(obj->property_index, name));
+
+	if (index == 0) {
+		return NULL;
 	}
 
-	return NULL;
+	return &g_array_index(obj->properties, MockObjectProperty, index - 1);
 }
 
 /**
@@ -942,7 +1858,7 @@ get_obj_property (DbusTestDbusMockObject * obj, const gchar * name)
  * Return value: Whether it was added
  */
 gboolean
-dbus_test_dbus_mock_object_add_property (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * name, const GVariantType * type, GVariant * value, G_GNUC_UNUSED GError ** error)
+dbus_test_dbus_mock_object_add_property (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * name, const GVariantType * type, GVariant * value, GError ** error)
 {
 	g_return_val_if_fail(DBUS_TEST_IS_DBUS_MOCK(mock), FALSE);
 	g_return_val_if_fail(obj != NULL, FALSE);
@@ -962,14 +1878,18 @@ dbus_test_dbus_mock_object_add_property (DbusTestDbusMock * mock, DbusTestDbusMo
 	newprop.value = g_variant_ref_sink(value);
 
 	g_array_append_val(obj->properties, newprop);
+	g_hash_table_insert(obj->property_index, newprop.name, GUINT_TO_POINTER(obj->properties->len));
 
 	/* If we're not running we can just leave it here */
 	if (!is_running(mock)) {
 		return TRUE;
 	}
 
-	_DbusMockIfaceOrgFreedesktopDBusMock * proxy = g_hash_table_lookup(mock->priv->object_proxies, obj->object_path);
-	g_return_val_if_fail(proxy != NULL, FALSE); /* Should never happen */
+	if (mock->priv->engine != NULL) {
+		return _dbus_test_mock_engine_add_property(mock->priv->engine, obj->object_path, obj->interface, name, value, error);
+	}
+
+	g_return_val_if_fail(g_hash_table_contains(mock->priv->installed_paths, obj->object_path), FALSE); /* Should never happen */
 
 	GVariantBuilder builder;
 	g_variant_builder_init(&builder, G_VARIANT_TYPE_ARRAY);
@@ -980,13 +1900,9 @@ dbus_test_dbus_mock_object_add_property (DbusTestDbusMock * mock, DbusTestDbusMo
 	g_variant_builder_close(&builder); /* variant */
 	g_variant_builder_close(&builder); /* dict_entry */
 
-	return _dbus_mock_iface_org_freedesktop_dbus_mock_call_add_properties_sync(
-		proxy,
-		obj->interface,
-		g_variant_builder_end(&builder),
-		mock->priv->cancel,
-		error
-	);
+	return mock_call_void(mock, obj->object_path, "AddProperties",
+		g_variant_new("(s@a{sv})", obj->interface, g_variant_builder_end(&builder)),
+		error);
 }
 
 /* Free the data allocated in dbus_test_dbus_mock_object_add_property() */
@@ -1036,8 +1952,14 @@ dbus_test_dbus_mock_object_update_property (DbusTestDbusMock * mock, DbusTestDbu
 		return FALSE;
 	}
 
-	/* Send the update to Dbusmock */
-	if (is_running(mock)) {
+	/* The engine sends PropertiesChanged itself */
+	if (is_running(mock) && mock->priv->engine != NULL) {
+		if (!_dbus_test_mock_engine_update_property(mock->priv->engine, obj->object_path, obj->interface, name, value, error)) {
+			g_variant_unref(value);
+			return FALSE;
+		}
+	} else if (is_running(mock)) {
+		/* Send the update to Dbusmock */
 		GError * local_error = NULL;
 		g_dbus_connection_call_sync(mock->priv->bus,
 			mock->priv->name,
@@ -1061,8 +1983,7 @@ dbus_test_dbus_mock_object_update_property (DbusTestDbusMock * mock, DbusTestDbu
 			return FALSE;
 		}
 
-		_DbusMockIfaceOrgFreedesktopDBusMock * proxy = g_hash_table_lookup(mock->priv->object_proxies, obj->object_path);
-		if (proxy != NULL) {
+		if (g_hash_table_contains(mock->priv->installed_paths, obj->object_path)) {
 			GVariantBuilder changed_builder;
 			g_variant_builder_init(&changed_builder, G_VARIANT_TYPE_ARRAY);
 			/* s */
@@ -1085,15 +2006,13 @@ dbus_test_dbus_mock_object_update_property (DbusTestDbusMock * mock, DbusTestDbu
 			g_variant_builder_add_value(&changed_builder, g_variant_new_array(G_VARIANT_TYPE_STRING, NULL, 0));
 			g_variant_builder_close(&changed_builder);
 
-			_dbus_mock_iface_org_freedesktop_dbus_mock_call_emit_signal_sync(proxy,
-			                                                                 "org.freedesktop.DBus.Properties",
-			                                                                 "PropertiesChanged",
-			                                                                 "sa{sv}as",
-			                                                                 g_variant_builder_end(&changed_builder),
-			                                                                 mock->priv->cancel,
-			                                                                 &local_error);
-
-			if (local_error != NULL) {
+			if (!mock_call_void(mock, obj->object_path, "EmitSignal",
+			                    g_variant_new("(sss@av)",
+			                                  "org.freedesktop.DBus.Properties",
+			                                  "PropertiesChanged",
+			                                  "sa{sv}as",
+			                                  g_variant_builder_end(&changed_builder)),
+			                    &local_error)) {
 				g_warning("Unable to emit properties changed: %s", local_error->message);
 				g_clear_error(&local_error);
 			}
@@ -1175,24 +2094,25 @@ dbus_test_dbus_mock_object_emit_signal (DbusTestDbusMock * mock, DbusTestDbusMoc
 		return FALSE;
 	}
 
-	_DbusMockIfaceOrgFreedesktopDBusMock * proxy = g_hash_table_lookup(mock->priv->object_proxies, obj->object_path);
-	g_return_val_if_fail(proxy != NULL, FALSE); /* Should never happen */
+	if (mock->priv->engine != NULL) {
+		return _dbus_test_mock_engine_emit_signal(mock->priv->engine, obj->object_path, obj->interface, name, values, error);
+	}
+
+	g_return_val_if_fail(g_hash_table_contains(mock->priv->installed_paths, obj->object_path), FALSE); /* Should never happen */
 
-	/* floating ref swallowed by call_emit_signal() */
+	/* floating ref swallowed by the call */
 	GVariant * sig_params = tuple_to_array(values);
 
 	GVariant * sig_types = method_params_to_variant(params);
 	g_variant_ref_sink(sig_types);
 
-	gboolean retval = _dbus_mock_iface_org_freedesktop_dbus_mock_call_emit_signal_sync(
-		proxy,
-		obj->interface,
-		name,
-		g_variant_get_string(sig_types, NULL),
-		sig_params,
-		mock->priv->cancel,
-		error
-	);
+	gboolean retval = mock_call_void(mock, obj->object_path, "EmitSignal",
+		g_variant_new("(sss@av)",
+			obj->interface,
+			name,
+			g_variant_get_string(sig_types, NULL),
+			sig_params),
+		error);
 
 	g_variant_unref(sig_types);
 
@@ -42,6 +42,18 @@ typedef struct _DbusTestDbusMockPrivate  DbusTestDbusMockPrivate;
 typedef struct _DbusTestDbusMockObject   DbusTestDbusMockObject;
 typedef struct _DbusTestDbusMockCall     DbusTestDbusMockCall;
 
+typedef enum
+{
+	DBUS_TEST_DBUS_MOCK_BACKEND_PYTHON,
+	DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE
+} DbusTestDbusMockBackend;
+
+typedef void (*DbusTestDbusMockCallFunc) (DbusTestDbusMock *        mock,
+                                          DbusTestDbusMockObject *  obj,
+                                          const gchar *             method,
+                                          gboolean                  called,
+                                          gpointer                  user_data);
+
 struct _DbusTestDbusMockClass {
 	DbusTestProcessClass parent_class;
 };
@@ -61,6 +73,11 @@ GType dbus_test_dbus_mock_get_type (void);
 
 DbusTestDbusMock *          dbus_test_dbus_mock_new                       (const gchar *             bus_name);
 
+void                        dbus_test_dbus_mock_set_backend               (DbusTestDbusMock *        mock,
+                                                                           DbusTestDbusMockBackend   backend);
+
+DbusTestDbusMockBackend     dbus_test_dbus_mock_get_backend               (DbusTestDbusMock *        mock);
+
 
 /* Object stuff */
 
@@ -77,6 +94,12 @@ gboolean                    dbus_test_dbus_mock_object_add_method         (DbusT
                                                                            const gchar *             python_code,
                                                                            GError **                 error);
 
+gboolean                    dbus_test_dbus_mock_object_set_method_return  (DbusTestDbusMock *        mock,
+                                                                           DbusTestDbusMockObject *  obj,
+                                                                           const gchar *             method,
+                                                                           GVariant *                value,
+                                                                           GError **                 error);
+
 gboolean                    dbus_test_dbus_mock_object_check_method_call  (DbusTestDbusMock *        mock,
                                                                            DbusTestDbusMockObject *  obj,
                                                                            const gchar *             method,
@@ -93,6 +116,24 @@ const DbusTestDbusMockCall * dbus_test_dbus_mock_object_get_method_calls  (DbusT
                                                                            guint *                   len,
                                                                            GError **                 error);
 
+gboolean                    dbus_test_dbus_mock_object_wait_for_call      (DbusTestDbusMock *        mock,
+                                                                           DbusTestDbusMockObject *  obj,
+                                                                           const gchar *             method,
+                                                                           GVariant *                params,
+                                                                           guint                     count,
+                                                                           guint                     timeout,
+                                                                           GError **                 error);
+
+gboolean                    dbus_test_dbus_mock_object_wait_for_call_async (DbusTestDbusMock *       mock,
+                                                                           DbusTestDbusMockObject *  obj,
+                                                                           const gchar *             method,
+                                                                           GVariant *                params,
+                                                                           guint                     count,
+                                                                           guint                     timeout,
+                                                                           DbusTestDbusMockCallFunc  func,
+                                                                           gpointer                  user_data,
+                                                                           GError **                 error);
+
 gboolean                    dbus_test_dbus_mock_object_add_property       (DbusTestDbusMock *        mock,
                                                                            DbusTestDbusMockObject *  obj,
                                                                            const gchar *             name,
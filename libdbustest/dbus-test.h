@@ -27,10 +27,14 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 #include <libdbustest/task.h>
+#include <libdbustest/daemon-pool.h>
 #include <libdbustest/service.h>
 #include <libdbustest/process.h>
 #include <libdbustest/bustle.h>
 #include <libdbustest/dbus-mock.h>
+#include <libdbustest/log.h>
+#include <libdbustest/trace.h>
+#include <libdbustest/watchdog.h>
 
 
 #endif /* __DBUS_TEST_H__ */
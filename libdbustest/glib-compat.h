@@ -40,4 +40,8 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
   } G_STMT_END
 #endif
 
+#ifndef G_SOURCE_FUNC
+#define G_SOURCE_FUNC(f) ((GSourceFunc) (void (*)(void)) (f))
+#endif
+
 #endif /* GLIB_COMPAT_H */
@@ -0,0 +1,212 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "guard.h"
+#include "kill.h"
+
+/* Points at a watchdog that isn't installed yet, like the one in the
+   build tree for make check */
+#define WATCHDOG_ENV "DBUS_TEST_WATCHDOG"
+
+/* One watchdog for everything in the process, shards talk to it from
+   their own threads */
+static GMutex guard_lock;
+static gboolean guard_started = FALSE;
+static gint guard_fd = -1;
+static guint guard_deadline = 0;
+
+/* Its end of the socket is close-on-exec like everything else, until
+   it is moved onto stdin */
+static void
+guard_child_setup (gpointer user_data)
+{
+	dup2(GPOINTER_TO_INT(user_data), STDIN_FILENO);
+}
+
+/* Called with the lock held */
+static void
+guard_start (void)
+{
+	gint fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		g_warning("Unable to start the watchdog: %s", g_strerror(errno));
+		return;
+	}
+
+	gchar * grace = g_strdup_printf("%d", DBUS_TEST_KILL_DEFAULT_TIMEOUT);
+	gchar * argv[3];
+	argv[0] = g_getenv(WATCHDOG_ENV) != NULL ? (gchar *)g_getenv(WATCHDOG_ENV) : WATCHDOG;
+	argv[1] = grace;
+	argv[2] = NULL;
+
+	GError * error = NULL;
+
+	/* Without G_SPAWN_DO_NOT_REAP_CHILD it gets double forked, so it
+	   isn't our child and nobody has to reap it */
+	g_spawn_async(NULL, /* cwd */
+	              argv,
+	              NULL, /* env */
+	              0, /* flags */
+	              guard_child_setup, GINT_TO_POINTER(fds[1]), /* Setup function */
+	              NULL, /* PID */
+	              &error);
+
+	g_free(grace);
+	close(fds[1]);
+
+	if (error != NULL) {
+		g_warning("Unable to start the watchdog: %s", error->message);
+		g_error_free(error);
+		close(fds[0]);
+		return;
+	}
+
+	guard_fd = fds[0];
+
+	return;
+}
+
+/* Called with the lock held, @start says whether this is worth
+   starting the watchdog for */
+static void
+guard_send (const gchar * line, gboolean start)
+{
+	if (!guard_started && start) {
+		guard_started = TRUE;
+		guard_start();
+	}
+
+	if (guard_fd < 0) {
+		return;
+	}
+
+	gsize len = strlen(line);
+
+	/* Not a SIGPIPE for us if it went away */
+	if (send(guard_fd, line, len, MSG_NOSIGNAL) != (gssize)len) {
+		g_warning("Lost the watchdog: %s", g_strerror(errno));
+		close(guard_fd);
+		guard_fd = -1;
+	}
+
+	return;
+}
+
+/* Has the watchdog kill @id if we go away first */
+void
+_dbus_test_guard_add (GPid id)
+{
+	g_return_if_fail(id != 0 && id != -1);
+
+	gchar * line = g_strdup_printf("+%d\n", id);
+
+	g_mutex_lock(&guard_lock);
+	guard_send(line, TRUE);
+	g_mutex_unlock(&guard_lock);
+
+	g_free(line);
+	return;
+}
+
+/* @id is gone, or is about to be and we'll wait for it */
+void
+_dbus_test_guard_remove (GPid id)
+{
+	g_return_if_fail(id != 0 && id != -1);
+
+	gchar * line = g_strdup_printf("-%d\n", id);
+
+	g_mutex_lock(&guard_lock);
+	guard_send(line, FALSE);
+	g_mutex_unlock(&guard_lock);
+
+	g_free(line);
+	return;
+}
+
+/* Has the watchdog kill everything in the cgroup at @path if we go
+   away first */
+void
+_dbus_test_guard_add_cgroup (const gchar * path)
+{
+	g_return_if_fail(path != NULL);
+
+	gchar * line = g_strdup_printf("C%s\n", path);
+
+	g_mutex_lock(&guard_lock);
+	guard_send(line, TRUE);
+	g_mutex_unlock(&guard_lock);
+
+	g_free(line);
+	return;
+}
+
+void
+_dbus_test_guard_remove_cgroup (const gchar * path)
+{
+	g_return_if_fail(path != NULL);
+
+	gchar * line = g_strdup_printf("c%s\n", path);
+
+	g_mutex_lock(&guard_lock);
+	guard_send(line, FALSE);
+	g_mutex_unlock(&guard_lock);
+
+	g_free(line);
+	return;
+}
+
+/* After @seconds the watchdog stops waiting for us to go away and
+   kills everything, 0 takes that back */
+void
+_dbus_test_guard_set_deadline (guint seconds)
+{
+	g_mutex_lock(&guard_lock);
+	guard_deadline = seconds;
+	g_mutex_unlock(&guard_lock);
+
+	_dbus_test_guard_ping();
+
+	return;
+}
+
+/* Pushes the deadline back by as much as it was set to */
+void
+_dbus_test_guard_ping (void)
+{
+	g_mutex_lock(&guard_lock);
+
+	gchar * line = g_strdup_printf("D%u\n", guard_deadline);
+	guard_send(line, guard_deadline != 0);
+	g_free(line);
+
+	g_mutex_unlock(&guard_lock);
+
+	return;
+}
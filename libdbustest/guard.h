@@ -0,0 +1,50 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __DBUS_TEST_GUARD_H__
+#define __DBUS_TEST_GUARD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Cleaning up after us when we can't, because we crashed or got a
+   SIGKILL.  A watchdog process of its own, see leash.c, is started
+   the first time anything is guarded and is told about everything we
+   start.  Its end of a socket closes when we go away however that
+   happens, and it then kills whatever we haven't told it is gone.
+   IDs are the same as kill() takes, a negative one being a process
+   group.  They have to be removed before they can be reused, for a
+   process group that is once everything in it has been reaped.  This
+   is internal to the library. */
+
+G_GNUC_INTERNAL
+void _dbus_test_guard_add           (GPid          id);
+G_GNUC_INTERNAL
+void _dbus_test_guard_remove        (GPid          id);
+G_GNUC_INTERNAL
+void _dbus_test_guard_add_cgroup    (const gchar * path);
+G_GNUC_INTERNAL
+void _dbus_test_guard_remove_cgroup (const gchar * path);
+G_GNUC_INTERNAL
+void _dbus_test_guard_set_deadline  (guint         seconds);
+G_GNUC_INTERNAL
+void _dbus_test_guard_ping          (void);
+
+G_END_DECLS
+
+#endif
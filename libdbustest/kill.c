@@ -0,0 +1,183 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include "kill.h"
+
+/* Called in the child before exec.  Puts it in a new process group
+   with the same ID as its PID, which is what gets stopped and what
+   the watchdog kills if we don't get to, see guard.h. */
+void
+_dbus_test_kill_child_init (void)
+{
+	setpgid(0, 0);
+}
+
+/* Child setup for spawning */
+void
+_dbus_test_kill_child_setup (G_GNUC_UNUSED gpointer user_data)
+{
+	_dbus_test_kill_child_init();
+}
+
+/* A pidfd lets us sleep until the process exits, without one we poll.
+   Returns -1 where there are none. */
+gint
+_dbus_test_kill_pidfd_open (GPid pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	return -1;
+#endif
+}
+
+/* Whether the process has exited, without reaping it so that its PID
+   and process group can't be reused yet */
+static gboolean
+has_exited (GPid pid)
+{
+	siginfo_t info;
+	info.si_pid = 0;
+
+	if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0) {
+		/* Not our child any more, nothing to wait on */
+		return errno == ECHILD;
+	}
+
+	return info.si_pid == pid;
+}
+
+/* Waits until @end on the monotonic clock, or forever for G_MAXINT64 */
+static gboolean
+wait_exit (GPid pid, gint pidfd, gint64 end)
+{
+	while (!has_exited(pid)) {
+		gint64 now = g_get_monotonic_time();
+		if (now >= end) {
+			return FALSE;
+		}
+
+		gint wait_ms = MIN((end - now + 999) / 1000, 1000);
+
+		if (pidfd >= 0) {
+			struct pollfd pfd = { .fd = pidfd, .events = POLLIN, .revents = 0 };
+			poll(&pfd, 1, wait_ms);
+		} else {
+			g_usleep(MIN(wait_ms, 5) * 1000);
+		}
+	}
+
+	return TRUE;
+}
+
+/* Sends @signal to the process group of @pid, or the process alone if
+   it doesn't lead one */
+static void
+signal_group (GPid pid, gint signal)
+{
+	if (kill(-pid, signal) != 0) {
+		kill(pid, signal);
+	}
+}
+
+/* Asks a child that we haven't reaped to go away with @signal, gives
+   it @timeout_ms to do that and then kills it.  Anything left in its
+   process group is killed as well and all of it gets reaped.  Any
+   child watch on it has to be gone already. */
+void
+_dbus_test_kill (GPid pid, gint signal, guint timeout_ms)
+{
+	g_return_if_fail(pid > 0);
+
+	signal_group(pid, signal);
+	_dbus_test_kill_finish(pid, g_get_monotonic_time() + (gint64)timeout_ms * 1000);
+
+	return;
+}
+
+/* The rest of _dbus_test_kill() for a child that has already been
+   signalled, with until @deadline on the monotonic clock to exit.
+   Signalling them all first and then finishing each one in turn
+   takes as long as the slowest of them, not all of them added up. */
+void
+_dbus_test_kill_finish (GPid pid, gint64 deadline)
+{
+	g_return_if_fail(pid > 0);
+
+	gint pidfd = _dbus_test_kill_pidfd_open(pid);
+
+	if (!wait_exit(pid, pidfd, deadline)) {
+		signal_group(pid, SIGKILL);
+		wait_exit(pid, pidfd, G_MAXINT64);
+	}
+
+	if (pidfd >= 0) {
+		close(pidfd);
+	}
+
+	/* The zombie holds on to the group ID so this can't hit anyone
+	   else's processes */
+	kill(-pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	while (waitpid(-pid, NULL, WNOHANG) > 0);
+
+	return;
+}
+
+/* Sends @signal to @pid and its process group without waiting, for
+   when a main loop is going to see it exit */
+void
+_dbus_test_kill_signal (GPid pid, gint signal)
+{
+	g_return_if_fail(pid > 0);
+
+	signal_group(pid, signal);
+
+	return;
+}
+
+/* Kills whatever is left in a process group whose leader has already
+   been reaped, and reaps those that ended up as our children.  The
+   group ID stays taken as long as anything is in it. */
+void
+_dbus_test_kill_group (GPid pgid)
+{
+	g_return_if_fail(pgid > 0);
+
+	if (kill(-pgid, SIGKILL) != 0) {
+		return;
+	}
+
+	while (waitpid(-pgid, NULL, WNOHANG) > 0);
+
+	return;
+}
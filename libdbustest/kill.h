@@ -0,0 +1,64 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_KILL_H__
+#define __DBUS_TEST_KILL_H__
+
+#include <glib.h>
+#include "dbus-test.h"
+
+G_BEGIN_DECLS
+
+/* Stopping the processes we start without forking a kill for each.
+   Children get a process group of their own so that whatever they
+   start goes with them when we stop them.  If we crash the watchdog
+   in guard.h stops them instead.  This is internal to the library. */
+
+/* How long a process gets to exit after being asked before it gets
+   a SIGKILL */
+#define DBUS_TEST_KILL_DEFAULT_TIMEOUT  1000
+
+G_GNUC_INTERNAL
+void _dbus_test_kill_child_init  (void);
+G_GNUC_INTERNAL
+void _dbus_test_kill_child_setup (gpointer   user_data);
+G_GNUC_INTERNAL
+void _dbus_test_kill             (GPid       pid,
+                                  gint       signal,
+                                  guint      timeout_ms);
+G_GNUC_INTERNAL
+void _dbus_test_kill_finish      (GPid       pid,
+                                  gint64     deadline);
+G_GNUC_INTERNAL
+void _dbus_test_kill_group       (GPid       pgid);
+G_GNUC_INTERNAL
+void _dbus_test_kill_signal      (GPid       pid,
+                                  gint       signal);
+G_GNUC_INTERNAL
+gint _dbus_test_kill_pidfd_open  (GPid       pid);
+
+/* The task's end of it, for processes stopped for taking too long */
+G_GNUC_INTERNAL
+void _dbus_test_task_set_timed_out (DbusTestTask * task);
+
+/* The process's end of it, signals it to stop ahead of it being
+   disposed so that many can be stopped at once */
+G_GNUC_INTERNAL
+void _dbus_test_process_stop (DbusTestProcess * process);
+
+G_END_DECLS
+
+#endif
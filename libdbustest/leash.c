@@ -17,76 +17,187 @@ You should have received a copy of the GNU General Public License along
 with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <glib.h>
-#include <glib-unix.h>
 
-GMainLoop * mainloop = NULL;
-guint timer = 0;
-pid_t victim = 0;
+/* Started by the library with a socket as stdin, see guard.c.  It
+   gets told which processes, process groups and cgroups to look
+   after, one line each:
 
-static gboolean sigterm_graceful_exit (gpointer user_data);
+     +<id>       guard a process, or a process group as a negative
+                 ID the same as kill() takes
+     -<id>       forget it again
+     C<path>     guard a cgroup directory
+     c<path>     forget it again
+     D<seconds>  give up on whoever started us that many seconds
+                 from now, 0 for never
 
-static gboolean
-destroy_everyone (gpointer user_data)
-{
-	if (victim != 0) {
-		kill(victim, SIGTERM);
-	}
+   When the other end of the socket closes, because whoever started us
+   is gone however that happened, or the deadline passes, everything
+   still guarded gets a SIGTERM, the grace period from the command
+   line to exit and then a SIGKILL. */
 
-	sigterm_graceful_exit(0);
-	return FALSE;
-}
+static GHashTable * guarded = NULL;
+static GHashTable * cgroups = NULL;
+static gint64 deadline = 0;
 
 static void
-restart_handler (void)
+command (const gchar * line)
 {
-	if (timer != 0) {
-		g_source_remove(timer);
+	gint64 value;
+
+	switch (line[0]) {
+	case '+':
+	case '-':
+		value = g_ascii_strtoll(line + 1, NULL, 10);
+		if (value == 0 || value == -1) {
+			break;
+		}
+		if (line[0] == '+') {
+			g_hash_table_add(guarded, GINT_TO_POINTER((gint)value));
+		} else {
+			g_hash_table_remove(guarded, GINT_TO_POINTER((gint)value));
+		}
+		break;
+	case 'C':
+		g_hash_table_add(cgroups, g_strdup(line + 1));
+		break;
+	case 'c':
+		g_hash_table_remove(cgroups, line + 1);
+		break;
+	case 'D':
+		value = g_ascii_strtoll(line + 1, NULL, 10);
+		deadline = value > 0 ? g_get_monotonic_time() + value * G_USEC_PER_SEC : 0;
+		break;
+	default:
+		break;
 	}
 
-	timer = g_timeout_add_seconds(60, destroy_everyone, NULL);
-
 	return;
 }
 
+/* Sends @signal to everything guarded, returns whether any of it is
+   still there */
 static gboolean
-sighup_dont_die (gpointer user_data)
+signal_guarded (gint signal)
 {
-	restart_handler();
-	return TRUE;
+	GHashTableIter iter;
+	gpointer key;
+	gboolean found = FALSE;
+
+	g_hash_table_iter_init(&iter, guarded);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (kill(GPOINTER_TO_INT(key), signal) == 0) {
+			found = TRUE;
+		}
+	}
+
+	return found;
 }
 
-static gboolean
-sigterm_graceful_exit (gpointer user_data)
+static void
+destroy_everyone (guint grace_ms)
 {
-	g_main_loop_quit(mainloop);
-	return FALSE;
+	gint64 end = g_get_monotonic_time() + (gint64)grace_ms * 1000;
+
+	if (signal_guarded(SIGTERM)) {
+		while (g_get_monotonic_time() < end && signal_guarded(0)) {
+			g_usleep(10000);
+		}
+	}
+
+	signal_guarded(SIGKILL);
+
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, cgroups);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		gchar * killfile = g_build_filename((gchar *)key, "cgroup.kill", NULL);
+		gint fd = open(killfile, O_WRONLY);
+		g_free(killfile);
+
+		if (fd >= 0) {
+			if (write(fd, "1", 1) != 1) {
+				g_warning("Unable to kill cgroup '%s': %s", (gchar *)key, g_strerror(errno));
+			}
+			close(fd);
+		}
+	}
+
+	return;
 }
 
 int
 main (int argc, char * argv[])
 {
 	if (argc != 2) {
-		g_critical("Need a PID to kill");
+		g_critical("Need a grace period in milliseconds");
 		return -1;
 	}
 
-#ifndef GLIB_VERSION_2_36
-	g_type_init();
-#endif
+	guint grace_ms = atoi(argv[1]);
+
+	/* Signals for whoever started us aren't for us */
+	setpgid(0, 0);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGHUP, SIG_IGN);
+
+	guarded = g_hash_table_new(g_direct_hash, g_direct_equal);
+	cgroups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	GString * buffer = g_string_new(NULL);
 
-	g_unix_signal_add (SIGTERM, sigterm_graceful_exit, NULL);
-	g_unix_signal_add (SIGHUP, sighup_dont_die, NULL);
+	while (TRUE) {
+		gint wait_ms = -1;
 
-	victim = atoi(argv[1]);
+		if (deadline != 0) {
+			gint64 now = g_get_monotonic_time();
+			if (now >= deadline) {
+				g_warning("Deadline passed, killing everything that is left");
+				break;
+			}
+			wait_ms = MIN((deadline - now + 999) / 1000, G_MAXINT);
+		}
 
-	restart_handler();
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN, .revents = 0 };
+		if (poll(&pfd, 1, wait_ms) == 0) {
+			continue;
+		}
 
-	mainloop = g_main_loop_new(NULL, FALSE);
-	g_main_loop_run(mainloop);
+		gchar chunk[4096];
+		gssize len = read(STDIN_FILENO, chunk, sizeof(chunk));
 
-	g_main_loop_unref(mainloop);
+		if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+			continue;
+		}
+
+		if (len <= 0) {
+			break;
+		}
+
+		g_string_append_len(buffer, chunk, len);
+
+		gchar * newline;
+		while ((newline = memchr(buffer->str, '\n', buffer->len)) != NULL) {
+			*newline = '\0';
+			command(buffer->str);
+			g_string_erase(buffer, 0, newline - buffer->str + 1);
+		}
+	}
+
+	destroy_everyone(grace_ms);
+
+	g_string_free(buffer, TRUE);
+	g_hash_table_destroy(cgroups);
+	g_hash_table_destroy(guarded);
 
 	return 0;
 }
-
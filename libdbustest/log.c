@@ -0,0 +1,139 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dbus-test.h"
+#include "output.h"
+
+/* One log for everything in the process, shards write to it from
+   their own threads */
+static GMutex log_lock;
+static FILE * log_file = NULL;
+static gint64 log_start = 0;
+static gint log_enabled = FALSE;
+
+/**
+ * dbus_test_log_open:
+ * @filename: File to write the log to, replacing what's there
+ * @error: Where to put an error if it can't be opened
+ *
+ * Starts writing the output of every task to @filename as well,
+ * each line with the time it was read, the task's name and which
+ * stream it came from.  Times are seconds on the monotonic clock
+ * since the log was opened.  Lines from all the tasks go into the
+ * one file in the order they were read.
+ *
+ * Return value: Whether the log was opened
+ */
+gboolean
+dbus_test_log_open (const gchar * filename, GError ** error)
+{
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	FILE * file = g_fopen(filename, "w");
+	if (file == NULL) {
+		gint errsv = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv), "Unable to open log file '%s': %s", filename, g_strerror(errsv));
+		return FALSE;
+	}
+
+	g_mutex_lock(&log_lock);
+
+	if (log_file != NULL) {
+		fclose(log_file);
+	}
+
+	log_file = file;
+	log_start = g_get_monotonic_time();
+	g_atomic_int_set(&log_enabled, TRUE);
+
+	g_mutex_unlock(&log_lock);
+
+	return TRUE;
+}
+
+/**
+ * dbus_test_log_close:
+ *
+ * Stops writing the log opened with dbus_test_log_open().
+ */
+void
+dbus_test_log_close (void)
+{
+	g_mutex_lock(&log_lock);
+
+	g_atomic_int_set(&log_enabled, FALSE);
+
+	if (log_file != NULL) {
+		fclose(log_file);
+		log_file = NULL;
+	}
+
+	g_mutex_unlock(&log_lock);
+
+	return;
+}
+
+/* Writes each line in @text, which came in together, with one time
+   stamp.  The time is taken under the lock so the file stays in
+   order. */
+void
+_dbus_test_log_write (const gchar * source, const gchar * stream, const gchar * text, gsize len)
+{
+	if (!g_atomic_int_get(&log_enabled) || len == 0) {
+		return;
+	}
+
+	g_mutex_lock(&log_lock);
+
+	if (log_file == NULL) {
+		g_mutex_unlock(&log_lock);
+		return;
+	}
+
+	gint64 stamp = g_get_monotonic_time() - log_start;
+	gchar * prefix = g_strdup_printf("%" G_GINT64_FORMAT ".%06d %s %s: ", stamp / G_USEC_PER_SEC, (gint)(stamp % G_USEC_PER_SEC), source, stream);
+	gsize prefix_len = strlen(prefix);
+
+	const gchar * end = text + len;
+	while (text < end) {
+		const gchar * newline = memchr(text, '\n', end - text);
+		const gchar * line_end = newline != NULL ? newline : end;
+
+		fwrite(prefix, 1, prefix_len, log_file);
+		fwrite(text, 1, line_end - text, log_file);
+		fputc('\n', log_file);
+
+		text = newline != NULL ? newline + 1 : end;
+	}
+
+	fflush(log_file);
+
+	g_mutex_unlock(&log_lock);
+	g_free(prefix);
+
+	return;
+}
@@ -0,0 +1,33 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_LOG_H__
+#define __DBUS_TEST_LOG_H__
+
+#ifndef __DBUS_TEST_TOP_LEVEL__
+#error "Please include #include <libdbustest/dbus-test.h> only"
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean dbus_test_log_open  (const gchar * filename, GError ** error);
+void     dbus_test_log_close (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,1229 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "mock-engine.h"
+
+/* From the D-Bus specification, for RequestName */
+#define NAME_FLAG_DO_NOT_QUEUE      0x4
+#define NAME_REPLY_PRIMARY_OWNER    1
+#define NAME_REPLY_ALREADY_OWNER    4
+
+struct _DbusTestMockEngine {
+	GMainContext * context;
+	GMainLoop * loop;
+	GThread * thread;
+
+	/* For callers waiting on the thread */
+	GMutex lock;
+	GCond done;
+
+	/* Adds waiting to go over together, of engine_queued_t, and how
+	   many batches are open */
+	GQueue batch;
+	guint batch_depth;
+
+	GDBusConnection * connection;
+	/* Object path to engine_object_t */
+	GHashTable * objects;
+	/* Object path to a table of method name to a GArray of
+	   DbusTestDbusMockCall, so a method's calls are in one place */
+	GHashTable * calls;
+};
+
+typedef struct {
+	gchar * name;
+	GVariantType * in;
+	GVariantType * out;
+	/* Always a tuple of the out parameters */
+	GVariant * reply;
+} engine_method_t;
+
+typedef struct {
+	gchar * name;
+	GVariantType * type;
+	GVariant * value;
+} engine_property_t;
+
+/* An interface on an object, its members are found by name when
+   the calls come */
+typedef struct {
+	DbusTestMockEngine * engine;
+	gchar * path;
+	gchar * interface;
+	/* Name to engine_method_t */
+	GHashTable * methods;
+	/* Name to engine_property_t */
+	GHashTable * properties;
+	/* What GDBus checks calls against, built when it is next asked for
+	   after the members change */
+	GDBusInterfaceInfo * info;
+} engine_iface_t;
+
+/* A path on the bus, registered once as a subtree so that GDBus asks
+   us about its interfaces on each call rather than being told them
+   again each time one changes */
+typedef struct {
+	DbusTestMockEngine * engine;
+	/* Interface name to engine_iface_t */
+	GHashTable * interfaces;
+	guint registration;
+} engine_object_t;
+
+/* The arguments of whatever is being done on the thread */
+typedef struct {
+	const gchar * path;
+	const gchar * interface;
+	const gchar * name;
+	const GVariantType * in;
+	const GVariantType * out;
+	GVariant * value;
+	GArray * calls;
+	guint since;
+} engine_op_t;
+
+typedef gboolean (*EngineOp) (DbusTestMockEngine * engine, engine_op_t * op, GError ** error);
+
+typedef struct {
+	DbusTestMockEngine * engine;
+	EngineOp func;
+	engine_op_t * op;
+	GError * error;
+	gboolean result;
+	gboolean done;
+} engine_call_t;
+
+/* An op in a batch, with its own copy of the arguments */
+typedef struct {
+	EngineOp func;
+	engine_op_t op;
+} engine_queued_t;
+
+static void
+method_free (gpointer data)
+{
+	engine_method_t * method = (engine_method_t *)data;
+
+	g_free(method->name);
+	if (method->in != NULL) {
+		g_variant_type_free(method->in);
+	}
+	if (method->out != NULL) {
+		g_variant_type_free(method->out);
+	}
+	g_variant_unref(method->reply);
+	g_free(method);
+
+	return;
+}
+
+static void
+property_free (gpointer data)
+{
+	engine_property_t * property = (engine_property_t *)data;
+
+	g_free(property->name);
+	g_variant_type_free(property->type);
+	g_variant_unref(property->value);
+	g_free(property);
+
+	return;
+}
+
+static void
+call_clear (gpointer data)
+{
+	DbusTestDbusMockCall * call = (DbusTestDbusMockCall *)data;
+
+	g_free((gchar *)call->name);
+	g_variant_unref(call->params);
+
+	return;
+}
+
+/* The members changed, GDBus gets told the next time it asks */
+static void
+iface_changed (engine_iface_t * iface)
+{
+	if (iface->info != NULL) {
+		g_dbus_interface_info_cache_release(iface->info);
+		g_dbus_interface_info_unref(iface->info);
+		iface->info = NULL;
+	}
+
+	return;
+}
+
+static void
+iface_free (gpointer data)
+{
+	engine_iface_t * iface = (engine_iface_t *)data;
+
+	iface_changed(iface);
+
+	g_free(iface->path);
+	g_free(iface->interface);
+	g_hash_table_destroy(iface->methods);
+	g_hash_table_destroy(iface->properties);
+	g_free(iface);
+
+	return;
+}
+
+static void
+object_free (gpointer data)
+{
+	engine_object_t * object = (engine_object_t *)data;
+
+	if (object->registration != 0) {
+		g_dbus_connection_unregister_subtree(object->engine->connection, object->registration);
+	}
+
+	g_hash_table_destroy(object->interfaces);
+	g_free(object);
+
+	return;
+}
+
+static engine_iface_t *
+iface_lookup (DbusTestMockEngine * engine, const gchar * path, const gchar * interface, GError ** error)
+{
+	engine_object_t * object = g_hash_table_lookup(engine->objects, path);
+	engine_iface_t * iface = object != NULL ? g_hash_table_lookup(object->interfaces, interface) : NULL;
+
+	if (iface == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No object '%s' with interface '%s'", path, interface);
+	}
+
+	return iface;
+}
+
+static inline engine_method_t *
+iface_method (engine_iface_t * iface, const gchar * name)
+{
+	return g_hash_table_lookup(iface->methods, name);
+}
+
+static inline engine_property_t *
+iface_property (engine_iface_t * iface, const gchar * name)
+{
+	return g_hash_table_lookup(iface->properties, name);
+}
+
+/* Whether @type can go on the bus, no type at all is no parameters */
+static gboolean
+type_is_dbus (const GVariantType * type, GError ** error)
+{
+	if (type == NULL) {
+		return TRUE;
+	}
+
+	gchar * signature = g_variant_type_dup_string(type);
+	gboolean valid = g_variant_is_signature(signature);
+
+	if (!valid) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Type '%s' isn't a D-Bus signature", signature);
+	}
+
+	g_free(signature);
+	return valid;
+}
+
+/* All zeros and empty, as a full reference */
+static GVariant *
+type_default (const GVariantType * type)
+{
+	GVariant * empty = g_variant_ref_sink(g_variant_new_from_data(type, NULL, 0, FALSE, NULL, NULL));
+	GVariant * value = g_variant_take_ref(g_variant_get_normal_form(empty));
+	g_variant_unref(empty);
+
+	return value;
+}
+
+/* Methods take their types like DBusMock does, a tuple or a single
+   type, but always reply with a tuple.  @value is what to reply with
+   in the out type, NULL for its default. */
+static GVariant *
+method_reply (const GVariantType * out, GVariant * value, GError ** error)
+{
+	GVariant * reply = NULL;
+
+	if (value == NULL) {
+		if (out != NULL && g_variant_type_is_tuple(out)) {
+			return type_default(out);
+		}
+
+		if (out == NULL) {
+			reply = g_variant_new_tuple(NULL, 0);
+		} else {
+			GVariant * child = type_default(out);
+			reply = g_variant_new_tuple(&child, 1);
+			g_variant_unref(child);
+		}
+
+		return g_variant_ref_sink(reply);
+	}
+
+	if (out == NULL) {
+		if (g_variant_is_of_type(value, G_VARIANT_TYPE_UNIT)) {
+			reply = value;
+		}
+	} else if (g_variant_type_is_tuple(out)) {
+		if (g_variant_is_of_type(value, out)) {
+			reply = value;
+		}
+	} else if (g_variant_is_of_type(value, out)) {
+		reply = g_variant_new_tuple(&value, 1);
+	}
+
+	if (reply == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Return value of type '%s' doesn't match the method", g_variant_get_type_string(value));
+		return NULL;
+	}
+
+	return g_variant_ref_sink(reply);
+}
+
+static void
+engine_log_call (DbusTestMockEngine * engine, const gchar * path, const gchar * method, GVariant * params)
+{
+	GHashTable * methods = g_hash_table_lookup(engine->calls, path);
+
+	if (methods == NULL) {
+		methods = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+		g_hash_table_insert(engine->calls, g_strdup(path), methods);
+	}
+
+	GArray * calls = g_hash_table_lookup(methods, method);
+
+	if (calls == NULL) {
+		calls = g_array_new(FALSE, TRUE, sizeof(DbusTestDbusMockCall));
+		g_array_set_clear_func(calls, call_clear);
+		g_hash_table_insert(methods, g_strdup(method), calls);
+	}
+
+	/* Seconds, like DBusMock gives us */
+	DbusTestDbusMockCall call = {
+		.timestamp = g_get_real_time() / G_USEC_PER_SEC,
+		.name = g_strdup(method),
+		.params = g_variant_ref(params)
+	};
+
+	g_array_append_val(calls, call);
+
+	/* Tell whoever is waiting on calls, the way DBusMock does */
+	GVariantBuilder args;
+	GVariantIter iter;
+	GVariant * param;
+
+	g_variant_builder_init(&args, G_VARIANT_TYPE("av"));
+	g_variant_iter_init(&iter, params);
+	while ((param = g_variant_iter_next_value(&iter)) != NULL) {
+		g_variant_builder_add(&args, "v", param);
+		g_variant_unref(param);
+	}
+
+	g_dbus_connection_emit_signal(engine->connection,
+		NULL, /* destination */
+		path,
+		"org.freedesktop.DBus.Mock",
+		"MethodCalled",
+		g_variant_new("(sav)", method, &args),
+		NULL);
+
+	return;
+}
+
+static void
+iface_method_call (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, const gchar * path, G_GNUC_UNUSED const gchar * interface, const gchar * name, GVariant * params, GDBusMethodInvocation * invocation, gpointer user_data)
+{
+	engine_iface_t * iface = (engine_iface_t *)user_data;
+	engine_method_t * method = iface_method(iface, name);
+
+	if (method == NULL) {
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "No method '%s'", name);
+		return;
+	}
+
+	engine_log_call(iface->engine, path, name, params);
+	g_dbus_method_invocation_return_value(invocation, method->reply);
+
+	return;
+}
+
+static void
+iface_emit_changed (engine_iface_t * iface, engine_property_t * property)
+{
+	GVariantBuilder changed;
+	g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&changed, "{sv}", property->name, property->value);
+
+	g_dbus_connection_emit_signal(iface->engine->connection,
+		NULL, /* destination */
+		iface->path,
+		"org.freedesktop.DBus.Properties",
+		"PropertiesChanged",
+		g_variant_new("(sa{sv}@as)", iface->interface, &changed, g_variant_new_array(G_VARIANT_TYPE_STRING, NULL, 0)),
+		NULL);
+
+	return;
+}
+
+static GVariant *
+iface_get_property (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, G_GNUC_UNUSED const gchar * path, G_GNUC_UNUSED const gchar * interface, const gchar * name, GError ** error, gpointer user_data)
+{
+	engine_iface_t * iface = (engine_iface_t *)user_data;
+	engine_property_t * property = iface_property(iface, name);
+
+	if (property == NULL) {
+		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "No property '%s'", name);
+		return NULL;
+	}
+
+	return g_variant_ref(property->value);
+}
+
+/* The type is checked against the introspection before we get it */
+static gboolean
+iface_set_property (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, G_GNUC_UNUSED const gchar * path, G_GNUC_UNUSED const gchar * interface, const gchar * name, GVariant * value, GError ** error, gpointer user_data)
+{
+	engine_iface_t * iface = (engine_iface_t *)user_data;
+	engine_property_t * property = iface_property(iface, name);
+
+	if (property == NULL) {
+		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "No property '%s'", name);
+		return FALSE;
+	}
+
+	g_variant_unref(property->value);
+	property->value = g_variant_ref(value);
+	iface_emit_changed(iface, property);
+
+	return TRUE;
+}
+
+static const GDBusInterfaceVTable iface_vtable = {
+	iface_method_call,
+	iface_get_property,
+	iface_set_property,
+	{ NULL }
+};
+
+static void
+xml_args (GString * xml, const GVariantType * type, const gchar * direction)
+{
+	if (type == NULL) {
+		return;
+	}
+
+	if (!g_variant_type_is_tuple(type)) {
+		gchar * signature = g_variant_type_dup_string(type);
+		g_string_append_printf(xml, "<arg direction=\"%s\" type=\"%s\"/>", direction, signature);
+		g_free(signature);
+		return;
+	}
+
+	const GVariantType * child;
+	for (child = g_variant_type_first(type); child != NULL; child = g_variant_type_next(child)) {
+		xml_args(xml, child, direction);
+	}
+
+	return;
+}
+
+/* GDBus checks each call against the description of the interface.
+   It is only built when GDBus asks after a change, so adding members
+   one at a time doesn't build it again for each. */
+static GDBusInterfaceInfo *
+iface_info (engine_iface_t * iface, GError ** error)
+{
+	if (iface->info != NULL) {
+		return iface->info;
+	}
+
+	GString * xml = g_string_new(NULL);
+	GHashTableIter iter;
+	gpointer value;
+
+	g_string_append_printf(xml, "<node><interface name=\"%s\">", iface->interface);
+
+	g_hash_table_iter_init(&iter, iface->methods);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		engine_method_t * method = (engine_method_t *)value;
+
+		g_string_append_printf(xml, "<method name=\"%s\">", method->name);
+		xml_args(xml, method->in, "in");
+		xml_args(xml, method->out, "out");
+		g_string_append(xml, "</method>");
+	}
+
+	g_hash_table_iter_init(&iter, iface->properties);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		engine_property_t * property = (engine_property_t *)value;
+		gchar * signature = g_variant_type_dup_string(property->type);
+
+		g_string_append_printf(xml, "<property name=\"%s\" type=\"%s\" access=\"readwrite\"/>", property->name, signature);
+		g_free(signature);
+	}
+
+	g_string_append(xml, "</interface></node>");
+
+	GDBusNodeInfo * node = g_dbus_node_info_new_for_xml(xml->str, error);
+	g_string_free(xml, TRUE);
+
+	if (node == NULL) {
+		return NULL;
+	}
+
+	/* Members are looked up in it for every call */
+	iface->info = g_dbus_interface_info_ref(node->interfaces[0]);
+	g_dbus_interface_info_cache_build(iface->info);
+	g_dbus_node_info_unref(node);
+
+	return iface->info;
+}
+
+/* Each path is registered on its own, there is nothing under it */
+static gchar **
+object_enumerate (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, G_GNUC_UNUSED const gchar * path, G_GNUC_UNUSED gpointer user_data)
+{
+	return g_new0(gchar *, 1);
+}
+
+static GDBusInterfaceInfo **
+object_introspect (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, G_GNUC_UNUSED const gchar * path, const gchar * node, gpointer user_data)
+{
+	engine_object_t * object = (engine_object_t *)user_data;
+
+	if (node != NULL) {
+		return NULL;
+	}
+
+	GPtrArray * infos = g_ptr_array_new();
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, object->interfaces);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		engine_iface_t * iface = (engine_iface_t *)value;
+		GError * error = NULL;
+		GDBusInterfaceInfo * info = iface_info(iface, &error);
+
+		if (info == NULL) {
+			g_warning("Unable to describe interface '%s' on '%s': %s", iface->interface, iface->path, error->message);
+			g_error_free(error);
+			continue;
+		}
+
+		g_ptr_array_add(infos, g_dbus_interface_info_ref(info));
+	}
+
+	g_ptr_array_add(infos, NULL);
+
+	return (GDBusInterfaceInfo **)g_ptr_array_free(infos, FALSE);
+}
+
+static const GDBusInterfaceVTable *
+object_dispatch (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * sender, G_GNUC_UNUSED const gchar * path, const gchar * interface, const gchar * node, gpointer * out_user_data, gpointer user_data)
+{
+	engine_object_t * object = (engine_object_t *)user_data;
+	engine_iface_t * iface = NULL;
+
+	if (node == NULL && interface != NULL) {
+		iface = g_hash_table_lookup(object->interfaces, interface);
+	}
+
+	if (iface == NULL) {
+		return NULL;
+	}
+
+	*out_user_data = iface;
+	return &iface_vtable;
+}
+
+static const GDBusSubtreeVTable object_vtable = {
+	object_enumerate,
+	object_introspect,
+	object_dispatch,
+	{ NULL }
+};
+
+/* Runs on our thread */
+static gboolean
+engine_dispatch (gpointer data)
+{
+	engine_call_t * call = (engine_call_t *)data;
+	DbusTestMockEngine * engine = call->engine;
+
+	/* Whichever thread this ends up on, what gets registered answers
+	   on ours */
+	g_main_context_push_thread_default(engine->context);
+	call->result = call->func(engine, call->op, &call->error);
+	g_main_context_pop_thread_default(engine->context);
+
+	g_mutex_lock(&engine->lock);
+	call->done = TRUE;
+	g_cond_broadcast(&engine->done);
+	g_mutex_unlock(&engine->lock);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Does @func on our thread and waits for it */
+static gboolean
+engine_run (DbusTestMockEngine * engine, EngineOp func, engine_op_t * op, GError ** error)
+{
+	/* Already there, which is the case for anything our callbacks do */
+	if (g_main_context_is_owner(engine->context)) {
+		return func(engine, op, error);
+	}
+
+	engine_call_t call = {
+		.engine = engine,
+		.func = func,
+		.op = op,
+		.error = NULL,
+		.result = FALSE,
+		.done = FALSE
+	};
+
+	g_main_context_invoke(engine->context, engine_dispatch, &call);
+
+	g_mutex_lock(&engine->lock);
+	while (!call.done) {
+		g_cond_wait(&engine->done, &engine->lock);
+	}
+	g_mutex_unlock(&engine->lock);
+
+	if (call.error != NULL) {
+		g_propagate_error(error, call.error);
+	}
+
+	return call.result;
+}
+
+static void
+queued_free (gpointer data)
+{
+	engine_queued_t * queued = (engine_queued_t *)data;
+
+	g_free((gchar *)queued->op.path);
+	g_free((gchar *)queued->op.interface);
+	g_free((gchar *)queued->op.name);
+	if (queued->op.in != NULL) {
+		g_variant_type_free((GVariantType *)queued->op.in);
+	}
+	if (queued->op.out != NULL) {
+		g_variant_type_free((GVariantType *)queued->op.out);
+	}
+	if (queued->op.value != NULL) {
+		g_variant_unref(queued->op.value);
+	}
+	g_free(queued);
+
+	return;
+}
+
+/* Does @func on our thread, or if there is a batch open adds it to
+   that.  It's done then, and any error comes from ending the batch. */
+static gboolean
+engine_submit (DbusTestMockEngine * engine, EngineOp func, engine_op_t * op, GError ** error)
+{
+	if (engine->batch_depth == 0) {
+		return engine_run(engine, func, op, error);
+	}
+
+	engine_queued_t * queued = g_new0(engine_queued_t, 1);
+	queued->func = func;
+	queued->op.path = g_strdup(op->path);
+	queued->op.interface = g_strdup(op->interface);
+	queued->op.name = g_strdup(op->name);
+	queued->op.in = op->in != NULL ? g_variant_type_copy(op->in) : NULL;
+	queued->op.out = op->out != NULL ? g_variant_type_copy(op->out) : NULL;
+	queued->op.value = op->value != NULL ? g_variant_ref_sink(op->value) : NULL;
+
+	g_queue_push_tail(&engine->batch, queued);
+
+	return TRUE;
+}
+
+/* Goes through all of them so one bad object doesn't keep the rest
+   off the bus, the first error is the one we tell about */
+static gboolean
+op_batch (DbusTestMockEngine * engine, G_GNUC_UNUSED engine_op_t * op, GError ** error)
+{
+	gboolean result = TRUE;
+	engine_queued_t * queued;
+
+	while ((queued = g_queue_pop_head(&engine->batch)) != NULL) {
+		GError * local = NULL;
+
+		if (!queued->func(engine, &queued->op, &local)) {
+			if (result) {
+				g_propagate_error(error, local);
+			} else {
+				g_error_free(local);
+			}
+			result = FALSE;
+		}
+
+		queued_free(queued);
+	}
+
+	return result;
+}
+
+static gpointer
+engine_thread (gpointer data)
+{
+	DbusTestMockEngine * engine = (DbusTestMockEngine *)data;
+
+	g_main_context_push_thread_default(engine->context);
+	g_main_loop_run(engine->loop);
+	g_main_context_pop_thread_default(engine->context);
+
+	return NULL;
+}
+
+static gboolean
+op_connect (DbusTestMockEngine * engine, engine_op_t * op, GError ** error)
+{
+	engine->connection = g_dbus_connection_new_for_address_sync(op->name,
+		G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+		NULL, /* observer */
+		NULL, /* cancel */
+		error);
+
+	return engine->connection != NULL;
+}
+
+/* Takes everything off the bus while the connection is still there */
+static gboolean
+op_shutdown (DbusTestMockEngine * engine, G_GNUC_UNUSED engine_op_t * op, G_GNUC_UNUSED GError ** error)
+{
+	g_hash_table_remove_all(engine->objects);
+	g_hash_table_remove_all(engine->calls);
+
+	return TRUE;
+}
+
+/* Connects to the bus at @address, the name comes later so that
+   the objects are there before anyone can see it */
+DbusTestMockEngine *
+_dbus_test_mock_engine_new (const gchar * address, GError ** error)
+{
+	g_return_val_if_fail(address != NULL, NULL);
+
+	DbusTestMockEngine * engine = g_new0(DbusTestMockEngine, 1);
+
+	engine->context = g_main_context_new();
+	engine->loop = g_main_loop_new(engine->context, FALSE);
+	g_mutex_init(&engine->lock);
+	g_cond_init(&engine->done);
+	g_queue_init(&engine->batch);
+	engine->batch_depth = 0;
+
+	engine->objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, object_free);
+	engine->calls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_destroy);
+
+	engine->thread = g_thread_new("dbus-mock", engine_thread, engine);
+
+	engine_op_t op = { .name = address };
+	if (!engine_run(engine, op_connect, &op, error)) {
+		_dbus_test_mock_engine_free(engine);
+		return NULL;
+	}
+
+	return engine;
+}
+
+void
+_dbus_test_mock_engine_free (DbusTestMockEngine * engine)
+{
+	g_return_if_fail(engine != NULL);
+
+	engine_op_t op = { 0 };
+	engine_run(engine, op_shutdown, &op, NULL);
+
+	/* A batch that was never ended */
+	g_queue_foreach(&engine->batch, (GFunc)queued_free, NULL);
+	g_queue_clear(&engine->batch);
+
+	g_main_loop_quit(engine->loop);
+	g_thread_join(engine->thread);
+
+	if (engine->connection != NULL) {
+		g_dbus_connection_close_sync(engine->connection, NULL, NULL);
+		g_object_unref(engine->connection);
+	}
+
+	g_hash_table_destroy(engine->objects);
+	g_hash_table_destroy(engine->calls);
+
+	g_main_loop_unref(engine->loop);
+	g_main_context_unref(engine->context);
+
+	g_mutex_clear(&engine->lock);
+	g_cond_clear(&engine->done);
+
+	g_free(engine);
+
+	return;
+}
+
+/* Doesn't queue, someone else having it is an error like it would
+   be for DBusMock */
+gboolean
+_dbus_test_mock_engine_own_name (DbusTestMockEngine * engine, const gchar * name, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(name != NULL, FALSE);
+
+	GVariant * reply = g_dbus_connection_call_sync(engine->connection,
+		"org.freedesktop.DBus",
+		"/org/freedesktop/DBus",
+		"org.freedesktop.DBus",
+		"RequestName",
+		g_variant_new("(su)", name, NAME_FLAG_DO_NOT_QUEUE),
+		G_VARIANT_TYPE("(u)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1, /* timeout */
+		NULL, /* cancel */
+		error);
+
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	guint32 result = 0;
+	g_variant_get(reply, "(u)", &result);
+	g_variant_unref(reply);
+
+	if (result != NAME_REPLY_PRIMARY_OWNER && result != NAME_REPLY_ALREADY_OWNER) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "Name '%s' is already owned", name);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The path is registered the first time, after that its interfaces
+   only need to be in the table for GDBus to find them */
+/* Until the matching end, adds are held to go over all at once rather
+   than each waiting on our thread.  They can be nested, only the last
+   end sends them. */
+void
+_dbus_test_mock_engine_batch_begin (DbusTestMockEngine * engine)
+{
+	g_return_if_fail(engine != NULL);
+
+	engine->batch_depth++;
+
+	return;
+}
+
+/* Whether everything in the batch worked, always so for an inner one */
+gboolean
+_dbus_test_mock_engine_batch_end (DbusTestMockEngine * engine, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(engine->batch_depth > 0, FALSE);
+
+	engine->batch_depth--;
+
+	if (engine->batch_depth > 0 || g_queue_is_empty(&engine->batch)) {
+		return TRUE;
+	}
+
+	engine_op_t op = { 0 };
+	return engine_run(engine, op_batch, &op, error);
+}
+
+static gboolean
+op_add_object (DbusTestMockEngine * engine, engine_op_t * op, GError ** error)
+{
+	if (!g_variant_is_object_path(op->path)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "'%s' isn't a valid object path", op->path);
+		return FALSE;
+	}
+
+	if (!g_dbus_is_interface_name(op->interface)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "'%s' isn't a valid interface name", op->interface);
+		return FALSE;
+	}
+
+	engine_object_t * object = g_hash_table_lookup(engine->objects, op->path);
+
+	if (object == NULL) {
+		object = g_new0(engine_object_t, 1);
+		object->engine = engine;
+		object->interfaces = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, iface_free);
+
+		object->registration = g_dbus_connection_register_subtree(engine->connection,
+			op->path,
+			&object_vtable,
+			G_DBUS_SUBTREE_FLAGS_NONE,
+			object,
+			NULL, /* free func */
+			error);
+
+		if (object->registration == 0) {
+			object_free(object);
+			return FALSE;
+		}
+
+		g_hash_table_insert(engine->objects, g_strdup(op->path), object);
+	}
+
+	if (g_hash_table_contains(object->interfaces, op->interface)) {
+		return TRUE;
+	}
+
+	engine_iface_t * iface = g_new0(engine_iface_t, 1);
+	iface->engine = engine;
+	iface->path = g_strdup(op->path);
+	iface->interface = g_strdup(op->interface);
+	iface->methods = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, method_free);
+	iface->properties = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, property_free);
+
+	/* Keyed on the name in the interface */
+	g_hash_table_insert(object->interfaces, iface->interface, iface);
+
+	return TRUE;
+}
+
+gboolean
+_dbus_test_mock_engine_add_object (DbusTestMockEngine * engine, const gchar * path, const gchar * interface, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(interface != NULL, FALSE);
+
+	engine_op_t op = { .path = path, .interface = interface };
+	return engine_submit(engine, op_add_object, &op, error);
+}
+
+static gboolean
+op_add_method (DbusTestMockEngine * engine, engine_op_t * op, GError ** error)
+{
+	engine_iface_t * iface = iface_lookup(engine, op->path, op->interface, error);
+	if (iface == NULL) {
+		return FALSE;
+	}
+
+	if (iface_method(iface, op->name) != NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "Method '%s' already exists", op->name);
+		return FALSE;
+	}
+
+	if (!g_dbus_is_member_name(op->name)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "'%s' isn't a valid method name", op->name);
+		return FALSE;
+	}
+
+	if (!type_is_dbus(op->in, error) || !type_is_dbus(op->out, error)) {
+		return FALSE;
+	}
+
+	GVariant * reply = method_reply(op->out, op->value, error);
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	engine_method_t * method = g_new0(engine_method_t, 1);
+	method->name = g_strdup(op->name);
+	method->in = op->in != NULL ? g_variant_type_copy(op->in) : NULL;
+	method->out = op->out != NULL ? g_variant_type_copy(op->out) : NULL;
+	method->reply = reply;
+
+	/* Keyed on the name in the method */
+	g_hash_table_insert(iface->methods, method->name, method);
+	iface_changed(iface);
+
+	return TRUE;
+}
+
+/* @ret is in the out type, NULL to reply with zeros and empties */
+gboolean
+_dbus_test_mock_engine_add_method (DbusTestMockEngine * engine, const gchar * path, const gchar * interface, const gchar * method, const GVariantType * in, const GVariantType * out, GVariant * ret, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(interface != NULL, FALSE);
+	g_return_val_if_fail(method != NULL, FALSE);
+
+	engine_op_t op = {
+		.path = path,
+		.interface = interface,
+		.name = method,
+		.in = in,
+		.out = out,
+		.value = ret
+	};
+	return engine_submit(engine, op_add_method, &op, error);
+}
+
+static gboolean
+op_set_return (DbusTestMockEngine * engine, engine_op_t * op, GError ** error)
+{
+	engine_iface_t * iface = iface_lookup(engine, op->path, op->interface, error);
+	if (iface == NULL) {
+		return FALSE;
+	}
+
+	engine_method_t * method = iface_method(iface, op->name);
+	if (method == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No method '%s'", op->name);
+		return FALSE;
+	}
+
+	GVariant * reply = method_reply(method->out, op->value, error);
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	g_variant_unref(method->reply);
+	method->reply = reply;
+
+	return TRUE;
+}
+
+gboolean
+_dbus_test_mock_engine_set_return (DbusTestMockEngine * engine, const gchar * path, const gchar * interface, const gchar * method, GVariant * ret, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(interface != NULL, FALSE);
+	g_return_val_if_fail(method != NULL, FALSE);
+
+	engine_op_t op = {
+		.path = path,
+		.interface = interface,
+		.name = method,
+		.value = ret
+	};
+	return engine_run(engine, op_set_return, &op, error);
+}
+
+static gboolean
+op_add_property (DbusTestMockEngine * engine, engine_op_t * op, GError ** error)
+{
+	engine_iface_t * iface = iface_lookup(engine, op->path, op->interface, error);
+	if (iface == NULL) {
+		return FALSE;
+	}
+
+	if (iface_property(iface, op->name) != NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "Property '%s' already exists", op->name);
+		return FALSE;
+	}
+
+	if (!g_dbus_is_member_name(op->name)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "'%s' isn't a valid property name", op->name);
+		return FALSE;
+	}
+
+	if (!type_is_dbus(g_variant_get_type(op->value), error)) {
+		return FALSE;
+	}
+
+	engine_property_t * property = g_new0(engine_property_t, 1);
+	property->name = g_strdup(op->name);
+	property->type = g_variant_type_copy(g_variant_get_type(op->value));
+	property->value = g_variant_ref(op->value);
+
+	/* Keyed on the name in the property */
+	g_hash_table_insert(iface->properties, property->name, property);
+	iface_changed(iface);
+
+	return TRUE;
+}
+
+gboolean
+_dbus_test_mock_engine_add_property (DbusTestMockEngine * engine, const gchar * path, const gchar * interface, const gchar * name, GVariant * value, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(interface != NULL, FALSE);
+	g_return_val_if_fail(name != NULL, FALSE);
+	g_return_val_if_fail(value != NULL, FALSE);
+
+	engine_op_t op = {
+		.path = path,
+		.interface = interface,
+		.name = name,
+		.value = value
+	};
+	return engine_submit(engine, op_add_property, &op, error);
+}
+
+static gboolean
+op_update_property (DbusTestMockEngine * engine, engine_op_t * op, GError ** error)
+{
+	engine_iface_t * iface = iface_lookup(engine, op->path, op->interface, error);
+	if (iface == NULL) {
+		return FALSE;
+	}
+
+	engine_property_t * property = iface_property(iface, op->name);
+	if (property == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No property '%s'", op->name);
+		return FALSE;
+	}
+
+	if (!g_variant_is_of_type(op->value, property->type)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Property '%s' is of another type", op->name);
+		return FALSE;
+	}
+
+	g_variant_unref(property->value);
+	property->value = g_variant_ref(op->value);
+	iface_emit_changed(iface, property);
+
+	return TRUE;
+}
+
+/* Sends PropertiesChanged along with it, like a Set from the bus */
+gboolean
+_dbus_test_mock_engine_update_property (DbusTestMockEngine * engine, const gchar * path, const gchar * interface, const gchar * name, GVariant * value, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(interface != NULL, FALSE);
+	g_return_val_if_fail(name != NULL, FALSE);
+	g_return_val_if_fail(value != NULL, FALSE);
+
+	engine_op_t op = {
+		.path = path,
+		.interface = interface,
+		.name = name,
+		.value = value
+	};
+	return engine_run(engine, op_update_property, &op, error);
+}
+
+static gboolean
+op_emit_signal (DbusTestMockEngine * engine, engine_op_t * op, GError ** error)
+{
+	if (iface_lookup(engine, op->path, op->interface, error) == NULL) {
+		return FALSE;
+	}
+
+	return g_dbus_connection_emit_signal(engine->connection,
+		NULL, /* destination */
+		op->path,
+		op->interface,
+		op->name,
+		op->value,
+		error);
+}
+
+/* @values is a tuple, or NULL for no parameters */
+gboolean
+_dbus_test_mock_engine_emit_signal (DbusTestMockEngine * engine, const gchar * path, const gchar * interface, const gchar * name, GVariant * values, GError ** error)
+{
+	g_return_val_if_fail(engine != NULL, FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(interface != NULL, FALSE);
+	g_return_val_if_fail(name != NULL, FALSE);
+	g_return_val_if_fail(values == NULL || g_variant_is_of_type(values, G_VARIANT_TYPE_TUPLE), FALSE);
+
+	engine_op_t op = {
+		.path = path,
+		.interface = interface,
+		.name = name,
+		.value = values != NULL ? g_variant_ref_sink(values) : NULL
+	};
+	gboolean emitted = engine_run(engine, op_emit_signal, &op, error);
+
+	if (op.value != NULL) {
+		g_variant_unref(op.value);
+	}
+
+	return emitted;
+}
+
+static gboolean
+op_get_calls (DbusTestMockEngine * engine, engine_op_t * op, G_GNUC_UNUSED GError ** error)
+{
+	GHashTable * methods = g_hash_table_lookup(engine->calls, op->path);
+	GArray * calls = methods != NULL ? g_hash_table_lookup(methods, op->name) : NULL;
+	guint i;
+
+	if (calls == NULL) {
+		return TRUE;
+	}
+
+	for (i = op->since; i < calls->len; i++) {
+		DbusTestDbusMockCall * call = &g_array_index(calls, DbusTestDbusMockCall, i);
+
+		DbusTestDbusMockCall copy = {
+			.timestamp = call->timestamp,
+			.name = g_strdup(call->name),
+			.params = g_variant_ref(call->params)
+		};
+
+		g_array_append_val(op->calls, copy);
+	}
+
+	return TRUE;
+}
+
+/* Appends copies of the calls of @method on @path to @calls, which
+   frees its entries.  The first @since calls are skipped, they're the
+   ones the caller already has. */
+void
+_dbus_test_mock_engine_get_calls (DbusTestMockEngine * engine, const gchar * path, const gchar * method, guint since, GArray * calls)
+{
+	g_return_if_fail(engine != NULL);
+	g_return_if_fail(path != NULL);
+	g_return_if_fail(method != NULL);
+	g_return_if_fail(calls != NULL);
+
+	engine_op_t op = {
+		.path = path,
+		.name = method,
+		.calls = calls,
+		.since = since
+	};
+	engine_run(engine, op_get_calls, &op, NULL);
+
+	return;
+}
+
+static gboolean
+op_clear_calls (DbusTestMockEngine * engine, engine_op_t * op, G_GNUC_UNUSED GError ** error)
+{
+	g_hash_table_remove(engine->calls, op->path);
+
+	return TRUE;
+}
+
+/* Every method on the object, whatever interface it's on */
+void
+_dbus_test_mock_engine_clear_calls (DbusTestMockEngine * engine, const gchar * path)
+{
+	g_return_if_fail(engine != NULL);
+	g_return_if_fail(path != NULL);
+
+	engine_op_t op = { .path = path };
+	engine_run(engine, op_clear_calls, &op, NULL);
+
+	return;
+}
@@ -0,0 +1,103 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_MOCK_ENGINE_H__
+#define __DBUS_TEST_MOCK_ENGINE_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "dbus-test.h"
+
+G_BEGIN_DECLS
+
+/* The native backend of DbusTestDbusMock.  Exports the mocked objects
+   from a connection of its own, which answers from a thread of its
+   own, so that the test can make blocking calls to them from any
+   thread.  Everything that touches the objects runs on that thread,
+   callers wait for it.  Adding objects, methods and properties can be
+   batched so that they all go over at once.  This is internal to the
+   library. */
+typedef struct _DbusTestMockEngine DbusTestMockEngine;
+
+G_GNUC_INTERNAL
+DbusTestMockEngine * _dbus_test_mock_engine_new             (const gchar *          address,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+void                 _dbus_test_mock_engine_free            (DbusTestMockEngine *   engine);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_own_name        (DbusTestMockEngine *   engine,
+                                                             const gchar *          name,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+void                 _dbus_test_mock_engine_batch_begin     (DbusTestMockEngine *   engine);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_batch_end       (DbusTestMockEngine *   engine,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_add_object      (DbusTestMockEngine *   engine,
+                                                             const gchar *          path,
+                                                             const gchar *          interface,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_add_method      (DbusTestMockEngine *   engine,
+                                                             const gchar *          path,
+                                                             const gchar *          interface,
+                                                             const gchar *          method,
+                                                             const GVariantType *   in,
+                                                             const GVariantType *   out,
+                                                             GVariant *             ret,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_set_return      (DbusTestMockEngine *   engine,
+                                                             const gchar *          path,
+                                                             const gchar *          interface,
+                                                             const gchar *          method,
+                                                             GVariant *             ret,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_add_property    (DbusTestMockEngine *   engine,
+                                                             const gchar *          path,
+                                                             const gchar *          interface,
+                                                             const gchar *          name,
+                                                             GVariant *             value,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_update_property (DbusTestMockEngine *   engine,
+                                                             const gchar *          path,
+                                                             const gchar *          interface,
+                                                             const gchar *          name,
+                                                             GVariant *             value,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+gboolean             _dbus_test_mock_engine_emit_signal     (DbusTestMockEngine *   engine,
+                                                             const gchar *          path,
+                                                             const gchar *          interface,
+                                                             const gchar *          name,
+                                                             GVariant *             values,
+                                                             GError **              error);
+G_GNUC_INTERNAL
+void                 _dbus_test_mock_engine_get_calls       (DbusTestMockEngine *   engine,
+                                                             const gchar *          path,
+                                                             const gchar *          method,
+                                                             guint                  since,
+                                                             GArray *               calls);
+G_GNUC_INTERNAL
+void                 _dbus_test_mock_engine_clear_calls     (DbusTestMockEngine *   engine,
+                                                             const gchar *          path);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,186 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "output.h"
+
+/* How much we read at once, also the longest line we'll keep whole */
+#define OUTPUT_READ_SIZE   (64 * 1024)
+/* Printed lines are held until there's about this much of them */
+#define OUTPUT_BATCH_SIZE  (64 * 1024)
+
+struct _DbusTestOutput {
+	DbusTestTask * task;
+	gchar * stream;
+
+	/* The start of a line we haven't seen the end of yet */
+	gchar * buffer;
+	gsize used;
+
+	GString * batch;
+};
+
+DbusTestOutput *
+_dbus_test_output_new (DbusTestTask * task, const gchar * stream)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), NULL);
+	g_return_val_if_fail(stream != NULL, NULL);
+
+	DbusTestOutput * output = g_new0(DbusTestOutput, 1);
+
+	/* Not a reference, the task owns us */
+	output->task = task;
+	output->stream = g_strdup(stream);
+	output->buffer = g_malloc(OUTPUT_READ_SIZE);
+	output->used = 0;
+	output->batch = g_string_sized_new(OUTPUT_BATCH_SIZE + 1024);
+
+	return output;
+}
+
+void
+_dbus_test_output_free (DbusTestOutput * output)
+{
+	if (output == NULL) {
+		return;
+	}
+
+	g_free(output->stream);
+	g_free(output->buffer);
+	g_string_free(output->batch, TRUE);
+	g_free(output);
+
+	return;
+}
+
+/* All at once, the task prints it with g_print() so that a print
+   handler still sees it */
+static void
+output_emit (DbusTestOutput * output)
+{
+	if (output->batch->len == 0) {
+		return;
+	}
+
+	_dbus_test_task_write(output->task, output->batch->str, output->batch->len);
+	g_string_truncate(output->batch, 0);
+
+	return;
+}
+
+static void
+output_line (DbusTestOutput * output, const gchar * line, gsize len)
+{
+	/* Printing stops at a nul, don't let it take the rest of the
+	   batch with it */
+	const gchar * nul = memchr(line, '\0', len);
+	if (nul != NULL) {
+		len = nul - line;
+	}
+
+	g_string_append(output->batch, _dbus_test_task_get_print_name(output->task));
+	g_string_append_len(output->batch, ": ", 2);
+	g_string_append_len(output->batch, line, len);
+	g_string_append_c(output->batch, '\n');
+
+	if (output->batch->len >= OUTPUT_BATCH_SIZE) {
+		output_emit(output);
+	}
+
+	return;
+}
+
+/* The lines that came in together go to the log together */
+static void
+output_log (DbusTestOutput * output, const gchar * text, gsize len)
+{
+	_dbus_test_log_write(dbus_test_task_get_name(output->task), output->stream, text, len);
+	return;
+}
+
+/* Reads once from @fd and prints every line that's complete.  Returns
+   G_IO_STATUS_AGAIN when there's nothing to read on a non-blocking
+   @fd, and G_IO_STATUS_EOF once it has been closed. */
+GIOStatus
+_dbus_test_output_read (DbusTestOutput * output, gint fd)
+{
+	g_return_val_if_fail(output != NULL, G_IO_STATUS_ERROR);
+
+	gssize got;
+
+	do {
+		got = read(fd, output->buffer + output->used, OUTPUT_READ_SIZE - output->used);
+	} while (got < 0 && errno == EINTR);
+
+	if (got < 0) {
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? G_IO_STATUS_AGAIN : G_IO_STATUS_ERROR;
+	}
+
+	if (got == 0) {
+		return G_IO_STATUS_EOF;
+	}
+
+	const gchar * end = output->buffer + output->used + got;
+	const gchar * start = output->buffer;
+	const gchar * newline;
+
+	while ((newline = memchr(start, '\n', end - start)) != NULL) {
+		output_line(output, start, newline - start);
+		start = newline + 1;
+	}
+
+	output_log(output, output->buffer, start - output->buffer);
+	output->used = end - start;
+
+	if (output->used == OUTPUT_READ_SIZE) {
+		/* Longer than we'll hold, it goes out in pieces */
+		output_line(output, output->buffer, output->used);
+		output_log(output, output->buffer, output->used);
+		output->used = 0;
+	} else if (output->used > 0 && start != output->buffer) {
+		memmove(output->buffer, start, output->used);
+	}
+
+	output_emit(output);
+
+	return G_IO_STATUS_NORMAL;
+}
+
+/* Prints the last line even though it didn't end */
+void
+_dbus_test_output_finish (DbusTestOutput * output)
+{
+	g_return_if_fail(output != NULL);
+
+	if (output->used > 0) {
+		output_line(output, output->buffer, output->used);
+		output_log(output, output->buffer, output->used);
+		output->used = 0;
+	}
+
+	output_emit(output);
+
+	return;
+}
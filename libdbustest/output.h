@@ -0,0 +1,61 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_OUTPUT_H__
+#define __DBUS_TEST_OUTPUT_H__
+
+#include <glib.h>
+#include "dbus-test.h"
+
+G_BEGIN_DECLS
+
+/* Reads what a child writes to us on one stream in large chunks and
+   prints it with the task's name in front, a batch of lines at a time.
+   The lines also go to the log tagged with the stream.  Memory use is
+   fixed, a line longer than the buffer gets split.  This is internal
+   to the library. */
+typedef struct _DbusTestOutput DbusTestOutput;
+
+G_GNUC_INTERNAL
+DbusTestOutput * _dbus_test_output_new    (DbusTestTask *    task,
+                                           const gchar *     stream);
+G_GNUC_INTERNAL
+void             _dbus_test_output_free   (DbusTestOutput *  output);
+G_GNUC_INTERNAL
+GIOStatus        _dbus_test_output_read   (DbusTestOutput *  output,
+                                           gint              fd);
+G_GNUC_INTERNAL
+void             _dbus_test_output_finish (DbusTestOutput *  output);
+
+/* In task.c, the name with its padding that output is printed with
+   and where whole lines of it go to be printed or held */
+G_GNUC_INTERNAL
+const gchar *    _dbus_test_task_get_print_name (DbusTestTask *  task);
+G_GNUC_INTERNAL
+void             _dbus_test_task_write          (DbusTestTask *  task,
+                                                 const gchar *   text,
+                                                 gsize           len);
+
+/* In log.c, adds lines to the log if there is one */
+G_GNUC_INTERNAL
+void             _dbus_test_log_write           (const gchar *   source,
+                                                 const gchar *   stream,
+                                                 const gchar *   text,
+                                                 gsize           len);
+
+G_END_DECLS
+
+#endif
@@ -21,21 +21,63 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "config.h"
 #endif
 
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib-unix.h>
+
 #include "dbus-test.h"
 
 #include "glib-compat.h"
+#include "cgroup.h"
+#include "guard.h"
+#include "kill.h"
+#include "output.h"
+#include "spawn.h"
+
+/* One of the pipes we read the process's output from */
+typedef struct {
+	DbusTestProcess * process;
+	const gchar * name;
+	GIOChannel * chan;
+	GSource * watch;
+	DbusTestOutput * output;
+} proc_stream_t;
+
+enum {
+	STREAM_STDOUT,
+	STREAM_STDERR,
+	NUM_STREAMS
+};
 
 struct _DbusTestProcessPrivate {
 	gchar * executable;
 	GArray * parameters;
+	gchar ** argv;
 
 	GPid pid;
-	guint io_watch;
-	guint watcher;
-	GIOChannel * io_chan;
+	GPid group;
+	guint kill_timeout;
+	/* When it has to be gone by, once it has been signalled on its way
+	   to being disposed, or zero */
+	gint64 stop_deadline;
+	/* Counting down the task's timeout, then the kill timeout once
+	   it has been asked to stop */
+	GSource * timeout;
+	GSource * watcher;
+	GIOChannel * exit_chan;
+	proc_stream_t streams[NUM_STREAMS];
 
 	gboolean complete;
 	gint status;
+	gboolean usage_known;
+	DbusTestProcessUsage usage;
 };
 
 enum {
@@ -120,8 +162,131 @@ dbus_test_process_init (DbusTestProcess *self)
 	                                     TRUE /* clear */,
 	                                     sizeof(gchar *));
 	g_array_set_clear_func(self->priv->parameters, array_free_helper);
+	self->priv->argv = NULL;
+
+	guint i;
+	for (i = 0; i < NUM_STREAMS; i++) {
+		self->priv->streams[i].process = self;
+		self->priv->streams[i].chan = NULL;
+		self->priv->streams[i].watch = NULL;
+		self->priv->streams[i].output = NULL;
+	}
+	self->priv->streams[STREAM_STDOUT].name = "stdout";
+	self->priv->streams[STREAM_STDERR].name = "stderr";
+
+	self->priv->timeout = NULL;
+	self->priv->watcher = NULL;
+	self->priv->exit_chan = NULL;
+	self->priv->status = -1;
+	self->priv->usage_known = FALSE;
+
+	self->priv->pid = 0;
+	self->priv->group = 0;
+	self->priv->kill_timeout = DBUS_TEST_KILL_DEFAULT_TIMEOUT;
+	self->priv->stop_deadline = 0;
+
+	return;
+}
+
+/* What a process we haven't reaped has used so far, from /proc */
+static gboolean
+proc_usage_read (GPid pid, DbusTestProcessUsage * usage)
+{
+#ifdef __linux__
+	gchar * path = g_strdup_printf("/proc/%d/stat", pid);
+	gchar * contents = NULL;
+	gboolean found = g_file_get_contents(path, &contents, NULL, NULL);
+	g_free(path);
+
+	if (!found) {
+		return FALSE;
+	}
+
+	/* The command in parentheses can have anything in it, the fields
+	   we want are counted from the last one */
+	const gchar * fields = strrchr(contents, ')');
+	gulong minflt, majflt, utime, stime;
+	gboolean parsed = fields != NULL &&
+		sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu", &minflt, &majflt, &utime, &stime) == 4;
+	g_free(contents);
+
+	if (!parsed) {
+		return FALSE;
+	}
+
+	glong ticks = sysconf(_SC_CLK_TCK);
+	if (ticks <= 0) {
+		ticks = 100;
+	}
+
+	memset(usage, 0, sizeof(DbusTestProcessUsage));
+	usage->user_time = (gint64)utime * G_USEC_PER_SEC / ticks;
+	usage->system_time = (gint64)stime * G_USEC_PER_SEC / ticks;
+	usage->minor_faults = minflt;
+	usage->major_faults = majflt;
+
+	/* The rest are only in status, which is fine to be without */
+	path = g_strdup_printf("/proc/%d/status", pid);
+	found = g_file_get_contents(path, &contents, NULL, NULL);
+	g_free(path);
+
+	if (found) {
+		gchar ** lines = g_strsplit(contents, "\n", -1);
+		gchar ** line;
+
+		for (line = lines; *line != NULL; line++) {
+			if (g_str_has_prefix(*line, "VmHWM:")) {
+				usage->max_rss = g_ascii_strtoll(*line + strlen("VmHWM:"), NULL, 10);
+			} else if (g_str_has_prefix(*line, "voluntary_ctxt_switches:")) {
+				usage->voluntary_switches = g_ascii_strtoll(*line + strlen("voluntary_ctxt_switches:"), NULL, 10);
+			} else if (g_str_has_prefix(*line, "nonvoluntary_ctxt_switches:")) {
+				usage->involuntary_switches = g_ascii_strtoll(*line + strlen("nonvoluntary_ctxt_switches:"), NULL, 10);
+			}
+		}
+
+		g_strfreev(lines);
+		g_free(contents);
+	}
+
+	return TRUE;
+#else
+	(void)pid;
+	(void)usage;
+	return FALSE;
+#endif
+}
+
+static void
+proc_timeout_clear (DbusTestProcess * process)
+{
+	if (process->priv->timeout != NULL) {
+		g_source_destroy(process->priv->timeout);
+		g_clear_pointer(&process->priv->timeout, g_source_unref);
+	}
+
+	return;
+}
 
-	self->priv->io_chan = NULL;
+/* Signals a running process to stop without waiting for it, dispose
+   then only waits out what is left of its kill timeout.  Its watcher
+   stays, so if it exits before then it finishes as usual. */
+void
+_dbus_test_process_stop (DbusTestProcess * process)
+{
+	g_return_if_fail(DBUS_TEST_IS_PROCESS(process));
+
+	if (process->priv->pid == 0 || process->priv->stop_deadline != 0) {
+		return;
+	}
+
+	proc_timeout_clear(process);
+
+	/* If it doesn't get reaped by its watcher first, what it used up
+	   to now is as close as we'll get */
+	process->priv->usage_known = proc_usage_read(process->priv->pid, &process->priv->usage);
+
+	_dbus_test_kill_signal(process->priv->pid, SIGTERM);
+	process->priv->stop_deadline = g_get_monotonic_time() + (gint64)process->priv->kill_timeout * 1000;
 
 	return;
 }
@@ -132,44 +297,52 @@ dbus_test_process_dispose (GObject *object)
 	g_return_if_fail(DBUS_TEST_IS_PROCESS(object));
 	DbusTestProcess * process = DBUS_TEST_PROCESS(object);
 
-	if (process->priv->io_watch != 0) {
-		g_source_remove(process->priv->io_watch);
-		process->priv->io_watch = 0;
+	proc_timeout_clear(process);
+
+	guint i;
+	for (i = 0; i < NUM_STREAMS; i++) {
+		proc_stream_t * stream = &process->priv->streams[i];
+
+		if (stream->watch != NULL) {
+			g_source_destroy(stream->watch);
+			g_clear_pointer(&stream->watch, g_source_unref);
+		}
 	}
 
-	if (process->priv->watcher != 0) {
-		g_source_remove(process->priv->watcher);
-		process->priv->watcher = 0;
+	if (process->priv->watcher != NULL) {
+		g_source_destroy(process->priv->watcher);
+		g_clear_pointer(&process->priv->watcher, g_source_unref);
 	}
+	g_clear_pointer(&process->priv->exit_chan, g_io_channel_unref);
 
 	if (process->priv->pid != 0) {
-		gchar * killstr = g_strdup_printf("kill -9 %d", process->priv->pid);
-		g_spawn_command_line_async(killstr, NULL);
-		g_free(killstr);
+		_dbus_test_process_stop(process);
+		_dbus_test_kill_finish(process->priv->pid, process->priv->stop_deadline);
 
 		g_spawn_close_pid(process->priv->pid);
 		process->priv->pid = 0;
+	} else if (process->priv->group != 0) {
+		/* Exited, but it might have left something behind */
+		_dbus_test_kill_group(process->priv->group);
 	}
+	if (process->priv->group != 0) {
+		_dbus_test_guard_remove(-process->priv->group);
+	}
+	process->priv->group = 0;
 
-	if (process->priv->io_chan != NULL) {
-		GIOStatus status = G_IO_STATUS_NORMAL;
-
-		while ((G_IO_IN & g_io_channel_get_buffer_condition(process->priv->io_chan)) && status == G_IO_STATUS_NORMAL) {
-			gchar * line = NULL;
-			gsize termloc;
-
-			status = g_io_channel_read_line (process->priv->io_chan, &line, NULL, &termloc, NULL);
+	for (i = 0; i < NUM_STREAMS; i++) {
+		proc_stream_t * stream = &process->priv->streams[i];
 
-			if (status != G_IO_STATUS_NORMAL) {
-				continue;
-			}
+		if (stream->chan != NULL) {
+			/* Whatever it wrote before it went away */
+			gint fd = g_io_channel_unix_get_fd(stream->chan);
+			while (_dbus_test_output_read(stream->output, fd) == G_IO_STATUS_NORMAL);
+			_dbus_test_output_finish(stream->output);
 
-			line[termloc] = '\0';
-			dbus_test_task_print(DBUS_TEST_TASK(process), line);
-			g_free(line);
+			g_clear_pointer(&stream->chan, g_io_channel_unref);
 		}
 
-		g_clear_pointer(&process->priv->io_chan, g_io_channel_unref);
+		g_clear_pointer(&stream->output, _dbus_test_output_free);
 	}
 
 	G_OBJECT_CLASS (dbus_test_process_parent_class)->dispose (object);
@@ -188,6 +361,8 @@ dbus_test_process_finalize (GObject *object)
 	g_array_free(process->priv->parameters, TRUE /* free segment */);
 	process->priv->parameters = NULL;
 
+	g_clear_pointer(&process->priv->argv, g_free);
+
 	G_OBJECT_CLASS (dbus_test_process_parent_class)->finalize (object);
 	return;
 }
@@ -236,6 +411,8 @@ set_property (GObject * object, guint property_id, G_GNUC_UNUSED const GValue *
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
 	}
 
+	g_clear_pointer(&self->priv->argv, g_free);
+
 	return;
 }
 
@@ -253,7 +430,8 @@ proc_watcher (GPid pid, gint status, gpointer data)
 
 	process->priv->complete = TRUE;
 	process->priv->status = status;
-	process->priv->watcher = 0;
+	g_clear_pointer(&process->priv->watcher, g_source_unref);
+	proc_timeout_clear(process);
 
 	if (status) {
 		message = g_strdup_printf("Exited with status %d", status);
@@ -266,35 +444,110 @@ proc_watcher (GPid pid, gint status, gpointer data)
 	return;
 }
 
+/* With a pidfd we reap it ourselves, which gets us the CPU time it
+   used along with its status */
 static gboolean
-proc_writes (GIOChannel * channel, G_GNUC_UNUSED GIOCondition condition, gpointer data)
+proc_exited (G_GNUC_UNUSED GIOChannel * channel, G_GNUC_UNUSED GIOCondition condition, gpointer data)
 {
 	g_return_val_if_fail(DBUS_TEST_IS_PROCESS(data), FALSE);
 	DbusTestProcess * process = DBUS_TEST_PROCESS(data);
 
-	gchar * line;
-	gsize termloc;
-	gboolean done = FALSE;
+	GPid pid = process->priv->pid;
+	gint status = -1;
+	struct rusage usage;
+	GPid reaped;
 
 	do {
-		GIOStatus status = g_io_channel_read_line (channel, &line, NULL, &termloc, NULL);
+		reaped = wait4(pid, &status, WNOHANG, &usage);
+	} while (reaped < 0 && errno == EINTR);
 
-		if (status == G_IO_STATUS_EOF) {
-			done = TRUE;
-			continue;
-		}
+	if (reaped == 0) {
+		return TRUE;
+	}
 
-		if (status != G_IO_STATUS_NORMAL) {
-			continue;
-		}
+	if (reaped == pid) {
+		process->priv->usage.user_time = (gint64)usage.ru_utime.tv_sec * G_USEC_PER_SEC + usage.ru_utime.tv_usec;
+		process->priv->usage.system_time = (gint64)usage.ru_stime.tv_sec * G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+		process->priv->usage.max_rss = usage.ru_maxrss;
+		process->priv->usage.minor_faults = usage.ru_minflt;
+		process->priv->usage.major_faults = usage.ru_majflt;
+		process->priv->usage.voluntary_switches = usage.ru_nvcsw;
+		process->priv->usage.involuntary_switches = usage.ru_nivcsw;
+		process->priv->usage_known = TRUE;
+	}
+
+	g_clear_pointer(&process->priv->exit_chan, g_io_channel_unref);
+	proc_watcher(pid, status, process);
+
+	return FALSE;
+}
+
+/* Had its chance to stop on its own, its watcher reaps it */
+static gboolean
+proc_timeout_kill (gpointer data)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_PROCESS(data), G_SOURCE_REMOVE);
+	DbusTestProcess * process = DBUS_TEST_PROCESS(data);
+	DbusTestCgroup * cgroup = _dbus_test_task_get_cgroup(DBUS_TEST_TASK(process));
+
+	g_clear_pointer(&process->priv->timeout, g_source_unref);
+
+	if (process->priv->pid != 0) {
+		dbus_test_task_print(DBUS_TEST_TASK(process), "Still running, killing");
+		_dbus_test_kill_signal(process->priv->pid, SIGKILL);
+	}
+	if (cgroup != NULL) {
+		_dbus_test_cgroup_kill(cgroup);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Ran out of time, ask it to stop and give it the kill timeout to
+   do that in like at the end of a run */
+static gboolean
+proc_timeout (gpointer data)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_PROCESS(data), G_SOURCE_REMOVE);
+	DbusTestProcess * process = DBUS_TEST_PROCESS(data);
+	DbusTestTask * task = DBUS_TEST_TASK(process);
+
+	GMainContext * context = g_source_get_context(process->priv->timeout);
+	g_clear_pointer(&process->priv->timeout, g_source_unref);
+
+	if (process->priv->pid == 0) {
+		return G_SOURCE_REMOVE;
+	}
 
-		line[termloc] = '\0';
-		dbus_test_task_print(DBUS_TEST_TASK(process), line);
-		g_free(line);
-	} while (G_IO_IN & g_io_channel_get_buffer_condition(channel));
+	gchar * message = g_strdup_printf("Timed out after %u ms, stopping", dbus_test_task_get_timeout(task));
+	dbus_test_task_print(task, message);
+	g_free(message);
 
-	if (done) {
-		process->priv->io_watch = 0;
+	_dbus_test_task_set_timed_out(task);
+	_dbus_test_kill_signal(process->priv->pid, SIGTERM);
+
+	process->priv->timeout = g_timeout_source_new(process->priv->kill_timeout);
+	g_source_set_callback(process->priv->timeout, proc_timeout_kill, process, NULL);
+	g_source_attach(process->priv->timeout, context);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+proc_writes (GIOChannel * channel, G_GNUC_UNUSED GIOCondition condition, gpointer data)
+{
+	proc_stream_t * stream = (proc_stream_t *)data;
+	g_return_val_if_fail(DBUS_TEST_IS_PROCESS(stream->process), FALSE);
+
+	GIOStatus status = _dbus_test_output_read(stream->output, g_io_channel_unix_get_fd(channel));
+
+	if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR) {
+		_dbus_test_output_finish(stream->output);
+
+		g_clear_pointer(&stream->watch, g_source_unref);
+		/* Nothing more is coming, don't hold the pipe open for the
+		   rest of the run */
+		g_clear_pointer(&stream->chan, g_io_channel_unref);
 		// wait for proc_watcher to switch state to FINISHED
 		return FALSE;
 	}
@@ -302,61 +555,105 @@ proc_writes (GIOChannel * channel, G_GNUC_UNUSED GIOCondition condition, gpointe
 	return TRUE;
 }
 
+/* Read in chunks straight from the pipe, the channel is only there
+   for the watch */
+static void
+stream_start (proc_stream_t * stream, gint fd, GMainContext * context)
+{
+	g_unix_set_fd_nonblocking(fd, TRUE, NULL);
+	stream->chan = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(stream->chan, TRUE);
+
+	if (stream->output == NULL) {
+		stream->output = _dbus_test_output_new(DBUS_TEST_TASK(stream->process), stream->name);
+	}
+
+	stream->watch = g_io_create_watch(stream->chan, G_IO_IN | G_IO_HUP | G_IO_ERR);
+	g_source_set_callback(stream->watch, G_SOURCE_FUNC(proc_writes), stream, NULL);
+	g_source_attach(stream->watch, context);
+
+	return;
+}
+
 static void
 process_run (DbusTestTask * task)
 {
 	g_return_if_fail(DBUS_TEST_IS_PROCESS(task));
 	DbusTestProcess * process = DBUS_TEST_PROCESS(task);
 
-	gchar * current_dir = g_get_current_dir();
-
-	gchar ** argv;
-	argv = g_new0(gchar *, process->priv->parameters->len + 2);
+	/* Built once and kept until the executable or parameters change,
+	   the strings belong to them */
+	if (process->priv->argv == NULL) {
+		process->priv->argv = g_new0(gchar *, process->priv->parameters->len + 2);
 
-	argv[0] = process->priv->executable;
-	guint i;
-	for (i = 0; i < process->priv->parameters->len; i++) {
-		argv[i + 1] = g_array_index(process->priv->parameters, gchar *, i);
+		process->priv->argv[0] = process->priv->executable;
+		guint i;
+		for (i = 0; i < process->priv->parameters->len; i++) {
+			process->priv->argv[i + 1] = g_array_index(process->priv->parameters, gchar *, i);
+		}
 	}
 
 	GError * error = NULL;
 	gint proc_stdout;
-	g_spawn_async_with_pipes(current_dir,
-	                         argv, /* argv */
-	                         NULL, /* envp */
-	                         G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, /* flags */
-	                         NULL, /* child setup func */
-	                         NULL, /* child setup data */
-							 &(process->priv->pid), /* PID */
-	                         NULL, /* stdin */
-	                         &proc_stdout, /* stdout */
-	                         NULL, /* stderr */
-	                         &error); /* error */
-	g_free(current_dir);
-	g_free(argv);
+	gint proc_stderr;
+	gchar * path = _dbus_test_spawn_resolve(process->priv->executable, dbus_test_task_get_environment(task), &error);
+	DbusTestCgroup * cgroup = _dbus_test_task_get_cgroup(task);
+
+	if (path != NULL) {
+		_dbus_test_spawn(path,
+		                 process->priv->argv,
+		                 dbus_test_task_get_environment(task),
+		                 cgroup != NULL ? _dbus_test_cgroup_get_procs_fd(cgroup) : -1,
+		                 &(process->priv->pid),
+		                 &proc_stdout,
+		                 &proc_stderr,
+		                 &error);
+		g_free(path);
+	}
 
 	if (error != NULL) {
 		g_warning("Unable to start process '%s': %s", process->priv->executable, error->message);
+		g_error_free(error);
 		process->priv->complete = TRUE;
 		process->priv->status = -1;
 		g_signal_emit_by_name(G_OBJECT(process), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, DBUS_TEST_TASK_STATE_FINISHED, NULL);
 		return;
 	}
 
+	process->priv->group = process->priv->pid;
+	_dbus_test_guard_add(-process->priv->group);
+
 	if (TRUE) {
 		gchar * message = g_strdup_printf("Started with PID: %d", process->priv->pid);
 		dbus_test_task_print(task, message);
 		g_free(message);
 	}
 
-	process->priv->io_chan = g_io_channel_unix_new(proc_stdout);
-	g_io_channel_set_buffer_size(process->priv->io_chan, 10 * 1024 * 1024); /* 10 MB should be enough for anyone */
-	process->priv->io_watch = g_io_add_watch(process->priv->io_chan,
-	                                         G_IO_IN | G_IO_HUP | G_IO_ERR, /* conditions */
-	                                         proc_writes, /* func */
-	                                         process); /* func data */
+	/* On the thread-default context, the service might be
+	   running in its own thread */
+	GMainContext * context = g_main_context_get_thread_default();
+
+	stream_start(&process->priv->streams[STREAM_STDOUT], proc_stdout, context);
+	stream_start(&process->priv->streams[STREAM_STDERR], proc_stderr, context);
 
-	process->priv->watcher = g_child_watch_add(process->priv->pid, proc_watcher, process);
+	gint pidfd = _dbus_test_kill_pidfd_open(process->priv->pid);
+	if (pidfd >= 0) {
+		process->priv->exit_chan = g_io_channel_unix_new(pidfd);
+		g_io_channel_set_close_on_unref(process->priv->exit_chan, TRUE);
+
+		process->priv->watcher = g_io_create_watch(process->priv->exit_chan, G_IO_IN | G_IO_HUP | G_IO_ERR);
+		g_source_set_callback(process->priv->watcher, G_SOURCE_FUNC(proc_exited), process, NULL);
+	} else {
+		process->priv->watcher = g_child_watch_source_new(process->priv->pid);
+		g_source_set_callback(process->priv->watcher, G_SOURCE_FUNC(proc_watcher), process, NULL);
+	}
+	g_source_attach(process->priv->watcher, context);
+
+	if (dbus_test_task_get_timeout(task) > 0) {
+		process->priv->timeout = g_timeout_source_new(dbus_test_task_get_timeout(task));
+		g_source_set_callback(process->priv->timeout, proc_timeout, process, NULL);
+		g_source_attach(process->priv->timeout, context);
+	}
 
 	g_signal_emit_by_name(G_OBJECT(process), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, DBUS_TEST_TASK_STATE_RUNNING, NULL);
 
@@ -404,9 +701,104 @@ dbus_test_process_append_param (DbusTestProcess * process, const gchar * paramet
 	gchar * newstr = g_strdup(parameter);
 	g_array_append_val(process->priv->parameters, newstr);
 
+	g_clear_pointer(&process->priv->argv, g_free);
+
+	return;
+}
+
+/**
+ * dbus_test_process_set_kill_timeout:
+ * @process: The #DbusTestProcess to adjust
+ * @timeout_ms: Time to wait in milliseconds
+ *
+ * A process that is still running when it is freed, or when it runs
+ * past dbus_test_task_set_timeout(), gets a SIGTERM, and a SIGKILL if
+ * it hasn't exited after this long.  Whatever else is left in its
+ * process group gets killed as well.
+ */
+void
+dbus_test_process_set_kill_timeout (DbusTestProcess * process, guint timeout_ms)
+{
+	g_return_if_fail(DBUS_TEST_IS_PROCESS(process));
+	process->priv->kill_timeout = timeout_ms;
 	return;
 }
 
+/**
+ * dbus_test_process_get_exit_status:
+ * @process: The #DbusTestProcess to check
+ *
+ * How the process ended, as a status from waitpid() that can be
+ * looked at with WIFEXITED() and friends.
+ *
+ * Return value: The status, or -1 if it hasn't ended or couldn't
+ *    be started
+ */
+gint
+dbus_test_process_get_exit_status (DbusTestProcess * process)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_PROCESS(process), -1);
+
+	if (!process->priv->complete) {
+		return -1;
+	}
+
+	return process->priv->status;
+}
+
+/**
+ * dbus_test_process_get_cpu_time:
+ * @process: The #DbusTestProcess to check
+ *
+ * The user and system CPU time the process used, not counting
+ * children it didn't wait for.  Only known once it has exited, and
+ * only where we can reap it ourselves.
+ *
+ * Return value: Time in microseconds, or -1 if it isn't known
+ */
+gint64
+dbus_test_process_get_cpu_time (DbusTestProcess * process)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_PROCESS(process), -1);
+
+	if (!process->priv->complete || !process->priv->usage_known) {
+		return -1;
+	}
+
+	return process->priv->usage.user_time + process->priv->usage.system_time;
+}
+
+/**
+ * dbus_test_process_get_usage:
+ * @process: The #DbusTestProcess to check
+ * @usage: (out): Where to put what it used
+ *
+ * The resources the process used.  Once it has exited these are the
+ * final figures from reaping it, where we can reap it ourselves.
+ * While it is running they are what it has used so far, which is
+ * also what is kept for a process that gets killed when it is freed.
+ * Children it didn't wait for aren't counted.
+ *
+ * Return value: Whether @usage was filled in
+ */
+gboolean
+dbus_test_process_get_usage (DbusTestProcess * process, DbusTestProcessUsage * usage)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_PROCESS(process), FALSE);
+	g_return_val_if_fail(usage != NULL, FALSE);
+
+	if (process->priv->pid != 0 && !process->priv->complete) {
+		return proc_usage_read(process->priv->pid, usage);
+	}
+
+	if (!process->priv->usage_known) {
+		return FALSE;
+	}
+
+	*usage = process->priv->usage;
+	return TRUE;
+}
+
 static DbusTestTaskState
 get_state (DbusTestTask * task)
 {
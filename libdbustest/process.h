@@ -36,6 +36,7 @@ G_BEGIN_DECLS
 typedef struct _DbusTestProcess         DbusTestProcess;
 typedef struct _DbusTestProcessClass    DbusTestProcessClass;
 typedef struct _DbusTestProcessPrivate  DbusTestProcessPrivate;
+typedef struct _DbusTestProcessUsage    DbusTestProcessUsage;
 
 struct _DbusTestProcessClass {
 	DbusTestTaskClass parent_class;
@@ -46,11 +47,37 @@ struct _DbusTestProcess {
 	DbusTestProcessPrivate * priv;
 };
 
+/**
+ * DbusTestProcessUsage:
+ * @user_time: CPU time spent in the process, in microseconds
+ * @system_time: CPU time spent in the kernel for it, in microseconds
+ * @max_rss: Largest resident set size, in KiB
+ * @minor_faults: Page faults that didn't need any I/O
+ * @major_faults: Page faults that did
+ * @voluntary_switches: Times it gave up the CPU, usually to wait
+ * @involuntary_switches: Times it was made to give up the CPU
+ *
+ * What a process cost to run, see dbus_test_process_get_usage().
+ */
+struct _DbusTestProcessUsage {
+	gint64 user_time;
+	gint64 system_time;
+	gint64 max_rss;
+	gint64 minor_faults;
+	gint64 major_faults;
+	gint64 voluntary_switches;
+	gint64 involuntary_switches;
+};
+
 GType dbus_test_process_get_type (void);
 
 DbusTestProcess * dbus_test_process_new (const gchar * executable);
 void dbus_test_process_append_param (DbusTestProcess * process, const gchar * parameter);
 GPid dbus_test_process_get_pid (DbusTestProcess * process);
+void dbus_test_process_set_kill_timeout (DbusTestProcess * process, guint timeout_ms);
+gint dbus_test_process_get_exit_status (DbusTestProcess * process);
+gint64 dbus_test_process_get_cpu_time (DbusTestProcess * process);
+gboolean dbus_test_process_get_usage (DbusTestProcess * process, DbusTestProcessUsage * usage);
 
 G_END_DECLS
 
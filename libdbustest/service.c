@@ -29,7 +29,11 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "glib-compat.h"
 
 #include "dbus-test.h"
-#include "watchdog.h"
+#include "broker.h"
+#include "cgroup.h"
+#include "daemon.h"
+#include "kill.h"
+#include "trace-internal.h"
 
 typedef enum _ServiceState ServiceState;
 enum _ServiceState {
@@ -43,42 +47,77 @@ enum _ServiceState {
 	STATE_FINISHED
 };
 
+/* The priorities, in the order they're started */
+#define TIER_COUNT              3
+
 struct _DbusTestServicePrivate {
 	GQueue tasks_first;
 	GQueue tasks_normal;
 	GQueue tasks_last;
 
+	/* How many tasks haven't started or finished, and how many in each
+	   priority aren't ready, kept up to date from the signals so
+	   checking doesn't walk all the tasks */
+	GHashTable * task_counts;
+	guint tasks_unstarted;
+	guint tasks_unfinished;
+	guint tiers_unready[TIER_COUNT];
+
 	GMainLoop * mainloop;
 	ServiceState state;
 
+	guint tiers_started;
+	guint ready_timeout;
+	GSource * ready_timeout_source;
+
 	gboolean daemon_crashed;
 
-	GPid dbus;
-	guint dbus_watch;
-	GIOChannel * dbus_io;
-	guint dbus_io_watch;
+	DbusTestServiceBackend backend;
+	DbusTestBroker * broker;
+	DbusTestDaemon * daemon;
+	DbusTestDaemonPool * pool;
+	gchar * address;
+	gchar ** environment;
+	/* What the environment of the tasks starts from, NULL for ours */
+	gchar ** base_env;
+	GDBusConnection * connection;
+	gboolean publish_env;
 	gchar * dbus_daemon;
 	gchar * dbus_configfile;
 
-	gboolean first_time;
 	gboolean keep_env;
 
-	DbusTestWatchdog * watchdog;
-	guint watchdog_source;
-
 	DbusTestServiceBus bus_type;
+
+	/* A cgroup for the run, with one under it for each task */
+	gboolean use_cgroups;
+	DbusTestCgroup * cgroup;
+	/* Numbers the task groups, names needn't be unique */
+	guint task_cgroups;
+
+	/* Our row in the trace */
+	gint number;
+	gchar * trace_track;
 };
 
 #define SERVICE_CHANGE_HANDLER  "dbus-test-service-change-handler"
+#define SERVICE_READY_HANDLER   "dbus-test-service-ready-handler"
+
+/* How long we'll wait for one priority to be ready before starting
+   the next one anyway */
+#define DEFAULT_READY_TIMEOUT   5000
 
 #define DBUS_TEST_SERVICE_GET_PRIVATE(o) \
 (G_TYPE_INSTANCE_GET_PRIVATE ((o), DBUS_TEST_TYPE_SERVICE, DbusTestServicePrivate))
 
+/* Numbers the services for the trace */
+static gint service_count = 0;
+
 static void dbus_test_service_class_init (DbusTestServiceClass *klass);
 static void dbus_test_service_init       (DbusTestService *self);
 static void dbus_test_service_dispose    (GObject *object);
 static void dbus_test_service_finalize   (GObject *object);
-static gboolean watchdog_ping            (gpointer user_data);
+static void ready_timeout_clear          (DbusTestService * service);
 
 G_DEFINE_TYPE (DbusTestService, dbus_test_service, G_TYPE_OBJECT);
 
@@ -104,30 +143,48 @@ dbus_test_service_init (DbusTestService *self)
 	g_queue_init(&self->priv->tasks_normal);
 	g_queue_init(&self->priv->tasks_last);
 
-	self->priv->mainloop = g_main_loop_new(NULL, FALSE);
+	self->priv->task_counts = g_hash_table_new(g_direct_hash, g_direct_equal);
+	self->priv->tasks_unstarted = 0;
+	self->priv->tasks_unfinished = 0;
+	guint tier;
+	for (tier = 0; tier < TIER_COUNT; tier++) {
+		self->priv->tiers_unready[tier] = 0;
+	}
+
+	/* Everything for the service runs on the context that it was
+	   created on so that services can run in parallel threads */
+	self->priv->mainloop = g_main_loop_new(g_main_context_get_thread_default(), FALSE);
 	self->priv->state = STATE_INIT;
 
+	self->priv->tiers_started = 0;
+	self->priv->ready_timeout = DEFAULT_READY_TIMEOUT;
+	self->priv->ready_timeout_source = NULL;
+
 	self->priv->daemon_crashed = FALSE;
 
-	self->priv->dbus = 0;
-	self->priv->dbus_watch = 0;
-	self->priv->dbus_io = NULL;
-	self->priv->dbus_io_watch = 0;
+	self->priv->backend = DBUS_TEST_SERVICE_BACKEND_DAEMON;
+	self->priv->broker = NULL;
+	self->priv->daemon = NULL;
+	self->priv->pool = NULL;
+	self->priv->address = NULL;
+	self->priv->environment = NULL;
+	self->priv->base_env = NULL;
+	self->priv->connection = NULL;
+	self->priv->publish_env = TRUE;
 	self->priv->dbus_daemon = g_strdup("dbus-daemon");
 	self->priv->dbus_configfile = g_strdup(DEFAULT_SESSION_CONF);
 
-	self->priv->first_time = TRUE;
 	self->priv->keep_env = FALSE;
 
-	self->priv->watchdog = g_object_new(DBUS_TEST_TYPE_WATCHDOG, NULL);
-	self->priv->watchdog_source = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT,
-	                                                         5,
-	                                                         watchdog_ping,
-	                                                         g_object_ref(self->priv->watchdog),
-	                                                         g_object_unref);
-
 	self->priv->bus_type = DBUS_TEST_SERVICE_BUS_SESSION;
 
+	self->priv->use_cgroups = FALSE;
+	self->priv->cgroup = NULL;
+	self->priv->task_cgroups = 0;
+
+	self->priv->number = g_atomic_int_add(&service_count, 1);
+	self->priv->trace_track = g_strdup_printf("bus %d", self->priv->number);
+
 	return;
 }
 
@@ -141,15 +198,38 @@ task_unref (gpointer data, G_GNUC_UNUSED gpointer user_data)
 		g_signal_handler_disconnect(G_OBJECT(task), handler);
 	}
 
+	handler = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(task), SERVICE_READY_HANDLER));
+	if (handler != 0) {
+		g_signal_handler_disconnect(G_OBJECT(task), handler);
+	}
+
 	g_object_unref(task);
 	return;
 }
 
+/* Signals every process we started, they don't outlive the bus anyway.
+   Disposing them one after the other then waits for them all at once,
+   those someone else still holds are finished off when they let go. */
+static void
+task_stop (gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+	if (DBUS_TEST_IS_PROCESS(data)) {
+		_dbus_test_process_stop(DBUS_TEST_PROCESS(data));
+	}
+
+	return;
+}
+
 static void
 dbus_test_service_dispose (GObject *object)
 {
 	g_return_if_fail(DBUS_TEST_IS_SERVICE(object));
 	DbusTestService * self = DBUS_TEST_SERVICE(object);
+	gint64 teardown_start = g_get_monotonic_time();
+
+	g_queue_foreach(&self->priv->tasks_last, task_stop, NULL);
+	g_queue_foreach(&self->priv->tasks_normal, task_stop, NULL);
+	g_queue_foreach(&self->priv->tasks_first, task_stop, NULL);
 
 	if (!g_queue_is_empty(&self->priv->tasks_last)) {
 		g_queue_foreach(&self->priv->tasks_last, task_unref, NULL);
@@ -166,30 +246,34 @@ dbus_test_service_dispose (GObject *object)
 		g_queue_clear(&self->priv->tasks_first);
 	}
 
-	if (self->priv->dbus_watch != 0) {
-		g_source_remove(self->priv->dbus_watch);
-		self->priv->dbus_watch = 0;
-	}
+	g_hash_table_remove_all(self->priv->task_counts);
 
-	if (self->priv->dbus_io_watch != 0) {
-		g_source_remove(self->priv->dbus_io_watch);
-		self->priv->dbus_io_watch = 0;
+	ready_timeout_clear(self);
+
+	g_clear_object(&self->priv->connection);
+
+	g_print("DBus daemon: Shutdown\n");
+	if (self->priv->daemon != NULL) {
+		_dbus_test_daemon_set_callbacks(self->priv->daemon, NULL, NULL, NULL);
+
+		if (self->priv->pool != NULL) {
+			_dbus_test_daemon_pool_recycle(self->priv->pool, self->priv->daemon);
+		} else {
+			_dbus_test_daemon_free(self->priv->daemon);
+		}
+		self->priv->daemon = NULL;
 	}
 
-	if (self->priv->dbus_io != NULL) {
-		g_io_channel_shutdown(self->priv->dbus_io, TRUE, NULL);
-		g_io_channel_unref(self->priv->dbus_io);
-		self->priv->dbus_io = NULL;
+	if (self->priv->broker != NULL) {
+		_dbus_test_broker_free(self->priv->broker);
+		self->priv->broker = NULL;
 	}
 
-	g_print("DBus daemon: Shutdown\n");
-	if (self->priv->dbus != 0) {
-		gchar * cmd = g_strdup_printf("kill -9 %d", self->priv->dbus);
-		g_spawn_command_line_async(cmd, NULL);
-		g_free(cmd);
+	g_clear_object(&self->priv->pool);
 
-		g_spawn_close_pid(self->priv->dbus);
-		self->priv->dbus = 0;
+	if (self->priv->cgroup != NULL) {
+		_dbus_test_cgroup_free(self->priv->cgroup);
+		self->priv->cgroup = NULL;
 	}
 
 	if (self->priv->mainloop != NULL) {
@@ -197,12 +281,7 @@ dbus_test_service_dispose (GObject *object)
 		self->priv->mainloop = NULL;
 	}
 
-	g_clear_object(&self->priv->watchdog);
-
-	if (self->priv->watchdog_source != 0) {
-		g_source_remove(self->priv->watchdog_source);
-		self->priv->watchdog_source = 0;
-	}
+	_dbus_test_trace_span(self->priv->trace_track, "service", "teardown", teardown_start, g_get_monotonic_time());
 
 	G_OBJECT_CLASS (dbus_test_service_parent_class)->dispose (object);
 	return;
@@ -214,15 +293,41 @@ dbus_test_service_finalize (GObject *object)
 	g_return_if_fail(DBUS_TEST_IS_SERVICE(object));
 	DbusTestService * self = DBUS_TEST_SERVICE(object);
 
+	g_hash_table_destroy(self->priv->task_counts);
+	self->priv->task_counts = NULL;
+
+	g_free(self->priv->address);
+	self->priv->address = NULL;
+	g_strfreev(self->priv->environment);
+	self->priv->environment = NULL;
+	g_strfreev(self->priv->base_env);
+	self->priv->base_env = NULL;
+
 	g_free(self->priv->dbus_daemon);
 	self->priv->dbus_daemon = NULL;
 	g_free(self->priv->dbus_configfile);
 	self->priv->dbus_configfile = NULL;
+	g_free(self->priv->trace_track);
+	self->priv->trace_track = NULL;
 
 	G_OBJECT_CLASS (dbus_test_service_parent_class)->finalize (object);
 	return;
 }
 
+/**
+ * dbus_test_service_new:
+ * @address: Unused
+ *
+ * Creates a service that starts a bus and runs its tasks on it.  The
+ * service does everything on the thread-default main context at the
+ * time it is created, and gives its tasks the address of its bus in
+ * their environment and its own connection to it.  Several services
+ * can be run at the same time from different threads as long as each
+ * has its own context and doesn't publish its environment, see
+ * dbus_test_service_set_publish_environment().
+ *
+ * Return value: (transfer full): A new service
+ */
 DbusTestService *
 dbus_test_service_new (G_GNUC_UNUSED const gchar * address)
 {
@@ -234,17 +339,6 @@ dbus_test_service_new (G_GNUC_UNUSED const gchar * address)
 	return service;
 }
 
-/* Ping the watchdog so that it knows we're still alive */
-static gboolean
-watchdog_ping (gpointer user_data)
-{
-	DbusTestWatchdog * watchdog = DBUS_TEST_WATCHDOG(user_data);
-
-	dbus_test_watchdog_ping(watchdog);
-
-	return TRUE;
-}
-
 static gboolean
 all_tasks_finished_helper (G_GNUC_UNUSED DbusTestService * service, DbusTestTask * task, G_GNUC_UNUSED gpointer user_data)
 {
@@ -278,6 +372,88 @@ all_tasks_bus_match (DbusTestService * service, DbusTestTask * task, G_GNUC_UNUS
 		dbus_test_task_get_bus(task) == service->priv->bus_type;
 }
 
+#define COUNTED_UNSTARTED   (1 << 0)
+#define COUNTED_UNFINISHED  (1 << 1)
+#define COUNTED_UNREADY     (1 << 2)
+/* The priority of the task is kept above the flags */
+#define COUNTED_TIER_SHIFT  4
+
+/* Moves the task between the counters if it changed since the last
+   time we looked at it */
+static void
+task_count_update (DbusTestService * service, DbusTestTask * task)
+{
+	guint old = GPOINTER_TO_UINT(g_hash_table_lookup(service->priv->task_counts, task));
+	guint tier = old >> COUNTED_TIER_SHIFT;
+	guint flags = tier << COUNTED_TIER_SHIFT;
+
+	if (!all_tasks_started_helper(service, task, NULL)) {
+		flags |= COUNTED_UNSTARTED;
+	}
+
+	if (!all_tasks_finished_helper(service, task, NULL)) {
+		flags |= COUNTED_UNFINISHED;
+	}
+
+	/* A task that is waiting, on a name or on other tasks, isn't going
+	   to get ready on its own.  It might be waiting on the next
+	   priority, so it doesn't hold things up. */
+	if (dbus_test_task_get_state(task) != DBUS_TEST_TASK_STATE_WAITING &&
+			!dbus_test_task_get_ready(task)) {
+		flags |= COUNTED_UNREADY;
+	}
+
+	if ((old ^ flags) & COUNTED_UNSTARTED) {
+		if (flags & COUNTED_UNSTARTED) {
+			service->priv->tasks_unstarted++;
+		} else {
+			service->priv->tasks_unstarted--;
+		}
+	}
+
+	if ((old ^ flags) & COUNTED_UNFINISHED) {
+		if (flags & COUNTED_UNFINISHED) {
+			service->priv->tasks_unfinished++;
+		} else {
+			service->priv->tasks_unfinished--;
+		}
+	}
+
+	if ((old ^ flags) & COUNTED_UNREADY) {
+		if (flags & COUNTED_UNREADY) {
+			service->priv->tiers_unready[tier]++;
+		} else {
+			service->priv->tiers_unready[tier]--;
+		}
+	}
+
+	g_hash_table_insert(service->priv->task_counts, task, GUINT_TO_POINTER(flags));
+
+	return;
+}
+
+static void
+task_count_remove (DbusTestService * service, DbusTestTask * task)
+{
+	guint old = GPOINTER_TO_UINT(g_hash_table_lookup(service->priv->task_counts, task));
+
+	if (old & COUNTED_UNSTARTED) {
+		service->priv->tasks_unstarted--;
+	}
+
+	if (old & COUNTED_UNFINISHED) {
+		service->priv->tasks_unfinished--;
+	}
+
+	if (old & COUNTED_UNREADY) {
+		service->priv->tiers_unready[old >> COUNTED_TIER_SHIFT]--;
+	}
+
+	g_hash_table_remove(service->priv->task_counts, task);
+
+	return;
+}
+
 typedef struct {
 	DbusTestService * service;
 	gboolean passing;
@@ -326,6 +502,13 @@ all_tasks (DbusTestService * service, gboolean (*helper) (DbusTestService * serv
 	return TRUE;
 }
 
+static gboolean
+task_count_helper (DbusTestService * service, DbusTestTask * task, G_GNUC_UNUSED gpointer user_data)
+{
+	task_count_update(service, task);
+	return TRUE;
+}
+
 static void
 task_set_name_length (gpointer data, gpointer user_data)
 {
@@ -367,6 +550,19 @@ normalize_name_lengths (DbusTestService * service)
 	return;
 }
 
+/* Tell the tasks where our bus is */
+static void
+task_set_bus_info (gpointer data, gpointer user_data)
+{
+	DbusTestTask * task = DBUS_TEST_TASK(data);
+	DbusTestService * service = DBUS_TEST_SERVICE(user_data);
+
+	dbus_test_task_set_environment(task, service->priv->environment);
+	dbus_test_task_set_connection(task, service->priv->connection);
+
+	return;
+}
+
 static void
 task_starter (gpointer data, G_GNUC_UNUSED gpointer user_data)
 {
@@ -377,148 +573,274 @@ task_starter (gpointer data, G_GNUC_UNUSED gpointer user_data)
 	return;
 }
 
+static GQueue *
+tier_queue (DbusTestService * service, guint tier)
+{
+	switch (tier) {
+	case 0:
+		return &service->priv->tasks_first;
+	case 1:
+		return &service->priv->tasks_normal;
+	default:
+		return &service->priv->tasks_last;
+	}
+}
+
+/* Checks to see if all the tasks in a priority are ready so we can
+   start the next one, tasks that are waiting aren't counted */
 static gboolean
-dbus_writes (GIOChannel * channel, GIOCondition condition, gpointer data)
+priority_ready (DbusTestService * service, guint tier)
 {
-	DbusTestService * service = DBUS_TEST_SERVICE(data);
+	return service->priv->tiers_unready[tier] == 0;
+}
 
-	if (condition & G_IO_ERR) {
-		g_critical("DBus writing failure!");
-		return FALSE;
+static void
+ready_timeout_clear (DbusTestService * service)
+{
+	if (service->priv->ready_timeout_source != NULL) {
+		g_source_destroy(service->priv->ready_timeout_source);
+		g_clear_pointer(&service->priv->ready_timeout_source, g_source_unref);
 	}
 
-	gchar * line;
-	gsize termloc;
-	GIOStatus status = g_io_channel_read_line (channel, &line, NULL, &termloc, NULL);
-	g_return_val_if_fail(status == G_IO_STATUS_NORMAL, FALSE);
-	line[termloc] = '\0';
-
-	g_print("DBus daemon: %s\n", line);
-
-	if (service->priv->first_time) {
-		service->priv->first_time = FALSE;
-
-		g_setenv("DBUS_STARTER_ADDRESS", line, TRUE);
-
-		switch (service->priv->bus_type) {
-		case DBUS_TEST_SERVICE_BUS_SESSION:
-			g_setenv("DBUS_SESSION_BUS_ADDRESS", line, TRUE);
-			g_setenv("DBUS_STARTER_BUS_TYPE", "session", TRUE);
-			break;
-		case DBUS_TEST_SERVICE_BUS_SYSTEM:
-			g_setenv("DBUS_SYSTEM_BUS_ADDRESS", line, TRUE);
-			g_setenv("DBUS_STARTER_BUS_TYPE", "system", TRUE);
-			break;
-		case DBUS_TEST_SERVICE_BUS_BOTH:
-			g_setenv("DBUS_SESSION_BUS_ADDRESS", line, TRUE);
-			g_setenv("DBUS_SYSTEM_BUS_ADDRESS", line, TRUE);
-			g_setenv("DBUS_STARTER_BUS_TYPE", "session", TRUE);
-			break;
+	return;
+}
+
+/* Runs the tasks of the next priority.  Tasks with dependencies of
+   their own wait for them on their own, so everything in the priority
+   gets started at once. */
+static void
+start_next_tier (DbusTestService * service)
+{
+	ready_timeout_clear(service);
+
+	/* Counted first as starting tasks can get us called again */
+	GQueue * queue = tier_queue(service, service->priv->tiers_started++);
+	g_queue_foreach(queue, task_starter, NULL);
+
+	return;
+}
+
+static gboolean start_tiers_timeout (gpointer user_data);
+
+/* Starts every priority whose previous one is ready.  Called each time
+   a task changes so that nothing waits on a main loop of its own. */
+static void
+start_tiers (DbusTestService * service)
+{
+	while (service->priv->tiers_started < TIER_COUNT) {
+		if (service->priv->tiers_started > 0 &&
+				!g_queue_is_empty(tier_queue(service, service->priv->tiers_started)) &&
+				!priority_ready(service, service->priv->tiers_started - 1)) {
+			if (service->priv->ready_timeout_source == NULL) {
+				service->priv->ready_timeout_source = g_timeout_source_new(service->priv->ready_timeout);
+				g_source_set_callback(service->priv->ready_timeout_source, start_tiers_timeout, service, NULL);
+				g_source_attach(service->priv->ready_timeout_source, g_main_loop_get_context(service->priv->mainloop));
+			}
+			return;
 		}
 
-		if (service->priv->state == STATE_DAEMON_STARTING) {
-			g_main_loop_quit(service->priv->mainloop);
+		start_next_tier(service);
+	}
+
+	return;
+}
+
+static gboolean
+start_tiers_timeout (gpointer user_data)
+{
+	DbusTestService * service = DBUS_TEST_SERVICE(user_data);
+
+	g_warning("Tasks not ready after %u ms, starting the next ones anyway", service->priv->ready_timeout);
+
+	g_clear_pointer(&service->priv->ready_timeout_source, g_source_unref);
+	start_next_tier(service);
+	start_tiers(service);
+
+	return G_SOURCE_REMOVE;
+}
+
+static const gchar * bus_variables[] = {
+	"DBUS_STARTER_ADDRESS",
+	"DBUS_STARTER_BUS_TYPE",
+	"DBUS_SESSION_BUS_ADDRESS",
+	"DBUS_SYSTEM_BUS_ADDRESS"
+};
+
+/* Sets up the environment for the tasks to use the bus at @address */
+static void
+service_set_address (DbusTestService * service, const gchar * address)
+{
+	gchar ** env = service->priv->base_env != NULL ? g_strdupv(service->priv->base_env) : g_get_environ();
+
+	g_print("DBus daemon: %s\n", address);
+
+	env = g_environ_setenv(env, "DBUS_STARTER_ADDRESS", address, TRUE);
+
+	switch (service->priv->bus_type) {
+	case DBUS_TEST_SERVICE_BUS_SESSION:
+		env = g_environ_setenv(env, "DBUS_SESSION_BUS_ADDRESS", address, TRUE);
+		env = g_environ_setenv(env, "DBUS_STARTER_BUS_TYPE", "session", TRUE);
+		break;
+	case DBUS_TEST_SERVICE_BUS_SYSTEM:
+		env = g_environ_setenv(env, "DBUS_SYSTEM_BUS_ADDRESS", address, TRUE);
+		env = g_environ_setenv(env, "DBUS_STARTER_BUS_TYPE", "system", TRUE);
+		break;
+	case DBUS_TEST_SERVICE_BUS_BOTH:
+		env = g_environ_setenv(env, "DBUS_SESSION_BUS_ADDRESS", address, TRUE);
+		env = g_environ_setenv(env, "DBUS_SYSTEM_BUS_ADDRESS", address, TRUE);
+		env = g_environ_setenv(env, "DBUS_STARTER_BUS_TYPE", "session", TRUE);
+		break;
+	}
+
+	/* Setting the variables in our own environment is what most
+	   users expect, but it isn't safe with more than one service */
+	if (service->priv->publish_env) {
+		guint i;
+		for (i = 0; i < G_N_ELEMENTS(bus_variables); i++) {
+			const gchar * value = g_environ_getenv(env, bus_variables[i]);
+			if (value != NULL) {
+				g_setenv(bus_variables[i], value, TRUE);
+			}
 		}
 	}
 
-	g_free(line);
+	g_free(service->priv->address);
+	service->priv->address = g_strdup(address);
+	g_strfreev(service->priv->environment);
+	service->priv->environment = env;
 
-	return TRUE;
+	return;
 }
 
 static void
-dbus_watcher (GPid pid, G_GNUC_UNUSED gint status, gpointer data)
+daemon_address (DbusTestDaemon * daemon, gpointer data)
 {
 	DbusTestService * service = DBUS_TEST_SERVICE(data);
-	g_critical("DBus Daemon exited abruptly!");
 
-	service->priv->daemon_crashed = TRUE;
-	g_main_loop_quit(DBUS_TEST_SERVICE(data)->priv->mainloop);
+	service_set_address(service, _dbus_test_daemon_get_address(daemon));
 
-	if (pid != 0) {
-		g_spawn_close_pid(pid);
+	if (service->priv->state == STATE_DAEMON_STARTING) {
+		g_main_loop_quit(service->priv->mainloop);
 	}
 
 	return;
 }
 
 static void
-dbus_child_setup ()
+daemon_exited (G_GNUC_UNUSED DbusTestDaemon * daemon, gpointer data)
 {
-	setpgrp();
+	DbusTestService * service = DBUS_TEST_SERVICE(data);
+	g_critical("DBus Daemon exited abruptly!");
+
+	service->priv->daemon_crashed = TRUE;
+	g_main_loop_quit(service->priv->mainloop);
+
+	return;
 }
 
-static void
-start_daemon (DbusTestService * service)
+/* Gets a dbus-daemon from the pool or starts one, and waits for it
+   to tell us its address */
+static gboolean
+start_daemon_process (DbusTestService * service)
 {
-	if (service->priv->dbus != 0) {
-		return;
+	if (service->priv->pool != NULL) {
+		service->priv->daemon = _dbus_test_daemon_pool_take(service->priv->pool,
+		                                                    service->priv->dbus_daemon,
+		                                                    service->priv->dbus_configfile,
+		                                                    service->priv->keep_env,
+		                                                    daemon_address,
+		                                                    daemon_exited,
+		                                                    service);
 	}
 
-	service->priv->state = STATE_DAEMON_STARTING;
+	if (service->priv->daemon == NULL) {
+		GError * error = NULL;
+		service->priv->daemon = _dbus_test_daemon_new(service->priv->dbus_daemon,
+		                                              service->priv->dbus_configfile,
+		                                              service->priv->keep_env,
+		                                              &error);
+
+		if (error != NULL) {
+			g_critical("Unable to start dbus daemon: %s", error->message);
+			g_error_free(error);
+			service->priv->daemon_crashed = TRUE;
+			return FALSE;
+		}
+
+		_dbus_test_daemon_set_callbacks(service->priv->daemon, daemon_address, daemon_exited, service);
+	}
 
-	gint dbus_stdout = 0;
+	/* Pooled daemons have usually told us their address already */
+	if (_dbus_test_daemon_get_address(service->priv->daemon) != NULL) {
+		daemon_address(service->priv->daemon, service);
+	} else {
+		g_main_loop_run(service->priv->mainloop);
+	}
+
+	return TRUE;
+}
+
+/* The embedded broker needs no process, so it has an address right
+   away and the pool has nothing to do with it */
+static gboolean
+start_broker (DbusTestService * service)
+{
 	GError * error = NULL;
-	gchar * blank[1] = {NULL};
-	gchar * current_dir = g_get_current_dir();
-	gchar * dbus_startup[] = {service->priv->dbus_daemon, "--config-file", service->priv->dbus_configfile, "--print-address", NULL};
-	g_spawn_async_with_pipes(current_dir,
-	                         dbus_startup, /* argv */
-	                         service->priv->keep_env ? NULL : blank, /* envp */
-	                         G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, /* flags */
-	                         (GSpawnChildSetupFunc) dbus_child_setup, /* child setup func */
-	                         NULL, /* child setup data */
-	                         &service->priv->dbus, /* PID */
-	                         NULL, /* stdin */
-	                         &dbus_stdout, /* stdout */
-	                         NULL, /* stderr */
-	                         &error); /* error */
-
-	g_free (current_dir);
+	service->priv->broker = _dbus_test_broker_new(&error);
 
 	if (error != NULL) {
-		g_critical("Unable to start dbus daemon: %s", error->message);
+		g_critical("Unable to start embedded bus: %s", error->message);
 		g_error_free(error);
 		service->priv->daemon_crashed = TRUE;
-		return;
+		return FALSE;
 	}
 
-	dbus_test_watchdog_add_pid(service->priv->watchdog, service->priv->dbus);
-
-	service->priv->dbus_watch = g_child_watch_add(service->priv->dbus, dbus_watcher, service);
+	service_set_address(service, _dbus_test_broker_get_address(service->priv->broker));
+	return TRUE;
+}
 
-	service->priv->dbus_io = g_io_channel_unix_new(dbus_stdout);
-	service->priv->dbus_io_watch = g_io_add_watch(service->priv->dbus_io,
-	                                              G_IO_IN | G_IO_HUP | G_IO_ERR, /* conditions */
-	                                              dbus_writes, /* func */
-	                                              service); /* func data */
+static void
+start_daemon (DbusTestService * service)
+{
+	if (service->priv->daemon != NULL || service->priv->broker != NULL) {
+		return;
+	}
 
-	g_main_loop_run(service->priv->mainloop);
+	service->priv->state = STATE_DAEMON_STARTING;
 
-	/* we should have a usable connection now, let's check */
-	const gchar * bus_address = NULL;
-	if (service->priv->bus_type == DBUS_TEST_SERVICE_BUS_SYSTEM) {
-		bus_address = g_getenv("DBUS_SYSTEM_BUS_ADDRESS");
+	if (service->priv->backend == DBUS_TEST_SERVICE_BACKEND_EMBEDDED) {
+		if (!start_broker(service)) {
+			return;
+		}
 	} else {
-		bus_address = g_getenv("DBUS_SESSION_BUS_ADDRESS");
+		if (!start_daemon_process(service)) {
+			return;
+		}
 	}
+
+	/* we should have a usable connection now, let's check */
+	const gchar * bus_address = service->priv->address;
 	g_return_if_fail(bus_address != NULL);
-	gchar **tokens = g_strsplit (bus_address, ",", 0);
 
-	guint i;
-	gboolean is_valid = FALSE;
-	for (i = 0; i < g_strv_length (tokens); i++) {
-		if (strlen (tokens[i]) && g_dbus_is_supported_address (tokens[i], NULL)) {
-			is_valid = TRUE;
-			break;
-		}
+	if (!g_dbus_is_supported_address(bus_address, NULL)) {
+		service->priv->state = STATE_DAEMON_FAILED;
+		g_critical ("DBus daemon failed: Bus address is not supported");
+		return;
 	}
-	g_strfreev(tokens);
 
-	if (!is_valid) {
+	/* Our own connection for the tasks to watch names on, the shared
+	   ones only know about the bus in our environment */
+	GError * error = NULL;
+	service->priv->connection = g_dbus_connection_new_for_address_sync(bus_address,
+		G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+		NULL, /* observer */
+		NULL, /* cancel */
+		&error);
+
+	if (error != NULL) {
 		service->priv->state = STATE_DAEMON_FAILED;
-		g_critical ("DBus daemon failed: Bus address is not supported");
-		g_error_free (error);
+		g_critical("DBus daemon failed: Unable to connect: %s", error->message);
+		g_error_free(error);
 		return;
 	}
 
@@ -526,18 +848,77 @@ start_daemon (DbusTestService * service)
 	return;
 }
 
+/* Gives a task without one a cgroup under the run's */
+static gboolean
+task_cgroup_helper (DbusTestService * service, DbusTestTask * task, G_GNUC_UNUSED gpointer user_data)
+{
+	if (_dbus_test_task_get_cgroup(task) != NULL) {
+		return TRUE;
+	}
+
+	GError * error = NULL;
+	gchar * name = g_strdup_printf("task-%u-%s", service->priv->task_cgroups++, dbus_test_task_get_name(task));
+	DbusTestCgroup * cgroup = _dbus_test_cgroup_new(service->priv->cgroup, name, &error);
+	g_free(name);
+
+	if (cgroup == NULL) {
+		g_warning("Unable to make a cgroup for '%s': %s", dbus_test_task_get_name(task), error->message);
+		g_error_free(error);
+		return TRUE;
+	}
+
+	_dbus_test_task_set_cgroup(task, cgroup);
+	return TRUE;
+}
+
+static void
+start_cgroups (DbusTestService * service)
+{
+	if (service->priv->cgroup == NULL) {
+		GError * error = NULL;
+		gchar * name = g_strdup_printf("run-%d-%d", (gint)getpid(), service->priv->number);
+		service->priv->cgroup = _dbus_test_cgroup_new(NULL, name, &error);
+		g_free(name);
+
+		if (service->priv->cgroup == NULL) {
+			g_warning("Unable to run tasks in cgroups: %s", error->message);
+			g_error_free(error);
+			service->priv->use_cgroups = FALSE;
+			return;
+		}
+	}
+
+	all_tasks(service, task_cgroup_helper, NULL);
+
+	return;
+}
+
 void
 dbus_test_service_start_tasks (DbusTestService * service)
 {
 	g_return_if_fail(DBUS_TEST_SERVICE(service));
 	g_return_if_fail(all_tasks(service, all_tasks_bus_match, NULL));
 
-	start_daemon(service);
-	g_return_if_fail(g_getenv("DBUS_SESSION_BUS_ADDRESS") != NULL ||
-		g_getenv("DBUS_SYSTEM_BUS_ADDRESS") != NULL);
+	if (service->priv->daemon == NULL && service->priv->broker == NULL) {
+		gint64 bus_start = g_get_monotonic_time();
+		start_daemon(service);
+		_dbus_test_trace_span(service->priv->trace_track, "service",
+		                      service->priv->backend == DBUS_TEST_SERVICE_BACKEND_EMBEDDED ? "broker start" : "daemon start",
+		                      bus_start, g_get_monotonic_time());
+	}
+
+	g_return_if_fail(service->priv->address != NULL);
 	g_return_if_fail(service->priv->state != STATE_DAEMON_FAILED);
 
-	if (all_tasks(service, all_tasks_started_helper, NULL)) {
+	if (service->priv->use_cgroups) {
+		start_cgroups(service);
+	}
+
+	/* Once over everything, the return types might have changed since
+	   the tasks were added, then it's just the signals */
+	all_tasks(service, task_count_helper, NULL);
+
+	if (service->priv->tasks_unstarted == 0) {
 		/* If we have all started we can mark it as such as long
 		   as we understand where we could hit this case */
 		if (service->priv->state == STATE_INIT || service->priv->state == STATE_DAEMON_STARTED) {
@@ -548,27 +929,23 @@ dbus_test_service_start_tasks (DbusTestService * service)
 
 	normalize_name_lengths(service);
 
-	g_queue_foreach(&service->priv->tasks_first, task_starter, NULL);
-	if (!g_queue_is_empty(&service->priv->tasks_first)) {
-		g_usleep(100000);
-	}
+	g_queue_foreach(&service->priv->tasks_first, task_set_bus_info, service);
+	g_queue_foreach(&service->priv->tasks_normal, task_set_bus_info, service);
+	g_queue_foreach(&service->priv->tasks_last, task_set_bus_info, service);
 
-	g_queue_foreach(&service->priv->tasks_normal, task_starter, NULL);
+	service->priv->state = STATE_STARTING;
+	gint64 tasks_start = g_get_monotonic_time();
+	start_tiers(service);
 
-	if (!g_queue_is_empty(&service->priv->tasks_last)) {
-		g_usleep(100000);
-	}
-	g_queue_foreach(&service->priv->tasks_last, task_starter, NULL);
-
-	if (!all_tasks(service, all_tasks_started_helper, NULL)) {
-		service->priv->state = STATE_STARTING;
+	if (service->priv->tasks_unstarted != 0) {
 		g_main_loop_run(service->priv->mainloop);
 
 		/* This should never happen, but let's be sure */
-		g_return_if_fail(all_tasks(service, all_tasks_started_helper, NULL));
+		g_return_if_fail(service->priv->tasks_unstarted == 0);
 	}
 
 	service->priv->state = STATE_STARTED;
+	_dbus_test_trace_span(service->priv->trace_track, "service", "starting tasks", tasks_start, g_get_monotonic_time());
 
 	return;
 }
@@ -579,6 +956,13 @@ all_tasks_passed_helper (G_GNUC_UNUSED DbusTestService * service, DbusTestTask *
 	return dbus_test_task_passed(task);
 }
 
+static gboolean
+all_tasks_flush_output_helper (G_GNUC_UNUSED DbusTestService * service, DbusTestTask * task, G_GNUC_UNUSED gpointer user_data)
+{
+	dbus_test_task_flush_output(task);
+	return TRUE;
+}
+
 static int
 get_status (DbusTestService * service)
 {
@@ -601,32 +985,46 @@ dbus_test_service_run (DbusTestService * service)
 	dbus_test_service_start_tasks(service);
 	g_return_val_if_fail(service->priv->state == STATE_STARTED, get_status(service));
 
-	if (all_tasks(service, all_tasks_finished_helper, NULL)) {
+	if (service->priv->tasks_unfinished == 0) {
 		return get_status(service);
 	}
 
 	service->priv->state = STATE_RUNNING;
+	gint64 run_start = g_get_monotonic_time();
 	g_main_loop_run(service->priv->mainloop);
+	_dbus_test_trace_span(service->priv->trace_track, "service", "running", run_start, g_get_monotonic_time());
+
+	/* Stopped before the tasks were done, or some failed, whatever
+	   they held back is wanted now */
+	if (service->priv->tasks_unfinished != 0 || get_status(service) != 0) {
+		all_tasks(service, all_tasks_flush_output_helper, NULL);
+	}
 
 	/* This should never happen, but let's be sure */
-	g_return_val_if_fail(all_tasks(service, all_tasks_finished_helper, NULL), -1);
+	g_return_val_if_fail(service->priv->tasks_unfinished == 0, -1);
 	service->priv->state = STATE_FINISHED;
 
 	return get_status(service);
 }
 
 static void
-task_state_changed (G_GNUC_UNUSED DbusTestTask * task, G_GNUC_UNUSED DbusTestTaskState state, gpointer user_data)
+task_state_changed (DbusTestTask * task, G_GNUC_UNUSED DbusTestTaskState state, gpointer user_data)
 {
 	g_return_if_fail(DBUS_TEST_IS_SERVICE(user_data));
 	DbusTestService * service = DBUS_TEST_SERVICE(user_data);
 
-	if (service->priv->state == STATE_STARTING && all_tasks(service, all_tasks_started_helper, NULL)) {
+	task_count_update(service, task);
+
+	if (service->priv->state == STATE_STARTING) {
+		start_tiers(service);
+	}
+
+	if (service->priv->state == STATE_STARTING && service->priv->tasks_unstarted == 0) {
 		g_main_loop_quit(service->priv->mainloop);
 		return;
 	}
 
-	if (service->priv->state == STATE_RUNNING && all_tasks(service, all_tasks_finished_helper, NULL)) {
+	if (service->priv->state == STATE_RUNNING && service->priv->tasks_unfinished == 0) {
 		g_main_loop_quit(service->priv->mainloop);
 		return;
 	}
@@ -634,6 +1032,25 @@ task_state_changed (G_GNUC_UNUSED DbusTestTask * task, G_GNUC_UNUSED DbusTestTas
 	return;
 }
 
+static void
+task_ready (DbusTestTask * task, gpointer user_data)
+{
+	g_return_if_fail(DBUS_TEST_IS_SERVICE(user_data));
+	DbusTestService * service = DBUS_TEST_SERVICE(user_data);
+
+	task_count_update(service, task);
+
+	if (service->priv->state == STATE_STARTING) {
+		start_tiers(service);
+
+		if (service->priv->tasks_unstarted == 0) {
+			g_main_loop_quit(service->priv->mainloop);
+		}
+	}
+
+	return;
+}
+
 void
 dbus_test_service_add_task (DbusTestService * service, DbusTestTask * task)
 {
@@ -650,28 +1067,36 @@ dbus_test_service_add_task_with_priority (DbusTestService * service, DbusTestTas
 	   goals for busness. Fail early. */
 	g_return_if_fail(all_tasks_bus_match(service, task, NULL));
 
-	GQueue * queue = NULL;
+	guint tier = 0;
 
 	switch (prio) {
 	case DBUS_TEST_SERVICE_PRIORITY_FIRST:
-		queue = &service->priv->tasks_first;
+		tier = 0;
 		break;
 	case DBUS_TEST_SERVICE_PRIORITY_NORMAL:
-		queue = &service->priv->tasks_normal;
+		tier = 1;
 		break;
 	case DBUS_TEST_SERVICE_PRIORITY_LAST:
-		queue = &service->priv->tasks_last;
+		tier = 2;
 		break;
 	default:
 		g_assert_not_reached();
 		break;
 	}
+	GQueue * queue = tier_queue(service, tier);
 
 	g_queue_push_tail(queue, g_object_ref(task));
+	if (!g_hash_table_contains(service->priv->task_counts, task)) {
+		g_hash_table_insert(service->priv->task_counts, task, GUINT_TO_POINTER(tier << COUNTED_TIER_SHIFT));
+	}
+	task_count_update(service, task);
 
 	gulong connect = g_signal_connect(G_OBJECT(task), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, G_CALLBACK(task_state_changed), service);
 	g_object_set_data(G_OBJECT(task), SERVICE_CHANGE_HANDLER, GUINT_TO_POINTER(connect));
 
+	connect = g_signal_connect(G_OBJECT(task), DBUS_TEST_TASK_SIGNAL_READY, G_CALLBACK(task_ready), service);
+	g_object_set_data(G_OBJECT(task), SERVICE_READY_HANDLER, GUINT_TO_POINTER(connect));
+
 	return;
 }
 
@@ -695,6 +1120,8 @@ dbus_test_service_remove_task (DbusTestService * service, DbusTestTask * task)
 	count += g_queue_remove_all(&service->priv->tasks_normal, task);
 	count += g_queue_remove_all(&service->priv->tasks_last, task);
 
+	task_count_remove(service, task);
+
 	/* Checking the count here so that we can generate a warning. Guessing that
 	   this actually never happens, but it's easy to check */
 	if (count > 1) {
@@ -739,6 +1166,153 @@ dbus_test_service_set_keep_environment (DbusTestService * service, gboolean keep
 	service->priv->keep_env = keep_env;
 }
 
+/**
+ * dbus_test_service_set_cgroups:
+ * @service: A #DbusTestService
+ * @use_cgroups: Whether to run the tasks in cgroups
+ *
+ * Runs each task in a cgroup v2 group of its own, all under one for
+ * the service.  Everything a task starts is then counted with it, see
+ * dbus_test_task_get_cgroup_usage(), is held to the limits set with
+ * dbus_test_task_set_memory_max() and dbus_test_task_set_cpu_max(),
+ * and is killed with it.  The process has to be in a cgroup that is
+ * delegated to it, like a systemd scope with Delegate=yes.
+ *
+ * The first service that starts tasks with this moves the whole
+ * calling process, all its threads included, into a
+ * "dbus-test-runner" group under the one it is in, as only groups
+ * without processes of their own can have groups under them.  It
+ * stays there for the rest of its life, after the service is gone.
+ *
+ * Without a delegated group tasks run as usual after a warning.  Must
+ * be set before the tasks start.
+ */
+void
+dbus_test_service_set_cgroups (DbusTestService * service, gboolean use_cgroups)
+{
+	g_return_if_fail(DBUS_TEST_IS_SERVICE(service));
+	service->priv->use_cgroups = use_cgroups;
+	return;
+}
+
+/**
+ * dbus_test_service_set_ready_timeout:
+ * @service: A #DbusTestService
+ * @timeout_ms: Time to wait in milliseconds
+ *
+ * Tasks of a priority aren't started until all the tasks of the
+ * previous priority are ready.  This sets how long to wait for that
+ * before giving up and starting them anyway.
+ */
+void
+dbus_test_service_set_ready_timeout (DbusTestService * service, guint timeout_ms)
+{
+	g_return_if_fail(DBUS_TEST_IS_SERVICE(service));
+	service->priv->ready_timeout = timeout_ms;
+	return;
+}
+
+/**
+ * dbus_test_service_set_daemon_pool:
+ * @service: A #DbusTestService
+ * @pool: (allow-none): Pool to get the bus daemon from
+ *
+ * Takes an already started bus daemon from @pool instead of starting
+ * one when the tasks are started.  If the pool has none that match the
+ * daemon, config file and environment of the service one is started
+ * as usual.
+ */
+void
+dbus_test_service_set_daemon_pool (DbusTestService * service, DbusTestDaemonPool * pool)
+{
+	g_return_if_fail(DBUS_TEST_IS_SERVICE(service));
+	g_return_if_fail(pool == NULL || DBUS_TEST_IS_DAEMON_POOL(pool));
+	g_return_if_fail(service->priv->daemon == NULL); /* too late once it's started */
+
+	if (pool != NULL) {
+		g_object_ref(pool);
+	}
+
+	g_clear_object(&service->priv->pool);
+	service->priv->pool = pool;
+
+	return;
+}
+
+/**
+ * dbus_test_service_set_publish_environment:
+ * @service: A #DbusTestService
+ * @publish: Whether to set the bus variables in our environment
+ *
+ * By default the addresses of the bus are set in the environment of
+ * the process so that everything in it uses the new bus.  Services
+ * that run in parallel threads can't all do that, with this turned
+ * off the addresses are only given to the tasks of the service.
+ */
+void
+dbus_test_service_set_publish_environment (DbusTestService * service, gboolean publish)
+{
+	g_return_if_fail(DBUS_TEST_IS_SERVICE(service));
+	service->priv->publish_env = publish;
+	return;
+}
+
+/**
+ * dbus_test_service_set_environment:
+ * @service: A #DbusTestService
+ * @envp: (allow-none): Environment for the tasks to start from, NULL
+ *   to use the environment of this process
+ *
+ * The tasks get this environment with the addresses of the bus added
+ * to it, for when they are run on behalf of another process with an
+ * environment of its own.  Doesn't change the environment of the bus
+ * daemon, see dbus_test_service_set_keep_environment().  Must be set
+ * before the tasks start.
+ */
+void
+dbus_test_service_set_environment (DbusTestService * service, gchar ** envp)
+{
+	g_return_if_fail(DBUS_TEST_IS_SERVICE(service));
+	g_strfreev(service->priv->base_env);
+	service->priv->base_env = g_strdupv(envp);
+	return;
+}
+
+/**
+ * dbus_test_service_set_bus_backend:
+ * @service: A #DbusTestService
+ * @backend: What provides the bus
+ *
+ * With %DBUS_TEST_SERVICE_BACKEND_EMBEDDED the bus is a small broker
+ * running in a thread of this process instead of a dbus-daemon, which
+ * makes short tests a lot cheaper to start.  It has no activation or
+ * security policy, so the daemon, config file and pool of the service
+ * aren't used with it.
+ */
+void
+dbus_test_service_set_bus_backend (DbusTestService * service, DbusTestServiceBackend backend)
+{
+	g_return_if_fail(DBUS_TEST_IS_SERVICE(service));
+	g_return_if_fail(service->priv->daemon == NULL && service->priv->broker == NULL); /* too late once it's started */
+	service->priv->backend = backend;
+	return;
+}
+
+/**
+ * dbus_test_service_get_address:
+ * @service: A #DbusTestService
+ *
+ * Gets the address of the bus that the service started.
+ *
+ * Return value: The address or NULL if the bus isn't started
+ */
+const gchar *
+dbus_test_service_get_address (DbusTestService * service)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_SERVICE(service), NULL);
+	return service->priv->address;
+}
+
 void
 dbus_test_service_stop (DbusTestService * service)
 {
@@ -750,7 +1324,7 @@ dbus_test_service_stop (DbusTestService * service)
 void dbus_test_service_set_bus (DbusTestService * service, DbusTestServiceBus bus)
 {
 	g_return_if_fail(DBUS_TEST_IS_SERVICE(service));
-	g_return_if_fail(service->priv->dbus == 0); /* we can't change after we're running */
+	g_return_if_fail(service->priv->daemon == NULL); /* we can't change after we're running */
 
 	if (bus == DBUS_TEST_SERVICE_BUS_BOTH) {
 		g_warning("Setting bus to BOTH, which is typically only used as a default value.");
@@ -27,6 +27,7 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <glib-object.h>
 
 #include "task.h"
+#include "daemon-pool.h"
 
 G_BEGIN_DECLS
 
@@ -64,6 +65,12 @@ typedef enum
 	DBUS_TEST_SERVICE_BUS_BOTH
 } DbusTestServiceBus;
 
+typedef enum
+{
+	DBUS_TEST_SERVICE_BACKEND_DAEMON,
+	DBUS_TEST_SERVICE_BACKEND_EMBEDDED
+} DbusTestServiceBackend;
+
 GType dbus_test_service_get_type (void);
 DbusTestService * dbus_test_service_new (const gchar * address);
 void dbus_test_service_start_tasks (DbusTestService * service);
@@ -77,7 +84,15 @@ gboolean dbus_test_service_remove_task (DbusTestService * service, DbusTestTask
 void dbus_test_service_set_daemon (DbusTestService * service, const gchar * daemon);
 void dbus_test_service_set_conf_file (DbusTestService * service, const gchar * conffile);
 void dbus_test_service_set_keep_environment (DbusTestService * service, gboolean keep_env);
+void dbus_test_service_set_cgroups (DbusTestService * service, gboolean use_cgroups);
 void dbus_test_service_set_bus (DbusTestService * service, DbusTestServiceBus bus);
+void dbus_test_service_set_ready_timeout (DbusTestService * service, guint timeout_ms);
+void dbus_test_service_set_daemon_pool (DbusTestService * service, DbusTestDaemonPool * pool);
+void dbus_test_service_set_publish_environment (DbusTestService * service, gboolean publish);
+void dbus_test_service_set_environment (DbusTestService * service, gchar ** envp);
+void dbus_test_service_set_bus_backend (DbusTestService * service, DbusTestServiceBackend backend);
+
+const gchar * dbus_test_service_get_address (DbusTestService * service);
 
 G_END_DECLS
 
@@ -0,0 +1,380 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* For clone() */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#endif
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "kill.h"
+#include "spawn.h"
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+/* The child only needs enough to get to exec */
+#define SPAWN_STACK_SIZE (64 * 1024)
+
+/* Lookups of names without a slash, keyed by the PATH searched and
+   the name */
+G_LOCK_DEFINE_STATIC(resolved);
+static GHashTable * resolved = NULL;
+
+/* Walks @search for @executable.  @cacheable is cleared when a
+   relative directory was looked in, those depend on where we are. */
+static gchar *
+find_in_path (const gchar * executable, const gchar * search, gboolean * cacheable)
+{
+	gchar ** dirs = g_strsplit(search, G_SEARCHPATH_SEPARATOR_S, -1);
+	gchar * found = NULL;
+	guint i;
+
+	*cacheable = TRUE;
+
+	for (i = 0; dirs[i] != NULL && found == NULL; i++) {
+		/* An empty entry is the current directory */
+		const gchar * dir = dirs[i][0] != '\0' ? dirs[i] : ".";
+
+		if (!g_path_is_absolute(dir)) {
+			*cacheable = FALSE;
+		}
+
+		gchar * file = g_build_filename(dir, executable, NULL);
+		if (g_file_test(file, G_FILE_TEST_IS_EXECUTABLE) && !g_file_test(file, G_FILE_TEST_IS_DIR)) {
+			found = file;
+		} else {
+			g_free(file);
+		}
+	}
+
+	g_strfreev(dirs);
+
+	return found;
+}
+
+/* Finds the file to exec for @executable the way a spawn searching
+   the PATH of @envp would, or ours if it is NULL, but only walks each
+   PATH once for each name.  Free the result with g_free(). */
+gchar *
+_dbus_test_spawn_resolve (const gchar * executable, gchar ** envp, GError ** error)
+{
+	g_return_val_if_fail(executable != NULL, NULL);
+
+	if (strchr(executable, G_DIR_SEPARATOR) != NULL) {
+		return g_strdup(executable);
+	}
+
+	const gchar * search = envp != NULL ? g_environ_getenv(envp, "PATH") : g_getenv("PATH");
+	if (search == NULL) {
+		/* What execvp() looks in without one */
+		search = "/bin:/usr/bin:.";
+	}
+
+	gchar * key = g_strconcat(search, "\n", executable, NULL);
+	gchar * path;
+
+	G_LOCK(resolved);
+
+	if (resolved == NULL) {
+		resolved = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	}
+
+	path = g_strdup(g_hash_table_lookup(resolved, key));
+
+	G_UNLOCK(resolved);
+
+	if (path == NULL) {
+		gboolean cacheable;
+		path = find_in_path(executable, search, &cacheable);
+
+		if (path != NULL && cacheable) {
+			G_LOCK(resolved);
+			g_hash_table_replace(resolved, key, g_strdup(path));
+			key = NULL;
+			G_UNLOCK(resolved);
+		}
+	}
+
+	g_free(key);
+
+	if (path == NULL) {
+		g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT, "Failed to execute child process \"%s\" (%s)", executable, g_strerror(ENOENT));
+	}
+
+	return path;
+}
+
+#ifdef __linux__
+
+/* Shared between us and the child, we're stopped until it execs */
+typedef struct {
+	const gchar * path;
+	gchar ** argv;
+	gchar ** envp;
+	gint stdin_fd;
+	gint stdout_fd;
+	gint stderr_fd;
+	gint cgroup_fd;
+	sigset_t mask;
+	gint error;
+} spawn_t;
+
+static gint
+spawn_error_code (gint errsv)
+{
+	switch (errsv) {
+	case ENOENT:
+		return G_SPAWN_ERROR_NOENT;
+	case EACCES:
+		return G_SPAWN_ERROR_ACCES;
+	case ENOEXEC:
+		return G_SPAWN_ERROR_NOEXEC;
+	case ENOMEM:
+		return G_SPAWN_ERROR_NOMEM;
+	case E2BIG:
+		return G_SPAWN_ERROR_TOO_BIG;
+	default:
+		return G_SPAWN_ERROR_FAILED;
+	}
+}
+
+static gint
+devnull_fd (void)
+{
+	static gsize fd = 0;
+
+	if (g_once_init_enter(&fd)) {
+		/* Stored plus one, zero is taken by g_once */
+		g_once_init_leave(&fd, open("/dev/null", O_RDONLY | O_CLOEXEC) + 1);
+	}
+
+	return (gint)fd - 1;
+}
+
+/* Anything we have open that isn't marked close-on-exec shouldn't end
+   up in the child either */
+static void
+spawn_child_cloexec (void)
+{
+#ifdef SYS_close_range
+	if (syscall(SYS_close_range, 3, ~0U, CLOSE_RANGE_CLOEXEC) == 0) {
+		return;
+	}
+#endif
+
+	struct rlimit limit;
+	gint fd;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+		limit.rlim_cur = 4096;
+	}
+
+	for (fd = 3; fd < (gint)limit.rlim_cur; fd++) {
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+}
+
+/* Puts @fd in place as @target, leaving it open across the exec */
+static gint
+spawn_child_dup (gint fd, gint target)
+{
+	if (fd == target) {
+		return fcntl(target, F_SETFD, 0);
+	}
+
+	return dup2(fd, target);
+}
+
+/* Writes our PID to the cgroup.procs behind @fd, formatted by hand as
+   we can't allocate here */
+static gint
+spawn_child_join_cgroup (gint fd)
+{
+	gchar buffer[24];
+	gsize pos = sizeof(buffer);
+	glong pid = syscall(SYS_getpid);
+
+	do {
+		buffer[--pos] = '0' + pid % 10;
+		pid /= 10;
+	} while (pid > 0);
+
+	return write(fd, buffer + pos, sizeof(buffer) - pos) < 0 ? -1 : 0;
+}
+
+/* Runs in the child on our memory and our thread's TLS, so nothing in
+   here may allocate or take a lock.  Just syscalls until the exec. */
+static int
+spawn_child (void * data)
+{
+	spawn_t * spawn = data;
+	gint sig;
+
+	/* A handler of ours running in here would be running on our
+	   memory, put them back to the default before unblocking */
+	for (sig = 1; sig < NSIG; sig++) {
+		struct sigaction action;
+
+		if (sigaction(sig, NULL, &action) != 0 || action.sa_handler == SIG_IGN || action.sa_handler == SIG_DFL) {
+			continue;
+		}
+
+		action.sa_handler = SIG_DFL;
+		action.sa_flags = 0;
+		sigemptyset(&action.sa_mask);
+		sigaction(sig, &action, NULL);
+	}
+
+	_dbus_test_kill_child_init();
+
+	if (spawn->cgroup_fd >= 0 && spawn_child_join_cgroup(spawn->cgroup_fd) < 0) {
+		goto failed;
+	}
+
+	if (spawn->stdin_fd >= 0 && dup2(spawn->stdin_fd, STDIN_FILENO) < 0) {
+		goto failed;
+	}
+
+	if (spawn_child_dup(spawn->stdout_fd, STDOUT_FILENO) < 0) {
+		goto failed;
+	}
+
+	if (spawn_child_dup(spawn->stderr_fd, STDERR_FILENO) < 0) {
+		goto failed;
+	}
+
+	spawn_child_cloexec();
+
+	sigprocmask(SIG_SETMASK, &spawn->mask, NULL);
+
+	execve(spawn->path, spawn->argv, spawn->envp);
+
+failed:
+	spawn->error = errno;
+	_exit(127);
+}
+
+gboolean
+_dbus_test_spawn (const gchar * path, gchar ** argv, gchar ** envp, gint cgroup_fd, GPid * pid, gint * stdout_fd, gint * stderr_fd, GError ** error)
+{
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(argv != NULL, FALSE);
+	g_return_val_if_fail(pid != NULL, FALSE);
+	g_return_val_if_fail(stdout_fd != NULL, FALSE);
+	g_return_val_if_fail(stderr_fd != NULL, FALSE);
+
+	gint pipe_fds[2];
+	if (!g_unix_open_pipe(pipe_fds, FD_CLOEXEC, error)) {
+		return FALSE;
+	}
+
+	gint err_fds[2];
+	if (!g_unix_open_pipe(err_fds, FD_CLOEXEC, error)) {
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		return FALSE;
+	}
+
+	spawn_t spawn;
+	spawn.path = path;
+	spawn.argv = argv;
+	spawn.envp = envp != NULL ? envp : environ;
+	spawn.stdin_fd = devnull_fd();
+	spawn.stdout_fd = pipe_fds[1];
+	spawn.stderr_fd = err_fds[1];
+	spawn.cgroup_fd = cgroup_fd;
+	spawn.error = 0;
+
+	/* Nothing gets delivered to the child until it has reset the
+	   handlers, it puts the mask back itself */
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &spawn.mask);
+
+	gchar * stack = g_malloc(SPAWN_STACK_SIZE);
+	GPid child = clone(spawn_child, stack + SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, &spawn);
+	gint errsv = errno;
+
+	pthread_sigmask(SIG_SETMASK, &spawn.mask, NULL);
+	g_free(stack);
+	close(pipe_fds[1]);
+	close(err_fds[1]);
+
+	if (child < 0) {
+		close(pipe_fds[0]);
+		close(err_fds[0]);
+		g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FORK, "Failed to fork (%s)", g_strerror(errsv));
+		return FALSE;
+	}
+
+	/* The child is gone already if the exec failed */
+	if (spawn.error != 0) {
+		waitpid(child, NULL, 0);
+		close(pipe_fds[0]);
+		close(err_fds[0]);
+		g_set_error(error, G_SPAWN_ERROR, spawn_error_code(spawn.error), "Failed to execute child process \"%s\" (%s)", argv[0], g_strerror(spawn.error));
+		return FALSE;
+	}
+
+	*pid = child;
+	*stdout_fd = pipe_fds[0];
+	*stderr_fd = err_fds[0];
+
+	return TRUE;
+}
+
+#else /* __linux__ */
+
+gboolean
+_dbus_test_spawn (const gchar * path, gchar ** argv, gchar ** envp, gint cgroup_fd, GPid * pid, gint * stdout_fd, gint * stderr_fd, GError ** error)
+{
+	/* No cgroups here */
+	(void)path;
+	(void)cgroup_fd;
+
+	return g_spawn_async_with_pipes(NULL, /* working dir */
+	                                argv,
+	                                envp,
+	                                G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+	                                _dbus_test_kill_child_setup,
+	                                NULL,
+	                                pid,
+	                                NULL, /* stdin */
+	                                stdout_fd,
+	                                stderr_fd,
+	                                error);
+}
+
+#endif /* __linux__ */
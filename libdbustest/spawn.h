@@ -0,0 +1,49 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_SPAWN_H__
+#define __DBUS_TEST_SPAWN_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Starting a process without copying our page tables.  A runner with
+   a few thousand tasks gets big enough that a fork for each of them
+   costs more than the tasks do, so the child borrows our memory until
+   it execs.  The child is set up the same way as with
+   _dbus_test_kill_child_setup(), in a process group of its own.
+   Stdin is /dev/null, stdout and stderr are pipes back to us.  With a @cgroup_fd, an open cgroup.procs, the
+   child joins that cgroup before it execs.  This is internal to the
+   library. */
+
+G_GNUC_INTERNAL
+gchar *       _dbus_test_spawn_resolve (const gchar *  executable,
+                                        gchar **       envp,
+                                        GError **      error);
+G_GNUC_INTERNAL
+gboolean      _dbus_test_spawn         (const gchar *  path,
+                                        gchar **       argv,
+                                        gchar **       envp,
+                                        gint           cgroup_fd,
+                                        GPid *         pid,
+                                        gint *         stdout_fd,
+                                        gint *         stderr_fd,
+                                        GError **      error);
+
+G_END_DECLS
+
+#endif
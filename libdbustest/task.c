@@ -21,15 +21,44 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include "dbus-test.h"
 #include <gio/gio.h>
 
+#include "cgroup.h"
+#include "kill.h"
+#include "output.h"
+#include "trace-internal.h"
+
+/* A bus name that has to show up before the task starts */
+typedef struct {
+	gchar * name;
+	DbusTestServiceBus bus;
+	guint watch;
+	gboolean found;
+} wait_name_t;
+
+/* Another task that has to get far enough along before this one
+   starts */
+typedef struct {
+	DbusTestTask * task;
+	DbusTestTaskDependency state;
+	gulong state_handler;
+	gulong ready_handler;
+} dependency_t;
+
 struct _DbusTestTaskPrivate {
 	DbusTestTaskReturn return_type;
 
-	gchar * wait_for;
-	DbusTestServiceBus wait_for_bus;
-	guint wait_task;
+	GList * wait_names;
+	GList * dependencies;
+	gboolean waiting;
+
+	gchar * ready_name;
+	guint ready_task;
+	gboolean ready_name_found;
+	guint ready_holds;
 
 	gchar * name;
 	gchar * name_padded;
@@ -38,22 +67,56 @@ struct _DbusTestTaskPrivate {
 	gboolean been_run;
 	gboolean wait_until_complete;
 
+	/* How long it gets to run, zero for as long as it likes */
+	guint timeout;
+	gboolean timed_out;
+
+	/* Monotonic times, zero until it gets there */
+	gint64 run_time;
+	gint64 start_time;
+	gint64 ready_time;
+	gint64 finish_time;
+
 	DbusTestServiceBus preferred_bus;
+
+	gchar ** environment;
+	GDBusConnection * connection;
+
+	/* Output held back until we know whether it's wanted, the newest
+	   HELD_OUTPUT_SIZE bytes of it in a ring */
+	DbusTestTaskOutput output;
+	gchar * held;
+	gsize held_alloc;
+	gsize held_start;
+	gsize held_len;
+	gboolean held_dropped;
+
+	/* Limits for its cgroup, when the service gives it one */
+	gint64 memory_max;
+	gint64 cpu_quota;
+	gint64 cpu_period;
+	DbusTestCgroup * cgroup;
 };
 
 /* Signals */
 enum {
 	STATE_CHANGED,
+	READY,
 	LAST_SIGNAL /* Don't touch! */
 };
 
 #define DBUS_TEST_TASK_GET_PRIVATE(o) \
 (G_TYPE_INSTANCE_GET_PRIVATE ((o), DBUS_TEST_TYPE_TASK, DbusTestTaskPrivate))
 
+#define HELD_OUTPUT_SIZE (256 * 1024)
+
 static void dbus_test_task_class_init (DbusTestTaskClass *klass);
 static void dbus_test_task_init       (DbusTestTask *self);
 static void dbus_test_task_dispose    (GObject *object);
 static void dbus_test_task_finalize   (GObject *object);
+static void task_state_changed        (DbusTestTask * task,
+                                       DbusTestTaskState state,
+                                       gpointer user_data);
 
 G_DEFINE_TYPE (DbusTestTask, dbus_test_task, G_TYPE_OBJECT);
 
@@ -72,6 +135,7 @@ dbus_test_task_class_init (DbusTestTaskClass *klass)
 	klass->run = NULL;
 	klass->get_state = NULL;
 	klass->get_passed = NULL;
+	klass->state_changed = task_state_changed;
 
 	signals[STATE_CHANGED]  = g_signal_new(DBUS_TEST_TASK_SIGNAL_STATE_CHANGED,
 	                                       G_TYPE_FROM_CLASS (klass),
@@ -80,6 +144,13 @@ dbus_test_task_class_init (DbusTestTaskClass *klass)
 	                                       NULL, NULL,
 	                                       g_cclosure_marshal_VOID__INT,
 	                                       G_TYPE_NONE, 1, G_TYPE_INT, G_TYPE_NONE);
+	signals[READY]          = g_signal_new(DBUS_TEST_TASK_SIGNAL_READY,
+	                                       G_TYPE_FROM_CLASS (klass),
+	                                       G_SIGNAL_RUN_LAST,
+	                                       0, /* no class handler */
+	                                       NULL, NULL,
+	                                       g_cclosure_marshal_VOID__VOID,
+	                                       G_TYPE_NONE, 0, G_TYPE_NONE);
 
 	return;
 }
@@ -93,9 +164,14 @@ dbus_test_task_init (DbusTestTask *self)
 
 	self->priv->return_type = DBUS_TEST_TASK_RETURN_NORMAL;
 
-	self->priv->wait_for = NULL;
-	self->priv->wait_for_bus = DBUS_TEST_SERVICE_BUS_BOTH;
-	self->priv->wait_task = 0;
+	self->priv->wait_names = NULL;
+	self->priv->dependencies = NULL;
+	self->priv->waiting = FALSE;
+
+	self->priv->ready_name = NULL;
+	self->priv->ready_task = 0;
+	self->priv->ready_name_found = FALSE;
+	self->priv->ready_holds = 0;
 
 	self->priv->name = g_strdup_printf("task-%d", task_count++);
 	self->priv->name_padded = NULL;
@@ -104,8 +180,74 @@ dbus_test_task_init (DbusTestTask *self)
 	self->priv->been_run = FALSE;
 	self->priv->wait_until_complete = FALSE;
 
+	self->priv->timeout = 0;
+	self->priv->timed_out = FALSE;
+
+	self->priv->run_time = 0;
+	self->priv->start_time = 0;
+	self->priv->ready_time = 0;
+	self->priv->finish_time = 0;
+
+	self->priv->memory_max = -1;
+	self->priv->cpu_quota = -1;
+	self->priv->cpu_period = 0;
+	self->priv->cgroup = NULL;
+
 	self->priv->preferred_bus = DBUS_TEST_SERVICE_BUS_BOTH;
 
+	self->priv->environment = NULL;
+	self->priv->connection = NULL;
+
+	self->priv->output = DBUS_TEST_TASK_OUTPUT_IMMEDIATE;
+	self->priv->held = NULL;
+	self->priv->held_alloc = 0;
+	self->priv->held_start = 0;
+	self->priv->held_len = 0;
+	self->priv->held_dropped = FALSE;
+
+	return;
+}
+
+static void
+wait_name_free (gpointer data)
+{
+	wait_name_t * wait = (wait_name_t *)data;
+
+	if (wait->watch != 0) {
+		g_bus_unwatch_name(wait->watch);
+	}
+
+	g_free(wait->name);
+	g_free(wait);
+
+	return;
+}
+
+static void
+dependency_disconnect (dependency_t * dep)
+{
+	if (dep->state_handler != 0) {
+		g_signal_handler_disconnect(dep->task, dep->state_handler);
+		dep->state_handler = 0;
+	}
+
+	if (dep->ready_handler != 0) {
+		g_signal_handler_disconnect(dep->task, dep->ready_handler);
+		dep->ready_handler = 0;
+	}
+
+	return;
+}
+
+static void
+dependency_free (gpointer data)
+{
+	dependency_t * dep = (dependency_t *)data;
+
+	dependency_disconnect(dep);
+	g_object_unref(dep->task);
+	g_free(dep);
+
 	return;
 }
 
@@ -115,9 +257,23 @@ dbus_test_task_dispose (GObject *object)
 	g_return_if_fail(DBUS_TEST_IS_TASK(object));
 	DbusTestTask * self = DBUS_TEST_TASK(object);
 
-	if (self->priv->wait_task != 0) {
-		g_bus_unwatch_name(self->priv->wait_task);
-		self->priv->wait_task = 0;
+	g_list_free_full(self->priv->wait_names, wait_name_free);
+	self->priv->wait_names = NULL;
+
+	g_list_free_full(self->priv->dependencies, dependency_free);
+	self->priv->dependencies = NULL;
+
+	if (self->priv->ready_task != 0) {
+		g_bus_unwatch_name(self->priv->ready_task);
+		self->priv->ready_task = 0;
+	}
+
+	g_clear_object(&self->priv->connection);
+
+	/* Anything it left running goes with it */
+	if (self->priv->cgroup != NULL) {
+		_dbus_test_cgroup_free(self->priv->cgroup);
+		self->priv->cgroup = NULL;
 	}
 
 	G_OBJECT_CLASS (dbus_test_task_parent_class)->dispose (object);
@@ -134,7 +290,9 @@ dbus_test_task_finalize (GObject *object)
 
 	g_free(self->priv->name);
 	g_free(self->priv->name_padded);
-	g_free(self->priv->wait_for);
+	g_free(self->priv->ready_name);
+	g_strfreev(self->priv->environment);
+	g_free(self->priv->held);
 
 	G_OBJECT_CLASS (dbus_test_task_parent_class)->finalize (object);
 	return;
@@ -199,19 +357,91 @@ void
 dbus_test_task_set_wait_for_bus (DbusTestTask * task, const gchar * dbus_name, DbusTestServiceBus bus)
 {
 	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+	g_return_if_fail(!task->priv->waiting);
 
-	if (task->priv->wait_for != NULL) {
-		g_free(task->priv->wait_for);
-		task->priv->wait_for = NULL;
-		task->priv->wait_for_bus = DBUS_TEST_SERVICE_BUS_BOTH;
-	}
+	g_list_free_full(task->priv->wait_names, wait_name_free);
+	task->priv->wait_names = NULL;
 
 	if (dbus_name == NULL) {
 		return;
 	}
 
-	task->priv->wait_for = g_strdup(dbus_name);
-	task->priv->wait_for_bus = bus;
+	dbus_test_task_add_wait_for(task, dbus_name, bus);
+
+	return;
+}
+
+/**
+ * dbus_test_task_add_wait_for:
+ * @task: Task to adjust the value on
+ * @dbus_name: Name that needs to be on the bus
+ * @bus: Which bus to look for the name on
+ *
+ * Adds a name to the ones that need to show up on the bus before
+ * the task is started.  Unlike dbus_test_task_set_wait_for() this
+ * keeps the names that were already there.
+ */
+void
+dbus_test_task_add_wait_for (DbusTestTask * task, const gchar * dbus_name, DbusTestServiceBus bus)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+	g_return_if_fail(dbus_name != NULL);
+	g_return_if_fail(!task->priv->waiting);
+
+	wait_name_t * wait = g_new0(wait_name_t, 1);
+	wait->name = g_strdup(dbus_name);
+	wait->bus = bus;
+
+	task->priv->wait_names = g_list_append(task->priv->wait_names, wait);
+
+	return;
+}
+
+/* Whether @task ends up waiting on @dependency somewhere down
+   the line */
+static gboolean
+task_depends_on (DbusTestTask * task, DbusTestTask * dependency)
+{
+	GList * ldep;
+
+	for (ldep = task->priv->dependencies; ldep != NULL; ldep = g_list_next(ldep)) {
+		dependency_t * dep = (dependency_t *)ldep->data;
+
+		if (dep->task == dependency || task_depends_on(dep->task, dependency)) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * dbus_test_task_add_dependency:
+ * @task: Task to adjust the value on
+ * @dependency: Task that needs to get along first
+ * @state: How far along @dependency needs to be
+ *
+ * Holds back starting @task until @dependency is running, ready or
+ * finished.  Tasks can depend on any number of other tasks and are
+ * started as soon as all of them, and all the names from
+ * dbus_test_task_add_wait_for(), are there.  Both tasks should be
+ * in the same service, otherwise @dependency never gets started.
+ */
+void
+dbus_test_task_add_dependency (DbusTestTask * task, DbusTestTask * dependency, DbusTestTaskDependency state)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+	g_return_if_fail(DBUS_TEST_IS_TASK(dependency));
+	g_return_if_fail(!task->priv->waiting);
+	/* Cycles would wait forever */
+	g_return_if_fail(task != dependency);
+	g_return_if_fail(!task_depends_on(dependency, task));
+
+	dependency_t * dep = g_new0(dependency_t, 1);
+	dep->task = g_object_ref(dependency);
+	dep->state = state;
+
+	task->priv->dependencies = g_list_append(task->priv->dependencies, dep);
 
 	return;
 }
@@ -229,18 +459,296 @@ dbus_test_task_set_return (DbusTestTask * task, DbusTestTaskReturn ret)
 	return;
 }
 
+/* Note when it finished, and dump what we were holding if it turned
+   out we needed it */
+static void
+task_state_changed (DbusTestTask * task, DbusTestTaskState state, G_GNUC_UNUSED gpointer user_data)
+{
+	if (state == DBUS_TEST_TASK_STATE_FINISHED && task->priv->finish_time == 0) {
+		task->priv->finish_time = g_get_monotonic_time();
+		_dbus_test_trace_span(task->priv->name, "task", "running", task->priv->start_time, task->priv->finish_time);
+	}
+
+	if (state == DBUS_TEST_TASK_STATE_FINISHED && task->priv->been_run && !dbus_test_task_passed(task)) {
+		dbus_test_task_flush_output(task);
+	}
+
+	return;
+}
+
+/* Keeps @len bytes of output, dropping the oldest when it's full */
+static void
+task_hold_output (DbusTestTask * task, const gchar * text, gsize len)
+{
+	DbusTestTaskPrivate * priv = task->priv;
+
+	if (len == 0) {
+		return;
+	}
+
+	if (len > HELD_OUTPUT_SIZE) {
+		text += len - HELD_OUTPUT_SIZE;
+		len = HELD_OUTPUT_SIZE;
+		priv->held_dropped = TRUE;
+	}
+
+	/* Only as big as it needs to be, most tasks don't say much */
+	if (priv->held_len + len > priv->held_alloc && priv->held_alloc < HELD_OUTPUT_SIZE) {
+		gsize alloc = MAX(MAX(priv->held_alloc * 2, priv->held_len + len), 4096);
+		alloc = MIN(alloc, HELD_OUTPUT_SIZE);
+
+		gchar * held = g_malloc(alloc);
+		gsize first = MIN(priv->held_len, priv->held_alloc - priv->held_start);
+		if (priv->held_len > 0) {
+			memcpy(held, priv->held + priv->held_start, first);
+			memcpy(held + first, priv->held, priv->held_len - first);
+		}
+
+		g_free(priv->held);
+		priv->held = held;
+		priv->held_alloc = alloc;
+		priv->held_start = 0;
+	}
+
+	if (priv->held_len + len > priv->held_alloc) {
+		gsize overflow = priv->held_len + len - priv->held_alloc;
+		priv->held_start = (priv->held_start + overflow) % priv->held_alloc;
+		priv->held_len -= overflow;
+		priv->held_dropped = TRUE;
+	}
+
+	gsize pos = (priv->held_start + priv->held_len) % priv->held_alloc;
+	gsize first = MIN(len, priv->held_alloc - pos);
+	memcpy(priv->held + pos, text, first);
+	memcpy(priv->held, text + first, len - first);
+	priv->held_len += len;
+
+	return;
+}
+
+/* Where all of a task's output goes, @text is whole lines */
+void
+_dbus_test_task_write (DbusTestTask * task, const gchar * text, gsize len)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	if (task->priv->output == DBUS_TEST_TASK_OUTPUT_ON_FAILURE) {
+		task_hold_output(task, text, len);
+	} else {
+		g_print("%.*s", (int)len, text);
+	}
+
+	return;
+}
+
+const gchar *
+_dbus_test_task_get_print_name (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), NULL);
+
+	if (task->priv->name_padded != NULL) {
+		return task->priv->name_padded;
+	}
+
+	return task->priv->name;
+}
+
 void
 dbus_test_task_print (DbusTestTask * task, const gchar * message)
 {
 	g_return_if_fail(DBUS_TEST_IS_TASK(task));
 	g_return_if_fail(message != NULL);
 
-	gchar * name = task->priv->name;
-	if (task->priv->name_padded != NULL) {
-		name = task->priv->name_padded;
+	/* What we say about the task goes in the log next to what it
+	   says itself */
+	_dbus_test_log_write(task->priv->name, "runner", message, strlen(message));
+
+	if (task->priv->output == DBUS_TEST_TASK_OUTPUT_IMMEDIATE) {
+		g_print("%s: %s\n", _dbus_test_task_get_print_name(task), message);
+		return;
+	}
+
+	gchar * line = g_strdup_printf("%s: %s\n", _dbus_test_task_get_print_name(task), message);
+	task_hold_output(task, line, strlen(line));
+	g_free(line);
+
+	return;
+}
+
+/**
+ * dbus_test_task_set_output:
+ * @task: Task to adjust the value on
+ * @output: When the output of the task gets printed
+ *
+ * With #DBUS_TEST_TASK_OUTPUT_ON_FAILURE the task's output is
+ * held back, and only printed if the task finishes without
+ * passing or dbus_test_task_flush_output() is called.  The most
+ * recent 256 KiB of it are kept.
+ */
+void
+dbus_test_task_set_output (DbusTestTask * task, DbusTestTaskOutput output)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	if (task->priv->output == output) {
+		return;
+	}
+
+	dbus_test_task_flush_output(task);
+	task->priv->output = output;
+
+	return;
+}
+
+/* Puts the limits on the cgroup, if there is one yet */
+static void
+task_apply_limits (DbusTestTask * task)
+{
+	GError * error = NULL;
+	gchar * value;
+
+	if (task->priv->cgroup == NULL) {
+		return;
 	}
 
-	g_print("%s: %s\n", name, message);
+	if (task->priv->memory_max >= 0) {
+		value = g_strdup_printf("%" G_GINT64_FORMAT, task->priv->memory_max);
+		if (!_dbus_test_cgroup_set(task->priv->cgroup, "memory.max", value, &error)) {
+			g_warning("Unable to limit memory of '%s': %s", task->priv->name, error->message);
+			g_clear_error(&error);
+		}
+		g_free(value);
+	}
+
+	if (task->priv->cpu_quota >= 0) {
+		value = g_strdup_printf("%" G_GINT64_FORMAT " %" G_GINT64_FORMAT, task->priv->cpu_quota, task->priv->cpu_period);
+		if (!_dbus_test_cgroup_set(task->priv->cgroup, "cpu.max", value, &error)) {
+			g_warning("Unable to limit CPU of '%s': %s", task->priv->name, error->message);
+			g_clear_error(&error);
+		}
+		g_free(value);
+	}
+
+	return;
+}
+
+/**
+ * dbus_test_task_set_memory_max:
+ * @task: Task to adjust the value on
+ * @bytes: Most memory it may use, or -1 for no limit
+ *
+ * Limits the memory the task and everything it starts can use
+ * together, through memory.max of its cgroup.  Only has an effect
+ * when the service runs tasks in cgroups, see
+ * dbus_test_service_set_cgroups().
+ */
+void
+dbus_test_task_set_memory_max (DbusTestTask * task, gint64 bytes)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	task->priv->memory_max = bytes;
+	task_apply_limits(task);
+
+	return;
+}
+
+/**
+ * dbus_test_task_set_cpu_max:
+ * @task: Task to adjust the value on
+ * @quota_us: CPU time it may use in each period, or -1 for no limit
+ * @period_us: Length of the period in microseconds
+ *
+ * Limits the CPU time the task and everything it starts can use
+ * together, through cpu.max of its cgroup.  A quota of half the
+ * period is half a CPU.  Only has an effect when the service runs
+ * tasks in cgroups, see dbus_test_service_set_cgroups().
+ */
+void
+dbus_test_task_set_cpu_max (DbusTestTask * task, gint64 quota_us, gint64 period_us)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+	g_return_if_fail(quota_us < 0 || period_us > 0);
+
+	task->priv->cpu_quota = quota_us;
+	task->priv->cpu_period = period_us;
+	task_apply_limits(task);
+
+	return;
+}
+
+/* Takes @cgroup to start its processes in */
+void
+_dbus_test_task_set_cgroup (DbusTestTask * task, DbusTestCgroup * cgroup)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	if (task->priv->cgroup != NULL) {
+		_dbus_test_cgroup_free(task->priv->cgroup);
+	}
+
+	task->priv->cgroup = cgroup;
+	task_apply_limits(task);
+
+	return;
+}
+
+DbusTestCgroup *
+_dbus_test_task_get_cgroup (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), NULL);
+
+	return task->priv->cgroup;
+}
+
+/**
+ * dbus_test_task_flush_output:
+ * @task: Task to print the output of
+ *
+ * Prints any output that the task has been holding back, all
+ * together.  Does nothing if it hasn't held any.
+ */
+void
+dbus_test_task_flush_output (DbusTestTask * task)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+	DbusTestTaskPrivate * priv = task->priv;
+
+	if (priv->held_len == 0 && !priv->held_dropped) {
+		return;
+	}
+
+	gsize start = priv->held_start;
+	gsize len = priv->held_len;
+
+	if (priv->held_dropped) {
+		g_print("%s: Earlier output was dropped\n", _dbus_test_task_get_print_name(task));
+
+		/* Don't start partway through a line */
+		while (len > 0) {
+			gchar c = priv->held[start];
+			start = (start + 1) % priv->held_alloc;
+			len--;
+
+			if (c == '\n') {
+				break;
+			}
+		}
+	}
+
+	gsize first = MIN(len, priv->held_alloc - start);
+	if (first > 0) {
+		g_print("%.*s", (int)first, priv->held + start);
+	}
+	if (len > first) {
+		g_print("%.*s", (int)(len - first), priv->held);
+	}
+
+	g_clear_pointer(&priv->held, g_free);
+	priv->held_alloc = 0;
+	priv->held_start = 0;
+	priv->held_len = 0;
+	priv->held_dropped = FALSE;
 
 	return;
 }
@@ -250,7 +758,7 @@ dbus_test_task_get_state (DbusTestTask * task)
 {
 	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), DBUS_TEST_TASK_STATE_FINISHED);
 
-	if (task->priv->wait_task != 0) {
+	if (task->priv->waiting) {
 		return DBUS_TEST_TASK_STATE_WAITING;
 	}
 
@@ -274,17 +782,83 @@ dbus_test_task_get_return (DbusTestTask * task)
 	return task->priv->return_type;
 }
 
+/* Figure out which bus a name we're watching for should be on */
+static GBusType
+task_bus_type (DbusTestTask * task, DbusTestServiceBus name_bus)
+{
+	if (name_bus == DBUS_TEST_SERVICE_BUS_BOTH &&
+			task->priv->preferred_bus == DBUS_TEST_SERVICE_BUS_SYSTEM) {
+		return G_BUS_TYPE_SYSTEM;
+	}
+
+	return G_BUS_TYPE_SESSION;
+}
+
+/* Watch on the connection from the service if we have one, otherwise
+   look at the buses in our environment */
+static guint
+task_watch_name (DbusTestTask * task, const gchar * name, DbusTestServiceBus name_bus, GBusNameAppearedCallback appeared)
+{
+	if (task->priv->connection != NULL) {
+		return g_bus_watch_name_on_connection(task->priv->connection,
+		                                      name,
+		                                      G_BUS_NAME_WATCHER_FLAGS_NONE,
+		                                      appeared,
+		                                      NULL,
+		                                      task,
+		                                      NULL);
+	}
+
+	return g_bus_watch_name(task_bus_type(task, name_bus),
+	                        name,
+	                        G_BUS_NAME_WATCHER_FLAGS_NONE,
+	                        appeared,
+	                        NULL,
+	                        task,
+	                        NULL);
+}
+
+/* Tell anyone listening that we're ready, if we are */
 static void
-wait_for_found (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * name, G_GNUC_UNUSED const gchar * name_owner, gpointer user_data)
+ready_check (DbusTestTask * task)
+{
+	if (dbus_test_task_get_ready(task)) {
+		if (task->priv->ready_time == 0) {
+			task->priv->ready_time = g_get_monotonic_time();
+			_dbus_test_trace_span(task->priv->name, "task", "getting ready", task->priv->start_time, task->priv->ready_time);
+		}
+		g_signal_emit(G_OBJECT(task), signals[READY], 0, NULL);
+	}
+
+	return;
+}
+
+static void
+ready_name_found (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const gchar * name, G_GNUC_UNUSED const gchar * name_owner, gpointer user_data)
 {
 	g_return_if_fail(DBUS_TEST_IS_TASK(user_data));
 	DbusTestTask * task = DBUS_TEST_TASK(user_data);
 
-	g_bus_unwatch_name(task->priv->wait_task);
-	task->priv->wait_task = 0;
+	g_bus_unwatch_name(task->priv->ready_task);
+	task->priv->ready_task = 0;
+	task->priv->ready_name_found = TRUE;
+
+	ready_check(task);
+
+	return;
+}
+
+/* Actually start the task, the waiting is done */
+static void
+task_start (DbusTestTask * task)
+{
+	if (task->priv->ready_name != NULL && !task->priv->ready_name_found && task->priv->ready_task == 0) {
+		task->priv->ready_task = task_watch_name(task, task->priv->ready_name, DBUS_TEST_SERVICE_BUS_BOTH, ready_name_found);
+	}
 
 	DbusTestTaskClass * klass = DBUS_TEST_TASK_GET_CLASS(task);
 	task->priv->been_run = TRUE;
+	task->priv->start_time = g_get_monotonic_time();
 	if (klass->run != NULL) {
 		klass->run(task);
 	} else {
@@ -294,38 +868,134 @@ wait_for_found (G_GNUC_UNUSED GDBusConnection * connection, G_GNUC_UNUSED const
 	return;
 }
 
+static gboolean
+dependency_met (dependency_t * dep)
+{
+	DbusTestTaskState state = dbus_test_task_get_state(dep->task);
+
+	switch (dep->state) {
+	case DBUS_TEST_TASK_DEPENDENCY_RUNNING:
+		return state == DBUS_TEST_TASK_STATE_RUNNING || state == DBUS_TEST_TASK_STATE_FINISHED;
+	case DBUS_TEST_TASK_DEPENDENCY_READY:
+		return dbus_test_task_get_ready(dep->task);
+	case DBUS_TEST_TASK_DEPENDENCY_FINISHED:
+		return state == DBUS_TEST_TASK_STATE_FINISHED;
+	}
+
+	return FALSE;
+}
+
+/* Start the task if nothing is holding it back anymore */
+static void
+wait_check (DbusTestTask * task)
+{
+	if (!task->priv->waiting) {
+		return;
+	}
+
+	GList * lwait;
+	for (lwait = task->priv->wait_names; lwait != NULL; lwait = g_list_next(lwait)) {
+		if (!((wait_name_t *)lwait->data)->found) {
+			return;
+		}
+	}
+
+	GList * ldep;
+	for (ldep = task->priv->dependencies; ldep != NULL; ldep = g_list_next(ldep)) {
+		if (!dependency_met((dependency_t *)ldep->data)) {
+			return;
+		}
+	}
+
+	for (ldep = task->priv->dependencies; ldep != NULL; ldep = g_list_next(ldep)) {
+		dependency_disconnect((dependency_t *)ldep->data);
+	}
+
+	task->priv->waiting = FALSE;
+	_dbus_test_trace_span(task->priv->name, "task", "waiting", task->priv->run_time, g_get_monotonic_time());
+	task_start(task);
+
+	return;
+}
+
+static void
+wait_for_found (G_GNUC_UNUSED GDBusConnection * connection, const gchar * name, G_GNUC_UNUSED const gchar * name_owner, gpointer user_data)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(user_data));
+	DbusTestTask * task = DBUS_TEST_TASK(user_data);
+
+	GList * lwait;
+	for (lwait = task->priv->wait_names; lwait != NULL; lwait = g_list_next(lwait)) {
+		wait_name_t * wait = (wait_name_t *)lwait->data;
+
+		if (wait->watch != 0 && g_strcmp0(wait->name, name) == 0) {
+			g_bus_unwatch_name(wait->watch);
+			wait->watch = 0;
+			wait->found = TRUE;
+
+			if (_dbus_test_trace_enabled()) {
+				gchar * span = g_strdup_printf("wait for %s", name);
+				_dbus_test_trace_span(task->priv->name, "wait-for", span, task->priv->run_time, g_get_monotonic_time());
+				g_free(span);
+			}
+		}
+	}
+
+	wait_check(task);
+
+	return;
+}
+
+static void
+dependency_state_changed (G_GNUC_UNUSED DbusTestTask * dependency, G_GNUC_UNUSED DbusTestTaskState state, gpointer user_data)
+{
+	wait_check(DBUS_TEST_TASK(user_data));
+	return;
+}
+
+static void
+dependency_ready (G_GNUC_UNUSED DbusTestTask * dependency, gpointer user_data)
+{
+	wait_check(DBUS_TEST_TASK(user_data));
+	return;
+}
+
 void
 dbus_test_task_run (DbusTestTask * task)
 {
 	g_return_if_fail(DBUS_TEST_IS_TASK(task));
 
+	task->priv->run_time = g_get_monotonic_time();
+
 	/* We're going to process the waiting at this level if we've been
 	   asked to do so */
-	if (task->priv->wait_for != NULL) {
-		GBusType bustype = G_BUS_TYPE_SESSION;
-		if (task->priv->wait_for_bus == DBUS_TEST_SERVICE_BUS_BOTH &&
-				task->priv->preferred_bus == DBUS_TEST_SERVICE_BUS_SYSTEM) {
-			bustype = G_BUS_TYPE_SYSTEM;
+	if (task->priv->wait_names != NULL || task->priv->dependencies != NULL) {
+		task->priv->waiting = TRUE;
+
+		GList * ldep;
+		for (ldep = task->priv->dependencies; ldep != NULL; ldep = g_list_next(ldep)) {
+			dependency_t * dep = (dependency_t *)ldep->data;
+
+			dep->state_handler = g_signal_connect(G_OBJECT(dep->task), DBUS_TEST_TASK_SIGNAL_STATE_CHANGED, G_CALLBACK(dependency_state_changed), task);
+			dep->ready_handler = g_signal_connect(G_OBJECT(dep->task), DBUS_TEST_TASK_SIGNAL_READY, G_CALLBACK(dependency_ready), task);
+		}
+
+		GList * lwait;
+		for (lwait = task->priv->wait_names; lwait != NULL; lwait = g_list_next(lwait)) {
+			wait_name_t * wait = (wait_name_t *)lwait->data;
+
+			wait->found = FALSE;
+			wait->watch = task_watch_name(task, wait->name, wait->bus, wait_for_found);
 		}
 
-		task->priv->wait_task = g_bus_watch_name(bustype,
-		                                         task->priv->wait_for,
-		                                         G_BUS_NAME_WATCHER_FLAGS_NONE,
-		                                         wait_for_found,
-		                                         NULL,
-		                                         task,
-		                                         NULL);
 		g_signal_emit(G_OBJECT(task), signals[STATE_CHANGED], 0, DBUS_TEST_TASK_STATE_WAITING, NULL);
+
+		/* The tasks we depend on might be there already */
+		wait_check(task);
 		return;
 	}
 
-	DbusTestTaskClass * klass = DBUS_TEST_TASK_GET_CLASS(task);
-	task->priv->been_run = TRUE;
-	if (klass->run != NULL) {
-		klass->run(task);
-	} else {
-		g_signal_emit(G_OBJECT(task), signals[STATE_CHANGED], 0, DBUS_TEST_TASK_STATE_FINISHED, NULL);
-	}
+	task_start(task);
 
 	return;
 }
@@ -336,6 +1006,11 @@ dbus_test_task_passed (DbusTestTask * task)
 	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), FALSE);
 	g_return_val_if_fail(task->priv->been_run, FALSE);
 
+	/* Asking for a time limit is caring, whatever the return */
+	if (task->priv->timed_out) {
+		return FALSE;
+	}
+
 	/* If we don't care, we always pass */
 	if (task->priv->return_type == DBUS_TEST_TASK_RETURN_IGNORE) {
 		return TRUE;
@@ -368,7 +1043,11 @@ dbus_test_task_get_wait_for (DbusTestTask * task)
 {
 	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), NULL);
 
-	return task->priv->wait_for;
+	if (task->priv->wait_names == NULL) {
+		return NULL;
+	}
+
+	return ((wait_name_t *)task->priv->wait_names->data)->name;
 }
 
 /**
@@ -390,6 +1069,77 @@ dbus_test_task_set_wait_finished (DbusTestTask * task, gboolean wait_till_comple
 	return;
 }
 
+/**
+ * dbus_test_task_set_timeout:
+ * @task: Task to adjust the value on
+ * @timeout_ms: How long it may run in milliseconds, or zero for
+ *    no limit
+ *
+ * A process still running this long after it was started is asked
+ * to stop with SIGTERM, and gets a SIGKILL if it is still there after
+ * its kill timeout, see dbus_test_process_set_kill_timeout().  Either
+ * way the task fails and dbus_test_task_get_timed_out() says why,
+ * even if its return value is ignored.  Has to be set before the
+ * task is run.
+ */
+void
+dbus_test_task_set_timeout (DbusTestTask * task, guint timeout_ms)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	if (task->priv->been_run) {
+		g_warning("Setting the timeout after the task has been run");
+	}
+
+	task->priv->timeout = timeout_ms;
+
+	return;
+}
+
+/**
+ * dbus_test_task_get_timeout:
+ * @task: Task to get the value from
+ *
+ * Return value: How long the task may run in milliseconds, zero
+ *    when there is no limit
+ */
+guint
+dbus_test_task_get_timeout (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), 0);
+
+	return task->priv->timeout;
+}
+
+/**
+ * dbus_test_task_get_timed_out:
+ * @task: Task to get the value from
+ *
+ * Whether the task was stopped for running longer than its timeout,
+ * as opposed to failing on its own.
+ *
+ * Return value: Whether it ran out of time
+ */
+gboolean
+dbus_test_task_get_timed_out (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), FALSE);
+
+	return task->priv->timed_out;
+}
+
+/* Called by whatever stopped it, before it finishes */
+void
+_dbus_test_task_set_timed_out (DbusTestTask * task)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	task->priv->timed_out = TRUE;
+	_dbus_test_trace_instant(task->priv->name, "task", "timed out");
+
+	return;
+}
+
 /**
  * dbus_test_task_set_wait_finished:
  * @task: Task to get the value from
@@ -433,3 +1183,269 @@ dbus_test_task_get_bus (DbusTestTask * task)
 
 	return task->priv->preferred_bus;
 }
+
+/**
+ * dbus_test_task_set_ready_name:
+ * @task: Task to adjust the value on
+ * @dbus_name: (allow-none): Name the task will own when it is ready
+ *
+ * By default a task is ready as soon as it is running.  Setting
+ * a name here means that it isn't ready until that name shows up
+ * on the bus, which holds back tasks of a later priority.
+ */
+void
+dbus_test_task_set_ready_name (DbusTestTask * task, const gchar * dbus_name)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	g_free(task->priv->ready_name);
+	task->priv->ready_name = g_strdup(dbus_name);
+	task->priv->ready_name_found = FALSE;
+
+	return;
+}
+
+/**
+ * dbus_test_task_get_ready_name:
+ * @task: Task to get the value from
+ *
+ * Gets the name that the task needs to own before it is ready.
+ */
+const gchar *
+dbus_test_task_get_ready_name (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), NULL);
+
+	return task->priv->ready_name;
+}
+
+/**
+ * dbus_test_task_get_ready:
+ * @task: Task to check
+ *
+ * Checks whether the task has gotten far enough along that other
+ * tasks can count on it.  That means it has started, owns its
+ * ready name if one was set, and no one is holding it back.  A
+ * task that has finished is always ready as nothing will change.
+ *
+ * Return value: Whether the task is ready
+ */
+gboolean
+dbus_test_task_get_ready (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), FALSE);
+
+	if (task->priv->ready_holds > 0) {
+		return FALSE;
+	}
+
+	switch (dbus_test_task_get_state(task)) {
+	case DBUS_TEST_TASK_STATE_INIT:
+	case DBUS_TEST_TASK_STATE_WAITING:
+		return FALSE;
+	case DBUS_TEST_TASK_STATE_FINISHED:
+		return TRUE;
+	case DBUS_TEST_TASK_STATE_RUNNING:
+		break;
+	}
+
+	if (task->priv->ready_name != NULL && !task->priv->ready_name_found) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * dbus_test_task_hold_ready:
+ * @task: Task to hold
+ *
+ * Used by subclasses that have more to do after they start before
+ * they are useful.  The task won't be ready until there is a call
+ * to dbus_test_task_release_ready() for each call to this one.
+ */
+void
+dbus_test_task_hold_ready (DbusTestTask * task)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	task->priv->ready_holds++;
+
+	return;
+}
+
+/**
+ * dbus_test_task_release_ready:
+ * @task: Task to release
+ *
+ * Drops a hold taken with dbus_test_task_hold_ready() and signals
+ * that the task is ready if it was the last one.
+ */
+void
+dbus_test_task_release_ready (DbusTestTask * task)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+	g_return_if_fail(task->priv->ready_holds > 0);
+
+	task->priv->ready_holds--;
+
+	if (task->priv->ready_holds == 0) {
+		ready_check(task);
+	}
+
+	return;
+}
+
+/**
+ * dbus_test_task_set_environment:
+ * @task: Task to adjust the value on
+ * @envp: (allow-none): Environment for anything the task starts,
+ *   NULL to use the environment of this process
+ *
+ * Set by the service to the environment that points at its bus.
+ */
+void
+dbus_test_task_set_environment (DbusTestTask * task, gchar ** envp)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+
+	g_strfreev(task->priv->environment);
+	task->priv->environment = g_strdupv(envp);
+
+	return;
+}
+
+/**
+ * dbus_test_task_get_environment:
+ * @task: Task to get the value from
+ *
+ * Gets the environment that processes started by the task should
+ * get.  Suitable for passing as the envp of g_spawn_async().
+ *
+ * Return value: (transfer none): The environment or NULL to inherit ours
+ */
+gchar **
+dbus_test_task_get_environment (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), NULL);
+
+	return task->priv->environment;
+}
+
+/**
+ * dbus_test_task_set_connection:
+ * @task: Task to adjust the value on
+ * @connection: (allow-none): Connection to the bus of the service
+ *
+ * Set by the service so that the task can talk to the bus without
+ * looking at the environment.
+ */
+void
+dbus_test_task_set_connection (DbusTestTask * task, GDBusConnection * connection)
+{
+	g_return_if_fail(DBUS_TEST_IS_TASK(task));
+	g_return_if_fail(connection == NULL || G_IS_DBUS_CONNECTION(connection));
+
+	if (connection != NULL) {
+		g_object_ref(connection);
+	}
+
+	g_clear_object(&task->priv->connection);
+	task->priv->connection = connection;
+
+	return;
+}
+
+/**
+ * dbus_test_task_get_connection:
+ * @task: Task to get the value from
+ *
+ * Gets the connection to the bus of the service running the task.
+ *
+ * Return value: (transfer none): The connection or NULL if the task
+ *   isn't being run by a service
+ */
+GDBusConnection *
+dbus_test_task_get_connection (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), NULL);
+
+	return task->priv->connection;
+}
+
+/**
+ * dbus_test_task_get_start_time:
+ * @task: Task to get the time from
+ *
+ * When the task was started, after anything it was waiting for.
+ *
+ * Return value: Time in microseconds from g_get_monotonic_time(),
+ *    or zero if it hasn't started
+ */
+gint64
+dbus_test_task_get_start_time (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), 0);
+
+	return task->priv->start_time;
+}
+
+/**
+ * dbus_test_task_get_ready_time:
+ * @task: Task to get the time from
+ *
+ * When the task first became ready, which for tasks with a ready
+ * name is when that name showed up on the bus.
+ *
+ * Return value: Time in microseconds from g_get_monotonic_time(),
+ *    or zero if it hasn't been ready
+ */
+gint64
+dbus_test_task_get_ready_time (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), 0);
+
+	return task->priv->ready_time;
+}
+
+/**
+ * dbus_test_task_get_finish_time:
+ * @task: Task to get the time from
+ *
+ * When the task finished.
+ *
+ * Return value: Time in microseconds from g_get_monotonic_time(),
+ *    or zero if it hasn't finished
+ */
+gint64
+dbus_test_task_get_finish_time (DbusTestTask * task)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), 0);
+
+	return task->priv->finish_time;
+}
+
+/**
+ * dbus_test_task_get_cgroup_usage:
+ * @task: Task to get the usage of
+ * @usage: (out): Where to put what it used
+ *
+ * What the task and everything it started used, from its cgroup.
+ * That includes children that left its process group or exited
+ * without being waited for.
+ *
+ * Return value: Whether the task has a cgroup to read @usage from
+ */
+gboolean
+dbus_test_task_get_cgroup_usage (DbusTestTask * task, DbusTestCgroupUsage * usage)
+{
+	g_return_val_if_fail(DBUS_TEST_IS_TASK(task), FALSE);
+	g_return_val_if_fail(usage != NULL, FALSE);
+
+	if (task->priv->cgroup == NULL) {
+		return FALSE;
+	}
+
+	_dbus_test_cgroup_get_usage(task->priv->cgroup, usage);
+	return TRUE;
+}
@@ -26,10 +26,12 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
 #define DBUS_TEST_TASK_SIGNAL_STATE_CHANGED  "state-changed"
+#define DBUS_TEST_TASK_SIGNAL_READY          "ready"
 
 #define DBUS_TEST_TYPE_TASK            (dbus_test_task_get_type ())
 #define DBUS_TEST_TASK(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), DBUS_TEST_TYPE_TASK, DbusTestTask))
@@ -57,6 +59,42 @@ typedef enum
 	DBUS_TEST_TASK_RETURN_INVERT
 } DbusTestTaskReturn;
 
+typedef struct _DbusTestCgroupUsage DbusTestCgroupUsage;
+
+/**
+ * DbusTestCgroupUsage:
+ * @cpu_time: CPU time used, in microseconds
+ * @user_time: Of that, the time spent in the processes
+ * @system_time: Of that, the time spent in the kernel for them
+ * @memory_peak: Most memory in use at once, in bytes
+ * @io_read: Bytes read from block devices
+ * @io_written: Bytes written to block devices
+ *
+ * What everything in a task's cgroup used.  Figures the kernel
+ * doesn't keep are -1.
+ */
+struct _DbusTestCgroupUsage {
+	gint64 cpu_time;
+	gint64 user_time;
+	gint64 system_time;
+	gint64 memory_peak;
+	gint64 io_read;
+	gint64 io_written;
+};
+
+typedef enum
+{
+	DBUS_TEST_TASK_DEPENDENCY_RUNNING,
+	DBUS_TEST_TASK_DEPENDENCY_READY,
+	DBUS_TEST_TASK_DEPENDENCY_FINISHED
+} DbusTestTaskDependency;
+
+typedef enum
+{
+	DBUS_TEST_TASK_OUTPUT_IMMEDIATE,
+	DBUS_TEST_TASK_OUTPUT_ON_FAILURE
+} DbusTestTaskOutput;
+
 struct _DbusTestTaskClass {
 	GObjectClass parent_class;
 
@@ -83,18 +121,42 @@ void dbus_test_task_set_name (DbusTestTask * task, const gchar * name);
 void dbus_test_task_set_name_spacing (DbusTestTask * task, glong chars);
 void dbus_test_task_set_wait_for (DbusTestTask * task, const gchar * dbus_name);
 void dbus_test_task_set_wait_for_bus (DbusTestTask * task, const gchar * dbus_name, DbusTestServiceBus bus);
+void dbus_test_task_add_wait_for (DbusTestTask * task, const gchar * dbus_name, DbusTestServiceBus bus);
+void dbus_test_task_add_dependency (DbusTestTask * task, DbusTestTask * dependency, DbusTestTaskDependency state);
 void dbus_test_task_set_return (DbusTestTask * task, DbusTestTaskReturn ret);
 void dbus_test_task_set_wait_finished (DbusTestTask * task, gboolean wait_till_complete);
+void dbus_test_task_set_timeout (DbusTestTask * task, guint timeout_ms);
 void dbus_test_task_set_bus (DbusTestTask * task, DbusTestServiceBus bus);
+void dbus_test_task_set_ready_name (DbusTestTask * task, const gchar * dbus_name);
+void dbus_test_task_set_environment (DbusTestTask * task, gchar ** envp);
+void dbus_test_task_set_connection (DbusTestTask * task, GDBusConnection * connection);
+
+void dbus_test_task_set_output (DbusTestTask * task, DbusTestTaskOutput output);
+void dbus_test_task_set_memory_max (DbusTestTask * task, gint64 bytes);
+void dbus_test_task_set_cpu_max (DbusTestTask * task, gint64 quota_us, gint64 period_us);
 
 void dbus_test_task_print (DbusTestTask * task, const gchar * message);
+void dbus_test_task_flush_output (DbusTestTask * task);
 
 DbusTestTaskState dbus_test_task_get_state (DbusTestTask * task);
 DbusTestTaskReturn dbus_test_task_get_return (DbusTestTask * task);
 const gchar * dbus_test_task_get_name (DbusTestTask * task);
 const gchar * dbus_test_task_get_wait_for (DbusTestTask * task);
 gboolean dbus_test_task_get_wait_finished (DbusTestTask * task);
+guint dbus_test_task_get_timeout (DbusTestTask * task);
+gboolean dbus_test_task_get_timed_out (DbusTestTask * task);
 DbusTestServiceBus dbus_test_task_get_bus (DbusTestTask * task);
+const gchar * dbus_test_task_get_ready_name (DbusTestTask * task);
+gboolean dbus_test_task_get_ready (DbusTestTask * task);
+gchar ** dbus_test_task_get_environment (DbusTestTask * task);
+GDBusConnection * dbus_test_task_get_connection (DbusTestTask * task);
+gint64 dbus_test_task_get_start_time (DbusTestTask * task);
+gint64 dbus_test_task_get_ready_time (DbusTestTask * task);
+gint64 dbus_test_task_get_finish_time (DbusTestTask * task);
+gboolean dbus_test_task_get_cgroup_usage (DbusTestTask * task, DbusTestCgroupUsage * usage);
+
+void dbus_test_task_hold_ready (DbusTestTask * task);
+void dbus_test_task_release_ready (DbusTestTask * task);
 
 void dbus_test_task_run (DbusTestTask * task);
 
@@ -0,0 +1,45 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_TRACE_INTERNAL_H__
+#define __DBUS_TEST_TRACE_INTERNAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Spans for the trace opened with dbus_test_trace_open().  Each
+   @track is a row of its own in the viewer, the bus of a service or
+   a task.  Times are from g_get_monotonic_time(), so callers can keep
+   them whether or not anyone is tracing and only pay for the writing
+   when someone is. */
+
+G_GNUC_INTERNAL
+gboolean _dbus_test_trace_enabled (void);
+G_GNUC_INTERNAL
+void     _dbus_test_trace_span    (const gchar *  track,
+                                   const gchar *  category,
+                                   const gchar *  name,
+                                   gint64         start,
+                                   gint64         end);
+G_GNUC_INTERNAL
+void     _dbus_test_trace_instant (const gchar *  track,
+                                   const gchar *  category,
+                                   const gchar *  name);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,245 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dbus-test.h"
+#include "trace-internal.h"
+
+/* One trace for everything in the process like the log, shards add
+   their spans from their own threads */
+static GMutex trace_lock;
+static FILE * trace_file = NULL;
+static gint64 trace_start = 0;
+static gint trace_enabled = FALSE;
+static gboolean trace_first = TRUE;
+/* Track name to the thread ID the viewer shows it as */
+static GHashTable * trace_tracks = NULL;
+
+/* Writes @string as a JSON string */
+static void
+trace_write_string (const gchar * string)
+{
+	const gchar * c;
+
+	fputc('"', trace_file);
+
+	for (c = string; c != NULL && *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', trace_file);
+			fputc(*c, trace_file);
+		} else if ((guchar)*c < 0x20) {
+			fprintf(trace_file, "\\u%04x", (guchar)*c);
+		} else {
+			fputc(*c, trace_file);
+		}
+	}
+
+	fputc('"', trace_file);
+
+	return;
+}
+
+/* Starts the next event in the array, call with the lock held */
+static void
+trace_write_separator (void)
+{
+	fputs(trace_first ? "\n" : ",\n", trace_file);
+	trace_first = FALSE;
+
+	return;
+}
+
+/* The thread ID for @track, naming it the first time it's seen */
+static gint
+trace_track_id (const gchar * track)
+{
+	gint id = GPOINTER_TO_INT(g_hash_table_lookup(trace_tracks, track));
+
+	if (id != 0) {
+		return id;
+	}
+
+	id = g_hash_table_size(trace_tracks) + 1;
+	g_hash_table_insert(trace_tracks, g_strdup(track), GINT_TO_POINTER(id));
+
+	trace_write_separator();
+	fprintf(trace_file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", (gint)getpid(), id);
+	trace_write_string(track);
+	fputs("}}", trace_file);
+
+	trace_write_separator();
+	fprintf(trace_file, "{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}", (gint)getpid(), id, id);
+
+	return id;
+}
+
+/**
+ * dbus_test_trace_open:
+ * @filename: File to write the trace to, replacing what's there
+ * @error: Where to put an error if it can't be opened
+ *
+ * Starts writing a timeline of the run to @filename in the Chrome
+ * trace event format, which chrome://tracing and Perfetto can load.
+ * Each bus and each task gets a row, with spans for starting the
+ * bus, the tasks waiting for names and each other, running and
+ * becoming ready, mocks starting and installing their objects, and
+ * the teardown at the end.  Only spans that end before the trace is
+ * closed make it into the file.
+ *
+ * Return value: Whether the trace was opened
+ */
+gboolean
+dbus_test_trace_open (const gchar * filename, GError ** error)
+{
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	FILE * file = g_fopen(filename, "w");
+	if (file == NULL) {
+		gint errsv = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv), "Unable to open trace file '%s': %s", filename, g_strerror(errsv));
+		return FALSE;
+	}
+
+	dbus_test_trace_close();
+
+	g_mutex_lock(&trace_lock);
+
+	trace_file = file;
+	trace_start = g_get_monotonic_time();
+	trace_first = TRUE;
+	trace_tracks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace_file);
+
+	trace_write_separator();
+	fprintf(trace_file, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"dbus-test-runner\"}}", (gint)getpid());
+
+	g_atomic_int_set(&trace_enabled, TRUE);
+
+	g_mutex_unlock(&trace_lock);
+
+	return TRUE;
+}
+
+/**
+ * dbus_test_trace_close:
+ *
+ * Finishes the file opened with dbus_test_trace_open() and stops
+ * tracing.
+ */
+void
+dbus_test_trace_close (void)
+{
+	g_mutex_lock(&trace_lock);
+
+	g_atomic_int_set(&trace_enabled, FALSE);
+
+	if (trace_file != NULL) {
+		fputs("\n]}\n", trace_file);
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+
+	g_clear_pointer(&trace_tracks, g_hash_table_destroy);
+
+	g_mutex_unlock(&trace_lock);
+
+	return;
+}
+
+gboolean
+_dbus_test_trace_enabled (void)
+{
+	return g_atomic_int_get(&trace_enabled);
+}
+
+/* Records that @name took from @start to @end on @track, spans that
+   started before the trace was opened are cut to its start */
+void
+_dbus_test_trace_span (const gchar * track, const gchar * category, const gchar * name, gint64 start, gint64 end)
+{
+	if (!g_atomic_int_get(&trace_enabled) || start == 0) {
+		return;
+	}
+
+	g_mutex_lock(&trace_lock);
+
+	if (trace_file == NULL) {
+		g_mutex_unlock(&trace_lock);
+		return;
+	}
+
+	gint id = trace_track_id(track);
+
+	start = MAX(start, trace_start);
+	end = MAX(end, start);
+
+	trace_write_separator();
+	fputs("{\"ph\":\"X\",\"name\":", trace_file);
+	trace_write_string(name);
+	fputs(",\"cat\":", trace_file);
+	trace_write_string(category);
+	fprintf(trace_file, ",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d}",
+	        start - trace_start, end - start, (gint)getpid(), id);
+
+	fflush(trace_file);
+
+	g_mutex_unlock(&trace_lock);
+
+	return;
+}
+
+/* Marks the moment @name happened on @track */
+void
+_dbus_test_trace_instant (const gchar * track, const gchar * category, const gchar * name)
+{
+	if (!g_atomic_int_get(&trace_enabled)) {
+		return;
+	}
+
+	g_mutex_lock(&trace_lock);
+
+	if (trace_file == NULL) {
+		g_mutex_unlock(&trace_lock);
+		return;
+	}
+
+	gint id = trace_track_id(track);
+
+	trace_write_separator();
+	fputs("{\"ph\":\"i\",\"s\":\"t\",\"name\":", trace_file);
+	trace_write_string(name);
+	fputs(",\"cat\":", trace_file);
+	trace_write_string(category);
+	fprintf(trace_file, ",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d}",
+	        g_get_monotonic_time() - trace_start, (gint)getpid(), id);
+
+	fflush(trace_file);
+
+	g_mutex_unlock(&trace_lock);
+
+	return;
+}
@@ -2,10 +2,16 @@
 #include "config.h"
 #endif
 
-#include "watchdog.h"
+#include <unistd.h>
+
+#include "dbus-test.h"
+#include "guard.h"
+
+/* The watchdog process itself is shared by everything in the process,
+   see guard.h, this only adds to what it looks after */
 
 struct _DbusTestWatchdogPrivate {
-	GPid watchdog;
+	GPid guarded;
 };
 
 #define DBUS_TEST_WATCHDOG_GET_PRIVATE(o) \
@@ -32,11 +38,11 @@ dbus_test_watchdog_class_init (DbusTestWatchdogClass *klass)
 
 /* Initialize instance data */
 static void
-dbus_test_watchdog_init (G_GNUC_UNUSED DbusTestWatchdog *self)
+dbus_test_watchdog_init (DbusTestWatchdog *self)
 {
 	self->priv = DBUS_TEST_WATCHDOG_GET_PRIVATE(self);
 
-	self->priv->watchdog = 0;
+	self->priv->guarded = 0;
 
 	return;
 }
@@ -46,9 +52,9 @@ static void
 dbus_test_watchdog_finalize (GObject *object)
 {
 	DbusTestWatchdog * watchdog = DBUS_TEST_WATCHDOG(object);
-	
-	if (watchdog->priv->watchdog != 0) {
-		kill(watchdog->priv->watchdog, SIGTERM);
+
+	if (watchdog->priv->guarded != 0) {
+		_dbus_test_guard_remove(watchdog->priv->guarded);
 	}
 
 	G_OBJECT_CLASS (dbus_test_watchdog_parent_class)->finalize (object);
@@ -60,59 +66,55 @@ dbus_test_watchdog_finalize (GObject *object)
  * @watchdog: Instance of #DbusTestWatchdog
  * @pid: PID to kill
  *
- * Adds a PID for the watchdog to watch.
+ * Adds a PID for the watchdog to kill if we go away without
+ * finalizing @watchdog, or the deadline passes.  A process leading
+ * its own process group is killed with the whole group.
  */
 void
 dbus_test_watchdog_add_pid (DbusTestWatchdog * watchdog, GPid pid)
 {
 	g_return_if_fail(DBUS_TEST_IS_WATCHDOG(watchdog));
-	g_return_if_fail(pid != 0);
-	g_return_if_fail(watchdog->priv->watchdog == 0);
-
-	/* Setting up argument vector */
-	gchar * strpid = g_strdup_printf("%d", pid);
-	gchar * argv[3];
-	argv[0] = WATCHDOG;
-	argv[1] = strpid;
-	argv[2] = NULL;
-	
-	GError * error = NULL;
-
-	/* Spawn the watchdog, we now have 60 secs */
-	g_spawn_async (NULL, /* cwd */
-	               argv,
-	               NULL, /* env */
-	               0, /* flags */
-	               NULL, NULL, /* Setup function */
-	               &watchdog->priv->watchdog,
-	               &error);
-
-	g_free(strpid);
-
-	if (error != NULL) {
-		g_warning("Unable to start watchdog");
-		watchdog->priv->watchdog = 0;
-		g_error_free(error);
-		return;
-	}
+	g_return_if_fail(pid > 0);
+	g_return_if_fail(watchdog->priv->guarded == 0);
+
+	watchdog->priv->guarded = getpgid(pid) == pid ? -pid : pid;
+	_dbus_test_guard_add(watchdog->priv->guarded);
 
 	return;
 }
 
 /**
- * dbus_test_watchdog_add_pid:
+ * dbus_test_watchdog_ping:
  * @watchdog: Instance of #DbusTestWatchdog
  *
- * Tell the watchdog not to kill.  For now.
+ * Tell the watchdog not to kill.  For now.  Pushes the deadline set
+ * with dbus_test_watchdog_set_deadline() back to as far from now as it
+ * was set to.
  */
 void
 dbus_test_watchdog_ping (DbusTestWatchdog * watchdog)
 {
 	g_return_if_fail(DBUS_TEST_IS_WATCHDOG(watchdog));
 
-	if (watchdog->priv->watchdog != 0) {
-		kill(watchdog->priv->watchdog, SIGHUP);
-	}
+	_dbus_test_guard_ping();
+
+	return;
+}
+
+/**
+ * dbus_test_watchdog_set_deadline:
+ * @seconds: How long from now, or 0 for no deadline
+ *
+ * Everything started by the library, tasks with whatever they started,
+ * bus daemons and bustle monitors, is killed by the watchdog process
+ * when we go away, however that happens.  With a deadline it is also
+ * killed once @seconds have passed without a ping, for when we hang
+ * instead.
+ */
+void
+dbus_test_watchdog_set_deadline (guint seconds)
+{
+	_dbus_test_guard_set_deadline(seconds);
 
 	return;
 }
@@ -1,6 +1,10 @@
 #ifndef __DBUS_TEST_WATCHDOG_H__
 #define __DBUS_TEST_WATCHDOG_H__
 
+#ifndef __DBUS_TEST_TOP_LEVEL__
+#error "Please include #include <libdbustest/dbus-test.h> only"
+#endif
+
 #include <glib.h>
 #include <glib-object.h>
 
@@ -30,6 +34,7 @@ GType dbus_test_watchdog_get_type        (void);
 void  dbus_test_watchdog_add_pid         (DbusTestWatchdog * watchdog,
                                           GPid                pid);
 void  dbus_test_watchdog_ping            (DbusTestWatchdog * watchdog);
+void  dbus_test_watchdog_set_deadline    (guint              seconds);
 
 G_END_DECLS
 
@@ -0,0 +1,141 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "protocol.h"
+
+/* Hands the command line to a dbus-test-runner started with --server
+   and plays back what it sends.  Everything but the socket is passed
+   through untouched, so this takes the same options as the runner. */
+
+static void
+usage (const gchar * name)
+{
+	fprintf(stderr, "Usage: %s [--socket=path] [dbus-test-runner options]\n", name);
+	fprintf(stderr, "The socket can also be set with " SOCKET_ENV ".\n");
+}
+
+int
+main (int argc, char * argv[])
+{
+	GError * error = NULL;
+	const gchar * path = g_getenv(SOCKET_ENV);
+	gint first = 1;
+
+#ifndef GLIB_VERSION_2_36
+	g_type_init();
+#endif
+
+	if (argc > 1 && g_str_has_prefix(argv[1], "--socket=")) {
+		path = argv[1] + strlen("--socket=");
+		first = 2;
+	} else if (argc > 2 && g_strcmp0(argv[1], "--socket") == 0) {
+		path = argv[2];
+		first = 3;
+	}
+
+	if (path == NULL || path[0] == '\0') {
+		usage(argv[0]);
+		return 1;
+	}
+
+	GSocketClient * client = g_socket_client_new();
+	GSocketAddress * address = g_unix_socket_address_new(path);
+	GSocketConnection * connection = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+	g_object_unref(address);
+	g_object_unref(client);
+
+	if (connection == NULL) {
+		fprintf(stderr, "Unable to connect to runner at '%s': %s\n", path, error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	GOutputStream * out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	GInputStream * in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+
+	gchar * cwd = g_get_current_dir();
+	gboolean sent = frame_write(out, FRAME_CWD, cwd, -1, &error);
+	g_free(cwd);
+
+	/* The tasks are run with our environment, not the server's */
+	gchar ** env = g_get_environ();
+	gint i;
+	for (i = 0; sent && env[i] != NULL; i++) {
+		sent = frame_write(out, FRAME_ENV, env[i], -1, &error);
+	}
+	g_strfreev(env);
+
+	for (i = first; sent && i < argc; i++) {
+		sent = frame_write(out, FRAME_ARG, argv[i], -1, &error);
+	}
+
+	if (sent) {
+		sent = frame_write(out, FRAME_RUN, NULL, 0, &error);
+	}
+
+	if (!sent) {
+		fprintf(stderr, "Unable to send job to runner: %s\n", error->message);
+		g_error_free(error);
+		g_object_unref(connection);
+		return 1;
+	}
+
+	gint status = -1;
+	gboolean done = FALSE;
+	gchar type;
+	gchar * data;
+	gsize len;
+
+	while (!done && frame_read(in, &type, &data, &len, &error)) {
+		switch (type) {
+		case FRAME_STDOUT:
+			fwrite(data, 1, len, stdout);
+			fflush(stdout);
+			break;
+		case FRAME_STDERR:
+			fwrite(data, 1, len, stderr);
+			fflush(stderr);
+			break;
+		case FRAME_EXIT:
+			status = atoi(data);
+			done = TRUE;
+			break;
+		default:
+			break;
+		}
+
+		g_free(data);
+	}
+
+	if (error != NULL) {
+		fprintf(stderr, "Lost connection to runner: %s\n", error->message);
+		g_error_free(error);
+	} else if (!done) {
+		fprintf(stderr, "Runner closed the connection before the job finished\n");
+	}
+
+	g_object_unref(connection);
+
+	return status;
+}
@@ -18,20 +18,95 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
 
 #include <libdbustest/dbus-test.h>
 
+#include "protocol.h"
+#include "report.h"
+
 static DbusTestServiceBus bus_type = DBUS_TEST_SERVICE_BUS_SESSION;
+static DbusTestServiceBackend bus_backend = DBUS_TEST_SERVICE_BACKEND_DAEMON;
 static gint max_wait = 60;
+static gint kill_timeout = -1;
+static gint watchdog_deadline = 0;
+static DbusTestTaskOutput task_output = DBUS_TEST_TASK_OUTPUT_IMMEDIATE;
+static gint daemon_pool = 0;
 static gboolean keep_env = FALSE;
+static gboolean use_cgroups = FALSE;
+static gint jobs = 1;
 static DbusTestProcess * last_task = NULL;
 static DbusTestService * service = NULL;
-static gboolean timeout = FALSE;
+static gint timeout = FALSE;
 
 #define NAME_SET "dbus-test-runner-name-set"
 
+/* The period for --cpu-max, the kernel's default */
+#define CPU_MAX_PERIOD 100000
+
+/* A set of tasks with its own bus, run on its own context so that
+   shards can run in parallel threads */
+typedef struct {
+	DbusTestService * service;
+	GList * tasks;
+	GMainContext * context;
+	gint number;
+	gint status;
+} shard_t;
+
+static GList * shards = NULL;
+static gint shards_running = 0;
+static GMainLoop * shards_loop = NULL;
+/* Every shard takes one daemon from a pool of this run's own, so it
+   only needs to keep ahead of the shards that haven't started */
+static gint shards_unstarted = 0;
+static DbusTestDaemonPool * shards_pool = NULL;
+
+static shard_t *
+shard_new (void)
+{
+	shard_t * shard = g_new0(shard_t, 1);
+
+	shard->context = g_main_context_new();
+	shard->number = g_list_length(shards);
+	shard->status = -1;
+
+	g_main_context_push_thread_default(shard->context);
+	shard->service = dbus_test_service_new(NULL);
+	g_main_context_pop_thread_default(shard->context);
+
+	shards = g_list_prepend(shards, shard);
+	service = shard->service;
+
+	return shard;
+}
+
+static void
+shard_free (gpointer data)
+{
+	shard_t * shard = (shard_t *)data;
+
+	g_list_free(shard->tasks);
+	g_object_unref(shard->service);
+	g_main_context_unref(shard->context);
+	g_free(shard);
+
+	return;
+}
+
 static gboolean
 option_bus_type (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
 {
@@ -53,6 +128,40 @@ option_bus_type (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UN
 	return TRUE;
 }
 
+static gboolean
+option_bus_backend (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (g_strcmp0(value, "daemon") == 0) {
+		bus_backend = DBUS_TEST_SERVICE_BACKEND_DAEMON;
+	} else if (g_strcmp0(value, "embedded") == 0) {
+		bus_backend = DBUS_TEST_SERVICE_BACKEND_EMBEDDED;
+	} else {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Bus backend '%s' unknown", value);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+option_output (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (g_strcmp0(value, "immediate") == 0) {
+		task_output = DBUS_TEST_TASK_OUTPUT_IMMEDIATE;
+	} else if (g_strcmp0(value, "on-failure") == 0) {
+		task_output = DBUS_TEST_TASK_OUTPUT_ON_FAILURE;
+	} else {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Output mode '%s' unknown", value);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+option_report (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	return report_add(value, error);
+}
+
 static gboolean
 option_task (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, G_GNUC_UNUSED GError ** error)
 {
@@ -63,6 +172,26 @@ option_task (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED
 
 	last_task = dbus_test_process_new(value);
 	dbus_test_service_add_task(service, DBUS_TEST_TASK(last_task));
+
+	/* So that later tasks can depend on it by name */
+	shard_t * shard = (shard_t *)shards->data;
+	shard->tasks = g_list_prepend(shard->tasks, last_task);
+
+	return TRUE;
+}
+
+static gboolean
+option_shard (G_GNUC_UNUSED const gchar * arg, G_GNUC_UNUSED const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (last_task == NULL) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "No tasks in the shard before --shard.");
+		return FALSE;
+	}
+
+	g_object_unref(last_task);
+	last_task = NULL;
+
+	shard_new();
 	return TRUE;
 }
 
@@ -168,6 +297,82 @@ option_param (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSE
 	return TRUE;
 }
 
+static gboolean
+option_memory_max (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (last_task == NULL) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "No task to limit the memory of.");
+		return FALSE;
+	}
+
+	gchar * end = NULL;
+	gint64 bytes = g_ascii_strtoll(value, &end, 10);
+
+	switch (g_ascii_toupper(*end)) {
+	case 'G':
+		bytes *= 1024;
+		/* fall through */
+	case 'M':
+		bytes *= 1024;
+		/* fall through */
+	case 'K':
+		bytes *= 1024;
+		end++;
+		break;
+	default:
+		break;
+	}
+
+	if (end == value || *end != '\0' || bytes <= 0) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Memory limit '%s' isn't a size", value);
+		return FALSE;
+	}
+
+	dbus_test_task_set_memory_max(DBUS_TEST_TASK(last_task), bytes);
+	return TRUE;
+}
+
+/* As a share of CPUs, 0.5 is half of one */
+static gboolean
+option_cpu_max (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (last_task == NULL) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "No task to limit the CPU of.");
+		return FALSE;
+	}
+
+	gchar * end = NULL;
+	gdouble cpus = g_ascii_strtod(value, &end);
+
+	if (end == value || *end != '\0' || cpus <= 0.0) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "CPU limit '%s' isn't a number of CPUs", value);
+		return FALSE;
+	}
+
+	dbus_test_task_set_cpu_max(DBUS_TEST_TASK(last_task), (gint64)(cpus * CPU_MAX_PERIOD), CPU_MAX_PERIOD);
+	return TRUE;
+}
+
+static gboolean
+option_task_timeout (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (last_task == NULL) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "No task to set the timeout of.");
+		return FALSE;
+	}
+
+	gchar * end = NULL;
+	gdouble seconds = g_ascii_strtod(value, &end);
+
+	if (end == value || *end != '\0' || seconds <= 0.0 || seconds * 1000.0 > G_MAXUINT) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Timeout '%s' isn't a number of seconds", value);
+		return FALSE;
+	}
+
+	dbus_test_task_set_timeout(DBUS_TEST_TASK(last_task), MAX((guint)(seconds * 1000.0), 1));
+	return TRUE;
+}
+
 static gboolean
 option_wait (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
 {
@@ -185,19 +390,139 @@ option_wait (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED
 	return TRUE;
 }
 
+static gboolean
+option_wait_also (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (last_task == NULL) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "No task to add a wait on %s for.", value);
+		return FALSE;
+	}
+
+	dbus_test_task_add_wait_for(DBUS_TEST_TASK(last_task), value, DBUS_TEST_SERVICE_BUS_BOTH);
+	return TRUE;
+}
+
+static gboolean
+option_depends (G_GNUC_UNUSED const gchar * arg, const gchar * value, G_GNUC_UNUSED gpointer data, GError ** error)
+{
+	if (last_task == NULL) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "No task to add a dependency on %s to.", value);
+		return FALSE;
+	}
+
+	DbusTestTaskDependency state = DBUS_TEST_TASK_DEPENDENCY_READY;
+	gchar * name = g_strdup(value);
+	gchar * state_name = strrchr(name, ':');
+
+	if (state_name != NULL) {
+		*state_name++ = '\0';
+
+		if (g_strcmp0(state_name, "running") == 0) {
+			state = DBUS_TEST_TASK_DEPENDENCY_RUNNING;
+		} else if (g_strcmp0(state_name, "ready") == 0) {
+			state = DBUS_TEST_TASK_DEPENDENCY_READY;
+		} else if (g_strcmp0(state_name, "finished") == 0) {
+			state = DBUS_TEST_TASK_DEPENDENCY_FINISHED;
+		} else {
+			g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Task state '%s' unknown", state_name);
+			g_free(name);
+			return FALSE;
+		}
+	}
+
+	/* Only tasks defined before this one, which keeps out cycles */
+	DbusTestTask * dependency = NULL;
+	GList * ltask;
+	for (ltask = ((shard_t *)shards->data)->tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+		DbusTestTask * task = DBUS_TEST_TASK(ltask->data);
+
+		if (task != DBUS_TEST_TASK(last_task) && g_strcmp0(dbus_test_task_get_name(task), name) == 0) {
+			dependency = task;
+			break;
+		}
+	}
+
+	if (dependency == NULL) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "No task named '%s' before this one in the shard.", name);
+		g_free(name);
+		return FALSE;
+	}
+
+	dbus_test_task_add_dependency(DBUS_TEST_TASK(last_task), dependency, state);
+
+	g_free(name);
+	return TRUE;
+}
+
 static gboolean
 max_wait_hit (G_GNUC_UNUSED gpointer user_data)
 {
 	g_warning("Timing out at maximum wait of %d seconds.", max_wait);
-	dbus_test_service_stop(service);
-	timeout = TRUE;
+	g_atomic_int_set(&timeout, TRUE);
+
+	GList * lshard;
+	for (lshard = shards; lshard != NULL; lshard = g_list_next(lshard)) {
+		shard_t * shard = (shard_t *)lshard->data;
+		dbus_test_service_stop(shard->service);
+	}
+
 	return FALSE;
 }
 
+static gboolean
+shard_done (gpointer user_data)
+{
+	shard_t * shard = (shard_t *)user_data;
+
+	g_print("Shard %d: %s\n", shard->number, shard->status == 0 ? "Passed" : "Failed");
+
+	if (--shards_running == 0) {
+		g_main_loop_quit(shards_loop);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+shard_starting (void)
+{
+	gint unstarted = g_atomic_int_add(&shards_unstarted, -1) - 1;
+
+	if (shards_pool != NULL) {
+		dbus_test_daemon_pool_set_size(shards_pool, MIN(daemon_pool, unstarted));
+	}
+
+	return;
+}
+
+/* Runs in a thread from the pool */
+static void
+shard_run (gpointer data, gpointer user_data)
+{
+	shard_t * shard = (shard_t *)data;
+	GMainContext * main_context = (GMainContext *)user_data;
+
+	shard_starting();
+
+	if (!g_atomic_int_get(&timeout)) {
+		g_main_context_push_thread_default(shard->context);
+		shard->status = dbus_test_service_run(shard->service);
+		g_main_context_pop_thread_default(shard->context);
+	}
+
+	g_main_context_invoke(main_context, shard_done, shard);
+	return;
+}
+
 static gchar * dbus_configfile = NULL;
 static gchar * dbus_daemon = NULL;
 static gchar * bustle_cmd = NULL;
 static gchar * bustle_datafile = NULL;
+static gchar * server_path = NULL;
+static gchar * log_path = NULL;
+static gchar * trace_path = NULL;
+/* The environment a server job's client sent for its tasks */
+static gchar ** job_env = NULL;
 
 static GOptionEntry general_options[] = {
 	{"dbus-daemon",  0,     0,                       G_OPTION_ARG_FILENAME,  &dbus_daemon,     "Path to the DBus deamon to use.  Defaults to 'dbus-daemon'.", "executable"},
@@ -205,8 +530,19 @@ static GOptionEntry general_options[] = {
 	{"bustle-monitor", 0,   0,                       G_OPTION_ARG_FILENAME,  &bustle_cmd,      "Path to the Bustle DBus Monitor to use.  Defaults to 'bustle-dbus-monitor'.", "executable"},
 	{"bustle-data",  'b',   0,                       G_OPTION_ARG_FILENAME,  &bustle_datafile, "A file to write out data from the bustle logger to.", "data_file"},
 	{"max-wait",     'm',   0,                       G_OPTION_ARG_INT,       &max_wait,        "The maximum amount of time the test runner will wait for the test to complete.  Default is 30 seconds.", "seconds"},
+	{"cgroup",       0,     0,                       G_OPTION_ARG_NONE,      &use_cgroups,     "Run each task in a cgroup of its own, so everything it starts is counted in the reports, held to --memory-max and --cpu-max, and killed with it.  Needs a delegated cgroup v2, like from systemd-run --scope -p Delegate=yes.", NULL },
 	{"keep-env",     0,     0,                       G_OPTION_ARG_NONE,      &keep_env,        "Whether to propagate the execution environment to the dbus-server and all the services activated by it.  By default the environment is cleared.", NULL },
 	{"bus-type",     0,     0,                       G_OPTION_ARG_CALLBACK,  option_bus_type,  "Configures which buses are represented by the tool to the tasks. Default: session", "{session|system|both}" },
+	{"bus-backend",  0,     0,                       G_OPTION_ARG_CALLBACK,  option_bus_backend, "What provides the bus: a dbus-daemon, or a minimal broker inside the runner that needs no process started.  Default: daemon", "{daemon|embedded}" },
+	{"output",       0,     0,                       G_OPTION_ARG_CALLBACK,  option_output,    "When the output of tasks is printed: as it happens, or only for tasks that fail and when timing out, keeping the last 256 KiB of each task until then.  Default: immediate", "{immediate|on-failure}" },
+	{"log-file",     0,     0,                       G_OPTION_ARG_FILENAME,  &log_path,        "Also write the stdout and stderr of every task to this file, each line with the time it was read in seconds since the start.", "log_file"},
+	{"trace",        0,     0,                       G_OPTION_ARG_FILENAME,  &trace_path,      "Write a timeline of the run to this file in the Chrome trace event format, for chrome://tracing or Perfetto: starting the bus, tasks waiting, starting and getting ready, mocks, and the teardown.", "trace_file"},
+	{"report",       0,     0,                       G_OPTION_ARG_CALLBACK,  option_report,    "Write the results with the timing and resource usage of each task for other tools to read, or a table of the usage for people.  TAP and the table without a file go to stdout.  May be used as many times as you'd like.", "{junit|json|tap|usage}[:file]"},
+	{"kill-timeout", 0,     0,                       G_OPTION_ARG_INT,       &kill_timeout,    "How long tasks still running at the end get to exit after SIGTERM before they're killed.  Default is 1000 milliseconds.", "milliseconds"},
+	{"watchdog-deadline", 0, 0,                      G_OPTION_ARG_INT,       &watchdog_deadline, "Everything the runner starts is killed by a separate watchdog process if the runner dies.  With a deadline it is also killed once the run has taken this long, in case the runner hangs.  Default is none.", "seconds"},
+	{"daemon-pool",  0,     0,                       G_OPTION_ARG_INT,       &daemon_pool,     "Number of DBus daemons to start ahead of time and hand out to the service, no more than one for each shard.  With --server they stay up between jobs.  Default is none.", "count"},
+	{"jobs",         'j',   0,                       G_OPTION_ARG_INT,       &jobs,            "Number of shards to run at the same time.  Default is 1.", "count"},
+	{"server",       0,     0,                       G_OPTION_ARG_FILENAME,  &server_path,     "Stay running and take jobs from dbus-test-runner-client on this Unix socket.", "socket"},
 	{ NULL, 0, 0, 0, NULL, NULL, NULL }
 };
 
@@ -217,24 +553,57 @@ static GOptionEntry task_options[] = {
 	{"ignore-return", 'r',  G_OPTION_FLAG_NO_ARG,     G_OPTION_ARG_CALLBACK,  option_noreturn, "Do not use the return value of the task to calculate whether the test passes or fails.", NULL},
 	{"invert-return", 'i',  G_OPTION_FLAG_NO_ARG,     G_OPTION_ARG_CALLBACK,  option_invert,   "Invert the return value of the task before calculating whether the test passes or fails.", NULL},
 	{"parameter",     'p',  0,                        G_OPTION_ARG_CALLBACK,  option_param,    "Add a parameter to the call of this utility.  May be called as many times as you'd like.", NULL},
+	{"memory-max",    0,    0,                        G_OPTION_ARG_CALLBACK,  option_memory_max, "With --cgroup, the most memory the task and everything it starts may use.", "bytes[K|M|G]"},
+	{"cpu-max",       0,    0,                        G_OPTION_ARG_CALLBACK,  option_cpu_max,  "With --cgroup, how many CPUs worth of time the task and everything it starts may use.", "cpus"},
+	{"task-timeout",  0,    0,                        G_OPTION_ARG_CALLBACK,  option_task_timeout, "How long the task may run before it is stopped and fails as timed out.  Can be a fraction.", "seconds"},
 	{"wait-for",      'f',  0,                        G_OPTION_ARG_CALLBACK,  option_wait,     "A dbus-name that should appear on the bus before this task is started", "dbus-name"},
+	{"also-wait-for", 0,    0,                        G_OPTION_ARG_CALLBACK,  option_wait_also, "Another dbus-name that should appear on the bus before this task is started.  May be used as many times as you'd like.", "dbus-name"},
+	{"depends-on",    0,    0,                        G_OPTION_ARG_CALLBACK,  option_depends,  "A task defined earlier that should be running, ready or finished before this task is started.  Defaults to ready.  May be used as many times as you'd like.", "task[:running|ready|finished]"},
 	{"wait-until-complete", 'c', G_OPTION_FLAG_NO_ARG,G_OPTION_ARG_CALLBACK,  option_complete, "Signal that we should wait until this task exits even if we don't need the return value", NULL},
+	{"shard",         0,    G_OPTION_FLAG_NO_ARG,     G_OPTION_ARG_CALLBACK,  option_shard,    "Start a new set of tasks that runs on its own bus, in parallel with the others when --jobs allows it.", NULL},
 	{ NULL, 0, 0, 0, NULL, NULL, NULL }
 };
 
-int
-main (int argc, char * argv[])
+/* Everything the options can change goes back to how it starts, so
+   that the server can parse a new command line for each job */
+static void
+runner_reset (void)
 {
-	GError * error = NULL;
-	GOptionContext * context;
+	g_clear_object(&last_task);
+	g_list_free_full(shards, shard_free);
+	shards = NULL;
+	service = NULL;
 
-#ifndef GLIB_VERSION_2_36
-	g_type_init();
-#endif
+	bus_type = DBUS_TEST_SERVICE_BUS_SESSION;
+	bus_backend = DBUS_TEST_SERVICE_BACKEND_DAEMON;
+	max_wait = 60;
+	kill_timeout = -1;
+	watchdog_deadline = 0;
+	task_output = DBUS_TEST_TASK_OUTPUT_IMMEDIATE;
+	daemon_pool = 0;
+	keep_env = FALSE;
+	use_cgroups = FALSE;
+	jobs = 1;
+	g_atomic_int_set(&timeout, FALSE);
+
+	g_clear_pointer(&dbus_configfile, g_free);
+	g_clear_pointer(&dbus_daemon, g_free);
+	g_clear_pointer(&bustle_cmd, g_free);
+	g_clear_pointer(&bustle_datafile, g_free);
+	g_clear_pointer(&server_path, g_free);
+	g_clear_pointer(&log_path, g_free);
+	g_clear_pointer(&trace_path, g_free);
+	g_clear_pointer(&job_env, g_strfreev);
 
-	service = dbus_test_service_new(NULL);
+	report_reset();
 
-	context = g_option_context_new("- run multiple tasks under an independent DBus session bus");
+	return;
+}
+
+static GOptionContext *
+runner_options (void)
+{
+	GOptionContext * context = g_option_context_new("- run multiple tasks under an independent DBus session bus");
 
 	g_option_context_add_main_entries(context, general_options, "dbus-runner");
 
@@ -242,56 +611,586 @@ main (int argc, char * argv[])
 	g_option_group_add_entries(taskgroup, task_options);
 	g_option_context_add_group(context, taskgroup);
 
-	if (!g_option_context_parse(context, &argc, &argv, &error)) {
-		g_print("option parsing failed: %s\n", error->message);
+	return context;
+}
+
+/* While the server is running a job everything we'd print goes back
+   to the client that sent it instead */
+static GMutex output_lock;
+static GOutputStream * output_stream = NULL;
+static DbusTestDaemonPool * server_pool = NULL;
+
+static void
+output_write (gchar type, const gchar * string, FILE * fallback)
+{
+	g_mutex_lock(&output_lock);
+
+	if (output_stream == NULL || !frame_write(output_stream, type, string, -1, NULL)) {
+		fputs(string, fallback);
+		fflush(fallback);
+	}
+
+	g_mutex_unlock(&output_lock);
+	return;
+}
+
+static void
+output_print (const gchar * string)
+{
+	output_write(FRAME_STDOUT, string, stdout);
+	return;
+}
+
+static void
+output_printerr (const gchar * string)
+{
+	output_write(FRAME_STDERR, string, stderr);
+	return;
+}
+
+static void
+output_log (const gchar * domain, GLogLevelFlags level, const gchar * message, gpointer user_data)
+{
+	if (g_atomic_pointer_get(&output_stream) == NULL) {
+		g_log_default_handler(domain, level, message, user_data);
+		return;
+	}
+
+	const gchar * level_name = "Message";
+	if (level & G_LOG_LEVEL_ERROR) {
+		level_name = "ERROR";
+	} else if (level & G_LOG_LEVEL_CRITICAL) {
+		level_name = "CRITICAL";
+	} else if (level & G_LOG_LEVEL_WARNING) {
+		level_name = "WARNING";
+	} else if (level & G_LOG_LEVEL_DEBUG) {
+		if (g_getenv("G_MESSAGES_DEBUG") == NULL) {
+			return;
+		}
+		level_name = "DEBUG";
+	} else if (level & G_LOG_LEVEL_INFO) {
+		level_name = "INFO";
+	}
+
+	gchar * line = g_strdup_printf("%s%s%s: %s\n", domain != NULL ? domain : "", domain != NULL ? "-" : "", level_name, message);
+	output_printerr(line);
+	g_free(line);
+
+	return;
+}
+
+static gint
+runner_run (void)
+{
+	GError * error = NULL;
+
+	/* These should all be in the service now */
+	if (last_task != NULL) {
+		g_object_unref(last_task);
+		last_task = NULL;
+	} else {
+		g_critical("No tasks assigned");
+		g_list_free_full(shards, shard_free);
+		shards = NULL;
+		return -1;
+	}
+
+	shards = g_list_reverse(shards);
+	gboolean parallel = shards->next != NULL;
+
+	if (parallel && bustle_datafile != NULL) {
+		g_critical("Bustle can only watch one bus, it can't be used with --shard");
+		g_list_free_full(shards, shard_free);
+		shards = NULL;
+		return -1;
+	}
+
+	if (log_path != NULL && !dbus_test_log_open(log_path, &error)) {
+		g_critical("%s", error->message);
 		g_error_free(error);
-		return 1;
+		g_list_free_full(shards, shard_free);
+		shards = NULL;
+		return -1;
+	}
+
+	if (trace_path != NULL && !dbus_test_trace_open(trace_path, &error)) {
+		g_critical("%s", error->message);
+		g_error_free(error);
+		if (log_path != NULL) {
+			dbus_test_log_close();
+		}
+		g_list_free_full(shards, shard_free);
+		shards = NULL;
+		return -1;
 	}
 
-	dbus_test_service_set_bus(service, bus_type);
+	report_start();
+
+	/* With one shard everything runs on its context right here, with
+	   more the shards get threads and we wait on a context of our own */
+	shard_t * first = (shard_t *)shards->data;
+	GMainContext * main_context = parallel ? g_main_context_new() : g_main_context_ref(first->context);
+	g_main_context_push_thread_default(main_context);
+
+	DbusTestDaemonPool * pool = NULL;
+	if (bus_backend == DBUS_TEST_SERVICE_BACKEND_EMBEDDED) {
+		/* No daemons to hand out */
+	} else if (daemon_pool > 0) {
+		const gchar * pool_conf = dbus_configfile;
+		if (pool_conf == NULL) {
+			pool_conf = bus_type == DBUS_TEST_SERVICE_BUS_SYSTEM ? DEFAULT_SYSTEM_CONF : DEFAULT_SESSION_CONF;
+		}
 
-	if (dbus_daemon != NULL) {
-		dbus_test_service_set_daemon(service, dbus_daemon);
+		/* Start the daemons now so they're up by the time the
+		   service wants one, no more than there are shards */
+		pool = dbus_test_daemon_pool_new(dbus_daemon, pool_conf, keep_env, MIN(daemon_pool, (gint)g_list_length(shards)));
+		shards_pool = pool;
+	} else if (server_pool != NULL) {
+		/* The pool only hands out daemons that match the config
+		   the service asks for, so it's safe to offer it to all */
+		pool = g_object_ref(server_pool);
 	}
 
-	if (dbus_configfile != NULL) {
-		dbus_test_service_set_conf_file(service, dbus_configfile);
+	GList * lshard;
+	for (lshard = shards; lshard != NULL; lshard = g_list_next(lshard)) {
+		DbusTestService * shard_service = ((shard_t *)lshard->data)->service;
+
+		dbus_test_service_set_bus(shard_service, bus_type);
+		dbus_test_service_set_bus_backend(shard_service, bus_backend);
+
+		GList * ltask;
+		for (ltask = ((shard_t *)lshard->data)->tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+			if (kill_timeout >= 0) {
+				dbus_test_process_set_kill_timeout(DBUS_TEST_PROCESS(ltask->data), kill_timeout);
+			}
+
+			dbus_test_task_set_output(DBUS_TEST_TASK(ltask->data), task_output);
+		}
+
+		if (dbus_daemon != NULL) {
+			dbus_test_service_set_daemon(shard_service, dbus_daemon);
+		}
+
+		if (dbus_configfile != NULL) {
+			dbus_test_service_set_conf_file(shard_service, dbus_configfile);
+		}
+
+		dbus_test_service_set_keep_environment(shard_service, keep_env);
+		dbus_test_service_set_environment(shard_service, job_env);
+		dbus_test_service_set_cgroups(shard_service, use_cgroups);
+
+		/* Our environment can only point at one of the buses */
+		dbus_test_service_set_publish_environment(shard_service, !parallel && server_pool == NULL && output_stream == NULL);
+
+		if (pool != NULL) {
+			dbus_test_service_set_daemon_pool(shard_service, pool);
+		}
 	}
 
 	if (bustle_datafile != NULL) {
 		DbusTestBustle * bustler = dbus_test_bustle_new(bustle_datafile);
 		/* We want to ensure that bustle captures all the data so start it first */
-		dbus_test_service_add_task_with_priority(service, DBUS_TEST_TASK(bustler), DBUS_TEST_SERVICE_PRIORITY_FIRST);
+		dbus_test_service_add_task_with_priority(first->service, DBUS_TEST_TASK(bustler), DBUS_TEST_SERVICE_PRIORITY_FIRST);
 
 		if (bustle_cmd != NULL) {
 			dbus_test_bustle_set_executable(bustler, bustle_cmd);
 		}
 
+		dbus_test_task_set_output(DBUS_TEST_TASK(bustler), task_output);
+
 		g_object_unref(bustler);
 	}
 
+	if (watchdog_deadline > 0) {
+		dbus_test_watchdog_set_deadline(watchdog_deadline);
+	}
+
 	if (max_wait > 0) {
-		g_timeout_add_seconds(max_wait, max_wait_hit, NULL);
+		GSource * max_wait_source = g_timeout_source_new_seconds(max_wait);
+		g_source_set_callback(max_wait_source, max_wait_hit, NULL, NULL);
+		g_source_attach(max_wait_source, main_context);
+		g_source_unref(max_wait_source);
 	}
 
-	dbus_test_service_set_keep_environment(service, keep_env);
+	gint service_status = 0;
+	GThreadPool * threads = NULL;
 
-	/* These should all be in the service now */
-	if (last_task != NULL) {
-		g_object_unref(last_task);
-		last_task = NULL;
+	g_atomic_int_set(&shards_unstarted, g_list_length(shards));
+
+	if (!parallel) {
+		shard_starting();
+		service_status = dbus_test_service_run(first->service);
 	} else {
-		g_critical("No tasks assigned");
-		g_object_unref(service);
-		return -1;
+		/* The threads are kept to ourselves and live until the shards
+		   are freed */
+		threads = g_thread_pool_new(shard_run, main_context, MAX(jobs, 1), TRUE, &error);
+		if (error != NULL) {
+			g_critical("Unable to create threads for the shards: %s", error->message);
+			g_error_free(error);
+			if (log_path != NULL) {
+				dbus_test_log_close();
+			}
+			if (trace_path != NULL) {
+				dbus_test_trace_close();
+			}
+			if (watchdog_deadline > 0) {
+				dbus_test_watchdog_set_deadline(0);
+			}
+			g_main_context_pop_thread_default(main_context);
+			g_main_context_unref(main_context);
+			shards_pool = NULL;
+			g_clear_object(&pool);
+			g_list_free_full(shards, shard_free);
+			shards = NULL;
+			return -1;
+		}
+
+		shards_loop = g_main_loop_new(main_context, FALSE);
+		shards_running = g_list_length(shards);
+
+		for (lshard = shards; lshard != NULL; lshard = g_list_next(lshard)) {
+			g_thread_pool_push(threads, lshard->data, NULL);
+		}
+
+		g_main_loop_run(shards_loop);
+		g_main_loop_unref(shards_loop);
+		shards_loop = NULL;
+
+		for (lshard = shards; lshard != NULL; lshard = g_list_next(lshard)) {
+			if (((shard_t *)lshard->data)->status != 0) {
+				service_status = -1;
+			}
+		}
 	}
 
-	gint service_status = dbus_test_service_run(service);
-	g_object_unref(service);
+	for (lshard = shards; lshard != NULL; lshard = g_list_next(lshard)) {
+		shard_t * shard = (shard_t *)lshard->data;
+
+		/* Tasks were prepended as they were parsed */
+		GList * ltask;
+		for (ltask = g_list_last(shard->tasks); ltask != NULL; ltask = g_list_previous(ltask)) {
+			report_task(DBUS_TEST_TASK(ltask->data), shard->number);
+		}
+	}
+
+	g_list_free_full(shards, shard_free);
+	shards = NULL;
+	shards_pool = NULL;
+	g_clear_object(&pool);
+
+	if (threads != NULL) {
+		g_thread_pool_free(threads, FALSE, TRUE);
+	}
+
+	/* A server's pooled daemons outlive the job */
+	if (watchdog_deadline > 0) {
+		dbus_test_watchdog_set_deadline(0);
+	}
+
+	g_main_context_pop_thread_default(main_context);
+	g_main_context_unref(main_context);
+
+	if (log_path != NULL) {
+		dbus_test_log_close();
+	}
+
+	if (trace_path != NULL) {
+		dbus_test_trace_close();
+	}
+
+	if (g_atomic_int_get(&timeout)) {
+		service_status = -1;
+	}
+
+	report_finish(service_status == 0);
+
+	return service_status;
+}
+
+/* Jobs share all the option globals, so only one runs at a time.  Use
+   --jobs in the job to get things running in parallel. */
+static GMutex job_lock;
+static gchar * server_cwd = NULL;
+
+static gint
+server_job_run (const gchar * cwd, gchar ** env, GPtrArray * args)
+{
+	GError * error = NULL;
+	gint retval = -1;
 
-	if (timeout) {
+	if (g_chdir(cwd) != 0) {
+		g_printerr("Unable to change to directory '%s'\n", cwd);
 		return -1;
+	}
+
+	runner_reset();
+	job_env = g_strdupv(env);
+	shard_new();
+
+	/* Parsing shuffles the array, so give it a copy */
+	gint argc = args->len;
+	gchar ** argv = g_new0(gchar *, args->len + 1);
+	memcpy(argv, args->pdata, sizeof(gchar *) * args->len);
+
+	GOptionContext * context = runner_options();
+	/* Help would exit() the server */
+	g_option_context_set_help_enabled(context, FALSE);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_print("option parsing failed: %s\n", error->message);
+		g_error_free(error);
+	} else if (server_path != NULL) {
+		g_print("option parsing failed: a job can't start a server\n");
 	} else {
-		return service_status;
+		retval = runner_run();
+	}
+
+	g_option_context_free(context);
+	g_free(argv);
+
+	runner_reset();
+
+	if (g_chdir(server_cwd) != 0) {
+		g_warning("Unable to change back to directory '%s'", server_cwd);
+	}
+
+	return retval;
+}
+
+/* Called on a thread of its own for each client that connects */
+static gboolean
+server_job (G_GNUC_UNUSED GThreadedSocketService * socket_service, GSocketConnection * connection, G_GNUC_UNUSED GObject * source, G_GNUC_UNUSED gpointer user_data)
+{
+	GInputStream * in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+	GOutputStream * out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	GError * error = NULL;
+
+	gchar * cwd = NULL;
+	GPtrArray * env = NULL;
+	GPtrArray * args = g_ptr_array_new_with_free_func(g_free);
+	g_ptr_array_add(args, g_strdup("dbus-test-runner"));
+
+	gboolean run = FALSE;
+	gchar type;
+	gchar * data;
+
+	while (!run && frame_read(in, &type, &data, NULL, &error)) {
+		switch (type) {
+		case FRAME_CWD:
+			g_free(cwd);
+			cwd = data;
+			break;
+		case FRAME_ENV:
+			if (env == NULL) {
+				env = g_ptr_array_new_with_free_func(g_free);
+			}
+			g_ptr_array_add(env, data);
+			break;
+		case FRAME_ARG:
+			g_ptr_array_add(args, data);
+			break;
+		case FRAME_RUN:
+			run = TRUE;
+			g_free(data);
+			break;
+		default:
+			g_free(data);
+			break;
+		}
+	}
+
+	if (error != NULL) {
+		g_warning("Unable to read job: %s", error->message);
+		g_error_free(error);
+	}
+
+	if (run) {
+		/* Clients that don't send one get ours */
+		if (env != NULL) {
+			g_ptr_array_add(env, NULL);
+		}
+
+		g_mutex_lock(&job_lock);
+
+		g_mutex_lock(&output_lock);
+		output_stream = out;
+		g_mutex_unlock(&output_lock);
+
+		gint status = server_job_run(cwd != NULL ? cwd : server_cwd, env != NULL ? (gchar **)env->pdata : NULL, args);
+
+		g_mutex_lock(&output_lock);
+		output_stream = NULL;
+		g_mutex_unlock(&output_lock);
+
+		g_mutex_unlock(&job_lock);
+
+		gchar * status_str = g_strdup_printf("%d", status);
+		frame_write(out, FRAME_EXIT, status_str, -1, NULL);
+		g_free(status_str);
+	}
+
+	g_ptr_array_unref(args);
+	if (env != NULL) {
+		g_ptr_array_unref(env);
 	}
+	g_free(cwd);
+
+	return TRUE;
+}
+
+static gboolean
+server_quit (gpointer user_data)
+{
+	g_main_loop_quit((GMainLoop *)user_data);
+	return G_SOURCE_CONTINUE;
+}
+
+/* Listens on the socket until we get a signal.  Daemons from the pool
+   are started here on the main context and stay warm between jobs. */
+static gint
+server_run (void)
+{
+	GError * error = NULL;
+
+	if (last_task != NULL) {
+		g_critical("Tasks can't be given to the server, send them with dbus-test-runner-client");
+		return -1;
+	}
+
+	/* A socket left over from a server that didn't clean up goes, but
+	   nothing else that happens to be there */
+	GStatBuf st;
+	if (g_lstat(server_path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			g_critical("Unable to listen on '%s': it exists and isn't a socket", server_path);
+			return -1;
+		}
+
+		g_unlink(server_path);
+	}
+
+	gchar * path = g_strdup(server_path);
+
+	if (daemon_pool > 0) {
+		const gchar * pool_conf = dbus_configfile;
+		if (pool_conf == NULL) {
+			pool_conf = bus_type == DBUS_TEST_SERVICE_BUS_SYSTEM ? DEFAULT_SYSTEM_CONF : DEFAULT_SESSION_CONF;
+		}
+
+		server_pool = dbus_test_daemon_pool_new(dbus_daemon, pool_conf, keep_env, daemon_pool);
+	}
+
+	runner_reset();
+	server_cwd = g_get_current_dir();
+
+	GSocketService * socket_service = g_threaded_socket_service_new(-1);
+	GSocketAddress * address = g_unix_socket_address_new(path);
+	gboolean listening = g_socket_listener_add_address(G_SOCKET_LISTENER(socket_service), address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error);
+	g_object_unref(address);
+
+	if (!listening) {
+		g_critical("Unable to listen on '%s': %s", path, error->message);
+		g_error_free(error);
+		g_object_unref(socket_service);
+		g_clear_object(&server_pool);
+		g_clear_pointer(&server_cwd, g_free);
+		g_free(path);
+		return -1;
+	}
+
+	g_set_print_handler(output_print);
+	g_set_printerr_handler(output_printerr);
+	g_log_set_default_handler(output_log, NULL);
+
+	g_signal_connect(socket_service, "run", G_CALLBACK(server_job), NULL);
+	g_socket_service_start(socket_service);
+
+	GMainLoop * loop = g_main_loop_new(NULL, FALSE);
+	g_unix_signal_add(SIGINT, server_quit, loop);
+	g_unix_signal_add(SIGTERM, server_quit, loop);
+
+	g_print("Runner listening on %s\n", path);
+	g_main_loop_run(loop);
+
+	g_socket_service_stop(socket_service);
+	g_socket_listener_close(G_SOCKET_LISTENER(socket_service));
+	g_unlink(path);
+
+	/* Let a job that's running finish before the pool goes away */
+	g_mutex_lock(&job_lock);
+	g_clear_object(&server_pool);
+	g_mutex_unlock(&job_lock);
+
+	g_main_loop_unref(loop);
+	g_object_unref(socket_service);
+	g_clear_pointer(&server_cwd, g_free);
+	g_free(path);
+
+	return 0;
+}
+
+/* Every running task holds a pipe, lots of short tasks can go past
+   the usual soft limit of 1024.  Not all the way to the hard limit
+   as spawning closes every possible descriptor in the child. */
+#define FD_LIMIT  65536
+
+static void
+raise_fd_limit (void)
+{
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+		return;
+	}
+
+	rlim_t wanted = MIN(limit.rlim_max, FD_LIMIT);
+	if (limit.rlim_cur >= wanted) {
+		return;
+	}
+
+	limit.rlim_cur = wanted;
+	if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+		g_warning("Unable to raise the open file limit to %lu", (gulong)wanted);
+	}
+
+	return;
+}
+
+int
+main (int argc, char * argv[])
+{
+	GError * error = NULL;
+	GOptionContext * context;
+
+#ifndef GLIB_VERSION_2_36
+	g_type_init();
+#endif
+
+	raise_fd_limit();
+
+#ifdef __linux__
+	/* Whatever the tasks leave behind when they exit comes to us
+	   instead of init, so it can be killed and reaped with them */
+	prctl(PR_SET_CHILD_SUBREAPER, 1);
+#endif
+
+	shard_new();
+
+	context = runner_options();
+
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_print("option parsing failed: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	g_option_context_free(context);
+
+	if (server_path != NULL) {
+		gint retval = server_run();
+		runner_reset();
+		return retval;
+	}
+
+	return runner_run();
 }
@@ -0,0 +1,106 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "protocol.h"
+
+/* Header and payload go out in one write so that frames from different
+   threads don't get interleaved on the socket */
+gboolean
+frame_write (GOutputStream * stream, gchar type, const gchar * data, gssize len, GError ** error)
+{
+	g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), FALSE);
+
+	if (data == NULL) {
+		len = 0;
+	} else if (len < 0) {
+		len = strlen(data);
+	}
+
+	gchar * frame = g_malloc(5 + len);
+	guint32 size = GUINT32_TO_BE((guint32)len);
+
+	frame[0] = type;
+	memcpy(frame + 1, &size, 4);
+	if (len > 0) {
+		memcpy(frame + 5, data, len);
+	}
+
+	gboolean retval = g_output_stream_write_all(stream, frame, 5 + len, NULL, NULL, error);
+
+	g_free(frame);
+	return retval;
+}
+
+/* Reads the next frame.  The payload is always nul terminated so that
+   strings can be used directly.  Returns FALSE without setting @error
+   when the other side closed the socket cleanly. */
+gboolean
+frame_read (GInputStream * stream, gchar * type, gchar ** data, gsize * len, GError ** error)
+{
+	g_return_val_if_fail(G_IS_INPUT_STREAM(stream), FALSE);
+	g_return_val_if_fail(type != NULL, FALSE);
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	gchar header[5];
+	gsize got = 0;
+
+	if (!g_input_stream_read_all(stream, header, sizeof(header), &got, NULL, error)) {
+		return FALSE;
+	}
+
+	if (got == 0) {
+		return FALSE;
+	}
+
+	if (got != sizeof(header)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "Truncated frame header");
+		return FALSE;
+	}
+
+	guint32 size;
+	memcpy(&size, header + 1, 4);
+	size = GUINT32_FROM_BE(size);
+
+	if (size > FRAME_MAX_SIZE) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Frame of %u bytes is too large", size);
+		return FALSE;
+	}
+
+	gchar * payload = g_malloc(size + 1);
+
+	if (!g_input_stream_read_all(stream, payload, size, &got, NULL, error)) {
+		g_free(payload);
+		return FALSE;
+	}
+
+	if (got != size) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "Truncated frame");
+		g_free(payload);
+		return FALSE;
+	}
+
+	payload[size] = '\0';
+
+	*type = header[0];
+	*data = payload;
+	if (len != NULL) {
+		*len = size;
+	}
+
+	return TRUE;
+}
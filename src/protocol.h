@@ -0,0 +1,57 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_RUNNER_PROTOCOL_H__
+#define __DBUS_TEST_RUNNER_PROTOCOL_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* What goes over the control socket between the runner server and its
+   clients.  Every frame is a type byte, a 32-bit big endian length and
+   then that many bytes of payload.  The client sends its working
+   directory, one frame per environment variable as NAME=value for the
+   tasks, one frame per argument and then asks for the run.  The server
+   sends back output as it happens and finishes with the exit status as
+   a decimal string. */
+
+#define FRAME_CWD       'C'
+#define FRAME_ENV       'V'
+#define FRAME_ARG       'A'
+#define FRAME_RUN       'R'
+#define FRAME_STDOUT    'O'
+#define FRAME_STDERR    'E'
+#define FRAME_EXIT      'X'
+
+#define FRAME_MAX_SIZE  (16 * 1024 * 1024)
+
+#define SOCKET_ENV      "DBUS_TEST_RUNNER_SOCKET"
+
+gboolean frame_write (GOutputStream * stream,
+                      gchar           type,
+                      const gchar *   data,
+                      gssize          len,
+                      GError **       error);
+gboolean frame_read  (GInputStream *  stream,
+                      gchar *         type,
+                      gchar **        data,
+                      gsize *         len,
+                      GError **       error);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,824 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include "report.h"
+
+typedef enum {
+	REPORT_JUNIT,
+	REPORT_TAP,
+	REPORT_JSON,
+	REPORT_USAGE
+} report_format_t;
+
+/* One --report, a NULL path is stdout */
+typedef struct {
+	report_format_t format;
+	gchar * path;
+} report_t;
+
+/* What we keep of a task, the tasks themselves go away with their
+   service before the reports are written */
+typedef struct {
+	gchar * name;
+	gchar * command;
+	const gchar * returns;
+	const gchar * state;
+	const gchar * result;
+	gint shard;
+	gint exit_code;
+	gint signal;
+	gdouble start;
+	gdouble ready;
+	gdouble finish;
+	gdouble wall;
+	gdouble cpu;
+	gboolean have_usage;
+	DbusTestProcessUsage usage;
+	gboolean have_cgroup;
+	DbusTestCgroupUsage cgroup;
+} report_task_t;
+
+static GList * reports = NULL;
+static GList * tasks = NULL;
+static gint64 run_start = 0;
+
+static void
+report_free (gpointer data)
+{
+	report_t * report = (report_t *)data;
+
+	g_free(report->path);
+	g_free(report);
+
+	return;
+}
+
+static void
+report_task_free (gpointer data)
+{
+	report_task_t * task = (report_task_t *)data;
+
+	g_free(task->name);
+	g_free(task->command);
+	g_free(task);
+
+	return;
+}
+
+gboolean
+report_add (const gchar * spec, GError ** error)
+{
+	const gchar * colon = strchr(spec, ':');
+	gchar * format = colon != NULL ? g_strndup(spec, colon - spec) : g_strdup(spec);
+	const gchar * path = colon != NULL ? colon + 1 : NULL;
+	report_t * report = g_new0(report_t, 1);
+
+	if (path != NULL && path[0] == '\0') {
+		path = NULL;
+	}
+
+	if (g_strcmp0(format, "junit") == 0) {
+		report->format = REPORT_JUNIT;
+	} else if (g_strcmp0(format, "tap") == 0) {
+		report->format = REPORT_TAP;
+	} else if (g_strcmp0(format, "json") == 0) {
+		report->format = REPORT_JSON;
+	} else if (g_strcmp0(format, "usage") == 0) {
+		report->format = REPORT_USAGE;
+	} else {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Report format '%s' unknown", format);
+		g_free(format);
+		g_free(report);
+		return FALSE;
+	}
+
+	/* TAP and the table read well mixed in with the task output */
+	if (path == NULL && report->format != REPORT_TAP && report->format != REPORT_USAGE) {
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Report format '%s' needs a file, as %s:FILE", format, format);
+		g_free(format);
+		g_free(report);
+		return FALSE;
+	}
+
+	report->path = g_strdup(path);
+	reports = g_list_append(reports, report);
+
+	g_free(format);
+	return TRUE;
+}
+
+/* The times for tasks are relative to this */
+void
+report_start (void)
+{
+	run_start = g_get_monotonic_time();
+
+	return;
+}
+
+/* Seconds since the run started, or -1 for a time the task never got to */
+static gdouble
+report_time (gint64 when)
+{
+	if (when == 0) {
+		return -1.0;
+	}
+
+	return (gdouble)(when - run_start) / G_USEC_PER_SEC;
+}
+
+static gchar *
+report_command (DbusTestTask * task)
+{
+	if (!DBUS_TEST_IS_PROCESS(task)) {
+		return NULL;
+	}
+
+	gchar * executable = NULL;
+	GArray * parameters = NULL;
+	g_object_get(task, "executable", &executable, "parameters", &parameters, NULL);
+
+	GString * command = g_string_new(NULL);
+	gchar * quoted = g_shell_quote(executable != NULL ? executable : "");
+	g_string_append(command, quoted);
+	g_free(quoted);
+
+	guint i;
+	for (i = 0; parameters != NULL && i < parameters->len; i++) {
+		quoted = g_shell_quote(g_array_index(parameters, gchar *, i));
+		g_string_append_c(command, ' ');
+		g_string_append(command, quoted);
+		g_free(quoted);
+	}
+
+	g_free(executable);
+	if (parameters != NULL) {
+		g_array_unref(parameters);
+	}
+
+	return g_string_free(command, FALSE);
+}
+
+/* Called for each task while it's still around, in the order they
+   were given on the command line */
+void
+report_task (DbusTestTask * task, gint shard)
+{
+	if (reports == NULL) {
+		return;
+	}
+
+	report_task_t * record = g_new0(report_task_t, 1);
+	DbusTestTaskState state = dbus_test_task_get_state(task);
+
+	record->name = g_strdup(dbus_test_task_get_name(task));
+	record->command = report_command(task);
+	record->shard = shard;
+	record->exit_code = -1;
+	record->signal = 0;
+	record->cpu = -1.0;
+
+	switch (dbus_test_task_get_return(task)) {
+	case DBUS_TEST_TASK_RETURN_IGNORE:
+		record->returns = "ignore";
+		break;
+	case DBUS_TEST_TASK_RETURN_INVERT:
+		record->returns = "invert";
+		break;
+	default:
+		record->returns = "normal";
+		break;
+	}
+
+	switch (state) {
+	case DBUS_TEST_TASK_STATE_INIT:
+		record->state = "init";
+		break;
+	case DBUS_TEST_TASK_STATE_WAITING:
+		record->state = "waiting";
+		break;
+	case DBUS_TEST_TASK_STATE_RUNNING:
+		record->state = "running";
+		break;
+	default:
+		record->state = "finished";
+		break;
+	}
+
+	if (state == DBUS_TEST_TASK_STATE_INIT) {
+		record->result = "skipped";
+	} else {
+		record->result = dbus_test_task_passed(task) ? "passed" : "failed";
+	}
+
+	/* Stopped by us rather than failing on its own */
+	if (dbus_test_task_get_timed_out(task)) {
+		record->result = "timed-out";
+	}
+
+	if (DBUS_TEST_IS_PROCESS(task)) {
+		gint status = dbus_test_process_get_exit_status(DBUS_TEST_PROCESS(task));
+		gint64 cpu = dbus_test_process_get_cpu_time(DBUS_TEST_PROCESS(task));
+
+		if (status != -1 && WIFEXITED(status)) {
+			record->exit_code = WEXITSTATUS(status);
+		} else if (status != -1 && WIFSIGNALED(status)) {
+			record->signal = WTERMSIG(status);
+		}
+
+		if (cpu >= 0) {
+			record->cpu = (gdouble)cpu / G_USEC_PER_SEC;
+		}
+
+		/* Tasks still running get what they've used so far, they're
+		   killed once we're done here */
+		record->have_usage = dbus_test_process_get_usage(DBUS_TEST_PROCESS(task), &record->usage);
+	}
+
+	gint64 start = dbus_test_task_get_start_time(task);
+	gint64 finish = dbus_test_task_get_finish_time(task);
+
+	record->start = report_time(start);
+	record->ready = report_time(dbus_test_task_get_ready_time(task));
+	record->finish = report_time(finish);
+
+	/* Tasks cut off at the end count up to now */
+	if (start == 0) {
+		record->wall = 0.0;
+	} else {
+		record->wall = (gdouble)((finish != 0 ? finish : g_get_monotonic_time()) - start) / G_USEC_PER_SEC;
+	}
+
+	/* Everything the task started, not just the process itself */
+	record->have_cgroup = dbus_test_task_get_cgroup_usage(task, &record->cgroup);
+
+	tasks = g_list_prepend(tasks, record);
+
+	return;
+}
+
+/* Always with a dot, whatever the locale */
+static const gchar *
+report_seconds (gchar * buffer, gdouble seconds)
+{
+	return g_ascii_formatd(buffer, G_ASCII_DTOSTR_BUF_SIZE, "%.6f", seconds);
+}
+
+/* Microseconds from the kernel, -1 when it doesn't have them */
+static gdouble
+report_usec (gint64 usec)
+{
+	return usec >= 0 ? (gdouble)usec / G_USEC_PER_SEC : -1.0;
+}
+
+/* A double quoted string that is both JSON and YAML */
+static void
+report_append_quoted (GString * out, const gchar * string)
+{
+	const gchar * c;
+
+	g_string_append_c(out, '"');
+
+	for (c = string; c != NULL && *c != '\0'; c++) {
+		switch (*c) {
+		case '"':
+			g_string_append(out, "\\\"");
+			break;
+		case '\\':
+			g_string_append(out, "\\\\");
+			break;
+		case '\n':
+			g_string_append(out, "\\n");
+			break;
+		case '\t':
+			g_string_append(out, "\\t");
+			break;
+		default:
+			if ((guchar)*c < 0x20) {
+				g_string_append_printf(out, "\\u%04x", (guchar)*c);
+			} else {
+				g_string_append_c(out, *c);
+			}
+			break;
+		}
+	}
+
+	g_string_append_c(out, '"');
+
+	return;
+}
+
+/* Timing out is its own result, but it still fails the test */
+static gboolean
+report_failed (report_task_t * task)
+{
+	return g_strcmp0(task->result, "failed") == 0 || g_strcmp0(task->result, "timed-out") == 0;
+}
+
+static gchar *
+report_failure_message (report_task_t * task)
+{
+	if (g_strcmp0(task->result, "timed-out") == 0) {
+		return g_strdup("Timed out");
+	}
+
+	if (g_strcmp0(task->state, "finished") != 0) {
+		return g_strdup_printf("Still %s at the end of the run", task->state);
+	}
+
+	if (task->signal != 0) {
+		return g_strdup_printf("Killed by signal %d", task->signal);
+	}
+
+	return g_strdup_printf("Exited with status %d", task->exit_code);
+}
+
+static void
+report_junit_property (GString * out, const gchar * name, const gchar * value)
+{
+	gchar * escaped = g_markup_escape_text(value, -1);
+	g_string_append_printf(out, "\t\t\t\t<property name=\"%s\" value=\"%s\"/>\n", name, escaped);
+	g_free(escaped);
+
+	return;
+}
+
+static void
+report_junit_time (GString * out, const gchar * name, gdouble seconds)
+{
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (seconds >= 0.0) {
+		report_junit_property(out, name, report_seconds(buffer, seconds));
+	}
+
+	return;
+}
+
+static void
+report_junit_usage (GString * out, DbusTestProcessUsage * usage)
+{
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar * value;
+
+	report_junit_property(out, "usage.user", report_seconds(buffer, (gdouble)usage->user_time / G_USEC_PER_SEC));
+	report_junit_property(out, "usage.system", report_seconds(buffer, (gdouble)usage->system_time / G_USEC_PER_SEC));
+
+	value = g_strdup_printf("%" G_GINT64_FORMAT, usage->max_rss);
+	report_junit_property(out, "usage.max-rss-kib", value);
+	g_free(value);
+
+	value = g_strdup_printf("%" G_GINT64_FORMAT, usage->minor_faults);
+	report_junit_property(out, "usage.minor-faults", value);
+	g_free(value);
+
+	value = g_strdup_printf("%" G_GINT64_FORMAT, usage->major_faults);
+	report_junit_property(out, "usage.major-faults", value);
+	g_free(value);
+
+	value = g_strdup_printf("%" G_GINT64_FORMAT, usage->voluntary_switches);
+	report_junit_property(out, "usage.voluntary-switches", value);
+	g_free(value);
+
+	value = g_strdup_printf("%" G_GINT64_FORMAT, usage->involuntary_switches);
+	report_junit_property(out, "usage.involuntary-switches", value);
+	g_free(value);
+
+	return;
+}
+
+/* Figures the kernel doesn't have are -1 and left out */
+static void
+report_junit_count (GString * out, const gchar * name, gint64 count)
+{
+	if (count >= 0) {
+		gchar * value = g_strdup_printf("%" G_GINT64_FORMAT, count);
+		report_junit_property(out, name, value);
+		g_free(value);
+	}
+
+	return;
+}
+
+static GString *
+report_junit (gdouble duration)
+{
+	GString * out = g_string_new("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+	gint failures = 0;
+	gint skipped = 0;
+	gint shards = 0;
+	GList * ltask;
+
+	for (ltask = tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+		report_task_t * task = (report_task_t *)ltask->data;
+
+		if (report_failed(task)) {
+			failures++;
+		} else if (g_strcmp0(task->result, "skipped") == 0) {
+			skipped++;
+		}
+
+		shards = MAX(shards, task->shard + 1);
+	}
+
+	g_string_append_printf(out, "<testsuites name=\"dbus-test-runner\" tests=\"%u\" failures=\"%d\" skipped=\"%d\" time=\"%s\">\n",
+	                       g_list_length(tasks), failures, skipped, report_seconds(buffer, duration));
+
+	gint shard;
+	for (shard = 0; shard < shards; shard++) {
+		g_string_append_printf(out, "\t<testsuite name=\"shard%d\">\n", shard);
+
+		for (ltask = tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+			report_task_t * task = (report_task_t *)ltask->data;
+
+			if (task->shard != shard) {
+				continue;
+			}
+
+			gchar * name = g_markup_escape_text(task->name, -1);
+			g_string_append_printf(out, "\t\t<testcase name=\"%s\" classname=\"dbus-test-runner.shard%d\" time=\"%s\">\n",
+			                       name, shard, report_seconds(buffer, task->wall));
+			g_free(name);
+
+			if (report_failed(task)) {
+				gchar * message = report_failure_message(task);
+				gchar * escaped = g_markup_escape_text(message, -1);
+				g_string_append_printf(out, "\t\t\t<failure message=\"%s\"/>\n", escaped);
+				g_free(escaped);
+				g_free(message);
+			} else if (g_strcmp0(task->result, "skipped") == 0) {
+				g_string_append(out, "\t\t\t<skipped message=\"Never started\"/>\n");
+			}
+
+			g_string_append(out, "\t\t\t<properties>\n");
+			if (task->command != NULL) {
+				report_junit_property(out, "command", task->command);
+			}
+			report_junit_property(out, "return", task->returns);
+			report_junit_property(out, "state", task->state);
+			if (task->exit_code >= 0) {
+				gchar * code = g_strdup_printf("%d", task->exit_code);
+				report_junit_property(out, "exit-code", code);
+				g_free(code);
+			}
+			if (task->signal != 0) {
+				gchar * sig = g_strdup_printf("%d", task->signal);
+				report_junit_property(out, "signal", sig);
+				g_free(sig);
+			}
+			report_junit_time(out, "start", task->start);
+			report_junit_time(out, "ready", task->ready);
+			report_junit_time(out, "finish", task->finish);
+			report_junit_time(out, "cpu", task->cpu);
+			if (task->have_usage) {
+				report_junit_usage(out, &task->usage);
+			}
+			if (task->have_cgroup) {
+				report_junit_time(out, "cgroup.cpu", report_usec(task->cgroup.cpu_time));
+				report_junit_time(out, "cgroup.user", report_usec(task->cgroup.user_time));
+				report_junit_time(out, "cgroup.system", report_usec(task->cgroup.system_time));
+				report_junit_count(out, "cgroup.memory-peak", task->cgroup.memory_peak);
+				report_junit_count(out, "cgroup.io-read", task->cgroup.io_read);
+				report_junit_count(out, "cgroup.io-written", task->cgroup.io_written);
+			}
+			g_string_append(out, "\t\t\t</properties>\n");
+
+			g_string_append(out, "\t\t</testcase>\n");
+		}
+
+		g_string_append(out, "\t</testsuite>\n");
+	}
+
+	g_string_append(out, "</testsuites>\n");
+
+	return out;
+}
+
+static void
+report_tap_time (GString * out, const gchar * name, gdouble seconds)
+{
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (seconds >= 0.0) {
+		g_string_append_printf(out, "  %s: %s\n", name, report_seconds(buffer, seconds));
+	}
+
+	return;
+}
+
+static GString *
+report_tap (void)
+{
+	GString * out = g_string_new("TAP version 13\n");
+	gint number = 0;
+	GList * ltask;
+
+	g_string_append_printf(out, "1..%u\n", g_list_length(tasks));
+
+	for (ltask = tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+		report_task_t * task = (report_task_t *)ltask->data;
+
+		g_string_append_printf(out, "%s %d - %s%s\n",
+		                       report_failed(task) ? "not ok" : "ok",
+		                       ++number,
+		                       task->name,
+		                       g_strcmp0(task->result, "skipped") == 0 ? " # SKIP Never started" : "");
+
+		g_string_append(out, "  ---\n");
+		if (task->command != NULL) {
+			g_string_append(out, "  command: ");
+			report_append_quoted(out, task->command);
+			g_string_append_c(out, '\n');
+		}
+		g_string_append_printf(out, "  shard: %d\n", task->shard);
+		g_string_append_printf(out, "  return: %s\n", task->returns);
+		g_string_append_printf(out, "  state: %s\n", task->state);
+		if (task->exit_code >= 0) {
+			g_string_append_printf(out, "  exit-code: %d\n", task->exit_code);
+		}
+		if (task->signal != 0) {
+			g_string_append_printf(out, "  signal: %d\n", task->signal);
+		}
+		report_tap_time(out, "start", task->start);
+		report_tap_time(out, "ready", task->ready);
+		report_tap_time(out, "finish", task->finish);
+		report_tap_time(out, "wall", task->wall);
+		report_tap_time(out, "cpu", task->cpu);
+		if (task->have_usage) {
+			gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+			g_string_append(out, "  usage:\n");
+			g_string_append_printf(out, "    user: %s\n", report_seconds(buffer, (gdouble)task->usage.user_time / G_USEC_PER_SEC));
+			g_string_append_printf(out, "    system: %s\n", report_seconds(buffer, (gdouble)task->usage.system_time / G_USEC_PER_SEC));
+			g_string_append_printf(out, "    max-rss-kib: %" G_GINT64_FORMAT "\n", task->usage.max_rss);
+			g_string_append_printf(out, "    minor-faults: %" G_GINT64_FORMAT "\n", task->usage.minor_faults);
+			g_string_append_printf(out, "    major-faults: %" G_GINT64_FORMAT "\n", task->usage.major_faults);
+			g_string_append_printf(out, "    voluntary-switches: %" G_GINT64_FORMAT "\n", task->usage.voluntary_switches);
+			g_string_append_printf(out, "    involuntary-switches: %" G_GINT64_FORMAT "\n", task->usage.involuntary_switches);
+		}
+		if (task->have_cgroup) {
+			gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+			g_string_append(out, "  cgroup:\n");
+			if (task->cgroup.cpu_time >= 0) {
+				g_string_append_printf(out, "    cpu: %s\n", report_seconds(buffer, report_usec(task->cgroup.cpu_time)));
+			}
+			if (task->cgroup.user_time >= 0) {
+				g_string_append_printf(out, "    user: %s\n", report_seconds(buffer, report_usec(task->cgroup.user_time)));
+			}
+			if (task->cgroup.system_time >= 0) {
+				g_string_append_printf(out, "    system: %s\n", report_seconds(buffer, report_usec(task->cgroup.system_time)));
+			}
+			if (task->cgroup.memory_peak >= 0) {
+				g_string_append_printf(out, "    memory-peak: %" G_GINT64_FORMAT "\n", task->cgroup.memory_peak);
+			}
+			if (task->cgroup.io_read >= 0) {
+				g_string_append_printf(out, "    io-read: %" G_GINT64_FORMAT "\n", task->cgroup.io_read);
+			}
+			if (task->cgroup.io_written >= 0) {
+				g_string_append_printf(out, "    io-written: %" G_GINT64_FORMAT "\n", task->cgroup.io_written);
+			}
+		}
+		g_string_append(out, "  ...\n");
+	}
+
+	return out;
+}
+
+static void
+report_json_time (GString * out, const gchar * name, gdouble seconds)
+{
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (seconds >= 0.0) {
+		g_string_append_printf(out, ",\n      \"%s\": %s", name, report_seconds(buffer, seconds));
+	} else {
+		g_string_append_printf(out, ",\n      \"%s\": null", name);
+	}
+
+	return;
+}
+
+/* @key comes with its separator and quotes, the kernel's -1 is null */
+static void
+report_json_cgroup_time (GString * out, const gchar * key, gint64 usec)
+{
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (usec >= 0) {
+		g_string_append_printf(out, "%s: %s", key, report_seconds(buffer, report_usec(usec)));
+	} else {
+		g_string_append_printf(out, "%s: null", key);
+	}
+
+	return;
+}
+
+static void
+report_json_cgroup_count (GString * out, const gchar * key, gint64 count)
+{
+	if (count >= 0) {
+		g_string_append_printf(out, "%s: %" G_GINT64_FORMAT, key, count);
+	} else {
+		g_string_append_printf(out, "%s: null", key);
+	}
+
+	return;
+}
+
+static GString *
+report_json (gboolean passed, gdouble duration)
+{
+	GString * out = g_string_new("{\n");
+	gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+	GList * ltask;
+
+	g_string_append_printf(out, "  \"passed\": %s,\n", passed ? "true" : "false");
+	g_string_append_printf(out, "  \"duration\": %s,\n", report_seconds(buffer, duration));
+	g_string_append(out, "  \"tasks\": [");
+
+	for (ltask = tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+		report_task_t * task = (report_task_t *)ltask->data;
+
+		g_string_append(out, ltask == tasks ? "\n    {\n" : ",\n    {\n");
+
+		g_string_append(out, "      \"name\": ");
+		report_append_quoted(out, task->name);
+		g_string_append(out, ",\n      \"command\": ");
+		if (task->command != NULL) {
+			report_append_quoted(out, task->command);
+		} else {
+			g_string_append(out, "null");
+		}
+		g_string_append_printf(out, ",\n      \"shard\": %d", task->shard);
+		g_string_append_printf(out, ",\n      \"return\": \"%s\"", task->returns);
+		g_string_append_printf(out, ",\n      \"state\": \"%s\"", task->state);
+		g_string_append_printf(out, ",\n      \"result\": \"%s\"", task->result);
+
+		if (task->exit_code >= 0) {
+			g_string_append_printf(out, ",\n      \"exit_code\": %d", task->exit_code);
+		} else {
+			g_string_append(out, ",\n      \"exit_code\": null");
+		}
+
+		if (task->signal != 0) {
+			g_string_append_printf(out, ",\n      \"signal\": %d", task->signal);
+		} else {
+			g_string_append(out, ",\n      \"signal\": null");
+		}
+
+		report_json_time(out, "start", task->start);
+		report_json_time(out, "ready", task->ready);
+		report_json_time(out, "finish", task->finish);
+		report_json_time(out, "wall", task->wall);
+		report_json_time(out, "cpu", task->cpu);
+
+		if (task->have_usage) {
+			gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+			g_string_append(out, ",\n      \"usage\": {");
+			g_string_append_printf(out, "\n        \"user\": %s", report_seconds(buffer, (gdouble)task->usage.user_time / G_USEC_PER_SEC));
+			g_string_append_printf(out, ",\n        \"system\": %s", report_seconds(buffer, (gdouble)task->usage.system_time / G_USEC_PER_SEC));
+			g_string_append_printf(out, ",\n        \"max_rss_kib\": %" G_GINT64_FORMAT, task->usage.max_rss);
+			g_string_append_printf(out, ",\n        \"minor_faults\": %" G_GINT64_FORMAT, task->usage.minor_faults);
+			g_string_append_printf(out, ",\n        \"major_faults\": %" G_GINT64_FORMAT, task->usage.major_faults);
+			g_string_append_printf(out, ",\n        \"voluntary_switches\": %" G_GINT64_FORMAT, task->usage.voluntary_switches);
+			g_string_append_printf(out, ",\n        \"involuntary_switches\": %" G_GINT64_FORMAT, task->usage.involuntary_switches);
+			g_string_append(out, "\n      }");
+		} else {
+			g_string_append(out, ",\n      \"usage\": null");
+		}
+
+		if (task->have_cgroup) {
+			g_string_append(out, ",\n      \"cgroup\": {");
+			report_json_cgroup_time(out, "\n        \"cpu\"", task->cgroup.cpu_time);
+			report_json_cgroup_time(out, ",\n        \"user\"", task->cgroup.user_time);
+			report_json_cgroup_time(out, ",\n        \"system\"", task->cgroup.system_time);
+			report_json_cgroup_count(out, ",\n        \"memory_peak\"", task->cgroup.memory_peak);
+			report_json_cgroup_count(out, ",\n        \"io_read\"", task->cgroup.io_read);
+			report_json_cgroup_count(out, ",\n        \"io_written\"", task->cgroup.io_written);
+			g_string_append(out, "\n      }");
+		} else {
+			g_string_append(out, ",\n      \"cgroup\": null");
+		}
+
+		g_string_append(out, "\n    }");
+	}
+
+	g_string_append(out, tasks != NULL ? "\n  ]\n}\n" : "]\n}\n");
+
+	return out;
+}
+
+/* A table for people, one row a task */
+static GString *
+report_usage (void)
+{
+	GString * out = g_string_new(NULL);
+	gint width = strlen("Task");
+	GList * ltask;
+
+	for (ltask = tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+		width = MAX(width, (gint)strlen(((report_task_t *)ltask->data)->name));
+	}
+
+	g_string_append_printf(out, "%-*s %10s %10s %10s %12s %8s %10s %10s\n", width,
+	                       "Task", "Wall", "User", "System", "Max RSS KiB", "Faults", "Vol. CS", "Invol. CS");
+
+	for (ltask = tasks; ltask != NULL; ltask = g_list_next(ltask)) {
+		report_task_t * task = (report_task_t *)ltask->data;
+
+		g_string_append_printf(out, "%-*s %10.3f", width, task->name, task->wall);
+
+		if (task->have_usage) {
+			g_string_append_printf(out, " %10.3f %10.3f %12" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT "\n",
+			                       (gdouble)task->usage.user_time / G_USEC_PER_SEC,
+			                       (gdouble)task->usage.system_time / G_USEC_PER_SEC,
+			                       task->usage.max_rss,
+			                       task->usage.minor_faults + task->usage.major_faults,
+			                       task->usage.voluntary_switches,
+			                       task->usage.involuntary_switches);
+		} else {
+			g_string_append_printf(out, " %10s %10s %12s %8s %10s %10s\n", "-", "-", "-", "-", "-", "-");
+		}
+	}
+
+	return out;
+}
+
+/* Writes out every report asked for, @passed being the result of
+   the whole run */
+void
+report_finish (gboolean passed)
+{
+	gdouble duration = (gdouble)(g_get_monotonic_time() - run_start) / G_USEC_PER_SEC;
+	GList * lreport;
+
+	tasks = g_list_reverse(tasks);
+
+	for (lreport = reports; lreport != NULL; lreport = g_list_next(lreport)) {
+		report_t * report = (report_t *)lreport->data;
+		GString * out = NULL;
+		GError * error = NULL;
+
+		switch (report->format) {
+		case REPORT_JUNIT:
+			out = report_junit(duration);
+			break;
+		case REPORT_TAP:
+			out = report_tap();
+			break;
+		case REPORT_JSON:
+			out = report_json(passed, duration);
+			break;
+		case REPORT_USAGE:
+			out = report_usage();
+			break;
+		}
+
+		if (report->path == NULL) {
+			g_print("%s", out->str);
+		} else if (!g_file_set_contents(report->path, out->str, out->len, &error)) {
+			g_warning("Unable to write report '%s': %s", report->path, error->message);
+			g_error_free(error);
+		}
+
+		g_string_free(out, TRUE);
+	}
+
+	g_list_free_full(tasks, report_task_free);
+	tasks = NULL;
+
+	return;
+}
+
+void
+report_reset (void)
+{
+	g_list_free_full(reports, report_free);
+	reports = NULL;
+	g_list_free_full(tasks, report_task_free);
+	tasks = NULL;
+	run_start = 0;
+
+	return;
+}
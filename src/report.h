@@ -0,0 +1,39 @@
+/*
+Copyright 2026 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it 
+under the terms of the GNU General Public License version 3, as published 
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranties of 
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR 
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBUS_TEST_RUNNER_REPORT_H__
+#define __DBUS_TEST_RUNNER_REPORT_H__
+
+#include <glib.h>
+#include <libdbustest/dbus-test.h>
+
+G_BEGIN_DECLS
+
+/* Results of a run for tools instead of people.  Each --report adds a
+   reporter, the tasks are recorded before they're freed and all the
+   reports get written once the run is over. */
+
+gboolean report_add    (const gchar *   spec,
+                        GError **       error);
+void     report_start  (void);
+void     report_task   (DbusTestTask *  task,
+                        gint            shard);
+void     report_finish (gboolean        passed);
+void     report_reset  (void);
+
+G_END_DECLS
+
+#endif
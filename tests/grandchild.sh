@@ -0,0 +1,7 @@
+#!/bin/sh
+# Leaves a grandchild of the runner behind in the background and
+# writes its PID to $1
+sleep 300 &
+echo $! > $1.tmp
+mv $1.tmp $1
+wait
@@ -335,6 +335,28 @@ test_methods (void)
 	g_assert(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
 	g_assert(!dbus_test_dbus_mock_object_check_method_call(mock, obj, "method1", NULL, NULL));
 
+	/* Calls after the clear are all that's left */
+	propret = g_dbus_connection_call_sync(bus,
+		"foo.test",
+		"/test",
+		"foo.test.interface",
+		"method1",
+		g_variant_new("(ss)", "after", "clear"),
+		G_VARIANT_TYPE("(s)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1,
+		NULL,
+		&error);
+	g_assert_no_error(error);
+	g_variant_unref(propret);
+
+	guint length = 0;
+	const DbusTestDbusMockCall * calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "method1", &length, NULL);
+	g_assert_cmpuint(length, ==, 1);
+	testvar = g_variant_ref_sink(g_variant_new("(ss)", "after", "clear"));
+	g_assert(g_variant_equal(calls[0].params, testvar));
+	g_variant_unref(testvar);
+
 	/* Clean up */
 	g_object_unref(mock);
 	g_object_unref(service);
@@ -698,6 +720,360 @@ test_interfaces (void)
 	return;
 }
 
+static void
+call_waited (DbusTestDbusMock * mock, DbusTestDbusMockObject * obj, const gchar * method, gboolean called, gpointer user_data)
+{
+	gint * result = (gint *)user_data;
+	*result = called ? 1 : 0;
+}
+
+void
+test_wait_for_call (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestDbusMock * mock = dbus_test_dbus_mock_new("foo.test");
+	g_assert(mock != NULL);
+
+	DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, "/test", "foo.test.interface", NULL);
+	dbus_test_dbus_mock_object_add_method(mock, obj,
+		"method1",
+		G_VARIANT_TYPE("s"),
+		NULL,
+		"",
+		NULL);
+
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(mock));
+	dbus_test_service_start_tasks(service);
+
+	g_assert(dbus_test_task_get_state(DBUS_TEST_TASK(mock)) == DBUS_TEST_TASK_STATE_RUNNING);
+
+	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	g_dbus_connection_set_exit_on_close(bus, FALSE);
+
+	GError * error = NULL;
+
+	/* Nothing called yet */
+	g_assert(!dbus_test_dbus_mock_object_wait_for_call(mock, obj, "method1", NULL, 1, 50, &error));
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+	g_clear_error(&error);
+
+	/* Not waiting on the reply, the wait has to see the call */
+	g_dbus_connection_call(bus, "foo.test", "/test", "foo.test.interface", "method1",
+		g_variant_new("(s)", "first"), NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+
+	g_assert(dbus_test_dbus_mock_object_wait_for_call(mock, obj, "method1", g_variant_new("(s)", "first"), 1, 5000, &error));
+	g_assert_no_error(error);
+
+	/* The callback comes from the main loop once the second call is in */
+	gint result = -1;
+	g_assert(dbus_test_dbus_mock_object_wait_for_call_async(mock, obj, "method1", NULL, 2, 5000, call_waited, &result, NULL));
+	g_assert_cmpint(result, ==, -1);
+
+	g_dbus_connection_call(bus, "foo.test", "/test", "foo.test.interface", "method1",
+		g_variant_new("(s)", "second"), NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+
+	while (result == -1) {
+		g_main_context_iteration(NULL, TRUE);
+	}
+	g_assert_cmpint(result, ==, 1);
+
+	/* One still waiting gets told when the mock goes */
+	result = -1;
+	g_assert(dbus_test_dbus_mock_object_wait_for_call_async(mock, obj, "method1", NULL, 10, 0, call_waited, &result, NULL));
+
+	g_object_unref(mock);
+	g_object_unref(service);
+	g_assert_cmpint(result, ==, 0);
+
+	wait_for_connection_close(bus);
+
+	return;
+}
+
+#define MANY_OBJECTS 200
+
+void
+test_many_objects (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestDbusMock * mock = dbus_test_dbus_mock_new("foo.test");
+	g_assert(mock != NULL);
+
+	guint i;
+	for (i = 0; i < MANY_OBJECTS; i++) {
+		gchar * path = g_strdup_printf("/test/%u", i);
+		DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, path, "foo.test.interface", NULL);
+		g_assert(dbus_test_dbus_mock_object_add_property(mock, obj, "index", G_VARIANT_TYPE_UINT32, g_variant_new_uint32(i), NULL));
+		g_free(path);
+	}
+
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(mock));
+	dbus_test_service_start_tasks(service);
+
+	g_assert(dbus_test_task_get_state(DBUS_TEST_TASK(mock)) == DBUS_TEST_TASK_STATE_RUNNING);
+
+	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	g_dbus_connection_set_exit_on_close(bus, FALSE);
+
+	/* All of them are there once it's running */
+	for (i = 0; i < MANY_OBJECTS; i++) {
+		gchar * path = g_strdup_printf("/test/%u", i);
+		GError * error = NULL;
+		GVariant * value = NULL;
+
+		GVariant * propret = g_dbus_connection_call_sync(bus,
+			"foo.test",
+			path,
+			"org.freedesktop.DBus.Properties",
+			"Get",
+			g_variant_new("(ss)", "foo.test.interface", "index"),
+			G_VARIANT_TYPE("(v)"),
+			G_DBUS_CALL_FLAGS_NONE,
+			-1,
+			NULL,
+			&error);
+		g_assert_no_error(error);
+
+		g_variant_get(propret, "(v)", &value);
+		g_assert_cmpuint(g_variant_get_uint32(value), ==, i);
+
+		g_variant_unref(value);
+		g_variant_unref(propret);
+		g_free(path);
+	}
+
+	g_object_unref(mock);
+	g_object_unref(service);
+
+	wait_for_connection_close(bus);
+
+	return;
+}
+
+void
+test_native (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestDbusMock * mock = dbus_test_dbus_mock_new("foo.test");
+	g_assert(mock != NULL);
+
+	dbus_test_dbus_mock_set_backend(mock, DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE);
+	g_assert(dbus_test_dbus_mock_get_backend(mock) == DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE);
+
+	DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, "/test", "foo.test.interface", NULL);
+	g_assert(dbus_test_dbus_mock_object_add_method(mock, obj,
+		"method1",
+		G_VARIANT_TYPE("(ss)"),
+		G_VARIANT_TYPE("s"),
+		NULL,
+		NULL));
+	g_assert(dbus_test_dbus_mock_object_set_method_return(mock, obj, "method1", g_variant_new_string("test"), NULL));
+	g_assert(dbus_test_dbus_mock_object_add_property(mock, obj, "prop1", G_VARIANT_TYPE_UINT32, g_variant_new_uint32(5), NULL));
+
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(mock));
+	dbus_test_service_start_tasks(service);
+
+	g_assert(dbus_test_task_get_state(DBUS_TEST_TASK(mock)) == DBUS_TEST_TASK_STATE_RUNNING);
+
+	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	g_dbus_connection_set_exit_on_close(bus, FALSE);
+
+	GError * error = NULL;
+	GVariant * ret = g_dbus_connection_call_sync(bus,
+		"foo.test",
+		"/test",
+		"foo.test.interface",
+		"method1",
+		g_variant_new("(ss)", "testin", "moretest"),
+		G_VARIANT_TYPE("(s)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1,
+		NULL,
+		&error);
+
+	if (error != NULL) {
+		g_error("Unable to call method1: %s", error->message);
+		g_error_free(error);
+	}
+
+	const gchar * retstr = NULL;
+	g_variant_get(ret, "(&s)", &retstr);
+	g_assert_cmpstr(retstr, ==, "test");
+	g_variant_unref(ret);
+
+	guint length = 0;
+	g_assert(dbus_test_dbus_mock_object_get_method_calls(mock, obj, "method1", &length, NULL) != NULL);
+	g_assert_cmpuint(length, ==, 1);
+
+	/* Changing the return while running */
+	g_assert(dbus_test_dbus_mock_object_set_method_return(mock, obj, "method1", g_variant_new_string("other"), NULL));
+
+	ret = g_dbus_connection_call_sync(bus,
+		"foo.test",
+		"/test",
+		"foo.test.interface",
+		"method1",
+		g_variant_new("(ss)", "again", "moretest"),
+		G_VARIANT_TYPE("(s)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1,
+		NULL,
+		&error);
+	g_assert_no_error(error);
+	g_variant_get(ret, "(&s)", &retstr);
+	g_assert_cmpstr(retstr, ==, "other");
+	g_variant_unref(ret);
+
+	/* Property */
+	ret = g_dbus_connection_call_sync(bus,
+		"foo.test",
+		"/test",
+		"org.freedesktop.DBus.Properties",
+		"Get",
+		g_variant_new("(ss)", "foo.test.interface", "prop1"),
+		G_VARIANT_TYPE("(v)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1,
+		NULL,
+		&error);
+	g_assert_no_error(error);
+
+	GVariant * value = NULL;
+	g_variant_get(ret, "(v)", &value);
+	g_assert_cmpuint(g_variant_get_uint32(value), ==, 5);
+	g_variant_unref(value);
+	g_variant_unref(ret);
+
+	/* A method added while running can be called right away */
+	g_assert(dbus_test_dbus_mock_object_add_method(mock, obj,
+		"method2",
+		NULL,
+		G_VARIANT_TYPE("u"),
+		NULL,
+		NULL));
+
+	ret = g_dbus_connection_call_sync(bus,
+		"foo.test",
+		"/test",
+		"foo.test.interface",
+		"method2",
+		NULL,
+		G_VARIANT_TYPE("(u)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1,
+		NULL,
+		&error);
+	g_assert_no_error(error);
+	g_variant_unref(ret);
+
+	/* The call log, the second one added to what we had */
+	const DbusTestDbusMockCall * calls = dbus_test_dbus_mock_object_get_method_calls(mock, obj, "method1", &length, NULL);
+	g_assert_cmpuint(length, ==, 2);
+	g_assert(g_variant_equal(calls[0].params, g_variant_new("(ss)", "testin", "moretest")));
+	g_assert(dbus_test_dbus_mock_object_check_method_call(mock, obj, "method1", g_variant_new("(ss)", "again", "moretest"), NULL));
+
+	g_assert(dbus_test_dbus_mock_object_clear_method_calls(mock, obj, NULL));
+	g_assert(!dbus_test_dbus_mock_object_check_method_call(mock, obj, "method1", NULL, NULL));
+
+	/* Clean up */
+	g_object_unref(mock);
+	g_object_unref(service);
+
+	wait_for_connection_close(bus);
+
+	return;
+}
+
+#define PERF_OBJECTS 50000
+
+/* Only with -m perf, how long setting up a mock the size of a real
+   device tree takes */
+void
+test_perf_objects (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestDbusMock * mock = dbus_test_dbus_mock_new("foo.test");
+	g_assert(mock != NULL);
+
+	dbus_test_dbus_mock_set_backend(mock, DBUS_TEST_DBUS_MOCK_BACKEND_NATIVE);
+
+	guint i;
+	g_test_timer_start();
+
+	for (i = 0; i < PERF_OBJECTS; i++) {
+		gchar * path = g_strdup_printf("/test/device%u", i);
+		DbusTestDbusMockObject * obj = dbus_test_dbus_mock_get_object(mock, path, "foo.test.Device", NULL);
+		g_assert(dbus_test_dbus_mock_object_add_property(mock, obj, "Index", G_VARIANT_TYPE_UINT32, g_variant_new_uint32(i), NULL));
+		g_assert(dbus_test_dbus_mock_object_add_method(mock, obj, "Refresh", NULL, NULL, NULL, NULL));
+		g_free(path);
+	}
+
+	g_test_message("Creating %u objects: %f s", PERF_OBJECTS, g_test_timer_elapsed());
+
+	/* Finding them again */
+	g_test_timer_start();
+
+	for (i = 0; i < PERF_OBJECTS; i++) {
+		gchar * path = g_strdup_printf("/test/device%u", i);
+		g_assert(dbus_test_dbus_mock_get_object(mock, path, "foo.test.Device", NULL) != NULL);
+		g_free(path);
+	}
+
+	g_test_message("Looking up %u objects: %f s", PERF_OBJECTS, g_test_timer_elapsed());
+
+	g_test_timer_start();
+
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(mock));
+	dbus_test_service_start_tasks(service);
+
+	g_test_minimized_result(g_test_timer_elapsed(), "Starting a mock with %u objects: %f s", PERF_OBJECTS, g_test_timer_last());
+
+	g_assert(dbus_test_task_get_state(DBUS_TEST_TASK(mock)) == DBUS_TEST_TASK_STATE_RUNNING);
+
+	GDBusConnection * bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+	g_dbus_connection_set_exit_on_close(bus, FALSE);
+
+	/* The last one is there */
+	gchar * path = g_strdup_printf("/test/device%u", PERF_OBJECTS - 1);
+	GError * error = NULL;
+	GVariant * propret = g_dbus_connection_call_sync(bus,
+		"foo.test",
+		path,
+		"org.freedesktop.DBus.Properties",
+		"Get",
+		g_variant_new("(ss)", "foo.test.Device", "Index"),
+		G_VARIANT_TYPE("(v)"),
+		G_DBUS_CALL_FLAGS_NONE,
+		-1,
+		NULL,
+		&error);
+	g_assert_no_error(error);
+	g_variant_unref(propret);
+	g_free(path);
+
+	g_object_unref(mock);
+	g_object_unref(service);
+
+	wait_for_connection_close(bus);
+
+	return;
+}
 
 /* Build our test suite */
 void
@@ -710,6 +1086,13 @@ test_libdbustest_mock_suite (void)
 	g_test_add_func ("/libdbustest/mock/running",      test_running);
 	g_test_add_func ("/libdbustest/mock/running-system", test_running_system);
 	g_test_add_func ("/libdbustest/mock/interfaces",   test_interfaces);
+	g_test_add_func ("/libdbustest/mock/wait-for-call", test_wait_for_call);
+	g_test_add_func ("/libdbustest/mock/many-objects", test_many_objects);
+	g_test_add_func ("/libdbustest/mock/native",       test_native);
+
+	if (g_test_perf()) {
+		g_test_add_func ("/libdbustest/mock/perf/objects", test_perf_objects);
+	}
 
 	return;
 }
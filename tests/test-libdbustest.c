@@ -1,4 +1,6 @@
 
+#include <signal.h>
+
 #include <glib.h>
 #include <libdbustest/dbus-test.h>
 
@@ -72,6 +74,428 @@ test_task_wait (void)
 	return;
 }
 
+void
+test_task_ready_name (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestProcess * proc = dbus_test_process_new(GETNAME_PATH);
+	g_assert(proc != NULL);
+	dbus_test_process_append_param(proc, "org.test.ready");
+	dbus_test_task_set_ready_name(DBUS_TEST_TASK(proc), "org.test.ready");
+	g_assert(g_strcmp0(dbus_test_task_get_ready_name(DBUS_TEST_TASK(proc)), "org.test.ready") == 0);
+	g_assert(!dbus_test_task_get_ready(DBUS_TEST_TASK(proc)));
+
+	dbus_test_service_add_task_with_priority(service, DBUS_TEST_TASK(proc), DBUS_TEST_SERVICE_PRIORITY_FIRST);
+
+	DbusTestTask * task = dbus_test_task_new();
+	g_assert(task != NULL);
+
+	dbus_test_service_add_task(service, task);
+	dbus_test_service_start_tasks(service);
+
+	/* The first priority has to be ready before the normal one starts */
+	g_assert(dbus_test_task_get_ready(DBUS_TEST_TASK(proc)));
+	g_assert(dbus_test_task_get_state(task) == DBUS_TEST_TASK_STATE_FINISHED);
+
+	g_object_unref(proc);
+	g_object_unref(task);
+	g_object_unref(service);
+
+	return;
+}
+
+void
+test_embedded_bus (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_bus_backend(service, DBUS_TEST_SERVICE_BACKEND_EMBEDDED);
+
+	DbusTestProcess * proc = dbus_test_process_new(GETNAME_PATH);
+	g_assert(proc != NULL);
+	dbus_test_process_append_param(proc, "org.test.embedded");
+	dbus_test_task_set_ready_name(DBUS_TEST_TASK(proc), "org.test.embedded");
+
+	dbus_test_service_add_task_with_priority(service, DBUS_TEST_TASK(proc), DBUS_TEST_SERVICE_PRIORITY_FIRST);
+
+	DbusTestTask * task = dbus_test_task_new();
+	g_assert(task != NULL);
+	dbus_test_task_set_wait_for(task, "org.test.embedded");
+
+	dbus_test_service_add_task(service, task);
+	dbus_test_service_start_tasks(service);
+
+	/* The name got owned and seen on the broker, no daemon needed */
+	g_assert(dbus_test_service_get_address(service) != NULL);
+	g_assert(dbus_test_task_get_ready(DBUS_TEST_TASK(proc)));
+	g_assert(dbus_test_task_get_state(task) == DBUS_TEST_TASK_STATE_FINISHED);
+
+	g_object_unref(proc);
+	g_object_unref(task);
+	g_object_unref(service);
+
+	return;
+}
+
+void
+test_task_dependency (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestProcess * proc = dbus_test_process_new(GETNAME_PATH);
+	g_assert(proc != NULL);
+	dbus_test_process_append_param(proc, "org.test.depend");
+	dbus_test_task_set_ready_name(DBUS_TEST_TASK(proc), "org.test.depend");
+
+	DbusTestTask * task = dbus_test_task_new();
+	g_assert(task != NULL);
+	dbus_test_task_add_dependency(task, DBUS_TEST_TASK(proc), DBUS_TEST_TASK_DEPENDENCY_READY);
+
+	DbusTestTask * last = dbus_test_task_new();
+	g_assert(last != NULL);
+	dbus_test_task_add_dependency(last, task, DBUS_TEST_TASK_DEPENDENCY_FINISHED);
+
+	/* All in the same priority, added backwards */
+	dbus_test_service_add_task(service, last);
+	dbus_test_service_add_task(service, task);
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(proc));
+
+	dbus_test_service_start_tasks(service);
+
+	g_assert(dbus_test_task_get_ready(DBUS_TEST_TASK(proc)));
+	g_assert(dbus_test_task_get_state(task) == DBUS_TEST_TASK_STATE_FINISHED);
+	g_assert(dbus_test_task_get_state(last) == DBUS_TEST_TASK_STATE_FINISHED);
+
+	g_object_unref(proc);
+	g_object_unref(task);
+	g_object_unref(last);
+	g_object_unref(service);
+
+	return;
+}
+
+void
+test_task_wait_names (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestTask * task = dbus_test_task_new();
+	g_assert(task != NULL);
+
+	dbus_test_task_add_wait_for(task, "org.test.one", DBUS_TEST_SERVICE_BUS_BOTH);
+	dbus_test_task_add_wait_for(task, "org.test.two", DBUS_TEST_SERVICE_BUS_BOTH);
+	g_assert(g_strcmp0(dbus_test_task_get_wait_for(task), "org.test.one") == 0);
+
+	dbus_test_service_add_task(service, task);
+
+	DbusTestProcess * one = dbus_test_process_new(GETNAME_PATH);
+	dbus_test_process_append_param(one, "org.test.one");
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(one));
+
+	DbusTestProcess * two = dbus_test_process_new(GETNAME_PATH);
+	dbus_test_process_append_param(two, "org.test.two");
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(two));
+
+	dbus_test_service_start_tasks(service);
+
+	g_assert(dbus_test_task_get_state(task) == DBUS_TEST_TASK_STATE_FINISHED);
+
+	g_object_unref(one);
+	g_object_unref(two);
+	g_object_unref(task);
+	g_object_unref(service);
+
+	return;
+}
+
+/* Lots of tasks that finish right away, the service shouldn't be
+   doing more work for each of them as there are more */
+void
+test_task_many (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	guint i;
+	for (i = 0; i < 10000; i++) {
+		DbusTestTask * task = dbus_test_task_new();
+		dbus_test_service_add_task(service, task);
+		g_object_unref(task);
+	}
+
+	GTimer * timer = g_timer_new();
+	g_assert_cmpint(dbus_test_service_run(service), ==, 0);
+	g_assert_cmpfloat(g_timer_elapsed(timer, NULL), <, 10.0);
+	g_timer_destroy(timer);
+
+	g_object_unref(service);
+
+	return;
+}
+
+static void
+wait_for_idle (DbusTestDaemonPool * pool, guint count)
+{
+	gint64 end = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+
+	while (dbus_test_daemon_pool_get_idle(pool) < count && g_get_monotonic_time() < end) {
+		g_main_context_iteration(NULL, TRUE);
+	}
+
+	return;
+}
+
+void
+test_process_kill (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	/* Ignores SIGTERM and leaves a grandchild in its group */
+	DbusTestProcess * proc = dbus_test_process_new("sh");
+	g_assert(proc != NULL);
+	dbus_test_process_append_param(proc, "-c");
+	dbus_test_process_append_param(proc, "trap '' TERM; sleep 30 & sleep 30");
+	dbus_test_process_set_kill_timeout(proc, 100);
+
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(proc));
+	dbus_test_service_start_tasks(service);
+
+	GPid pid = dbus_test_process_get_pid(proc);
+	g_assert(pid != 0);
+
+	GTimer * timer = g_timer_new();
+
+	g_object_unref(proc);
+	g_object_unref(service);
+
+	g_assert_cmpfloat(g_timer_elapsed(timer, NULL), <, 5.0);
+	g_timer_destroy(timer);
+
+	/* Nothing is left in the group, once init has reaped the
+	   grandchild */
+	gint64 end = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
+	while (kill(-pid, 0) == 0 && g_get_monotonic_time() < end) {
+		g_usleep(10 * 1000);
+	}
+	g_assert(kill(-pid, 0) != 0);
+
+	return;
+}
+
+/* Runs past its timeout ignoring SIGTERM, gets killed and fails
+   even though its return is ignored */
+void
+test_process_timeout (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestProcess * proc = dbus_test_process_new("sh");
+	g_assert(proc != NULL);
+	dbus_test_process_append_param(proc, "-c");
+	dbus_test_process_append_param(proc, "trap '' TERM; sleep 30");
+	dbus_test_process_set_kill_timeout(proc, 100);
+	dbus_test_task_set_timeout(DBUS_TEST_TASK(proc), 100);
+	dbus_test_task_set_return(DBUS_TEST_TASK(proc), DBUS_TEST_TASK_RETURN_IGNORE);
+
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(proc));
+	dbus_test_service_start_tasks(service);
+
+	gint64 end = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+	while (dbus_test_task_get_state(DBUS_TEST_TASK(proc)) != DBUS_TEST_TASK_STATE_FINISHED && g_get_monotonic_time() < end) {
+		g_main_context_iteration(NULL, TRUE);
+	}
+
+	g_assert(dbus_test_task_get_state(DBUS_TEST_TASK(proc)) == DBUS_TEST_TASK_STATE_FINISHED);
+	g_assert(dbus_test_task_get_timed_out(DBUS_TEST_TASK(proc)));
+	g_assert(!dbus_test_task_passed(DBUS_TEST_TASK(proc)));
+
+	g_object_unref(proc);
+	g_object_unref(service);
+
+	return;
+}
+
+/* Processes are started by looking the name up once and reusing
+   the same argv, the child's stdin is /dev/null */
+void
+test_process_spawn (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	guint i;
+	for (i = 0; i < 200; i++) {
+		DbusTestProcess * proc = dbus_test_process_new("sh");
+		dbus_test_process_append_param(proc, "-c");
+		dbus_test_process_append_param(proc, "read line && exit 1; exit 0");
+		dbus_test_service_add_task(service, DBUS_TEST_TASK(proc));
+		g_object_unref(proc);
+	}
+
+	g_assert_cmpint(dbus_test_service_run(service), ==, 0);
+	g_object_unref(service);
+
+	/* Not found in PATH fails the task instead of the spawn */
+	service = dbus_test_service_new(NULL);
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	DbusTestProcess * missing = dbus_test_process_new("dbus-test-runner-not-there");
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(missing));
+
+	g_test_expect_message("libdbustest", G_LOG_LEVEL_WARNING, "Unable to start process*");
+	g_assert_cmpint(dbus_test_service_run(service), !=, 0);
+	g_test_assert_expected_messages();
+
+	g_object_unref(missing);
+	g_object_unref(service);
+
+	return;
+}
+
+void
+test_service_environment (void)
+{
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+
+	gchar ** env = g_get_environ();
+	env = g_environ_setenv(env, "DBUS_TEST_SERVICE_VAR", "set", TRUE);
+	dbus_test_service_set_environment(service, env);
+	g_strfreev(env);
+
+	g_assert(g_getenv("DBUS_TEST_SERVICE_VAR") == NULL);
+
+	DbusTestProcess * proc = dbus_test_process_new("printenv");
+	dbus_test_process_append_param(proc, "DBUS_TEST_SERVICE_VAR");
+	dbus_test_service_add_task(service, DBUS_TEST_TASK(proc));
+
+	g_assert_cmpint(dbus_test_service_run(service), ==, 0);
+
+	g_object_unref(proc);
+	g_object_unref(service);
+
+	return;
+}
+
+/* One service on a context of its own, owning the same name as the
+   one in the other thread does on its bus */
+static gpointer
+parallel_service (G_GNUC_UNUSED gpointer user_data)
+{
+	GMainContext * context = g_main_context_new();
+	g_main_context_push_thread_default(context);
+
+	DbusTestService * service = dbus_test_service_new(NULL);
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+	dbus_test_service_set_publish_environment(service, FALSE);
+
+	DbusTestProcess * proc = dbus_test_process_new(GETNAME_PATH);
+	dbus_test_process_append_param(proc, "org.test.parallel");
+	dbus_test_task_set_ready_name(DBUS_TEST_TASK(proc), "org.test.parallel");
+	dbus_test_service_add_task_with_priority(service, DBUS_TEST_TASK(proc), DBUS_TEST_SERVICE_PRIORITY_FIRST);
+
+	DbusTestTask * task = dbus_test_task_new();
+	dbus_test_task_set_wait_for(task, "org.test.parallel");
+	dbus_test_service_add_task(service, task);
+
+	dbus_test_service_start_tasks(service);
+
+	gboolean passed = dbus_test_task_get_ready(DBUS_TEST_TASK(proc)) &&
+		dbus_test_task_get_state(task) == DBUS_TEST_TASK_STATE_FINISHED;
+
+	g_object_unref(proc);
+	g_object_unref(task);
+	g_object_unref(service);
+
+	g_main_context_pop_thread_default(context);
+	g_main_context_unref(context);
+
+	return GINT_TO_POINTER(passed);
+}
+
+void
+test_parallel_services (void)
+{
+	GThread * one = g_thread_new("service-one", parallel_service, NULL);
+	GThread * two = g_thread_new("service-two", parallel_service, NULL);
+
+	g_assert(GPOINTER_TO_INT(g_thread_join(one)));
+	g_assert(GPOINTER_TO_INT(g_thread_join(two)));
+
+	return;
+}
+
+void
+test_daemon_pool (void)
+{
+	DbusTestDaemonPool * pool = dbus_test_daemon_pool_new(NULL, SESSION_CONF, FALSE, 2);
+	g_assert(pool != NULL);
+
+	wait_for_idle(pool, 2);
+	g_assert_cmpuint(dbus_test_daemon_pool_get_idle(pool), ==, 2);
+
+	DbusTestService * service = dbus_test_service_new(NULL);
+	g_assert(service != NULL);
+
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+	dbus_test_service_set_daemon_pool(service, pool);
+
+	DbusTestTask * task = dbus_test_task_new();
+	g_assert(task != NULL);
+
+	dbus_test_service_add_task(service, task);
+	dbus_test_service_start_tasks(service);
+
+	g_assert(dbus_test_task_get_state(task) == DBUS_TEST_TASK_STATE_FINISHED);
+	g_assert(g_getenv("DBUS_SESSION_BUS_ADDRESS") != NULL);
+
+	g_object_unref(task);
+	g_object_unref(service);
+
+	/* The one we took gets replaced in the background */
+	wait_for_idle(pool, 2);
+	g_assert_cmpuint(dbus_test_daemon_pool_get_idle(pool), ==, 2);
+
+	/* Unless no more are wanted */
+	dbus_test_daemon_pool_set_size(pool, 0);
+
+	service = dbus_test_service_new(NULL);
+	dbus_test_service_set_conf_file(service, SESSION_CONF);
+	dbus_test_service_set_daemon_pool(service, pool);
+	dbus_test_service_start_tasks(service);
+	g_object_unref(service);
+
+	while (g_main_context_iteration(NULL, FALSE));
+	g_assert_cmpuint(dbus_test_daemon_pool_get_idle(pool), ==, 1);
+
+	g_object_unref(pool);
+
+	return;
+}
+
 /* Build our test suite */
 void
 test_libdbustest_suite (void)
@@ -79,6 +503,17 @@ test_libdbustest_suite (void)
 	g_test_add_func ("/libdbustest/env_var",    test_env_var);
 	g_test_add_func ("/libdbustest/task_start", test_task_start);
 	g_test_add_func ("/libdbustest/task_wait",  test_task_wait);
+	g_test_add_func ("/libdbustest/task_ready_name", test_task_ready_name);
+	g_test_add_func ("/libdbustest/embedded_bus", test_embedded_bus);
+	g_test_add_func ("/libdbustest/task_dependency", test_task_dependency);
+	g_test_add_func ("/libdbustest/task_wait_names", test_task_wait_names);
+	g_test_add_func ("/libdbustest/task_many", test_task_many);
+	g_test_add_func ("/libdbustest/process_kill", test_process_kill);
+	g_test_add_func ("/libdbustest/process_timeout", test_process_timeout);
+	g_test_add_func ("/libdbustest/process_spawn", test_process_spawn);
+	g_test_add_func ("/libdbustest/service_environment", test_service_environment);
+	g_test_add_func ("/libdbustest/parallel_services", test_parallel_services);
+	g_test_add_func ("/libdbustest/daemon_pool", test_daemon_pool);
 
 	return;
 }